@@ -0,0 +1,529 @@
+/*
+ * qpromise.h - Q Promises Library for C
+ *
+ * This header defines the public API for a C-based implementation of promises,
+ * inspired by the Q library in JavaScript. It aims to provide asynchronous
+ * operation management, including deferred execution, chaining, and error handling.
+ *
+ * The API includes:
+ * - Core Promise creation and manipulation (resolve, reject, then).
+ * - Q.defer() equivalent for creating deferred objects.
+ * - Q.all() for synchronizing multiple promises.
+ * - Q.nfcall()/Q.nfapply() for wrapping Node.js-style callbacks.
+ * - Experimental PMLL (Persistent Memory) hardened queue for resilient operations.
+ * - File-backed persistent promises that can be resumed after a restart.
+ * - A basic event loop simulation for managing asynchronous tasks.
+ */
+#ifndef QPROMISE_H
+#define QPROMISE_H
+
+#include <stdbool.h> // For bool type
+#include <stddef.h>  // For size_t
+#include <pthread.h> // For mutex in persistent/concurrent scenarios
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// --- Core Types ---
+
+// Forward declaration of the main Promise structure.
+typedef struct Promise Promise;
+
+// Forward declaration for the Deferred object, used with Q.defer() style.
+typedef struct PromiseDeferred PromiseDeferred;
+
+// Forward declaration for a file-backed store of persistent promises.
+typedef struct PromiseStore PromiseStore;
+
+// Forward declaration for a hardened resource queue, potentially using persistent memory.
+// PMLL = Persistent Memory Lexicon/Library (hypothetical or specific project context)
+typedef struct PMLL_HardenedResourceQueue PMLL_HardenedResourceQueue;
+
+// Represents the state of a Promise.
+typedef enum {
+    PROMISE_PENDING,  // Initial state, operation not yet completed.
+    PROMISE_FULFILLED, // Operation completed successfully.
+    PROMISE_REJECTED   // Operation failed.
+} PromiseState;
+
+// Lanes of the event loop's microtask queue. The loop drains the high lane
+// first and runs low-lane tasks one at a time when it is empty, checking
+// timers and I/O in between, so CPU-heavy work (extraction, hashing) queued
+// low does not hold up I/O completions. The low lane cannot starve: while it
+// has work, it gets one task after every 16 high-lane batches.
+typedef enum {
+    PROMISE_PRIORITY_HIGH, // Default: I/O completions and ordinary callbacks
+    PROMISE_PRIORITY_LOW   // Long-running, throughput-oriented work
+} PromisePriority;
+
+#define PROMISE_PRIORITY_LANES 2
+
+// Generic type for the value of a fulfilled promise or the reason for a rejection.
+// In a more complex system, this might be a tagged union or a more structured error type.
+typedef void* PromiseValue;
+
+// Callback function type for when a promise is fulfilled.
+// Args:
+//   value: The fulfillment value of the parent promise.
+//   user_data: Arbitrary user-provided data passed during 'then'.
+// Returns:
+//   A PromiseValue. This can be:
+//   1. A direct value: The chained promise (from 'then') will be fulfilled with this value.
+//   2. A new Promise*: The chained promise will adopt the state and value of this new promise.
+//   3. NULL (or a special marker): Could indicate no further value, or an error if not handled.
+typedef PromiseValue (*on_fulfilled_callback)(PromiseValue value, void* user_data);
+
+// Callback function type for when a promise is rejected.
+// Args:
+//   reason: The rejection reason of the parent promise.
+//   user_data: Arbitrary user-provided data passed during 'then'.
+// Returns:
+//   A PromiseValue. This can be:
+//   1. A direct value: The chained promise will be fulfilled with this value (recovery).
+//   2. A new Promise*: The chained promise will adopt the state and value of this new promise.
+//   3. If the callback itself wants to propagate or signal a new error, it might
+//      return a special error marker or a new promise that is already rejected.
+//      Alternatively, it could re-throw by returning a specific error-coded PromiseValue.
+typedef PromiseValue (*on_rejected_callback)(PromiseValue reason, void* user_data);
+
+
+// --- Promise API ---
+
+// Creates a new promise in the PENDING state, holding one reference for the caller.
+// This is for standard, in-memory promises.
+Promise* promise_create(void);
+
+// Creates a new pending promise backed by a record in a promise store, so its
+// state survives a restart once it is named (see "Persistent Promises" below).
+// Args:
+//   pmem_ctx: The PromiseStore* (from promise_store_open()) to allocate the record in.
+//   lock: Unused; every promise has its own lock. Kept for source compatibility.
+// Returns NULL if pmem_ctx is NULL or the store is full.
+Promise* promise_create_persistent(void* pmem_ctx, pthread_mutex_t* lock);
+
+// Resolves a promise with a given value.
+// If the promise is already settled, this is a no-op.
+// Transitions state from PENDING to FULFILLED.
+void promise_resolve(Promise* p, PromiseValue value);
+
+// Rejects a promise with a given reason.
+// If the promise is already settled, this is a no-op.
+// Transitions state from PENDING to REJECTED.
+void promise_reject(Promise* p, PromiseValue reason);
+
+// Resolves promises[i] with values[i] (NULL `values`: every value is NULL),
+// like promise_resolve() on each in turn, but the callbacks of all of them are
+// queued to the event loop as one task per priority lane, with a single queue
+// operation and at most one wake-up each; within a lane they run in input
+// order. NULL entries and promises that
+// have already settled are skipped. Meant for completion bursts, e.g. every
+// transfer finished by one curl multi cycle.
+void promise_resolve_batch(Promise* promises[], PromiseValue values[], size_t count);
+
+// Sets the lane `p`'s callbacks are dispatched in. Promises returned by
+// promise_then() on `p` after this inherit it, so a whole CPU-bound chain can
+// be moved to PROMISE_PRIORITY_LOW by marking its first promise.
+void promise_set_priority(Promise* p, PromisePriority priority);
+
+// Where a promise's callbacks run once it settles. Every promise dispatches
+// through one scheduler, execute_callbacks(), which runs a promise's callbacks
+// in registration order, one task per promise at a time; this only selects
+// what runs that task. The CPM engine's QPromise (src/cpm.h) is built on this
+// core and maps its QDispatchMode onto these.
+typedef enum {
+    PROMISE_DISPATCH_LOOP,    // Default: the microtask queue, run by run_event_loop*()
+    PROMISE_DISPATCH_RUNTIME, // The shared runtime workers (src/q_runtime.h); no loop needed
+    PROMISE_DISPATCH_INLINE   // The thread that settles the promise, or attaches a callback
+                              // once it has settled, right after the promise lock is released
+} PromiseDispatch;
+
+// Sets where `p`'s callbacks run. Promises returned by promise_then() on `p`
+// after this inherit it, like the priority.
+void promise_set_dispatch(Promise* p, PromiseDispatch dispatch);
+
+// Attaches fulfillment and rejection handlers to a promise.
+// Returns a new promise that is resolved or rejected based on the outcome of the callbacks.
+// Args:
+//   p: The parent promise.
+//   on_fulfilled: Callback for successful resolution. Can be NULL.
+//   on_rejected: Callback for rejection. Can be NULL.
+//   user_data: Arbitrary data to be passed to the callbacks.
+// The caller owns one reference to the returned promise; the engine keeps its own
+// until the promise has been settled, so it may be released at any time.
+Promise* promise_then(Promise* p, on_fulfilled_callback on_fulfilled, on_rejected_callback on_rejected, void* user_data);
+
+// Like promise_then() for handlers whose return value goes nowhere: no chained
+// promise is created, so nothing is allocated unless `p` already has more than
+// two callbacks. A NULL handler means that outcome is ignored. Returns false
+// if the handlers could not be attached (out of memory).
+bool promise_observe(Promise* p, on_fulfilled_callback on_fulfilled, on_rejected_callback on_rejected, void* user_data);
+
+// Returns `p` as a callback result that the chained promise adopts, following
+// the Promises/A+ resolution procedure: if `p` is already settled the chained
+// promise settles the same way right away, with no extra event-loop hop;
+// otherwise it is linked to `p` directly and settles when `p` does. Use it as
+// `return promise_adopt(inner);` from an on_fulfilled/on_rejected callback.
+// Consumes the caller's reference to `p`; whoever will settle `p` must hold
+// a reference of its own (see promise_retain()).
+PromiseValue promise_adopt(Promise* p);
+
+// Adds a reference to `p` and returns it. Promises are reference counted
+// (atomically, so references may be taken and dropped on any thread).
+Promise* promise_retain(Promise* p);
+
+// Drops a reference to `p`. When the last one goes, the promise is returned
+// to a per-thread pool for reuse; callbacks still registered on a promise that
+// never settled are discarded and release their chained promises.
+void promise_free(Promise* p);
+
+
+// --- Q.defer() API ---
+// Provides a way to create a promise and manually control its resolution or rejection.
+
+// Structure for a deferred object. Contains the promise it controls.
+struct PromiseDeferred {
+    Promise* promise;
+    // Potentially a lock if the deferred object itself needs to be thread-safe
+    // for resolve/reject operations from different threads.
+    // pthread_mutex_t* lock; // Example
+};
+
+// Creates a new deferred object (and its associated promise).
+PromiseDeferred* promise_defer_create(void);
+
+// Creates a new deferred object whose promise is persistent (see promise_create_persistent()).
+PromiseDeferred* promise_defer_create_persistent(void* pmem_ctx, pthread_mutex_t* lock);
+
+// Resolves the promise associated with the deferred object.
+void promise_defer_resolve(PromiseDeferred* deferred, PromiseValue value);
+
+// Rejects the promise associated with the deferred object.
+void promise_defer_reject(PromiseDeferred* deferred, PromiseValue reason);
+
+// Frees the deferred object. Note: This typically also implies freeing the
+// associated promise if it's not intended to outlive the deferred controller.
+// Careful lifetime management is needed.
+void promise_defer_free(PromiseDeferred* deferred);
+
+
+// --- Q.all() API ---
+// Creates a promise that fulfills when all promises in an array are fulfilled,
+// or rejects if any promise in the array rejects.
+
+// Args:
+//   promises: An array of Promise pointers (NULL entries count as fulfilled with NULL).
+//   count: The number of promises in the array.
+// Returns:
+//   A new promise fulfilled with a malloc'd array of the `count` fulfillment
+//   values, in input order; whoever receives it frees it with free(). It is
+//   rejected with the reason of the first input to reject. The inputs are not
+//   retained: keep them alive until they settle. Settling takes one atomic
+//   decrement per input and no lock, so millions of inputs are fine.
+Promise* promise_all(Promise* promises[], size_t count);
+
+
+// --- Blocking work ---
+// Runs `work(arg)` on the worker pool shared with the CPM engine's
+// q_run_async() (see src/q_runtime.h) and returns a promise for its outcome:
+// fulfilled with *result when `work` returns true, rejected with *result
+// when it returns false. Callbacks still run on the event loop. Rejected at
+// once if no worker thread can be started.
+typedef bool (*promise_work_function)(void* arg, PromiseValue* result);
+
+Promise* promise_run_async(promise_work_function work, void* arg);
+
+
+// --- Q.nfcall() API (Node.js-style callback wrapping) ---
+// Wraps a function that uses the Node.js (error, result) callback pattern
+// into a function that returns a promise.
+
+// Node.js-style callback signature.
+// Args:
+//   err: Error object/value (or NULL/0 if success).
+//   result: Result value (if success).
+//   user_data: Context data.
+typedef void (*NodeCallback)(void* err, PromiseValue result, void* user_data);
+
+// Calls the Node.js-style callback function and returns a promise
+// that resolves or rejects based on the callback's arguments.
+// Args:
+//   cb: The Node.js-style callback function to wrap.
+//   user_data: User data to pass to the NodeCallback.
+//   ... (potentially other arguments to pass to the wrapped function itself,
+//        which would require varargs or a more complex wrapper).
+// For simplicity, this example assumes 'cb' is called with pre-set arguments
+// or 'user_data' is used to convey them. promise_nfapply() and
+// promise_nfcall_args() below forward arguments to the target function.
+Promise* promise_nfcall(NodeCallback cb, void* user_data /*, ...args for the function itself */);
+
+// A Node.js-style function taking its arguments as an array: it does its work
+// with args[0..argc) and reports the outcome through
+// callback(err, result, callback_data) exactly once, from any thread, before
+// or after returning. `args` stays valid until it calls `callback`.
+typedef void (*NodeFunction)(PromiseValue args[], size_t argc, NodeCallback callback, void* callback_data);
+
+// Q.nfapply(): copies args[0..argc) and calls `fn` with them on the worker
+// pool promise_run_async() uses, so blocking calls (stat(), hashing, inflate)
+// stay off the event loop. The returned promise is rejected with `err` if it
+// is non-NULL, otherwise fulfilled with `result`; its callbacks run on the
+// event loop. Rejected at once if no worker thread can be started.
+Promise* promise_nfapply(NodeFunction fn, PromiseValue args[], size_t argc);
+
+// Q.nfcall(): promise_nfapply() with the `argc` arguments given inline. Each
+// must be a pointer-sized PromiseValue; cast integers through intptr_t.
+Promise* promise_nfcall_args(NodeFunction fn, size_t argc, ...);
+
+
+// --- PMLL Hardened Queue API ---
+// A queue of operations run by its own worker pool. A persistent queue records
+// every durable operation in an append-only, mmap'd write-ahead log before it
+// runs, and marks it done afterwards. Appends from many producers are made
+// durable together by one msync() per batch (group commit). After a crash,
+// reopening the queue replays every logged operation that was not marked done,
+// so durable operations run at least once.
+// The log is `<resource_id>.wal` in the directory named by PMLL_QUEUE_DIR
+// (default: the current directory).
+
+// Handler for durable operations: runs on a worker thread with the logged
+// payload. Returns 0 on success; any other value is retried, up to
+// PMLL_MAX_ATTEMPTS runs in total, before the operation is given up on.
+typedef int (*pmll_operation_handler)(const void* payload, size_t length, void* context);
+
+#define PMLL_MAX_ATTEMPTS 3
+
+// Counters for monitoring and benchmarks.
+typedef struct {
+    size_t committed;       // Durable operations made durable
+    size_t commit_batches;  // Group commits (one msync each)
+    size_t completed;       // Operations finished (successfully or not)
+    size_t failed;          // Operations given up on after PMLL_MAX_ATTEMPTS
+    size_t replayed;        // Unfinished operations found in the log when opened
+} PMLL_QueueStats;
+
+// Creates a hardened resource queue.
+// Args:
+//   resource_id: A unique identifier for the resource this queue manages; names its log.
+//   persistent_queue: If true, the queue is backed by the write-ahead log, which is
+//                     created or, if it exists, scanned for operations to replay.
+// Returns NULL if the log cannot be opened or is not a PMLL log.
+PMLL_HardenedResourceQueue* pmll_queue_create(const char* resource_id, bool persistent_queue);
+
+// Starts `workers` worker threads (0 picks a default) that run durable
+// operations with `handler`. Operations replayed from the log run first.
+// Returns false if the queue is already started or the threads cannot be created.
+bool pmll_queue_start(PMLL_HardenedResourceQueue* hq, size_t workers,
+                      pmll_operation_handler handler, void* context);
+
+// Submits a durable operation: `payload` is copied into the log. The returned
+// promise is fulfilled once the record is durable and the handler has succeeded,
+// or rejected if the handler keeps failing. Requires pmll_queue_start().
+Promise* pmll_submit_durable(PMLL_HardenedResourceQueue* hq, const void* payload, size_t length);
+
+// Executes an operation through the hardened queue's worker pool.
+// Function pointers cannot be replayed after a restart, so these operations are
+// not logged; use pmll_submit_durable() for operations that must survive a crash.
+// Args:
+//   hq: The hardened queue instance (started on first use if needed).
+//   operation_fn: Called as operation_fn(NULL, op_user_data) on a worker. Its result
+//                 fulfils the promise; it may return promise_adopt(p) to follow `p`.
+//   error_fn: Called as error_fn(reason, op_user_data) if the queue is freed before
+//             the operation ran; its result fulfils the promise (recovery). If NULL,
+//             the promise is rejected with the reason instead.
+//   op_user_data: User data for the operation and error functions.
+// Returns:
+//   A promise that settles with the outcome of the hardened operation.
+Promise* pmll_execute_hardened_operation(
+    PMLL_HardenedResourceQueue* hq,
+    on_fulfilled_callback operation_fn, // Or a more specific operation signature
+    on_rejected_callback error_fn,     // Or a more specific error signature
+    void* op_user_data);
+
+// Copies the queue's counters into `stats`.
+void pmll_queue_get_stats(PMLL_HardenedResourceQueue* hq, PMLL_QueueStats* stats);
+
+// Runs every queued operation, stops the workers, makes the log durable and
+// frees the queue. Operations still waiting when no workers were ever started
+// stay in the log and are replayed next time.
+void pmll_queue_free(PMLL_HardenedResourceQueue* hq);
+
+
+// --- Persistent Promises ---
+// A promise store is a regular file, mapped into memory, holding a fixed number
+// of promise records. A persistent promise writes its state and value to its
+// record when it settles. Every record has two copies: an update is written to
+// the spare copy and flushed, and only then is the record's header word switched
+// to it and flushed, so after a crash each record is either its old or its new
+// version. No PMDK or persistent-memory hardware is needed.
+//
+// Named promises form the store's root directory and are what a restarted
+// process finds again; an unnamed record is reclaimed when its promise is freed,
+// or when the store is next opened. Values are stored as their bit pattern, so
+// settle persistent promises with values that mean the same in the next process
+// (status codes, ids) and keep anything else in the promise's attached data.
+
+#define PROMISE_STORE_NAME_MAX 64  // Root name length, including the terminating NUL
+#define PROMISE_STORE_DATA_MAX 176 // Bytes of data attachable to a persistent promise
+
+// Opens the store at `path`, creating it with room for `capacity` promises if it
+// does not exist (an existing store keeps its own capacity). Returns NULL if the
+// file cannot be created or mapped, or is not a promise store.
+PromiseStore* promise_store_open(const char* path, size_t capacity);
+
+// Closes the store. Every promise created from or loaded out of it must have
+// been freed first. Records of named promises stay in the file.
+void promise_store_close(PromiseStore* store);
+
+// Names persistent promise `p` (created in `store`) in the root directory, where
+// promise_store_get_root() finds it after a restart. Returns false if `p` is not
+// in `store`, the name is too long, or another promise already has the name.
+bool promise_store_set_root(PromiseStore* store, const char* name, Promise* p);
+
+// Returns a new reference to the promise named `name`, in the state last
+// persisted, or NULL if there is none. Settling it updates the store.
+Promise* promise_store_get_root(PromiseStore* store, const char* name);
+
+// Removes `name` from the root directory. The record is reclaimed once its
+// promise (if loaded) is freed. Returns false if there is no such name.
+bool promise_store_remove_root(PromiseStore* store, const char* name);
+
+// Called by promise_store_resume() for each named promise still pending. `p` is
+// borrowed for the call; retain it to keep it (e.g. to settle it later).
+typedef void (*promise_store_visitor)(const char* name, Promise* p, void* context);
+
+// Visits every named promise that is still pending, typically right after
+// opening the store, so interrupted work can be picked up where it stopped.
+// Returns the number of promises visited.
+size_t promise_store_resume(PromiseStore* store, promise_store_visitor visitor, void* context);
+
+// Replaces the data attached to persistent promise `p` (at most
+// PROMISE_STORE_DATA_MAX bytes), e.g. what is needed to resume its work.
+// Returns false if `p` is not persistent or `length` is too large.
+bool promise_persistent_set_data(Promise* p, const void* data, size_t length);
+
+// Copies up to `capacity` bytes of `p`'s attached data into `buffer` and
+// returns the data's full length (0 if `p` is not persistent).
+size_t promise_persistent_get_data(Promise* p, void* buffer, size_t capacity);
+
+
+// --- Event Loop Simulation (for async behavior) ---
+// Promises inherently imply asynchronous behavior. In C, this usually means
+// integrating with an existing event loop (libuv, libevent, etc.) or simulating one.
+// This is a very basic simulation for demonstration.
+
+// Initializes the event loop (e.g., creates a task queue).
+void init_event_loop(void);
+
+// Enqueues a "microtask" to be run by the event loop.
+// Promise resolutions and rejections often schedule their callbacks as microtasks.
+// Args:
+//   task: Function pointer to the task to execute.
+//   data: Data to pass to the task function.
+void enqueue_microtask(void (*task)(void* data), void* data);
+
+// Like enqueue_microtask() (which uses PROMISE_PRIORITY_HIGH), in the given
+// lane; see PromisePriority. Tasks queued from inside run_event_loop_parallel()
+// go to the worker's own deque, where the lanes are not distinguished.
+void enqueue_microtask_priority(void (*task)(void* data), void* data, PromisePriority priority);
+
+// Runs the event loop until all tasks are processed.
+// In a real application, this would be more sophisticated, possibly running
+// indefinitely or until a specific stop condition.
+void run_event_loop(void);
+
+// Runs the event loop on `worker_count` threads (the calling thread is one of
+// them) until every queued task, including tasks queued while running, has
+// run. Each worker owns a Chase-Lev work-stealing deque: tasks queued from a
+// worker go to its own deque, idle workers steal from the others, and tasks
+// queued from outside the loop are pulled from the shared queue. Callbacks of
+// any one promise still run in registration order; the relative order of
+// tasks belonging to different promises is not preserved.
+// Do not call run_event_loop() concurrently with this function.
+void run_event_loop_parallel(size_t worker_count);
+
+// Runs the event loop until stop_event_loop() is called. Unlike run_event_loop()
+// it does not return when the queue is empty: it sleeps in epoll_wait() on an
+// eventfd that enqueue_microtask() signals, or until the next timer is due.
+// Only one thread may run the loop at a time.
+void run_event_loop_blocking(void);
+
+// Makes run_event_loop_blocking() return after the task it is running, if any.
+// Safe to call from any thread, including from a task.
+void stop_event_loop(void);
+
+// Frees any resources associated with the event loop.
+// Pending timers are discarded without running.
+void free_event_loop(void);
+
+
+// --- Timers ---
+// Timers live in a hierarchical timer wheel with 1 ms resolution, so adding
+// and cancelling a timer are O(1). Callbacks run on the event-loop thread
+// (run_event_loop() runs those already due; run_event_loop_blocking() also
+// sleeps until the next one). Timers are not run by run_event_loop_parallel().
+// After event_loop_drive_timers(), a driver thread runs them instead while
+// no thread is inside run_event_loop_blocking().
+
+typedef struct EventLoopTimer EventLoopTimer;
+
+typedef void (*event_loop_timer_callback)(void* data);
+
+// Schedules `callback(data)` to run once, `delay_ms` milliseconds from now.
+// The timer is freed after its callback returns. Returns NULL on allocation failure.
+EventLoopTimer* event_loop_add_timer(unsigned long delay_ms, event_loop_timer_callback callback, void* data);
+
+// Cancels a timer that has not fired yet and frees it. Returns false if the
+// timer already fired; the handle must not be used once its callback has started.
+bool event_loop_cancel_timer(EventLoopTimer* timer);
+
+// Starts a thread that runs due timers whenever run_event_loop_blocking() is
+// not running, for programs that never run the loop. Idempotent; cannot be
+// undone. Returns false if the thread could not be started.
+bool event_loop_drive_timers(void);
+
+// Q.delay(): returns a promise fulfilled with `value` after `delay_ms` milliseconds.
+Promise* promise_delay(unsigned long delay_ms, PromiseValue value);
+
+// Q.timeout(): returns a promise that follows `p`, but is rejected with
+// `reason` if `p` has not settled within `timeout_ms` milliseconds. The
+// returned promise is chained to `p`.
+Promise* promise_timeout(Promise* p, unsigned long timeout_ms, PromiseValue reason);
+
+
+// --- I/O ---
+// I/O promises are settled by the event loop thread: run_event_loop() reaps
+// whatever has completed, and run_event_loop_blocking() also sleeps until
+// something does, so one thread can drive thousands of operations at once.
+// They are not reaped by run_event_loop_parallel(). I/O still in flight when
+// free_event_loop() is called is abandoned and its promises never settle.
+
+// Readiness events for promise_from_fd(); the same bits as poll(2)/epoll(7).
+#define PROMISE_FD_READABLE 0x001u
+#define PROMISE_FD_WRITABLE 0x004u
+#define PROMISE_FD_ERROR 0x008u  // Always reported; need not be requested
+#define PROMISE_FD_HANGUP 0x010u // Always reported; need not be requested
+
+// Returns a promise fulfilled, once, with the PROMISE_FD_* bits that are set
+// when `fd` becomes ready for any of `events`; cast the value to uintptr_t.
+// Several promises may wait on the same fd. Regular files are always ready.
+// Rejected if `fd` cannot be watched. Keep `fd` open until the promise settles.
+Promise* promise_from_fd(int fd, unsigned events);
+
+// Reads up to `length` bytes from `fd` at `offset` (-1: the current file
+// position, as for sockets and pipes) into `buffer`, using io_uring. Fulfilled
+// with the number of bytes read (cast to intptr_t; 0 at end of file), rejected
+// with a strerror() message. `buffer` must stay valid until the promise
+// settles. Without io_uring the read happens synchronously in the call.
+// Like read(2), one call moves at most 0x7ffff000 bytes; larger requests
+// complete short.
+Promise* promise_read(int fd, void* buffer, size_t length, long long offset);
+
+// Writes `length` bytes from `buffer` to `fd` at `offset`, like promise_read().
+// Fulfilled with the number of bytes written, which may be short.
+Promise* promise_write(int fd, const void* buffer, size_t length, long long offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // QPROMISE_H
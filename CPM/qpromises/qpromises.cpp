@@ -1,238 +1,36 @@
 /*
- * qpromise.h - Q Promises Library for C
- *
- * This header defines the public API for a C-based implementation of promises,
- * inspired by the Q library in JavaScript. It aims to provide asynchronous
- * operation management, including deferred execution, chaining, and error handling.
- *
- * The API includes:
- * - Core Promise creation and manipulation (resolve, reject, then).
- * - Q.defer() equivalent for creating deferred objects.
- * - Q.all() for synchronizing multiple promises.
- * - Q.nfcall() for wrapping Node.js-style callbacks.
- * - Experimental PMLL (Persistent Memory) hardened queue for resilient operations.
- * - A basic event loop simulation for managing asynchronous tasks.
+ * qpromises.cpp - implementation of the Q Promises API declared in qpromise.h.
+ * The code is plain C; build it as C (e.g. `cc -x c`) or as C++.
  */
-#ifndef QPROMISE_H
-#define QPROMISE_H
-
-#include <stdbool.h> // For bool type
-#include <stddef.h>  // For size_t
-#include <pthread.h> // For mutex in persistent/concurrent scenarios
-
-// --- Core Types ---
-
-// Forward declaration of the main Promise structure.
-typedef struct Promise Promise;
-
-// Forward declaration for the Deferred object, used with Q.defer() style.
-typedef struct PromiseDeferred PromiseDeferred;
-
-// Forward declaration for a hardened resource queue, potentially using persistent memory.
-// PMLL = Persistent Memory Lexicon/Library (hypothetical or specific project context)
-typedef struct PMLL_HardenedResourceQueue PMLL_HardenedResourceQueue;
-
-// Represents the state of a Promise.
-typedef enum {
-    PROMISE_PENDING,  // Initial state, operation not yet completed.
-    PROMISE_FULFILLED, // Operation completed successfully.
-    PROMISE_REJECTED   // Operation failed.
-} PromiseState;
-
-// Generic type for the value of a fulfilled promise or the reason for a rejection.
-// In a more complex system, this might be a tagged union or a more structured error type.
-typedef void* PromiseValue;
-
-// Callback function type for when a promise is fulfilled.
-// Args:
-//   value: The fulfillment value of the parent promise.
-//   user_data: Arbitrary user-provided data passed during 'then'.
-// Returns:
-//   A PromiseValue. This can be:
-//   1. A direct value: The chained promise (from 'then') will be fulfilled with this value.
-//   2. A new Promise*: The chained promise will adopt the state and value of this new promise.
-//   3. NULL (or a special marker): Could indicate no further value, or an error if not handled.
-typedef PromiseValue (*on_fulfilled_callback)(PromiseValue value, void* user_data);
-
-// Callback function type for when a promise is rejected.
-// Args:
-//   reason: The rejection reason of the parent promise.
-//   user_data: Arbitrary user-provided data passed during 'then'.
-// Returns:
-//   A PromiseValue. This can be:
-//   1. A direct value: The chained promise will be fulfilled with this value (recovery).
-//   2. A new Promise*: The chained promise will adopt the state and value of this new promise.
-//   3. If the callback itself wants to propagate or signal a new error, it might
-//      return a special error marker or a new promise that is already rejected.
-//      Alternatively, it could re-throw by returning a specific error-coded PromiseValue.
-typedef PromiseValue (*on_rejected_callback)(PromiseValue reason, void* user_data);
-
-
-// --- Promise API ---
-
-// Creates a new promise in the PENDING state.
-// This is for standard, in-memory promises.
-Promise* promise_create(void);
-
-// Creates a new promise, potentially in persistent memory.
-// Args:
-//   pmem_ctx: Context for persistent memory allocation/management.
-//   lock: A mutex for synchronizing access if the promise is shared or persistent.
-// This is an advanced feature for durability and inter-process/session state.
-Promise* promise_create_persistent(void* pmem_ctx, pthread_mutex_t* lock);
-
-// Resolves a promise with a given value.
-// If the promise is already settled, this is a no-op.
-// Transitions state from PENDING to FULFILLED.
-void promise_resolve(Promise* p, PromiseValue value);
-
-// Rejects a promise with a given reason.
-// If the promise is already settled, this is a no-op.
-// Transitions state from PENDING to REJECTED.
-void promise_reject(Promise* p, PromiseValue reason);
-
-// Attaches fulfillment and rejection handlers to a promise.
-// Returns a new promise that is resolved or rejected based on the outcome of the callbacks.
-// Args:
-//   p: The parent promise.
-//   on_fulfilled: Callback for successful resolution. Can be NULL.
-//   on_rejected: Callback for rejection. Can be NULL.
-//   user_data: Arbitrary data to be passed to the callbacks.
-Promise* promise_then(Promise* p, on_fulfilled_callback on_fulfilled, on_rejected_callback on_rejected, void* user_data);
-
-// Frees the memory associated with a promise.
-// Important: This should handle freeing internal callback queues and other resources.
-// If the promise is persistent, this might involve deallocation in persistent memory.
-void promise_free(Promise* p);
-
-
-// --- Q.defer() API ---
-// Provides a way to create a promise and manually control its resolution or rejection.
-
-// Structure for a deferred object. Contains the promise it controls.
-struct PromiseDeferred {
-    Promise* promise;
-    // Potentially a lock if the deferred object itself needs to be thread-safe
-    // for resolve/reject operations from different threads.
-    // pthread_mutex_t* lock; // Example
-};
-
-// Creates a new deferred object (and its associated promise).
-PromiseDeferred* promise_defer_create(void);
-
-// Creates a new deferred object, potentially with persistent backing for its promise.
-PromiseDeferred* promise_defer_create_persistent(void* pmem_ctx, pthread_mutex_t* lock);
-
-// Resolves the promise associated with the deferred object.
-void promise_defer_resolve(PromiseDeferred* deferred, PromiseValue value);
-
-// Rejects the promise associated with the deferred object.
-void promise_defer_reject(PromiseDeferred* deferred, PromiseValue reason);
-
-// Frees the deferred object. Note: This typically also implies freeing the
-// associated promise if it's not intended to outlive the deferred controller.
-// Careful lifetime management is needed.
-void promise_defer_free(PromiseDeferred* deferred);
-
-
-// --- Q.all() API ---
-// Creates a promise that fulfills when all promises in an array are fulfilled,
-// or rejects if any promise in the array rejects.
-
-// Args:
-//   promises: An array of Promise pointers.
-//   count: The number of promises in the array.
-// Returns:
-//   A new promise that aggregates the results. The fulfillment value will typically
-//   be an array of the fulfillment values from the input promises, in order.
-Promise* promise_all(Promise* promises[], size_t count);
-
-
-// --- Q.nfcall() API (Node.js-style callback wrapping) ---
-// Wraps a function that uses the Node.js (error, result) callback pattern
-// into a function that returns a promise.
-
-// Node.js-style callback signature.
-// Args:
-//   err: Error object/value (or NULL/0 if success).
-//   result: Result value (if success).
-//   user_data: Context data.
-typedef void (*NodeCallback)(void* err, PromiseValue result, void* user_data);
-
-// Calls the Node.js-style callback function and returns a promise
-// that resolves or rejects based on the callback's arguments.
-// Args:
-//   cb: The Node.js-style callback function to wrap.
-//   user_data: User data to pass to the NodeCallback.
-//   ... (potentially other arguments to pass to the wrapped function itself,
-//        which would require varargs or a more complex wrapper).
-// For simplicity, this example assumes 'cb' is called with pre-set arguments
-// or 'user_data' is used to convey them. A more complete `nfcall` would
-// need to handle forwarding arguments to the target function.
-Promise* promise_nfcall(NodeCallback cb, void* user_data /*, ...args for the function itself */);
-
-
-// --- PMLL Hardened Queue API ---
-// Experimental API for operations that need to be resilient, potentially
-// involving persistent state or transactional execution.
-
-// Creates a hardened resource queue.
-// Args:
-//   resource_id: A unique identifier for the resource this queue manages.
-//   persistent_queue: If true, the queue's state might be backed by persistent memory.
-PMLL_HardenedResourceQueue* pmll_queue_create(const char* resource_id, bool persistent_queue);
-
-// Executes an operation through the hardened queue.
-// This implies that the operation might be retried, logged, or handled
-// transactionally depending on the queue's implementation.
-// Args:
-//   hq: The hardened queue instance.
-//   operation_fn: The function to execute (similar to on_fulfilled).
-//   error_fn: Handler for errors during the operation (similar to on_rejected).
-//   op_user_data: User data for the operation and error functions.
-// Returns:
-//   A promise that settles with the outcome of the hardened operation.
-Promise* pmll_execute_hardened_operation(
-    PMLL_HardenedResourceQueue* hq,
-    on_fulfilled_callback operation_fn, // Or a more specific operation signature
-    on_rejected_callback error_fn,     // Or a more specific error signature
-    void* op_user_data);
-
-// Frees the hardened resource queue and any associated resources.
-void pmll_queue_free(PMLL_HardenedResourceQueue* hq);
-
-
-// --- Event Loop Simulation (for async behavior) ---
-// Promises inherently imply asynchronous behavior. In C, this usually means
-// integrating with an existing event loop (libuv, libevent, etc.) or simulating one.
-// This is a very basic simulation for demonstration.
-
-// Initializes the event loop (e.g., creates a task queue).
-void init_event_loop(void);
-
-// Enqueues a "microtask" to be run by the event loop.
-// Promise resolutions and rejections often schedule their callbacks as microtasks.
-// Args:
-//   task: Function pointer to the task to execute.
-//   data: Data to pass to the task function.
-void enqueue_microtask(void (*task)(void* data), void* data);
-
-// Runs the event loop until all tasks are processed.
-// In a real application, this would be more sophisticated, possibly running
-// indefinitely or until a specific stop condition.
-void run_event_loop(void);
-
-// Frees any resources associated with the event loop.
-void free_event_loop(void);
-
-#endif // QPROMISE_H
-
 // --- Implementation (qpromise.c) ---
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // For clock_gettime, eventfd and epoll under -std=c11
+#endif
 #include <stdio.h>   // For printf (debugging), NULL
 #include <stdlib.h>  // For malloc, free
 #include <string.h>  // For memcpy, memset (potentially)
 #include <stdbool.h> // For boolean types
-// #include "qpromise.h" // Already included via the combined file structure for this example
+#include <sched.h>   // For sched_yield in idle event-loop workers
+#include <stdint.h>  // For uint64_t timer ticks
+#include <time.h>    // For clock_gettime (timer wheel clock)
+#include <unistd.h>  // For read/write/close on the wake-up eventfd
+#include <fcntl.h>   // For open/posix_fallocate on the PMLL write-ahead log
+#include <errno.h>
+#include <stdarg.h>  // For promise_nfcall_args()
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h> // io_uring has no libc wrappers
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define QPROMISE_HAVE_IO_URING 1
+#endif
+#endif
+#include "qpromise.h"
+#include "../../src/q_trace.h" // Opt-in lifecycle tracing shared with the CPM engine
+#include "../../src/q_runtime.h" // Worker pool and object pools shared with the CPM engine
 
 // Forward declaration (already in .h but good practice in .c if not including .h directly)
 // typedef struct Promise Promise; // Not needed if qpromise.h is included
@@ -260,17 +58,22 @@ typedef struct {
                                         // the outcome of on_fulfilled/on_rejected.
 } PromiseCallbackEntry; // Renamed for clarity from PromiseCallback
 
-// Simple dynamic array for storing callback entries.
-// This queue is processed when the promise settles.
+// Number of callback entries stored inside the promise itself. Most promises get
+// one or two .then() calls, so registering and dispatching them never allocates.
+#define PROMISE_CALLBACK_INLINE 2
+
+// Callback list with small-buffer optimisation. Entries live in `inline_items`
+// until more than PROMISE_CALLBACK_INLINE are registered; from then on all of
+// them live in the `heap` array. Each entry holds both handlers and is
+// processed once, whichever way the promise settles, in registration order.
 typedef struct {
-    PromiseCallbackEntry* items; // Dynamically allocated array of callback entries.
-    size_t count;                // Number of callback entries currently in the queue.
-    size_t capacity;             // Allocated capacity of the items array.
-    // For PMLL/persistent scenarios, this queue might also need to be in persistent memory,
+    PromiseCallbackEntry inline_items[PROMISE_CALLBACK_INLINE];
+    PromiseCallbackEntry* heap;  // NULL while the entries fit inline.
+    size_t count;                // Number of callback entries currently in the list.
+    size_t capacity;             // Capacity of `heap` (0 while inline).
+    // For PMLL/persistent scenarios, this list might also need to be in persistent memory,
     // or its contents carefully managed with respect to transactions if the promise is persistent.
-    // pthread_mutex_t* queue_lock; // Optional: if callbacks can be added from multiple threads
-                                 // after promise creation but before settlement.
-} PromiseCallbackQueue;
+} PromiseCallbackList;
 
 // The Promise structure itself
 struct Promise {
@@ -278,103 +81,138 @@ struct Promise {
     PromiseValue value; // Stores the fulfillment value or rejection reason once settled.
                         // If state is PENDING, this is typically NULL or undefined.
 
-    PromiseCallbackQueue fulfillment_callbacks; // Queue of callbacks to execute on fulfillment.
-    PromiseCallbackQueue rejection_callbacks;   // Queue of callbacks to execute on rejection.
+    PromiseCallbackList callbacks; // Callbacks to execute once settled (either outcome).
 
     pthread_mutex_t lock; // Mutex for thread-safe access to promise state and callback queues.
                           // Essential if promises are resolved/rejected or 'then'ed from
                           // multiple threads. For single-threaded event loops, this might be
                           // optional or a lighter-weight synchronization mechanism could be used.
 
-    bool is_persistent;   // Flag to indicate if this promise is backed by persistent memory.
-    void* pmem_ctx;       // Context for persistent memory operations (e.g., a pmemobj_pool*).
-                          // If is_persistent is true, 'value' might be a persistent pointer,
-                          // and callback queues might also need special handling.
+    PromisePriority priority; // Lane its execute_callbacks tasks are queued in.
+    PromiseDispatch dispatch; // What runs its execute_callbacks tasks.
+    QRuntimeJob dispatch_job; // The task, when it runs on the runtime workers.
+
+    bool callbacks_scheduled; // An execute_callbacks task is queued or running. At most one
+                              // exists per promise, which keeps its callbacks in order even
+                              // when several event-loop workers run tasks in parallel.
 
-    // Reference counting could be useful for managing promise lifetime, especially
-    // in complex chaining scenarios or when promises are shared.
-    // int ref_count;
-    // pthread_mutex_t ref_count_lock;
+    bool is_persistent;   // Backed by a record in a PromiseStore; settling updates the record.
+    void* pmem_ctx;       // The PromiseStore* holding the record (NULL if not persistent).
+    size_t pmem_slot;     // Index of the record in the store. Callbacks are never persisted.
+
+    // Intrusive reference count (atomic). Held by: the creator, each callback entry
+    // whose chained_promise this is, a queued execute_callbacks task, and timer
+    // contexts. The promise is reclaimed when it drops to zero.
+    size_t ref_count;
+    struct Promise* pool_next; // Worklist link while promise_destroy() reclaims a chain.
 };
 
-// --- Helper Functions for Callback Queues (Conceptual moving towards Real) ---
-
-// Initializes a callback queue.
-// Real-world: Allocate initial capacity, set count to 0.
-static void callback_queue_init(PromiseCallbackQueue* queue, size_t initial_capacity) {
-    // Defensive coding: check for NULL queue pointer.
-    if (!queue) return;
-
-    queue->count = 0;
-    if (initial_capacity > 0) {
-        queue->items = (PromiseCallbackEntry*)malloc(initial_capacity * sizeof(PromiseCallbackEntry));
-        if (!queue->items) {
-            // Allocation failure: a critical error.
-            // In a real system, this should be handled robustly (e.g., log, signal error).
-            // For this sketch, we'll set capacity to 0 to indicate failure.
-            perror("Failed to allocate callback queue items");
-            queue->capacity = 0;
-            // Potentially, the promise creation itself should fail if its queues can't be initialized.
-        } else {
-            queue->capacity = initial_capacity;
-        }
-    } else {
-        queue->items = NULL;
-        queue->capacity = 0;
-    }
-    // If this queue were for a persistent promise, 'items' might be allocated in pmem
-    // using pmemobj_alloc or similar, and 'queue_lock' might be a persistent mutex.
+// --- Helper Functions for Callback Lists ---
+
+// Initializes an empty callback list. Never allocates.
+static void callback_list_init(PromiseCallbackList* list) {
+    list->heap = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+static PromiseCallbackEntry* callback_list_items(PromiseCallbackList* list) {
+    return list->heap ? list->heap : list->inline_items;
 }
 
-// Adds a callback entry to the queue.
-// Real-world: Handle resizing if capacity is reached.
-static bool callback_queue_add(PromiseCallbackQueue* queue, PromiseCallbackEntry entry) {
-    // Defensive coding: check for NULL queue or uninitialized items (if capacity is 0 but items is NULL).
-    if (!queue) return false;
+// Appends a callback entry. Allocates only when the list outgrows the inline
+// buffer (moving every entry to the heap) or the heap array is full.
+static bool callback_list_add(PromiseCallbackList* list, PromiseCallbackEntry entry) {
+    if (!list) return false;
 
-    if (queue->count >= queue->capacity) {
-        // Resize needed. Double the capacity, or a more sophisticated growth strategy.
-        size_t new_capacity = (queue->capacity == 0) ? 4 : queue->capacity * 2; // Start with 4, then double
-        PromiseCallbackEntry* new_items = (PromiseCallbackEntry*)realloc(queue->items, new_capacity * sizeof(PromiseCallbackEntry));
+    if (!list->heap && list->count < PROMISE_CALLBACK_INLINE) {
+        list->inline_items[list->count++] = entry;
+        return true;
+    }
+
+    if (list->count >= list->capacity) {
+        // Double the capacity, starting from twice the inline buffer.
+        size_t new_capacity = list->heap ? list->capacity * 2 : PROMISE_CALLBACK_INLINE * 2;
+        PromiseCallbackEntry* new_items = (PromiseCallbackEntry*)realloc(list->heap, new_capacity * sizeof(PromiseCallbackEntry));
         if (!new_items) {
-            perror("Failed to resize callback queue");
+            perror("Failed to resize callback list");
             // Failed to add. The caller needs to handle this (e.g., the 'then' operation fails).
             return false;
         }
-        queue->items = new_items;
-        queue->capacity = new_capacity;
+        if (!list->heap) {
+            memcpy(new_items, list->inline_items, list->count * sizeof(PromiseCallbackEntry));
+        }
+        list->heap = new_items;
+        list->capacity = new_capacity;
     }
 
-    queue->items[queue->count++] = entry;
+    list->heap[list->count++] = entry;
     return true;
-    // For PMLL/persistent queues:
-    // If 'items' is in pmem, realloc might not be directly applicable.
+    // For PMLL/persistent lists:
+    // If 'heap' is in pmem, realloc might not be directly applicable.
     // A persistent memory allocator would be used (e.g., pmemobj_realloc or manual copy to new larger pmem block).
     // The addition itself might need to be part of a transaction if the promise is persistent
     // to ensure consistency (pmemobj_tx_add_range).
 }
 
-// Frees the resources used by a callback queue.
-// Real-world: Free the 'items' array.
-static void callback_queue_free(PromiseCallbackQueue* queue) {
-    if (!queue) return;
+// Moves every entry of `list` into `taken` and leaves `list` empty. The inline
+// entries are copied by value and a heap array changes owner, so this never
+// allocates; call it with the owning promise's lock held.
+static void callback_list_steal(PromiseCallbackList* list, PromiseCallbackList* taken) {
+    *taken = *list;
+    callback_list_init(list);
+}
+
+// Frees the resources used by a callback list.
+static void callback_list_free(PromiseCallbackList* list) {
+    if (!list) return;
 
-    // Important: This frees the queue's internal buffer.
+    // Important: This frees the list's heap buffer.
     // It does NOT free the chained_promise within each PromiseCallbackEntry.
     // The lifetime of chained_promises is managed separately (e.g., when they are resolved/rejected and freed).
-    if (queue->items) {
-        // If using PMLL for the queue items, this would be pmemobj_free(&queue->items_oid) or similar.
-        free(queue->items);
-        queue->items = NULL;
-    }
-    queue->count = 0;
-    queue->capacity = 0;
+    free(list->heap);
+    callback_list_init(list);
 }
 
 // --- Forward declarations for internal promise functions ---
 static void promise_settle(Promise* p, PromiseState state, PromiseValue value);
-static void schedule_callback_execution(Promise* p);
+static bool claim_callback_execution(Promise* p);
+static void dispatch_callback_execution(Promise* p);
 static void execute_callbacks(void* data); // Task for event loop
+static void execute_callback_batch(void* data); // Task for promise_resolve_batch()
+static bool promise_store_attach(Promise* p, PromiseStore* store);
+static void promise_store_persist_locked(Promise* p);
+static void promise_store_detach(Promise* p);
+
+
+// --- Promise pool ---
+// Promises come from a pool of the shared runtime (src/q_runtime.h), the same
+// per-thread caches the CPM engine allocates from: released promises are kept
+// with their mutex still initialised and handed out again by promise_create(),
+// so steady-state create/free never reaches malloc.
+
+static bool promise_pool_construct(void* object) {
+    Promise* p = (Promise*)object;
+    if (pthread_mutex_init(&p->lock, NULL) != 0) {
+        perror("Failed to initialize promise mutex");
+        return false;
+    }
+    return true;
+}
+
+static void promise_pool_destroy(void* object) {
+    pthread_mutex_destroy(&((Promise*)object)->lock);
+}
+
+static QRuntimePool promise_pool = Q_RUNTIME_POOL("qpromise", Promise, promise_pool_construct, promise_pool_destroy);
+
+static Promise* promise_pool_get(void) {
+    return (Promise*)q_runtime_alloc(&promise_pool);
+}
+
+static void promise_pool_put(Promise* p) {
+    q_runtime_free(&promise_pool, p);
+}
 
 
 // --- Promise API Implementation ---
@@ -382,48 +220,38 @@ static void execute_callbacks(void* data); // Task for event loop
 Promise* promise_create_internal(bool is_persistent_promise, void* pmem_ctx_param, pthread_mutex_t* lock_param) {
     Promise* p = NULL;
 
-    // For persistent promises, allocation would use pmemobj_alloc or similar.
-    // For this sketch, we'll use malloc and simulate the distinction.
-    if (is_persistent_promise && pmem_ctx_param) {
-        // p = pmemobj_tx_alloc(sizeof(Promise), TYPE_PROMISE_STRUCT_ID); // Example PMDK
-        // if (!p) { perror("Failed to allocate persistent promise"); return NULL; }
-        // For now, simulate with malloc and set flags.
-        p = (Promise*)malloc(sizeof(Promise));
-        if (!p) { perror("Failed to allocate promise (simulating persistent)"); return NULL; }
-        p->is_persistent = true;
-        p->pmem_ctx = pmem_ctx_param;
-        // If a lock is provided for a persistent promise, it's likely for managing
-        // concurrent access to the persistent state itself.
-        // The internal 'lock' field of the Promise struct is for its own state integrity.
-        // This needs careful design: is lock_param for the pmem region or for this promise instance?
-        // Assuming lock_param is for this instance if it's to be managed externally.
-        // Or, the promise initializes its own persistent mutex if pmem_ctx supports it.
-    } else {
-        p = (Promise*)malloc(sizeof(Promise));
-        if (!p) { perror("Failed to allocate promise"); return NULL; }
-        p->is_persistent = false;
-        p->pmem_ctx = NULL;
-    }
+    (void)lock_param; // Each promise has its own lock; see struct Promise.
+
+    // The Promise itself always lives in ordinary memory. A persistent one is
+    // additionally bound to a record in its store, which holds what must
+    // survive a restart (state, value, name, data).
+    p = promise_pool_get();
+    if (!p) { perror("Failed to allocate promise"); return NULL; }
+    p->is_persistent = false;
+    p->pmem_ctx = NULL;
+    p->pmem_slot = 0;
 
     p->state = PROMISE_PENDING;
     p->value = NULL; // No value/reason when pending.
+    p->callbacks_scheduled = false;
+    p->priority = PROMISE_PRIORITY_HIGH;
+    p->dispatch = PROMISE_DISPATCH_LOOP;
+    p->ref_count = 1; // The caller's reference
 
-    // Initialize callback queues.
-    // Initial capacity can be tuned. 0 means it allocates on first 'then'.
-    callback_queue_init(&p->fulfillment_callbacks, 2);
-    callback_queue_init(&p->rejection_callbacks, 2);
+    // The first PROMISE_CALLBACK_INLINE callbacks are stored in the promise itself.
+    callback_list_init(&p->callbacks);
 
-    // Initialize the mutex for the promise.
-    // For persistent promises, this mutex itself might need to be persistent (e.g., PMDK POBJ_MUTEX_INIT).
-    if (pthread_mutex_init(&p->lock, NULL) != 0) {
-        perror("Failed to initialize promise mutex");
-        // If persistent, pmemobj_free(&p_oid);
-        free(p);
+    // The mutex was initialised by promise_pool_get() (pooled promises keep theirs).
+
+    if (is_persistent_promise && !promise_store_attach(p, (PromiseStore*)pmem_ctx_param)) {
+        promise_pool_put(p);
         return NULL;
     }
-    
-    // p->ref_count = 1; // If using reference counting
-    // pthread_mutex_init(&p->ref_count_lock, NULL); // If using reference counting
+
+    // Tracing: the pending interval shows up as an async span keyed by p.
+    if (Q_TRACE_ON()) {
+        q_trace_async_begin("qpromise", "pending", p);
+    }
 
     return p;
 }
@@ -434,50 +262,53 @@ Promise* promise_create(void) {
 }
 
 Promise* promise_create_persistent(void* pmem_ctx, pthread_mutex_t* lock) {
-    // This is the advanced persistent promise.
-    // The 'lock' parameter here might be for the overall persistent context or
-    // an externally managed lock for this specific promise instance if it's stored
-    // in a shared persistent region. The promise's internal lock handles its own data.
+    // pmem_ctx is the PromiseStore* to allocate the promise's record in.
     if (!pmem_ctx) {
-        // fprintf(stderr, "Persistent context (pmem_ctx) is required for persistent promise.\n");
-        return NULL; // Or fallback to non-persistent if allowed by design.
+        return NULL;
     }
     return promise_create_internal(true, pmem_ctx, lock);
 }
 
-// Internal function to actually settle the promise and trigger callbacks.
-// This function MUST be called with the promise's lock held.
-static void promise_settle_locked(Promise* p, PromiseState new_state, PromiseValue new_value) {
+// Settles the promise. This function MUST be called with the promise's lock
+// held. Returns true if the caller must queue execute_callbacks(p): see
+// claim_callback_execution().
+static bool promise_settle_claim_locked(Promise* p, PromiseState new_state, PromiseValue new_value) {
     if (p->state != PROMISE_PENDING) {
         // Promise already settled. Per spec, further resolves/rejects are ignored.
         // If new_value is a promise itself (e.g. promise_resolve(p, another_promise)),
         // and it's dynamically allocated, it might need to be freed here if not adopted.
         // However, typical Q/Promises+ spec doesn't involve freeing values passed to resolve/reject
         // by the resolve/reject functions themselves; caller manages that.
-        return;
+        return false;
     }
 
     p->state = new_state;
     p->value = new_value; // Ownership of value is passed to the promise.
 
-    // For persistent promises, the state and value update need to be made persistent.
-    if (p->is_persistent && p->pmem_ctx) {
-        // pmemobj_tx_add_range_direct(p, sizeof(PromiseState) + sizeof(PromiseValue)); // Or specific fields
-        // pmemobj_persist(p->pmem_ctx, p, sizeof(Promise)); // Or finer-grained flush
-        // This is a simplification; actual PMDK usage involves transactions (pmemobj_tx_begin, commit/abort).
-        // For example:
-        // TX_BEGIN(p->pmem_ctx) {
-        //     pmemobj_tx_add_range_direct(p, offsetof(struct Promise, state), sizeof(p->state) + sizeof(p->value) + ...);
-        //     p->state = new_state;
-        //     p->value = new_value; // If value is also persistent, its pmem representation is assigned.
-        // } TX_ONABORT {
-        //     fprintf(stderr, "Transaction aborted while settling persistent promise.\n");
-        // } TX_END
+    if (Q_TRACE_ON()) {
+        q_trace_async_end("qpromise", "pending", p, new_state == PROMISE_FULFILLED ? "fulfilled" : "rejected");
+    }
+
+    // For persistent promises, the new state and value reach the store before
+    // any callback can observe them.
+    if (p->is_persistent) {
+        promise_store_persist_locked(p);
     }
 
-    // Schedule the execution of callbacks. This is often done via an event loop or microtask queue
-    // to ensure asynchronous behavior (callbacks don't run immediately on the caller's stack).
-    schedule_callback_execution(p);
+    // The callbacks run later, from the dispatch task, once the caller has
+    // released the lock (on the event loop unless p->dispatch says otherwise).
+    // With no callbacks there is nothing to run; a later .then() schedules itself.
+    return p->callbacks.count > 0 && claim_callback_execution(p);
+}
+
+// Settles the promise and dispatches its callbacks.
+static void promise_settle(Promise* p, PromiseState new_state, PromiseValue new_value) {
+    pthread_mutex_lock(&p->lock);
+    bool claimed = promise_settle_claim_locked(p, new_state, new_value);
+    pthread_mutex_unlock(&p->lock);
+    if (claimed) {
+        dispatch_callback_execution(p);
+    }
 }
 
 
@@ -492,27 +323,102 @@ void promise_resolve(Promise* p, PromiseValue value) {
     // For this sketch, we assume `value` is a final fulfillment value.
     // if (is_promise(value)) { /* complex adoption logic */ }
 
-    pthread_mutex_lock(&p->lock);
-    promise_settle_locked(p, PROMISE_FULFILLED, value);
-    pthread_mutex_unlock(&p->lock);
+    promise_settle(p, PROMISE_FULFILLED, value);
 }
 
 void promise_reject(Promise* p, PromiseValue reason) {
     if (!p) return;
 
+    promise_settle(p, PROMISE_REJECTED, reason);
+}
+
+
+// Dispatch task for a batch settlement: the promises whose callbacks were
+// claimed, each with the task reference execute_callbacks() releases.
+typedef struct {
+    size_t count;
+    PromisePriority priority; // Lane of every promise in the batch
+    Promise** promises;       // Points just past this header
+} CallbackBatch;
+
+static CallbackBatch* callback_batch_new(size_t capacity, PromisePriority priority) {
+    CallbackBatch* batch = (CallbackBatch*)malloc(sizeof(CallbackBatch) + capacity * sizeof(Promise*));
+    if (batch) {
+        batch->count = 0;
+        batch->priority = priority;
+        batch->promises = (Promise**)(batch + 1);
+    }
+    return batch;
+}
+
+// Queues the batch's dispatch as one task (or as the single promise's own).
+static void callback_batch_submit(CallbackBatch* batch) {
+    if (!batch) return;
+    PromisePriority priority = batch->priority;
+    if (batch->count == 0) {
+        free(batch);
+    } else if (batch->count == 1) {
+        enqueue_microtask_priority(execute_callbacks, batch->promises[0], priority);
+        free(batch);
+    } else {
+        enqueue_microtask_priority(execute_callback_batch, batch, priority);
+    }
+}
+
+void promise_resolve_batch(Promise* promises[], PromiseValue values[], size_t count) {
+    if (!promises || count == 0) return;
+
+    // One batch per priority lane, allocated when the first promise of that lane needs one.
+    CallbackBatch* batches[PROMISE_PRIORITY_LANES] = { NULL };
+    for (size_t i = 0; i < count; ++i) {
+        Promise* p = promises[i];
+        if (!p) continue;
+        pthread_mutex_lock(&p->lock);
+        bool claimed = promise_settle_claim_locked(p, PROMISE_FULFILLED, values ? values[i] : NULL);
+        if (claimed && p->dispatch != PROMISE_DISPATCH_LOOP) {
+            // Not run by the event loop: dispatched on its own below.
+        } else if (claimed) {
+            CallbackBatch** batch = &batches[p->priority];
+            if (!*batch) {
+                *batch = callback_batch_new(count - i, p->priority);
+            }
+            if (*batch) {
+                (*batch)->promises[(*batch)->count++] = p;
+            } else {
+                enqueue_microtask_priority(execute_callbacks, p, p->priority); // Out of memory: one task each
+            }
+            claimed = false;
+        }
+        pthread_mutex_unlock(&p->lock);
+        if (claimed) {
+            dispatch_callback_execution(p);
+        }
+    }
+
+    for (int lane = 0; lane < PROMISE_PRIORITY_LANES; ++lane) {
+        callback_batch_submit(batches[lane]);
+    }
+}
+
+void promise_set_priority(Promise* p, PromisePriority priority) {
+    if (!p) return;
     pthread_mutex_lock(&p->lock);
-    promise_settle_locked(p, PROMISE_REJECTED, reason);
+    p->priority = priority == PROMISE_PRIORITY_LOW ? PROMISE_PRIORITY_LOW : PROMISE_PRIORITY_HIGH;
     pthread_mutex_unlock(&p->lock);
 }
 
+void promise_set_dispatch(Promise* p, PromiseDispatch dispatch) {
+    if (!p) return;
+    __atomic_store_n(&p->dispatch, dispatch, __ATOMIC_RELAXED);
+}
 
 Promise* promise_then(Promise* p, on_fulfilled_callback on_fulfilled, on_rejected_callback on_rejected, void* user_data) {
     if (!p) return NULL;
 
-    // Create the new promise that will be returned by 'then'.
-    // This chained promise's persistence should ideally match the parent,
-    // or be explicitly managed. For simplicity, new chained promises are in-memory.
-    Promise* chained_promise = promise_create_internal(p->is_persistent, p->pmem_ctx, NULL); // or just promise_create()
+    // Create the new promise that will be returned by 'then'. Chained promises
+    // are in-memory even when the parent is persistent: callbacks cannot be
+    // persisted, so a restarted process re-attaches its own.
+    Promise* chained_promise = promise_create();
     if (!chained_promise) {
         // Failed to create chained promise, cannot proceed.
         return NULL;
@@ -522,75 +428,30 @@ Promise* promise_then(Promise* p, on_fulfilled_callback on_fulfilled, on_rejecte
     entry.on_fulfilled = on_fulfilled;
     entry.on_rejected = on_rejected;
     entry.user_data = user_data;
-    entry.chained_promise = chained_promise;
+    entry.chained_promise = promise_retain(chained_promise); // The entry's reference
 
     pthread_mutex_lock(&p->lock);
-
-    bool added = false;
-    if (p->state == PROMISE_PENDING) {
-        // If parent is pending, enqueue the callbacks.
-        // The choice of queue depends on whether we have fulfillment/rejection handlers.
-        // A single queue is often used, and the handler type is checked during execution.
-        // Here, we use separate queues as sketched.
-        // A 'then' call always effectively registers for both, even if one handler is NULL.
-        // The resolution logic will pick the right one.
-        // For simplicity, let's assume if on_fulfilled is provided, it goes to fulfillment_callbacks,
-        // and if on_rejected is provided, it goes to rejection_callbacks.
-        // A more robust approach might be a single callback queue where each entry
-        // stores both, and the execution logic picks the correct one.
-        // Or, always add to both and let the NULL check handle it.
-        // Let's refine: add to fulfillment_callbacks if on_fulfilled is not NULL,
-        // and to rejection_callbacks if on_rejected is not NULL.
-        // This is slightly different from JS where a single "reaction record" is typically made.
-        // For this C sketch, adding to respective queues is simpler.
-        
-        // A more common model: a single list of "reactions"
-        // For this sketch, we'll add to both if handlers exist.
-        // This means a chained promise could be affected by either path if both handlers are given.
-        // This is fine, as only one path (fulfill or reject) will be taken by the parent.
-        added = callback_queue_add(&p->fulfillment_callbacks, entry); // Add the same entry
-        if(added) { // only try to add to second queue if first one succeeded.
-             added = callback_queue_add(&p->rejection_callbacks, entry);
-        }
-
-
-    } else {
-        // If parent is already settled, schedule immediate execution of the relevant callback.
-        // This still needs to be asynchronous to maintain consistency.
-        // We directly prepare data for a single callback execution.
-        // This is a simplified path; typically, even for already settled promises,
-        // the callback execution is deferred to a microtask.
-        // For this sketch, we'll use the same schedule_callback_execution mechanism.
-        // The execute_callbacks function will then iterate through the (now non-empty) queues.
-        // This means we still add to the queue, and then schedule.
-        if (p->state == PROMISE_FULFILLED && on_fulfilled) {
-            added = callback_queue_add(&p->fulfillment_callbacks, entry);
-        } else if (p->state == PROMISE_REJECTED && on_rejected) {
-            added = callback_queue_add(&p->rejection_callbacks, entry);
-        } else if (p->state == PROMISE_FULFILLED && !on_fulfilled) {
-            // No fulfillment handler, but parent fulfilled. Propagate fulfillment to chained promise.
-            promise_resolve(chained_promise, p->value); // Directly resolve/reject
-            added = true; // conceptually
-        } else if (p->state == PROMISE_REJECTED && !on_rejected) {
-            // No rejection handler, but parent rejected. Propagate rejection to chained promise.
-            promise_reject(chained_promise, p->value); // Directly resolve/reject
-            added = true; // conceptually
-        }
-        
-        if (added && p->state != PROMISE_PENDING) {
-             // If already settled and callback was relevant (or propagation needed),
-             // ensure processing is scheduled.
-             schedule_callback_execution(p); // This will pick up the newly added callback for the settled promise
-        }
-    }
+    chained_promise->priority = p->priority;
+    chained_promise->dispatch = p->dispatch;
+
+    // One entry carries both handlers; execute_callbacks() picks the one matching
+    // the outcome, or passes the parent's value/reason through to the chained
+    // promise when that handler is NULL.
+    bool added = callback_list_add(&p->callbacks, entry);
+    // Already settled: callbacks still run from the dispatch task (on the event
+    // loop by default). If one is queued or running, it picks this entry up.
+    bool claimed = added && p->state != PROMISE_PENDING && claim_callback_execution(p);
     
     pthread_mutex_unlock(&p->lock);
+    if (claimed) {
+        dispatch_callback_execution(p);
+    }
 
-    if (!added && p->state == PROMISE_PENDING) {
-        // If adding callback failed (e.g., out of memory for queue resize)
-        // The chained_promise should probably be rejected.
+    if (!added) {
+        // If adding callback failed (e.g., out of memory for list resize),
+        // drop the entry's reference and reject the chained promise.
+        promise_free(chained_promise);
         promise_reject(chained_promise, (void*)"Failed to attach callback"); // Or a proper error value
-        // promise_free(chained_promise); // Or let it be freed by its eventual consumer.
         return chained_promise; // Or NULL if we decide 'then' itself failed.
     }
 
@@ -598,423 +459,2520 @@ Promise* promise_then(Promise* p, on_fulfilled_callback on_fulfilled, on_rejecte
     return chained_promise;
 }
 
-void promise_free(Promise* p) {
-    if (!p) return;
+// Registers handlers whose return value goes nowhere: the entry has no chained
+// promise, so nothing is allocated unless the callback list outgrows its
+// inline buffer. Handlers are dispatched like those of .then().
+// Returns false if the entry could not be added.
+bool promise_observe(Promise* p, on_fulfilled_callback on_fulfilled, on_rejected_callback on_rejected, void* user_data) {
+    PromiseCallbackEntry entry;
+    entry.on_fulfilled = on_fulfilled;
+    entry.on_rejected = on_rejected;
+    entry.user_data = user_data;
+    entry.chained_promise = NULL;
 
-    // Potential complexities:
-    // 1. Reference counting: Decrement ref_count. If 0, then proceed to free.
-    //    pthread_mutex_lock(&p->ref_count_lock);
-    //    p->ref_count--;
-    //    if (p->ref_count > 0) {
-    //        pthread_mutex_unlock(&p->ref_count_lock);
-    //        return;
-    //    }
-    //    pthread_mutex_unlock(&p->ref_count_lock);
-    //    pthread_mutex_destroy(&p->ref_count_lock);
-
-
-    // 2. Chained promises: Freeing a promise should not break unresolved chained promises.
-    //    The `value` (if it's a pointer to dynamically allocated memory) needs careful ownership rules.
-    //    Typically, the promise "owns" its resolved value/reason if it was heap-allocated for it.
-    //    If the user provided a pointer, they manage its lifetime unless documented otherwise.
-    //    For this sketch, we assume `value` is either not owned or its freeing is handled elsewhere/by type.
-
-    pthread_mutex_destroy(&p->lock);
-
-    // Free the callback queues.
-    // This frees the arrays of PromiseCallbackEntry, but not the chained_promise pointers themselves.
-    // Chained promises are independent entities and should be freed when they are no longer needed.
-    callback_queue_free(&p->fulfillment_callbacks);
-    callback_queue_free(&p->rejection_callbacks);
-
-    // If the promise value itself is dynamically allocated and owned by this promise, free it.
-    // This requires a convention, e.g., if p->value was malloc'd by promise_resolve/reject.
-    // if (p->state != PROMISE_PENDING && p->value_is_owned) { free(p->value); }
-
-
-    // For persistent promises, deallocation involves pmemobj_free or similar.
-    if (p->is_persistent && p->pmem_ctx) {
-        // TX_BEGIN(p->pmem_ctx) {
-        //     pmemobj_tx_free(pmemobj_oid(p)); // Free the promise struct itself from pmem
-        // } TX_ONABORT {
-        //     fprintf(stderr, "Transaction aborted while freeing persistent promise.\n");
-        // } TX_END
-        // For this simulation:
-        free(p);
-    } else {
-        free(p);
+    pthread_mutex_lock(&p->lock);
+    bool added = callback_list_add(&p->callbacks, entry);
+    bool claimed = added && p->state != PROMISE_PENDING && claim_callback_execution(p);
+    pthread_mutex_unlock(&p->lock);
+    if (claimed) {
+        dispatch_callback_execution(p);
     }
+    return added;
 }
 
+// Set by promise_adopt() while a callback runs; execute_callbacks() checks it
+// to tell a returned promise from a plain value (PromiseValue is untyped).
+static __thread Promise* callback_adopted = NULL;
 
-// --- Event Loop Simulation and Callback Execution ---
-// This is a very basic event loop for demonstration.
-// A real system would use libuv, libevent, or integrate into an existing application loop.
-
-typedef struct Microtask {
-    void (*task_func)(void* data);
-    void* task_data;
-    struct Microtask* next;
-} Microtask;
-
-static Microtask* microtask_queue_head = NULL;
-static Microtask* microtask_queue_tail = NULL;
-static pthread_mutex_t event_loop_lock = PTHREAD_MUTEX_INITIALIZER;
-// static pthread_cond_t event_loop_cond = PTHREAD_COND_INITIALIZER; // For a blocking run_event_loop
-
-void init_event_loop(void) {
-    // Already initialized statically or could do dynamic init here.
-    // Ensure queue is empty.
-    microtask_queue_head = NULL;
-    microtask_queue_tail = NULL;
+PromiseValue promise_adopt(Promise* p) {
+    callback_adopted = p;
+    return (PromiseValue)p;
 }
 
-void enqueue_microtask(void (*task)(void* data), void* task_data) {
-    Microtask* new_task = (Microtask*)malloc(sizeof(Microtask));
-    if (!new_task) {
-        perror("Failed to allocate microtask");
-        // This is a critical failure. In a robust system, might try to recover or log.
+// Promises/A+ resolution procedure for a callback that returned promise `x`:
+// `p` (which may be NULL) takes on x's eventual state. A settled `x` is copied
+// inline; a pending one gets a handler-less entry for `p`, so when `x` settles
+// its own dispatch passes the outcome straight through to `p`. Consumes the
+// caller's reference to `x`.
+static void promise_adopt_state(Promise* p, Promise* x) {
+    if (x == p) {
+        // 2.3.1: a promise cannot be resolved with itself.
+        promise_reject(p, (void*)"Promise cannot adopt itself");
+        promise_free(x);
         return;
     }
-    new_task->task_func = task;
-    new_task->task_data = task_data;
-    new_task->next = NULL;
 
-    pthread_mutex_lock(&event_loop_lock);
-    if (microtask_queue_tail) {
-        microtask_queue_tail->next = new_task;
-        microtask_queue_tail = new_task;
-    } else {
-        microtask_queue_head = new_task;
-        microtask_queue_tail = new_task;
+    pthread_mutex_lock(&x->lock);
+    PromiseState state = x->state;
+    PromiseValue value = x->value;
+    bool linked = true;
+    if (state == PROMISE_PENDING && p) {
+        PromiseCallbackEntry link = { NULL, NULL, NULL, promise_retain(p) };
+        linked = callback_list_add(&x->callbacks, link);
     }
-    // pthread_cond_signal(&event_loop_cond); // Signal if run_event_loop is waiting
-    pthread_mutex_unlock(&event_loop_lock);
+    pthread_mutex_unlock(&x->lock);
+
+    if (!linked) {
+        promise_free(p); // The link's reference
+        promise_reject(p, (void*)"Failed to adopt promise");
+    } else if (state == PROMISE_FULFILLED && p) {
+        promise_resolve(p, value);
+    } else if (state == PROMISE_REJECTED && p) {
+        promise_reject(p, value);
+    }
+    promise_free(x);
 }
 
-// This function is called when a promise settles to schedule the processing of its callbacks.
-static void schedule_callback_execution(Promise* p) {
-    // The 'data' for the microtask is the promise itself.
-    // The `execute_callbacks` function will then use this promise to find and run its callbacks.
-    // We might need to increment a ref count for 'p' if 'execute_callbacks' could outlive
-    // the current scope that holds 'p', though typically microtasks are short-lived.
-    // For now, assume 'p' remains valid.
-    enqueue_microtask(execute_callbacks, p);
+Promise* promise_retain(Promise* p) {
+    if (p) {
+        __atomic_add_fetch(&p->ref_count, 1, __ATOMIC_RELAXED);
+    }
+    return p;
 }
 
-// This is the function executed by the event loop for a settled promise.
-static void execute_callbacks(void* data) {
-    Promise* p = (Promise*)data;
-    if (!p) return;
-
-    pthread_mutex_lock(&p->lock);
+// Returns a promise whose last reference is gone to the pool. Entries still in
+// its callback list (it never settled) release their chained promises, which
+// may cascade down a long chain, so this walks a worklist instead of recursing.
+static void promise_destroy(Promise* p) {
+    p->pool_next = NULL;
+    while (p) {
+        Promise* next = p->pool_next;
 
-    PromiseCallbackQueue* queue_to_process = NULL;
-    if (p->state == PROMISE_FULFILLED) {
-        queue_to_process = &p->fulfillment_callbacks;
-    } else if (p->state == PROMISE_REJECTED) {
-        queue_to_process = &p->rejection_callbacks;
-    } else {
-        // Should not happen if scheduled correctly (only on settlement)
-        pthread_mutex_unlock(&p->lock);
-        return;
-    }
+        if (Q_TRACE_ON() && p->state == PROMISE_PENDING) {
+            q_trace_async_end("qpromise", "pending", p, "abandoned");
+        }
 
-    // Iterate over a copy of the callbacks or carefully manage the queue.
-    // Processing callbacks might add new callbacks to other promises,
-    // so the list should be stable during iteration.
-    // For simplicity, we iterate and clear. A more robust system might copy.
-    // This also means callbacks added *after* settlement but *before* this execution
-    // will be processed.
-    
-    // Create a temporary copy of the relevant callback entries to avoid issues
-    // if a callback itself tries to call .then() on the same promise (though unlikely/problematic).
-    size_t count = queue_to_process->count;
-    PromiseCallbackEntry* entries_to_run = NULL;
-    if (count > 0) {
-        entries_to_run = (PromiseCallbackEntry*)malloc(count * sizeof(PromiseCallbackEntry));
-        if (entries_to_run) {
-            memcpy(entries_to_run, queue_to_process->items, count * sizeof(PromiseCallbackEntry));
-            // Clear the original queue as these are now being processed.
-            // Or, if callbacks are one-shot, remove them after processing.
-            // For this model, once a promise is settled, its callback queues are processed once.
-            queue_to_process->count = 0; // Effectively clears it for future (though should not be reused for same settlement)
-        } else {
-            perror("Failed to allocate temporary callback array for execution");
-            // Critical: cannot execute callbacks. Chained promises will not settle.
-            // Potentially reject all chained promises from this queue.
-            for (size_t i = 0; i < queue_to_process->count; ++i) {
-                 if (queue_to_process->items[i].chained_promise) {
-                    promise_reject(queue_to_process->items[i].chained_promise, (void*)"Internal error during callback processing");
-                 }
+        PromiseCallbackEntry* entries = callback_list_items(&p->callbacks);
+        for (size_t i = 0; i < p->callbacks.count; ++i) {
+            Promise* chained = entries[i].chained_promise;
+            if (chained && __atomic_sub_fetch(&chained->ref_count, 1, __ATOMIC_ACQ_REL) == 0) {
+                chained->pool_next = next;
+                next = chained;
             }
-            queue_to_process->count = 0;
-            pthread_mutex_unlock(&p->lock);
-            return;
         }
-    }
-
+        callback_list_free(&p->callbacks);
 
-    pthread_mutex_unlock(&p->lock); // Unlock before calling user code (callbacks)
-
-    for (size_t i = 0; i < count; ++i) {
-        PromiseCallbackEntry* current_entry = &entries_to_run[i];
-        Promise* chained_promise = current_entry->chained_promise;
-        PromiseValue callback_result = NULL;
-        bool callback_executed = false;
-
-        if (p->state == PROMISE_FULFILLED && current_entry->on_fulfilled) {
-            // Try-catch equivalent is harder in C. If on_fulfilled crashes, the loop breaks.
-            // A robust system might use setjmp/longjmp or run callbacks in separate threads/processes (heavy).
-            callback_result = current_entry->on_fulfilled(p->value, current_entry->user_data);
-            callback_executed = true;
-        } else if (p->state == PROMISE_REJECTED && current_entry->on_rejected) {
-            callback_result = current_entry->on_rejected(p->value, current_entry->user_data);
-            callback_executed = true;
-        }
-
-        if (chained_promise) {
-            if (callback_executed) {
-                // If the callback returned another promise, the chained_promise should adopt its state.
-                // This is the "Promise Resolution Procedure".
-                // For simplicity here, we assume callback_result is a direct value or NULL.
-                // A full implementation would check if callback_result is a "thenable" (another promise).
-                // if (is_promise(callback_result)) {
-                //    promise_then(callback_result, resolve_chained_passthrough, reject_chained_passthrough, chained_promise);
-                // } else {
-                //    promise_resolve(chained_promise, callback_result);
-                // }
-                // Simplified: directly resolve the chained promise with the callback's result.
-                // If callback_result is intended to be a rejection, it needs a special marker or type.
-                // For now, assume on_fulfilled's result fulfills, on_rejected's result also fulfills (recovery).
-                // To propagate rejection from on_rejected, it would need to return a new rejected promise or a special error value.
-                promise_resolve(chained_promise, callback_result);
-            } else {
-                // No appropriate callback was executed (e.g., on_fulfilled was NULL for a fulfilled promise).
-                // Propagate the original promise's state and value.
-                if (p->state == PROMISE_FULFILLED) {
-                    promise_resolve(chained_promise, p->value);
-                } else { // PROMISE_REJECTED
-                    promise_reject(chained_promise, p->value);
-                }
-            }
+        if (p->is_persistent) {
+            promise_store_detach(p); // Named records stay in the store
         }
-        // If callback_result was dynamically allocated by the callback, its ownership needs to be clear.
-        // If chained_promise takes ownership (e.g. via promise_resolve), then it's fine.
-    }
-    if (entries_to_run) {
-        free(entries_to_run);
+        promise_pool_put(p);
+        p = next;
     }
-    // Note: The original promise 'p' is not freed here. Its lifetime is independent.
-    // Chained promises are now resolved/rejected and will be freed by their consumers or when they are no longer referenced.
 }
 
+void promise_free(Promise* p) {
+    if (!p) return;
 
-void run_event_loop(void) {
-    // Simple run-once model: process all tasks currently in the queue.
-    // A real event loop would often block and wait for new tasks if the queue is empty (using a condition variable).
-    while (true) {
-        Microtask* task_to_run = NULL;
-
-        pthread_mutex_lock(&event_loop_lock);
-        if (microtask_queue_head) {
-            task_to_run = microtask_queue_head;
-            microtask_queue_head = microtask_queue_head->next;
-            if (!microtask_queue_head) {
-                microtask_queue_tail = NULL; // Queue is now empty
-            }
-        }
-        pthread_mutex_unlock(&event_loop_lock);
-
-        if (task_to_run) {
-            task_to_run->task_func(task_to_run->task_data);
-            free(task_to_run);
-        } else {
-            // No more tasks in the queue.
-            break;
-        }
+    // Drops one reference; the last one reclaims the promise. Chained promises
+    // are unaffected while anyone else (a callback entry, a queued dispatch, a
+    // timer) still references them.
+    // The `value` is not owned by the promise: if it points to dynamically
+    // allocated memory, whoever resolved the promise decides when to free it.
+    if (__atomic_sub_fetch(&p->ref_count, 1, __ATOMIC_ACQ_REL) == 0) {
+        promise_destroy(p);
     }
 }
 
-void free_event_loop(void) {
-    // Free any remaining tasks in the queue.
-    Microtask* current = microtask_queue_head;
-    while (current) {
-        Microtask* next = current->next;
-        // Potentially, if task_data was allocated and owned by the event loop, free it.
-        // Here, task_data (the Promise*) is not owned by the event loop tasks.
-        free(current);
-        current = next;
-    }
-    microtask_queue_head = NULL;
-    microtask_queue_tail = NULL;
-    // pthread_mutex_destroy(&event_loop_lock); // If dynamically allocated
-    // pthread_cond_destroy(&event_loop_cond); // If dynamically allocated
-}
 
-// --- Q.defer() API Implementation ---
-PromiseDeferred* promise_defer_create_internal(bool is_persistent, void* pmem_ctx, pthread_mutex_t* lock) {
-    PromiseDeferred* deferred = (PromiseDeferred*)malloc(sizeof(PromiseDeferred));
-    if (!deferred) {
-        perror("Failed to allocate deferred object");
-        return NULL;
-    }
+// --- Persistent Promise Store ---
+// File layout: a PROMISE_STORE_HEADER_SIZE header, then `capacity` fixed-size
+// records. A record is a header word and two copies of its body; the word's
+// PROMISE_RECORD_COPY bit selects the current copy. Updates go through
+// promise_store_commit(): write the spare copy, flush it, then switch the word
+// and flush that. The word is 8-byte aligned, so the switch itself cannot tear.
+//
+// The store also maps each record to its live Promise, if one is loaded, so
+// promise_store_get_root() never hands out two promises for one record. Record
+// bodies are only written under the owning promise's lock, or under the store
+// lock while no promise is loaded; lock order is store, then promise.
 
-    // The promise associated with the deferred object.
-    // Its persistence should match the deferred request.
-    if (is_persistent) {
-        deferred->promise = promise_create_persistent(pmem_ctx, lock);
-    } else {
-        deferred->promise = promise_create();
-    }
+#define PROMISE_STORE_MAGIC "QPSTORE1"
+#define PROMISE_STORE_VERSION 1u
+#define PROMISE_STORE_HEADER_SIZE 4096
 
-    if (!deferred->promise) {
-        free(deferred);
-        return NULL;
-    }
-    // If 'deferred' itself needs to be persistent, its allocation would also use pmem.
-    return deferred;
-}
+#define PROMISE_RECORD_IN_USE 1u
+#define PROMISE_RECORD_COPY 2u
 
+typedef struct {
+    uint64_t value;  // PromiseValue bit pattern
+    uint32_t state;  // PromiseState
+    uint32_t data_length;
+    char name[PROMISE_STORE_NAME_MAX]; // Empty for promises outside the root directory
+    unsigned char data[PROMISE_STORE_DATA_MAX];
+} PromiseRecordBody;
 
-PromiseDeferred* promise_defer_create(void) {
-    return promise_defer_create_internal(false, NULL, NULL);
-}
+typedef struct {
+    uint64_t header; // PROMISE_RECORD_* bits
+    unsigned char padding[56];
+    PromiseRecordBody copies[2];
+} PromiseRecord;
 
-PromiseDeferred* promise_defer_create_persistent(void* pmem_ctx, pthread_mutex_t* lock) {
-     if (!pmem_ctx) return NULL;
-    return promise_defer_create_internal(true, pmem_ctx, lock);
-}
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t capacity;
+} PromiseStoreHeader;
+
+struct PromiseStore {
+    int fd;
+    unsigned char* base;
+    size_t size;
+    size_t capacity;
+    size_t page_size;
+    Promise** live;    // Loaded promise per record, or NULL
+    size_t next_free;  // Where the next free-record search starts
+    pthread_mutex_t lock;
+};
 
-void promise_defer_resolve(PromiseDeferred* deferred, PromiseValue value) {
-    if (!deferred || !deferred->promise) return;
-    promise_resolve(deferred->promise, value);
+static PromiseRecord* promise_store_record(PromiseStore* store, size_t slot) {
+    return (PromiseRecord*)(store->base + PROMISE_STORE_HEADER_SIZE) + slot;
 }
 
-void promise_defer_reject(PromiseDeferred* deferred, PromiseValue reason) {
-    if (!deferred || !deferred->promise) return;
-    promise_reject(deferred->promise, reason);
+static PromiseRecordBody* promise_record_current(PromiseRecord* record) {
+    return &record->copies[(record->header & PROMISE_RECORD_COPY) ? 1 : 0];
 }
 
-void promise_defer_free(PromiseDeferred* deferred) {
-    if (!deferred) return;
-    // The crucial question: does freeing the deferred object also free its promise?
-    // Typically, yes, unless the promise has been "detached" or returned elsewhere
-    // and its lifetime is now managed independently.
-    // For a simple defer, the promise is intrinsically linked.
-    // If promise_free handles ref counting or checks if it's part of a deferred,
-    // it might be okay. Otherwise, explicit free here.
-    if (deferred->promise) {
-        promise_free(deferred->promise); // This assumes deferred owns the promise.
-        deferred->promise = NULL;
+static void promise_store_flush(PromiseStore* store, const void* at, size_t length) {
+    size_t start = (size_t)((const unsigned char*)at - store->base);
+    size_t aligned = start & ~(store->page_size - 1);
+    if (msync(store->base + aligned, start + length - aligned, MS_SYNC) != 0) {
+        perror("Failed to flush promise store");
     }
-    free(deferred);
 }
 
+// Makes `body` the record's current version, crash-consistently.
+static void promise_store_commit(PromiseStore* store, PromiseRecord* record, const PromiseRecordBody* body) {
+    uint64_t spare = (record->header & PROMISE_RECORD_COPY) ? 0 : 1;
+    memcpy(&record->copies[spare], body, sizeof(PromiseRecordBody));
+    promise_store_flush(store, &record->copies[spare], sizeof(PromiseRecordBody));
 
-// --- Q.all() API Implementation (Sketch) ---
-typedef struct {
-    Promise* all_promise; // The aggregate promise returned by promise_all
-    PromiseValue* results_array; // Array to store results from individual promises
-    size_t total_promises;
-    size_t fulfilled_count;
-    size_t rejected_count; // Only one rejection is enough, but good to track
-    pthread_mutex_t lock; // To protect shared counts and results_array
-    bool is_persistent_context; // if results_array needs to be in pmem
-    void* pmem_ctx;
-} PromiseAllContext;
-
-// Callback for individual promises in promise_all
-static PromiseValue promise_all_on_fulfilled(PromiseValue value, void* user_data_packed) {
-    // user_data_packed contains { PromiseAllContext* context, size_t index }
-    // This requires a small struct to be passed as user_data or careful casting.
-    // For simplicity, let's assume user_data is PromiseAllContext* and index is implicitly managed
-    // or passed via a more complex structure.
-    // A simpler way: create a unique fulfillment handler for each promise in the 'all' array.
-    // Each handler knows its index.
-
-    // This is a placeholder. A full implementation would be more complex.
-    // It needs to:
-    // 1. Lock the PromiseAllContext.
-    // 2. Store 'value' in context->results_array[index].
-    // 3. Increment context->fulfilled_count.
-    // 4. If context->fulfilled_count == context->total_promises, resolve context->all_promise with results_array.
-    // 5. Unlock.
-    // 6. Return NULL (or value, though it's not directly used by a chained promise here).
-    PromiseAllContext* context = (PromiseAllContext*) user_data_packed; // Simplified
-    // int index = ... ; // This needs to be passed correctly.
-
-    // pthread_mutex_lock(&context->lock);
-    // context->results_array[index] = value; // Value ownership needs care
-    // context->fulfilled_count++;
-    // if (context->fulfilled_count == context->total_promises) {
-    //    promise_resolve(context->all_promise, context->results_array); // results_array becomes owned by all_promise
-    // }
-    // pthread_mutex_unlock(&context->lock);
-    return NULL;
+    __atomic_store_n(&record->header, PROMISE_RECORD_IN_USE | (spare ? PROMISE_RECORD_COPY : 0), __ATOMIC_RELEASE);
+    promise_store_flush(store, &record->header, sizeof(record->header));
 }
 
-static PromiseValue promise_all_on_rejected(PromiseValue reason, void* user_data) {
-    PromiseAllContext* context = (PromiseAllContext*)user_data;
-    // pthread_mutex_lock(&context->lock);
-    // if (context->all_promise->state == PROMISE_PENDING) { // Only reject once
-    //    promise_reject(context->all_promise, reason); // Reason ownership needs care
-    //    context->rejected_count++;
-    // }
-    // pthread_mutex_unlock(&context->lock);
-    // If reason was allocated, and all_promise now owns it, fine. Otherwise, potential leak/double free.
-    return NULL; // Indicates this handler doesn't try to recover for the 'all' promise.
+// Takes a reference only if the promise is not already on its way to destruction.
+static bool promise_try_retain(Promise* p) {
+    size_t count = __atomic_load_n(&p->ref_count, __ATOMIC_RELAXED);
+    while (count > 0) {
+        if (__atomic_compare_exchange_n(&p->ref_count, &count, count + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
 }
 
+// Allocates a pending record for the new promise `p`.
+static bool promise_store_attach(Promise* p, PromiseStore* store) {
+    if (!store) return false;
 
-Promise* promise_all(Promise* promises[], size_t count) {
-    if (count == 0) {
-        // If the array is empty, Q resolves with an empty array.
-        Promise* p = promise_create();
-        PromiseValue* empty_array = (PromiseValue*)malloc(0); // Or a static empty array marker
-        promise_resolve(p, empty_array);
-        return p;
+    pthread_mutex_lock(&store->lock);
+    size_t slot = store->capacity;
+    for (size_t i = 0; i < store->capacity; ++i) {
+        size_t candidate = (store->next_free + i) % store->capacity;
+        if (!(promise_store_record(store, candidate)->header & PROMISE_RECORD_IN_USE)) {
+            slot = candidate;
+            break;
+        }
     }
+    if (slot == store->capacity) {
+        pthread_mutex_unlock(&store->lock);
+        fprintf(stderr, "Promise store is full (%zu records)\n", store->capacity);
+        return false;
+    }
+
+    PromiseRecordBody body;
+    memset(&body, 0, sizeof(body));
+    body.state = PROMISE_PENDING;
+    promise_store_commit(store, promise_store_record(store, slot), &body);
 
-    // PromiseAllContext* context = (PromiseAllContext*)malloc(sizeof(PromiseAllContext));
-    // // ... initialize context ...
-    // context->all_promise = promise_create(); // Or persistent if source promises are
-    // context->results_array = (PromiseValue*)malloc(count * sizeof(PromiseValue));
-    // // ... error check mallocs ...
-    // pthread_mutex_init(&context->lock, NULL);
+    store->live[slot] = p;
+    store->next_free = (slot + 1) % store->capacity;
+    pthread_mutex_unlock(&store->lock);
 
-    // for (size_t i = 0; i < count; ++i) {
-    //    // Create unique user_data for each if index is needed, or pass context and index.
-    //    // For simplicity, assume promise_all_on_fulfilled can get its index or context is enough.
-    //    promise_then(promises[i], promise_all_on_fulfilled, promise_all_on_rejected, context);
-    // }
-    // return context->all_promise;
-    // TODO: Full implementation is non-trivial due to concurrent updates and managing the results array.
-    // Memory management for results_array and individual results also needs care.
-    // If any promise in the input `promises` array is persistent, the `all_promise` and its
-    // `results_array` might also need to be persistent.
-    fprintf(stderr, "promise_all is not fully implemented in this sketch.\n");
-    return promise_create(); // Return a pending promise as a placeholder
+    p->is_persistent = true;
+    p->pmem_ctx = store;
+    p->pmem_slot = slot;
+    return true;
 }
 
+// Called from promise_settle_claim_locked() with p->lock held.
+static void promise_store_persist_locked(Promise* p) {
+    PromiseStore* store = (PromiseStore*)p->pmem_ctx;
+    PromiseRecord* record = promise_store_record(store, p->pmem_slot);
+    PromiseRecordBody body = *promise_record_current(record);
+    body.state = p->state;
+    body.value = (uint64_t)(uintptr_t)p->value;
+    promise_store_commit(store, record, &body);
+}
 
-// --- Q.nfcall() API Implementation (Sketch) ---
-typedef struct {
-    PromiseDeferred* deferred;
-    // Any other context needed by the NodeCallback wrapper
-} NFCALL_Context;
+// The promise is being destroyed: unload it, and reclaim its record unless it
+// is named. Reclaiming needs no flush; unnamed records are dropped on open anyway.
+static void promise_store_detach(Promise* p) {
+    PromiseStore* store = (PromiseStore*)p->pmem_ctx;
+    PromiseRecord* record = promise_store_record(store, p->pmem_slot);
+
+    pthread_mutex_lock(&store->lock);
+    if (store->live[p->pmem_slot] == p) {
+        store->live[p->pmem_slot] = NULL;
+        if (promise_record_current(record)->name[0] == '\0') {
+            __atomic_store_n(&record->header, 0, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
 
-// This is the actual callback that will be passed to the Node.js-style function
-static void nfcall_trampoline_callback(void* err, PromiseValue result, void* user_data) {
-    NFCALL_Context* context = (NFCALL_Context*)user_data;
-    if (!context || !context->deferred) return;
+    p->is_persistent = false;
+    p->pmem_ctx = NULL;
+}
 
-    if (err) {
-        promise_defer_reject(context->deferred, err); // 'err' becomes the rejection reason
-    } else {
-        promise_defer_resolve(context->deferred, result); // 'result' becomes the fulfillment value
+// Returns the record named `name`, or store->capacity. Store lock held.
+static size_t promise_store_find(PromiseStore* store, const char* name) {
+    for (size_t i = 0; i < store->capacity; ++i) {
+        PromiseRecord* record = promise_store_record(store, i);
+        if ((record->header & PROMISE_RECORD_IN_USE) &&
+            strncmp(promise_record_current(record)->name, name, PROMISE_STORE_NAME_MAX) == 0) {
+            return i;
+        }
     }
-    // The NFCALL_Context might need to be freed here if it was allocated per call.
+    return store->capacity;
+}
+
+PromiseStore* promise_store_open(const char* path, size_t capacity) {
+    if (!path) return NULL;
+
+    PromiseStore* store = (PromiseStore*)calloc(1, sizeof(PromiseStore));
+    if (!store) {
+        perror("Failed to allocate promise store");
+        return NULL;
+    }
+    store->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    store->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    if (store->fd < 0 || fstat(store->fd, &st) != 0) {
+        perror("Failed to open promise store");
+        if (store->fd >= 0) close(store->fd);
+        free(store);
+        return NULL;
+    }
+
+    PromiseStoreHeader header;
+    bool created = st.st_size == 0;
+    if (created) {
+        if (capacity == 0) capacity = 1;
+        memcpy(header.magic, PROMISE_STORE_MAGIC, sizeof(header.magic));
+        header.version = PROMISE_STORE_VERSION;
+        header.record_size = (uint32_t)sizeof(PromiseRecord);
+        header.capacity = capacity;
+        store->size = PROMISE_STORE_HEADER_SIZE + capacity * sizeof(PromiseRecord);
+        // Zeroed records are free. The size is metadata, so sync it before use.
+        if (ftruncate(store->fd, (off_t)store->size) != 0 ||
+            pwrite(store->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+            fsync(store->fd) != 0) {
+            perror("Failed to initialise promise store");
+            close(store->fd);
+            free(store);
+            return NULL;
+        }
+    } else if ((size_t)st.st_size < PROMISE_STORE_HEADER_SIZE ||
+               pread(store->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+               memcmp(header.magic, PROMISE_STORE_MAGIC, sizeof(header.magic)) != 0 ||
+               header.version != PROMISE_STORE_VERSION ||
+               header.record_size != sizeof(PromiseRecord) ||
+               header.capacity == 0 ||
+               (size_t)st.st_size < PROMISE_STORE_HEADER_SIZE + header.capacity * sizeof(PromiseRecord)) {
+        fprintf(stderr, "%s is not a promise store\n", path);
+        close(store->fd);
+        free(store);
+        return NULL;
+    } else {
+        store->size = PROMISE_STORE_HEADER_SIZE + header.capacity * sizeof(PromiseRecord);
+    }
+    store->capacity = (size_t)header.capacity;
+
+    void* map = mmap(NULL, store->size, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+    store->live = (Promise**)calloc(store->capacity, sizeof(Promise*));
+    if (map == MAP_FAILED || !store->live) {
+        perror("Failed to map promise store");
+        if (map != MAP_FAILED) munmap(map, store->size);
+        free(store->live);
+        close(store->fd);
+        free(store);
+        return NULL;
+    }
+    store->base = (unsigned char*)map;
+    pthread_mutex_init(&store->lock, NULL);
+
+    // Unnamed records belonged to promises of a previous process; nothing can
+    // refer to them any more.
+    for (size_t i = 0; !created && i < store->capacity; ++i) {
+        PromiseRecord* record = promise_store_record(store, i);
+        if ((record->header & PROMISE_RECORD_IN_USE) && promise_record_current(record)->name[0] == '\0') {
+            record->header = 0;
+        }
+    }
+    return store;
+}
+
+void promise_store_close(PromiseStore* store) {
+    if (!store) return;
+    promise_store_flush(store, store->base, store->size);
+    munmap(store->base, store->size);
+    close(store->fd);
+    free(store->live);
+    pthread_mutex_destroy(&store->lock);
+    free(store);
+}
+
+bool promise_store_set_root(PromiseStore* store, const char* name, Promise* p) {
+    if (!store || !name || !*name || !p || strlen(name) >= PROMISE_STORE_NAME_MAX) return false;
+
+    pthread_mutex_lock(&store->lock);
+    bool ok = p->pmem_ctx == store && store->live[p->pmem_slot] == p;
+    if (ok) {
+        size_t existing = promise_store_find(store, name);
+        ok = existing == store->capacity || existing == p->pmem_slot;
+    }
+    if (ok) {
+        PromiseRecord* record = promise_store_record(store, p->pmem_slot);
+        pthread_mutex_lock(&p->lock);
+        PromiseRecordBody body = *promise_record_current(record);
+        memset(body.name, 0, sizeof(body.name));
+        strcpy(body.name, name);
+        promise_store_commit(store, record, &body);
+        pthread_mutex_unlock(&p->lock);
+    }
+    pthread_mutex_unlock(&store->lock);
+    return ok;
+}
+
+Promise* promise_store_get_root(PromiseStore* store, const char* name) {
+    if (!store || !name || !*name) return NULL;
+
+    pthread_mutex_lock(&store->lock);
+    size_t slot = promise_store_find(store, name);
+    if (slot == store->capacity) {
+        pthread_mutex_unlock(&store->lock);
+        return NULL;
+    }
+    Promise* p = store->live[slot];
+    if (p && promise_try_retain(p)) {
+        pthread_mutex_unlock(&store->lock);
+        return p;
+    }
+
+    // Load it: a fresh in-memory promise bound to the record, in its persisted state.
+    p = promise_create();
+    if (p) {
+        PromiseRecordBody* body = promise_record_current(promise_store_record(store, slot));
+        p->is_persistent = true;
+        p->pmem_ctx = store;
+        p->pmem_slot = slot;
+        p->state = (PromiseState)body->state;
+        p->value = (PromiseValue)(uintptr_t)body->value;
+        store->live[slot] = p;
+        if (Q_TRACE_ON() && p->state != PROMISE_PENDING) {
+            q_trace_async_end("qpromise", "pending", p, p->state == PROMISE_FULFILLED ? "fulfilled" : "rejected");
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+    return p;
+}
+
+bool promise_store_remove_root(PromiseStore* store, const char* name) {
+    if (!store || !name || !*name) return false;
+
+    pthread_mutex_lock(&store->lock);
+    size_t slot = promise_store_find(store, name);
+    if (slot == store->capacity) {
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+    PromiseRecord* record = promise_store_record(store, slot);
+    Promise* p = store->live[slot];
+    if (p) {
+        // Loaded: keep the record until the promise goes, just unnamed.
+        pthread_mutex_lock(&p->lock);
+        PromiseRecordBody body = *promise_record_current(record);
+        memset(body.name, 0, sizeof(body.name));
+        promise_store_commit(store, record, &body);
+        pthread_mutex_unlock(&p->lock);
+    } else {
+        __atomic_store_n(&record->header, 0, __ATOMIC_RELEASE);
+        promise_store_flush(store, &record->header, sizeof(record->header));
+    }
+    pthread_mutex_unlock(&store->lock);
+    return true;
+}
+
+size_t promise_store_resume(PromiseStore* store, promise_store_visitor visitor, void* context) {
+    if (!store || !visitor) return 0;
+
+    size_t visited = 0;
+    for (size_t i = 0; i < store->capacity; ++i) {
+        char name[PROMISE_STORE_NAME_MAX];
+        pthread_mutex_lock(&store->lock);
+        PromiseRecord* record = promise_store_record(store, i);
+        PromiseRecordBody* body = promise_record_current(record);
+        bool pending = (record->header & PROMISE_RECORD_IN_USE) && body->name[0] != '\0' &&
+                       body->state == PROMISE_PENDING;
+        if (pending) memcpy(name, body->name, sizeof(name));
+        pthread_mutex_unlock(&store->lock);
+        if (!pending) continue;
+
+        Promise* p = promise_store_get_root(store, name);
+        if (!p) continue;
+        pthread_mutex_lock(&p->lock);
+        pending = p->state == PROMISE_PENDING;
+        pthread_mutex_unlock(&p->lock);
+        if (pending) {
+            visitor(name, p, context);
+            visited++;
+        }
+        promise_free(p);
+    }
+    return visited;
+}
+
+bool promise_persistent_set_data(Promise* p, const void* data, size_t length) {
+    if (!p || length > PROMISE_STORE_DATA_MAX || (!data && length > 0)) return false;
+
+    pthread_mutex_lock(&p->lock);
+    bool ok = p->is_persistent;
+    if (ok) {
+        PromiseStore* store = (PromiseStore*)p->pmem_ctx;
+        PromiseRecord* record = promise_store_record(store, p->pmem_slot);
+        PromiseRecordBody body = *promise_record_current(record);
+        memset(body.data, 0, sizeof(body.data));
+        if (length > 0) memcpy(body.data, data, length);
+        body.data_length = (uint32_t)length;
+        promise_store_commit(store, record, &body);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return ok;
+}
+
+size_t promise_persistent_get_data(Promise* p, void* buffer, size_t capacity) {
+    if (!p) return 0;
+
+    size_t length = 0;
+    pthread_mutex_lock(&p->lock);
+    if (p->is_persistent) {
+        PromiseStore* store = (PromiseStore*)p->pmem_ctx;
+        PromiseRecordBody* body = promise_record_current(promise_store_record(store, p->pmem_slot));
+        length = body->data_length;
+        if (buffer) memcpy(buffer, body->data, length < capacity ? length : capacity);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return length;
+}
+
+
+// --- Event Loop Simulation and Callback Execution ---
+// This is a very basic event loop for demonstration.
+// A real system would use libuv, libevent, or integrate into an existing application loop.
+
+// Microtask queue: a bounded multi-producer / single-consumer ring (after
+// Vyukov's bounded queue). Producers on any thread claim a slot with one
+// CAS on `tail` and publish it with a release store of the slot's sequence;
+// no allocation and no lock. When the ring is full, tasks spill into a
+// mutex-protected overflow list. While that list is non-empty every new
+// task goes there too, and the consumer only drains it once the ring is
+// empty, so each producer's tasks still run in the order it queued them.
+// run_event_loop() is the single consumer and drains the ring in batches.
+//
+// There is one ring per priority lane. The loop drains the high lane in
+// batches and runs low-lane tasks one at a time, only when the high lane is
+// empty, re-checking timers and I/O after each, so a long CPU task delays an
+// I/O completion by at most one task. Starvation protection: after
+// MICROTASK_HIGH_STREAK consecutive high batches with low work waiting, one
+// low task runs anyway.
+
+#define MICROTASK_RING_CAPACITY 4096 // Power of two
+#define MICROTASK_RING_MASK (MICROTASK_RING_CAPACITY - 1)
+#define MICROTASK_BATCH 64
+#define MICROTASK_CACHE_LINE 64
+#define MICROTASK_HIGH_STREAK 16 // High batches between forced low-lane tasks
+
+typedef struct Microtask {
+    void (*task_func)(void* data);
+    void* task_data;
+    struct Microtask* next; // Overflow list only
+} Microtask;
+
+// A slot's sequence is stored relative to its index so the zero-initialised
+// ring is ready to use: slot i is free for position p when seq == p, and
+// holds the task for position p when seq == p + 1.
+typedef struct {
+    size_t turn;
+    void (*task_func)(void* data);
+    void* task_data;
+} MicrotaskSlot;
+
+typedef struct {
+    MicrotaskSlot slots[MICROTASK_RING_CAPACITY];
+    size_t tail __attribute__((aligned(MICROTASK_CACHE_LINE))); // Next position to claim (producers)
+    size_t head __attribute__((aligned(MICROTASK_CACHE_LINE))); // Next position to run (consumer only)
+    size_t overflow_count __attribute__((aligned(MICROTASK_CACHE_LINE)));
+    Microtask* overflow_head;
+    Microtask* overflow_tail;
+    // Consumer only: an overflow list taken for one-at-a-time running. It is
+    // older than anything in the ring, so it runs first.
+    Microtask* backlog;
+} MicrotaskLane;
+
+static MicrotaskLane microtask_lanes[PROMISE_PRIORITY_LANES];
+static pthread_mutex_t event_loop_lock = PTHREAD_MUTEX_INITIALIZER; // Guards the overflow lists
+
+// Blocking loop state. `sleeping` is set by the consumer before its final
+// emptiness check and read by producers after they publish, both behind a
+// full fence, so either the consumer sees the new task or the producer sees
+// `sleeping` and writes the eventfd. An idle loop costs no CPU, and a busy
+// one no syscalls.
+static struct {
+    int epoll_fd;
+    int wake_fd;
+    int sleeping;
+    int stop;
+} event_loop_wait = { -1, -1, 0, 0 };
+
+static pthread_mutex_t event_loop_wait_lock = PTHREAD_MUTEX_INITIALIZER; // Guards set-up
+
+// epoll_event.data of the loop's own descriptors; any other value is a
+// watched fd (see promise_from_fd()).
+#define EVENT_LOOP_TAG_WAKE UINT64_MAX
+#define EVENT_LOOP_TAG_RING (UINT64_MAX - 1)
+#define EVENT_LOOP_IO_BATCH 64
+
+// True on a thread inside run_event_loop(); its io_uring submissions are
+// batched and entered when the loop next polls for I/O.
+static __thread bool event_loop_thread = false;
+
+static bool event_loop_wait_init(void);
+static void event_loop_poll_io(void);
+static void event_loop_dispatch_io(const struct epoll_event* events, int count);
+static void event_loop_io_teardown(void);
+
+static void event_loop_wake(void) {
+    if (__atomic_exchange_n(&event_loop_wait.sleeping, 0, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        if (write(event_loop_wait.wake_fd, &one, sizeof(one)) < 0) {
+            perror("Failed to wake the event loop");
+        }
+    }
+}
+
+static size_t microtask_slot_sequence(const MicrotaskSlot* slot, size_t index) {
+    return __atomic_load_n(&slot->turn, __ATOMIC_ACQUIRE) + index;
+}
+
+static void microtask_slot_publish(MicrotaskSlot* slot, size_t index, size_t sequence) {
+    __atomic_store_n(&slot->turn, sequence - index, __ATOMIC_RELEASE);
+}
+
+// Returns false when the ring is full.
+static bool microtask_ring_push(MicrotaskLane* lane, void (*task)(void* data), void* task_data) {
+    size_t position = __atomic_load_n(&lane->tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        size_t index = position & MICROTASK_RING_MASK;
+        MicrotaskSlot* slot = &lane->slots[index];
+        size_t sequence = microtask_slot_sequence(slot, index);
+
+        if (sequence == position) {
+            // Free for this lap; claim it (on failure `position` is reloaded)
+            if (__atomic_compare_exchange_n(&lane->tail, &position, position + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->task_func = task;
+                slot->task_data = task_data;
+                microtask_slot_publish(slot, index, position + 1);
+                return true;
+            }
+        } else if (sequence < position) {
+            // Still holds last lap's task: the ring is full
+            return false;
+        } else {
+            // Another producer claimed it first
+            position = __atomic_load_n(&lane->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Consumer side: moves up to `max` published tasks into `batch`.
+static size_t microtask_ring_pop_batch(MicrotaskLane* lane, Microtask* batch, size_t max) {
+    size_t position = lane->head;
+    size_t count = 0;
+
+    while (count < max) {
+        size_t index = position & MICROTASK_RING_MASK;
+        MicrotaskSlot* slot = &lane->slots[index];
+        if (microtask_slot_sequence(slot, index) != position + 1) {
+            break; // Empty, or the producer has not published yet
+        }
+
+        batch[count].task_func = slot->task_func;
+        batch[count].task_data = slot->task_data;
+        count++;
+
+        // Hand the slot back to producers for the next lap
+        microtask_slot_publish(slot, index, position + MICROTASK_RING_CAPACITY);
+        position++;
+    }
+
+    lane->head = position;
+    return count;
+}
+
+static void microtask_overflow_push(MicrotaskLane* lane, void (*task)(void* data), void* task_data) {
+    Microtask* new_task = (Microtask*)malloc(sizeof(Microtask));
+    if (!new_task) {
+        perror("Failed to allocate microtask");
+        // This is a critical failure. In a robust system, might try to recover or log.
+        return;
+    }
+    new_task->task_func = task;
+    new_task->task_data = task_data;
+    new_task->next = NULL;
+
+    pthread_mutex_lock(&event_loop_lock);
+    if (lane->overflow_tail) {
+        lane->overflow_tail->next = new_task;
+    } else {
+        lane->overflow_head = new_task;
+    }
+    lane->overflow_tail = new_task;
+    __atomic_store_n(&lane->overflow_count, lane->overflow_count + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&event_loop_lock);
+}
+
+// Detaches the whole overflow list; producers return to the ring afterwards.
+static Microtask* microtask_overflow_take(MicrotaskLane* lane) {
+    if (__atomic_load_n(&lane->overflow_count, __ATOMIC_ACQUIRE) == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&event_loop_lock);
+    Microtask* list = lane->overflow_head;
+    lane->overflow_head = NULL;
+    lane->overflow_tail = NULL;
+    __atomic_store_n(&lane->overflow_count, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&event_loop_lock);
+    return list;
+}
+
+// Consumer side: takes the lane's next task (backlog, then ring, then the
+// overflow list, which becomes the backlog). Returns false if it has none.
+static bool microtask_lane_pop_one(MicrotaskLane* lane, Microtask* item) {
+    if (!lane->backlog) {
+        if (microtask_ring_pop_batch(lane, item, 1) == 1) {
+            return true;
+        }
+        lane->backlog = microtask_overflow_take(lane);
+        if (!lane->backlog) {
+            return false;
+        }
+    }
+    Microtask* task = lane->backlog;
+    lane->backlog = task->next;
+    *item = *task;
+    free(task);
+    return true;
+}
+
+// Consumer side: true if the lane has a task ready.
+static bool microtask_lane_ready(const MicrotaskLane* lane) {
+    size_t position = lane->head;
+    size_t index = position & MICROTASK_RING_MASK;
+    return lane->backlog || microtask_slot_sequence(&lane->slots[index], index) == position + 1 ||
+           __atomic_load_n(&lane->overflow_count, __ATOMIC_ACQUIRE) != 0;
+}
+
+void init_event_loop(void) {
+    // The ring is usable zero-initialised; start from an empty queue.
+    free_event_loop();
+}
+
+// --- Work-stealing workers (run_event_loop_parallel) ---
+// Each worker owns a bounded Chase-Lev deque (Le et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models"): the owner pushes and pops at `bottom`
+// without contention, thieves take from `top` with a CAS. Items are stored
+// through atomics so a thief reading a slot never races the owner's write.
+
+#define EVENT_LOOP_MAX_WORKERS 64
+#define WORK_DEQUE_CAPACITY 8192 // Power of two
+
+typedef struct {
+    long top __attribute__((aligned(MICROTASK_CACHE_LINE)));    // Thieves
+    long bottom __attribute__((aligned(MICROTASK_CACHE_LINE))); // Owner
+    void (*task_funcs[WORK_DEQUE_CAPACITY])(void* data);
+    void* task_datas[WORK_DEQUE_CAPACITY];
+} WorkDeque;
+
+typedef struct {
+    WorkDeque deque;
+    size_t index;
+    unsigned int steal_seed;
+} EventLoopWorker;
+
+static struct {
+    EventLoopWorker* workers;
+    size_t count;
+    size_t idle;  // Workers that found no work anywhere
+    bool done;
+} event_loop_pool;
+
+static __thread EventLoopWorker* event_loop_worker = NULL;
+
+static bool work_deque_push(WorkDeque* deque, void (*task)(void* data), void* task_data) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= WORK_DEQUE_CAPACITY) {
+        return false;
+    }
+
+    size_t index = (size_t)bottom & (WORK_DEQUE_CAPACITY - 1);
+    __atomic_store_n(&deque->task_funcs[index], task, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->task_datas[index], task_data, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static bool work_deque_pop(WorkDeque* deque, Microtask* item) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (top > bottom) {
+        // Empty
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    size_t index = (size_t)bottom & (WORK_DEQUE_CAPACITY - 1);
+    item->task_func = __atomic_load_n(&deque->task_funcs[index], __ATOMIC_RELAXED);
+    item->task_data = __atomic_load_n(&deque->task_datas[index], __ATOMIC_RELAXED);
+    if (top == bottom) {
+        // Last item: race the thieves for it
+        bool won = __atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                               __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return won;
+    }
+    return true;
+}
+
+static bool work_deque_steal(WorkDeque* deque, Microtask* item) {
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) {
+        return false;
+    }
+
+    size_t index = (size_t)top & (WORK_DEQUE_CAPACITY - 1);
+    item->task_func = __atomic_load_n(&deque->task_funcs[index], __ATOMIC_RELAXED);
+    item->task_data = __atomic_load_n(&deque->task_datas[index], __ATOMIC_RELAXED);
+    return __atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+void enqueue_microtask(void (*task)(void* data), void* task_data) {
+    enqueue_microtask_priority(task, task_data, PROMISE_PRIORITY_HIGH);
+}
+
+void enqueue_microtask_priority(void (*task)(void* data), void* task_data, PromisePriority priority) {
+    // Tasks queued by a parallel-loop worker stay on its own deque
+    EventLoopWorker* worker = event_loop_worker;
+    if (worker && work_deque_push(&worker->deque, task, task_data)) {
+        return;
+    }
+    MicrotaskLane* lane = &microtask_lanes[priority == PROMISE_PRIORITY_LOW ? PROMISE_PRIORITY_LOW : PROMISE_PRIORITY_HIGH];
+    if (__atomic_load_n(&lane->overflow_count, __ATOMIC_ACQUIRE) != 0 ||
+        !microtask_ring_push(lane, task, task_data)) {
+        microtask_overflow_push(lane, task, task_data);
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&event_loop_wait.sleeping, __ATOMIC_RELAXED)) {
+        event_loop_wake();
+    }
+}
+
+// Marks p's callbacks as scheduled and takes a reference for the dispatch
+// task. Returns false if a task is already queued (or running): it picks up
+// callbacks added since, and a second task could run them concurrently and
+// out of order. Must be called with p->lock held.
+static bool claim_callback_execution(Promise* p) {
+    if (p->callbacks_scheduled) {
+        return false;
+    }
+    p->callbacks_scheduled = true;
+    promise_retain(p);
+    return true;
+}
+
+// Runs the dispatch task claimed by claim_callback_execution() wherever p's
+// callbacks are set to run. Must be called WITHOUT p->lock held: an inline
+// dispatch runs the callbacks right here, and they may use p.
+// The 'data' for the task is the promise itself; the task holds the reference
+// taken by the claim, so the caller may free 'p' right after settling it.
+static void dispatch_callback_execution(Promise* p) {
+    switch (__atomic_load_n(&p->dispatch, __ATOMIC_RELAXED)) {
+    case PROMISE_DISPATCH_INLINE:
+        execute_callbacks(p);
+        break;
+    case PROMISE_DISPATCH_RUNTIME:
+        // At most one task per promise exists at a time, so the job record
+        // lives in the promise and a dispatch does not allocate.
+        p->dispatch_job.function = execute_callbacks;
+        p->dispatch_job.arg = p;
+        if (!q_runtime_submit(&p->dispatch_job)) {
+            execute_callbacks(p); // No worker available: run here
+        }
+        break;
+    default:
+        enqueue_microtask_priority(execute_callbacks, p, p->priority);
+        break;
+    }
+}
+
+// This is the dispatch task for a settled promise (see dispatch_callback_execution()).
+// It keeps running batches until the list is empty, so callbacks attached
+// while it runs are executed by this same task, in registration order.
+// Each batch is stolen from the promise under its lock, so dispatch does not
+// allocate (unless the promise had more than PROMISE_CALLBACK_INLINE callbacks,
+// whose heap array is simply handed over and freed here).
+static void execute_callbacks(void* data) {
+    Promise* p = (Promise*)data;
+    if (!p) return;
+
+    pthread_mutex_lock(&p->lock);
+
+    while (true) {
+        if (p->callbacks.count == 0 || p->state == PROMISE_PENDING) {
+            // Nothing left (or, defensively, not settled): let the next .then() reschedule.
+            p->callbacks_scheduled = false;
+            pthread_mutex_unlock(&p->lock);
+            promise_free(p); // The task's reference
+            return;
+        }
+
+        // Take the pending entries so callbacks can run without the lock
+        // (a callback may call .then() on this same promise).
+        PromiseCallbackList batch;
+        callback_list_steal(&p->callbacks, &batch);
+        PromiseState state = p->state; // Immutable once settled
+        PromiseValue value = p->value;
+
+        pthread_mutex_unlock(&p->lock); // Unlock before calling user code (callbacks)
+
+        PromiseCallbackEntry* entries = callback_list_items(&batch);
+        for (size_t i = 0; i < batch.count; ++i) {
+            PromiseCallbackEntry* current_entry = &entries[i];
+            Promise* chained_promise = current_entry->chained_promise;
+            PromiseValue callback_result = NULL;
+            bool callback_executed = false;
+
+            uint64_t trace_start = q_trace_span_start(); // 0 unless tracing is on
+            callback_adopted = NULL;
+            if (state == PROMISE_FULFILLED && current_entry->on_fulfilled) {
+                // Try-catch equivalent is harder in C. If on_fulfilled crashes, the loop breaks.
+                // A robust system might use setjmp/longjmp or run callbacks in separate threads/processes (heavy).
+                callback_result = current_entry->on_fulfilled(value, current_entry->user_data);
+                callback_executed = true;
+            } else if (state == PROMISE_REJECTED && current_entry->on_rejected) {
+                callback_result = current_entry->on_rejected(value, current_entry->user_data);
+                callback_executed = true;
+            }
+            Promise* adopted = callback_executed && callback_adopted == (Promise*)callback_result ? callback_adopted : NULL;
+            callback_adopted = NULL;
+            if (trace_start && callback_executed) {
+                q_trace_complete("qpromise", state == PROMISE_FULFILLED ? "on_fulfilled" : "on_rejected", trace_start, p);
+            }
+
+            if (adopted) {
+                // The callback returned promise_adopt(x): the chained promise adopts x's state
+                // ("Promise Resolution Procedure"), inline if x has settled. This is also how
+                // on_rejected propagates a rejection: return an already-rejected promise.
+                promise_adopt_state(chained_promise, adopted);
+                promise_free(chained_promise); // The entry's reference (NULL-safe)
+            } else if (chained_promise) {
+                if (callback_executed) {
+                    // A plain value fulfils the chained promise, from either handler (recovery).
+                    promise_resolve(chained_promise, callback_result);
+                } else {
+                    // No appropriate callback was executed (e.g., on_fulfilled was NULL for a fulfilled promise).
+                    // Propagate the original promise's state and value.
+                    if (state == PROMISE_FULFILLED) {
+                        promise_resolve(chained_promise, value);
+                    } else { // PROMISE_REJECTED
+                        promise_reject(chained_promise, value);
+                    }
+                }
+                promise_free(chained_promise); // The entry's reference
+            }
+            // If callback_result was dynamically allocated by the callback, its ownership needs to be clear.
+            // If chained_promise takes ownership (e.g. via promise_resolve), then it's fine.
+        }
+        callback_list_free(&batch);
+        // Note: 'p' stays referenced by this task until it returns. Chained promises are now
+        // settled; they are reclaimed once their consumers have released them too.
+
+        pthread_mutex_lock(&p->lock);
+    }
+}
+
+// Runs the dispatch tasks of one promise_resolve_batch(), in input order.
+static void execute_callback_batch(void* data) {
+    CallbackBatch* batch = (CallbackBatch*)data;
+    for (size_t i = 0; i < batch->count; ++i) {
+        if (event_loop_worker) {
+            // On a parallel-loop worker: fan out onto its deque so the others can steal.
+            enqueue_microtask_priority(execute_callbacks, batch->promises[i], batch->priority);
+        } else {
+            execute_callbacks(batch->promises[i]);
+        }
+    }
+    free(batch);
+}
+
+// --- Timer wheel ---
+// Four levels of 64 slots at 1 ms per tick (after Varghese & Lauck's hashed
+// hierarchical wheels, as in the classic Linux timer base): level 0 holds
+// timers due within 64 ticks, level n those due within 64^(n+1). A timer is
+// hashed into one slot's doubly linked list, so add and cancel are O(1).
+// Each time level n wraps, the matching slot of level n+1 is cascaded down.
+// Timers further out than the wheel spans wait in the last level and are
+// re-hashed on each cascade until they come into range.
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_MAX_TICKS ((1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+struct EventLoopTimer {
+    uint64_t expires;               // Absolute tick
+    event_loop_timer_callback callback;
+    void* data;
+    EventLoopTimer* prev;
+    EventLoopTimer* next;
+    EventLoopTimer** slot;          // List head it is linked into; NULL once fired
+};
+
+static struct {
+    EventLoopTimer* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t next_tick;             // First tick not yet processed
+    uint64_t epoch_ns;              // CLOCK_MONOTONIC at tick 0
+    size_t count;                   // Armed timers
+    pthread_mutex_t lock;
+} timer_wheel = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t timer_wheel_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Nanoseconds since tick 0. Must be called with timer_wheel.lock held.
+static uint64_t timer_wheel_elapsed_ns(void) {
+    uint64_t now = timer_wheel_clock_ns();
+    if (timer_wheel.epoch_ns == 0) {
+        timer_wheel.epoch_ns = now;
+    }
+    return now - timer_wheel.epoch_ns;
+}
+
+// Ticks fully elapsed. Must be called with timer_wheel.lock held.
+static uint64_t timer_wheel_now(void) {
+    return timer_wheel_elapsed_ns() / 1000000ull;
+}
+
+// Must be called with timer_wheel.lock held.
+static void timer_wheel_link(EventLoopTimer* timer) {
+    uint64_t next = timer_wheel.next_tick;
+    if (timer->expires < next) {
+        timer->expires = next;
+    }
+    uint64_t delta = timer->expires - next;
+    if (delta > TIMER_WHEEL_MAX_TICKS) {
+        // Park in the last level; it is re-hashed on cascade.
+        delta = TIMER_WHEEL_MAX_TICKS;
+    }
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ull << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    uint64_t position = delta == TIMER_WHEEL_MAX_TICKS ? next + delta : timer->expires;
+    size_t index = (size_t)(position >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+
+    EventLoopTimer** slot = &timer_wheel.slots[level][index];
+    timer->slot = slot;
+    timer->prev = NULL;
+    timer->next = *slot;
+    if (*slot) {
+        (*slot)->prev = timer;
+    }
+    *slot = timer;
+}
+
+// Must be called with timer_wheel.lock held.
+static void timer_wheel_unlink(EventLoopTimer* timer) {
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        *timer->slot = timer->next;
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    timer->slot = NULL;
+}
+
+// Re-hashes one slot of `level` into the lower levels. Returns the slot index,
+// which is 0 when the next level up wraps as well.
+static size_t timer_wheel_cascade(int level) {
+    size_t index = (size_t)(timer_wheel.next_tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    EventLoopTimer* timer = timer_wheel.slots[level][index];
+    timer_wheel.slots[level][index] = NULL;
+    while (timer) {
+        EventLoopTimer* next = timer->next;
+        timer_wheel_link(timer);
+        timer = next;
+    }
+    return index;
+}
+
+// Unlinks every timer due by `now` and returns them as a list (via `next`),
+// in expiry order. Must be called with timer_wheel.lock held.
+static EventLoopTimer* timer_wheel_collect(uint64_t now) {
+    EventLoopTimer* expired = NULL;
+    EventLoopTimer** expired_tail = &expired;
+
+    if (timer_wheel.count == 0 && timer_wheel.next_tick <= now) {
+        // Nothing armed: skip the idle ticks instead of walking them.
+        timer_wheel.next_tick = now + 1;
+        return NULL;
+    }
+
+    while (timer_wheel.next_tick <= now && timer_wheel.count > 0) {
+        size_t index = (size_t)timer_wheel.next_tick & TIMER_WHEEL_MASK;
+        if (index == 0) {
+            for (int level = 1; level < TIMER_WHEEL_LEVELS && timer_wheel_cascade(level) == 0; level++) {
+            }
+        }
+
+        EventLoopTimer* timer = timer_wheel.slots[0][index];
+        timer_wheel.slots[0][index] = NULL;
+        while (timer) {
+            EventLoopTimer* next = timer->next;
+            timer->slot = NULL;
+            timer->next = NULL;
+            *expired_tail = timer;
+            expired_tail = &timer->next;
+            __atomic_store_n(&timer_wheel.count, timer_wheel.count - 1, __ATOMIC_RELAXED);
+            timer = next;
+        }
+        timer_wheel.next_tick++;
+    }
+    if (timer_wheel.count == 0 && timer_wheel.next_tick <= now) {
+        timer_wheel.next_tick = now + 1;
+    }
+    return expired;
+}
+
+// Runs the callbacks of all due timers. Returns true if any ran.
+static bool timer_wheel_run_due(void) {
+    if (__atomic_load_n(&timer_wheel.count, __ATOMIC_RELAXED) == 0) {
+        return false;
+    }
+
+    pthread_mutex_lock(&timer_wheel.lock);
+    EventLoopTimer* expired = timer_wheel_collect(timer_wheel_now());
+    pthread_mutex_unlock(&timer_wheel.lock);
+
+    bool ran = expired != NULL;
+    while (expired) {
+        EventLoopTimer* next = expired->next;
+        uint64_t trace_start = q_trace_span_start();
+        expired->callback(expired->data);
+        if (trace_start) {
+            q_trace_complete("qpromise", "timer", trace_start, NULL);
+        }
+        free(expired);
+        expired = next;
+    }
+    return ran;
+}
+
+// Milliseconds until the loop must wake for timers: -1 if none are armed.
+// Only level 0 is scanned; otherwise the loop wakes when level 0 wraps and
+// the next cascade brings later timers closer.
+static int timer_wheel_timeout_ms(void) {
+    pthread_mutex_lock(&timer_wheel.lock);
+    int timeout = -1;
+    if (timer_wheel.count > 0) {
+        uint64_t now = timer_wheel_now();
+        uint64_t tick = timer_wheel.next_tick;
+        uint64_t wrap = (tick | TIMER_WHEEL_MASK) + 1;
+        if ((tick & TIMER_WHEEL_MASK) == 0) {
+            wrap = tick; // A cascade is due first; wake for it
+        }
+        while (tick < wrap && !timer_wheel.slots[0][tick & TIMER_WHEEL_MASK]) {
+            tick++;
+        }
+        timeout = tick <= now ? 0 : (int)(tick - now);
+    }
+    pthread_mutex_unlock(&timer_wheel.lock);
+    return timeout;
+}
+
+// --- Timer driver ---
+// Programs that never run the event loop (the CPM engine's q_delay() and
+// q_timeout()) still need their timers to fire. Once enabled, one thread
+// sleeps until the wheel's next deadline and runs what is due; while a
+// thread is inside run_event_loop_blocking(), the loop runs them instead.
+// It is not a q_runtime job: callers may block every worker on a timer.
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;            // CLOCK_MONOTONIC; signalled on add and loop entry/exit
+    pthread_once_t once;
+    bool enabled;                   // The driver thread is running
+    bool loop_running;              // A thread is inside run_event_loop_blocking()
+} timer_driver = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER, .once = PTHREAD_ONCE_INIT };
+
+static void* timer_driver_run(void* arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&timer_driver.lock);
+    for (;;) {
+        // Read under the driver lock: a timer added after this is signalled.
+        int timeout = timer_driver.loop_running ? -1 : timer_wheel_timeout_ms();
+        if (timeout < 0) {
+            pthread_cond_wait(&timer_driver.wake, &timer_driver.lock);
+            continue;
+        }
+        if (timeout > 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += timeout / 1000;
+            deadline.tv_nsec += (long)(timeout % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&timer_driver.wake, &timer_driver.lock, &deadline);
+            continue;
+        }
+
+        pthread_mutex_unlock(&timer_driver.lock);
+        timer_wheel_run_due();
+        pthread_mutex_lock(&timer_driver.lock);
+    }
+    return NULL;
+}
+
+static void timer_driver_start(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer_driver.wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, timer_driver_run, NULL) != 0) {
+        perror("Failed to start the timer driver");
+        return;
+    }
+    pthread_detach(thread);
+    __atomic_store_n(&timer_driver.enabled, true, __ATOMIC_RELEASE);
+}
+
+// Lets a sleeping driver recompute its deadline after the wheel changed.
+static void timer_driver_notify(void) {
+    if (!__atomic_load_n(&timer_driver.enabled, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    pthread_mutex_lock(&timer_driver.lock);
+    pthread_cond_signal(&timer_driver.wake);
+    pthread_mutex_unlock(&timer_driver.lock);
+}
+
+// Called by run_event_loop_blocking() on entry and exit.
+static void timer_driver_set_loop_running(bool running) {
+    pthread_mutex_lock(&timer_driver.lock);
+    timer_driver.loop_running = running;
+    pthread_mutex_unlock(&timer_driver.lock);
+    timer_driver_notify();
+}
+
+bool event_loop_drive_timers(void) {
+    pthread_once(&timer_driver.once, timer_driver_start);
+    return __atomic_load_n(&timer_driver.enabled, __ATOMIC_ACQUIRE);
+}
+
+EventLoopTimer* event_loop_add_timer(unsigned long delay_ms, event_loop_timer_callback callback, void* data) {
+    if (!callback) return NULL;
+
+    EventLoopTimer* timer = (EventLoopTimer*)malloc(sizeof(EventLoopTimer));
+    if (!timer) {
+        perror("Failed to allocate timer");
+        return NULL;
+    }
+    timer->callback = callback;
+    timer->data = data;
+
+    pthread_mutex_lock(&timer_wheel.lock);
+    uint64_t elapsed = timer_wheel_elapsed_ns();
+    uint64_t now = elapsed / 1000000ull;
+    if (timer_wheel.count == 0 && timer_wheel.next_tick < now) {
+        // Idle wheel: catch up so the timer is not hashed behind the clock.
+        timer_wheel.next_tick = now;
+    }
+    // Round up to a whole tick so a timer never fires early.
+    timer->expires = (elapsed + (uint64_t)delay_ms * 1000000ull + 999999ull) / 1000000ull;
+    timer_wheel_link(timer);
+    __atomic_store_n(&timer_wheel.count, timer_wheel.count + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&timer_wheel.lock);
+
+    // A sleeping loop may be waiting for a later deadline; let it recompute.
+    if (__atomic_load_n(&event_loop_wait.sleeping, __ATOMIC_SEQ_CST)) {
+        event_loop_wake();
+    }
+    timer_driver_notify();
+    return timer;
+}
+
+bool event_loop_cancel_timer(EventLoopTimer* timer) {
+    if (!timer) return false;
+
+    pthread_mutex_lock(&timer_wheel.lock);
+    bool armed = timer->slot != NULL;
+    if (armed) {
+        timer_wheel_unlink(timer);
+        __atomic_store_n(&timer_wheel.count, timer_wheel.count - 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&timer_wheel.lock);
+
+    if (armed) {
+        free(timer);
+    }
+    return armed;
+}
+
+// Drops every armed timer without running it.
+static void timer_wheel_clear(void) {
+    pthread_mutex_lock(&timer_wheel.lock);
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        for (size_t index = 0; index < TIMER_WHEEL_SLOTS; ++index) {
+            EventLoopTimer* timer = timer_wheel.slots[level][index];
+            timer_wheel.slots[level][index] = NULL;
+            while (timer) {
+                EventLoopTimer* next = timer->next;
+                free(timer);
+                timer = next;
+            }
+        }
+    }
+    __atomic_store_n(&timer_wheel.count, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&timer_wheel.lock);
+}
+
+static void event_loop_run_task(const Microtask* item) {
+    uint64_t trace_start = q_trace_span_start();
+    item->task_func(item->task_data);
+    if (trace_start) {
+        q_trace_complete("qpromise", "microtask", trace_start, NULL);
+    }
+}
+
+// Runs one batch of the high lane: up to MICROTASK_BATCH tasks from the ring
+// or, once it is drained, the whole overflow list. Returns the number run.
+static size_t event_loop_run_high_batch(void) {
+    MicrotaskLane* lane = &microtask_lanes[PROMISE_PRIORITY_HIGH];
+    Microtask batch[MICROTASK_BATCH];
+    size_t count = microtask_ring_pop_batch(lane, batch, MICROTASK_BATCH);
+    for (size_t i = 0; i < count; ++i) {
+        event_loop_run_task(&batch[i]);
+    }
+    if (count > 0) {
+        return count;
+    }
+
+    // Ring drained: the overflow list holds everything queued after it filled.
+    Microtask* overflow = microtask_overflow_take(lane);
+    while (overflow) {
+        Microtask* next = overflow->next;
+        event_loop_run_task(overflow);
+        free(overflow);
+        overflow = next;
+        count++;
+    }
+    return count;
+}
+
+void run_event_loop(void) {
+    // Simple run-once model: process tasks until the queue is empty, including
+    // tasks queued by the tasks themselves. Only one thread may run the loop
+    // at a time (the ring has a single consumer); any thread may enqueue.
+    bool outer_loop_thread = event_loop_thread;
+    event_loop_thread = true;
+    unsigned int high_streak = 0;
+
+    while (true) {
+        // Timers already due run first, like the timers phase of a JS event loop,
+        // then completed I/O.
+        timer_wheel_run_due();
+        event_loop_poll_io();
+
+        size_t count = event_loop_run_high_batch();
+        if (count > 0 && ++high_streak < MICROTASK_HIGH_STREAK) {
+            continue;
+        }
+        high_streak = 0;
+
+        // High lane empty (or its streak is up): one low-lane task, then back
+        // to timers, I/O and the high lane.
+        Microtask item;
+        if (microtask_lane_pop_one(&microtask_lanes[PROMISE_PRIORITY_LOW], &item)) {
+            event_loop_run_task(&item);
+            continue;
+        }
+        if (count == 0) {
+            // No more tasks in the queue.
+            break;
+        }
+    }
+    event_loop_thread = outer_loop_thread;
+}
+
+// Only one worker at a time consumes the shared (single-consumer) queue.
+static pthread_mutex_t event_loop_consumer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Moves tasks queued from outside the loop onto this worker's deque, so other
+// workers can steal them. Returns one task to run now, if any.
+static bool event_loop_take_shared(EventLoopWorker* self, Microtask* item) {
+    if (pthread_mutex_trylock(&event_loop_consumer_lock) != 0) {
+        return false;
+    }
+
+    // The high lane first; the low lane when it is empty, or on every
+    // MICROTASK_HIGH_STREAK-th take so it cannot starve. Once on a deque,
+    // tasks of both lanes are equal.
+    static unsigned int takes = 0;
+    Microtask batch[MICROTASK_BATCH];
+    size_t count = 0;
+    Microtask* overflow = NULL;
+    int first = ++takes % MICROTASK_HIGH_STREAK == 0 ? PROMISE_PRIORITY_LOW : PROMISE_PRIORITY_HIGH;
+    for (int i = 0; i < PROMISE_PRIORITY_LANES && count == 0 && !overflow; ++i) {
+        MicrotaskLane* lane = &microtask_lanes[(first + i) % PROMISE_PRIORITY_LANES];
+        if (lane->backlog) {
+            overflow = lane->backlog; // Left by run_event_loop(); older than the ring
+            lane->backlog = NULL;
+            break;
+        }
+        count = microtask_ring_pop_batch(lane, batch, MICROTASK_BATCH);
+        overflow = count == 0 ? microtask_overflow_take(lane) : NULL;
+    }
+    pthread_mutex_unlock(&event_loop_consumer_lock);
+
+    bool found = false;
+    for (size_t i = 0; i < count; ++i) {
+        if (!found) {
+            *item = batch[i];
+            found = true;
+        } else if (!work_deque_push(&self->deque, batch[i].task_func, batch[i].task_data)) {
+            event_loop_run_task(&batch[i]);
+        }
+    }
+    while (overflow) {
+        Microtask* next = overflow->next;
+        if (!found) {
+            *item = *overflow;
+            found = true;
+        } else if (!work_deque_push(&self->deque, overflow->task_func, overflow->task_data)) {
+            event_loop_run_task(overflow);
+        }
+        free(overflow);
+        overflow = next;
+    }
+    return found;
+}
+
+static bool event_loop_find_work(EventLoopWorker* self, Microtask* item) {
+    size_t count = event_loop_pool.count;
+    // xorshift: spread the first victim so thieves do not pile onto one deque
+    unsigned int seed = self->steal_seed;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    self->steal_seed = seed;
+    size_t start = (size_t)seed % count;
+    for (size_t i = 0; i < count; ++i) {
+        EventLoopWorker* victim = &event_loop_pool.workers[(start + i) % count];
+        if (victim != self && work_deque_steal(&victim->deque, item)) {
+            return true;
+        }
+    }
+    return event_loop_take_shared(self, item);
+}
+
+// A worker counts itself idle only while it holds no task and its deque is
+// empty, and leaves the count before searching, so when every worker is idle
+// there is no work left anywhere.
+static void* event_loop_worker_main(void* arg) {
+    EventLoopWorker* self = (EventLoopWorker*)arg;
+    event_loop_worker = self;
+    Microtask item;
+
+    while (true) {
+        if (work_deque_pop(&self->deque, &item) || event_loop_find_work(self, &item)) {
+            event_loop_run_task(&item);
+            continue;
+        }
+
+        bool found = false;
+        __atomic_add_fetch(&event_loop_pool.idle, 1, __ATOMIC_SEQ_CST);
+        while (!found) {
+            if (__atomic_load_n(&event_loop_pool.done, __ATOMIC_ACQUIRE)) {
+                event_loop_worker = NULL;
+                return NULL;
+            }
+            if (__atomic_load_n(&event_loop_pool.idle, __ATOMIC_SEQ_CST) == event_loop_pool.count) {
+                __atomic_store_n(&event_loop_pool.done, true, __ATOMIC_RELEASE);
+                continue;
+            }
+
+            __atomic_sub_fetch(&event_loop_pool.idle, 1, __ATOMIC_SEQ_CST);
+            found = event_loop_find_work(self, &item);
+            if (!found) {
+                __atomic_add_fetch(&event_loop_pool.idle, 1, __ATOMIC_SEQ_CST);
+                sched_yield();
+            }
+        }
+        event_loop_run_task(&item);
+    }
+}
+
+void run_event_loop_parallel(size_t worker_count) {
+    if (worker_count <= 1) {
+        run_event_loop();
+        return;
+    }
+    if (worker_count > EVENT_LOOP_MAX_WORKERS) {
+        worker_count = EVENT_LOOP_MAX_WORKERS;
+    }
+
+    EventLoopWorker* workers = (EventLoopWorker*)calloc(worker_count, sizeof(EventLoopWorker));
+    pthread_t* threads = (pthread_t*)malloc(worker_count * sizeof(pthread_t));
+    if (!workers || !threads) {
+        perror("Failed to allocate event loop workers");
+        free(workers);
+        free(threads);
+        run_event_loop();
+        return;
+    }
+
+    for (size_t i = 0; i < worker_count; ++i) {
+        workers[i].index = i;
+        workers[i].steal_seed = (unsigned int)(i * 2654435761u + 1);
+    }
+    event_loop_pool.workers = workers;
+    event_loop_pool.count = worker_count;
+    event_loop_pool.idle = 0;
+    event_loop_pool.done = false;
+
+    // The calling thread is worker 0. If a thread cannot be started, its
+    // worker still takes part in termination as if permanently idle.
+    size_t started = 1;
+    for (size_t i = 1; i < worker_count; ++i) {
+        if (pthread_create(&threads[i], NULL, event_loop_worker_main, &workers[i]) == 0) {
+            threads[started++] = threads[i];
+        } else {
+            __atomic_add_fetch(&event_loop_pool.idle, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+    event_loop_worker_main(&workers[0]);
+
+    for (size_t i = 1; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    event_loop_pool.workers = NULL;
+    event_loop_pool.count = 0;
+    free(workers);
+    free(threads);
+}
+
+// --- Blocking event loop ---
+
+// Creates the epoll set on first use; I/O promises may get here from any thread.
+static bool event_loop_wait_init(void) {
+    if (__atomic_load_n(&event_loop_wait.epoll_fd, __ATOMIC_ACQUIRE) >= 0) {
+        return true;
+    }
+
+    pthread_mutex_lock(&event_loop_wait_lock);
+    if (event_loop_wait.epoll_fd >= 0) {
+        pthread_mutex_unlock(&event_loop_wait_lock);
+        return true;
+    }
+    int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = EVENT_LOOP_TAG_WAKE;
+    if (wake_fd < 0 || epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) != 0) {
+        perror("Failed to set up event loop wake-ups");
+        if (wake_fd >= 0) close(wake_fd);
+        if (epoll_fd >= 0) close(epoll_fd);
+        pthread_mutex_unlock(&event_loop_wait_lock);
+        return false;
+    }
+
+    event_loop_wait.wake_fd = wake_fd;
+    __atomic_store_n(&event_loop_wait.epoll_fd, epoll_fd, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&event_loop_wait_lock);
+    return true;
+}
+
+// Consumer-side check; the ring heads are only read by the loop thread.
+static bool event_loop_has_tasks(void) {
+    return microtask_lane_ready(&microtask_lanes[PROMISE_PRIORITY_HIGH]) ||
+           microtask_lane_ready(&microtask_lanes[PROMISE_PRIORITY_LOW]);
+}
+
+void run_event_loop_blocking(void) {
+    if (!event_loop_wait_init()) {
+        // No way to sleep: fall back to draining what is queued now.
+        run_event_loop();
+        return;
+    }
+
+    timer_driver_set_loop_running(true);
+    while (!__atomic_load_n(&event_loop_wait.stop, __ATOMIC_ACQUIRE)) {
+        run_event_loop();
+
+        // Announce the sleep, then look once more: a producer that enqueued
+        // before seeing `sleeping` is caught here, one after it writes the eventfd.
+        __atomic_store_n(&event_loop_wait.sleeping, 1, __ATOMIC_SEQ_CST);
+        int timeout = timer_wheel_timeout_ms();
+        if (event_loop_has_tasks() || timeout == 0 ||
+            __atomic_load_n(&event_loop_wait.stop, __ATOMIC_SEQ_CST)) {
+            __atomic_store_n(&event_loop_wait.sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        // Wake-ups, I/O readiness and io_uring completions all arrive here.
+        struct epoll_event events[EVENT_LOOP_IO_BATCH];
+        int ready = epoll_wait(event_loop_wait.epoll_fd, events, EVENT_LOOP_IO_BATCH, timeout);
+        __atomic_store_n(&event_loop_wait.sleeping, 0, __ATOMIC_RELAXED);
+        if (ready > 0) {
+            event_loop_dispatch_io(events, ready);
+        }
+    }
+    __atomic_store_n(&event_loop_wait.stop, 0, __ATOMIC_RELAXED);
+    timer_driver_set_loop_running(false);
+}
+
+void stop_event_loop(void) {
+    __atomic_store_n(&event_loop_wait.stop, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&event_loop_wait.sleeping, __ATOMIC_SEQ_CST)) {
+        event_loop_wake();
+    }
+}
+
+void free_event_loop(void) {
+    // Discard any remaining tasks. Task data (the Promise*) is not owned by the
+    // event loop tasks. Call only while no thread is enqueueing.
+    for (int i = 0; i < PROMISE_PRIORITY_LANES; ++i) {
+        MicrotaskLane* lane = &microtask_lanes[i];
+        Microtask item;
+        while (microtask_lane_pop_one(lane, &item)) {
+        }
+    }
+
+    timer_wheel_clear();
+    event_loop_io_teardown();
+    if (event_loop_wait.epoll_fd >= 0) {
+        close(event_loop_wait.epoll_fd);
+        close(event_loop_wait.wake_fd);
+        event_loop_wait.epoll_fd = -1;
+        event_loop_wait.wake_fd = -1;
+    }
+    // pthread_mutex_destroy(&event_loop_lock); // If dynamically allocated
+}
+
+// --- I/O promises ---
+// Readiness: each watched fd is registered once in the loop's epoll set,
+// EPOLLONESHOT, for the union of what its waiters want; when it fires, the
+// matching waiters are settled and the fd is re-armed for the rest (or
+// removed). Completions: one io_uring shared by all threads. Submitters fill
+// an SQE under a lock and enter the kernel right away; the kernel signals an
+// eventfd in the epoll set on completion, and the loop thread reaps the CQ
+// ring without a syscall. Each SQE's user_data is a referenced Promise*.
+
+typedef struct FdWaiter {
+    Promise* promise; // Referenced until settled
+    unsigned events;
+    struct FdWaiter* next;
+} FdWaiter;
+
+static struct {
+    FdWaiter** waiters; // Per fd, in arrival order
+    size_t capacity;
+    size_t count;       // Waiters across all fds
+    pthread_mutex_t lock;
+} fd_watch = { NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+static unsigned fd_watch_events_locked(int fd) {
+    unsigned events = 0;
+    for (FdWaiter* w = fd_watch.waiters[fd]; w; w = w->next) {
+        events |= w->events;
+    }
+    return events;
+}
+
+Promise* promise_from_fd(int fd, unsigned events) {
+    Promise* p = promise_create();
+    if (!p) return NULL;
+
+    events &= PROMISE_FD_READABLE | PROMISE_FD_WRITABLE;
+    if (fd < 0 || events == 0) {
+        promise_reject(p, (void*)"Invalid file descriptor or events");
+        return p;
+    }
+    FdWaiter* waiter = (FdWaiter*)malloc(sizeof(FdWaiter));
+    if (!waiter || !event_loop_wait_init()) {
+        free(waiter);
+        promise_reject(p, (void*)"Failed to watch file descriptor");
+        return p;
+    }
+    waiter->promise = promise_retain(p);
+    waiter->events = events;
+    waiter->next = NULL;
+
+    pthread_mutex_lock(&fd_watch.lock);
+    if ((size_t)fd >= fd_watch.capacity) {
+        size_t capacity = fd_watch.capacity ? fd_watch.capacity : 64;
+        while (capacity <= (size_t)fd) capacity *= 2;
+        FdWaiter** grown = (FdWaiter**)realloc(fd_watch.waiters, capacity * sizeof(FdWaiter*));
+        if (!grown) {
+            pthread_mutex_unlock(&fd_watch.lock);
+            promise_free(p); // The waiter's reference
+            free(waiter);
+            promise_reject(p, (void*)"Failed to watch file descriptor");
+            return p;
+        }
+        memset(grown + fd_watch.capacity, 0, (capacity - fd_watch.capacity) * sizeof(FdWaiter*));
+        fd_watch.waiters = grown;
+        fd_watch.capacity = capacity;
+    }
+
+    bool first = fd_watch.waiters[fd] == NULL;
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = (events | fd_watch_events_locked(fd)) | EPOLLONESHOT;
+    event.data.u64 = (uint64_t)fd;
+    int rc = epoll_ctl(event_loop_wait.epoll_fd, first ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event);
+    if (rc != 0 && first && errno == EEXIST) {
+        rc = epoll_ctl(event_loop_wait.epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    }
+    int error = rc == 0 ? 0 : errno;
+    if (rc == 0) {
+        FdWaiter** link = &fd_watch.waiters[fd];
+        while (*link) link = &(*link)->next;
+        *link = waiter;
+        __atomic_store_n(&fd_watch.count, fd_watch.count + 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&fd_watch.lock);
+
+    if (rc != 0) {
+        promise_free(p); // The waiter's reference
+        free(waiter);
+        if (error == EPERM) {
+            // epoll does not take regular files: they are always ready.
+            promise_resolve(p, (PromiseValue)(uintptr_t)events);
+        } else {
+            promise_reject(p, (PromiseValue)strerror(error));
+        }
+    }
+    return p;
+}
+
+// Settles the waiters of `fd` that `ready` satisfies; loop thread only.
+static void fd_watch_fire(int fd, unsigned ready) {
+    FdWaiter* fired = NULL;
+    FdWaiter** fired_tail = &fired;
+
+    pthread_mutex_lock(&fd_watch.lock);
+    if ((size_t)fd >= fd_watch.capacity) {
+        pthread_mutex_unlock(&fd_watch.lock);
+        return;
+    }
+    size_t count = 0;
+    FdWaiter** link = &fd_watch.waiters[fd];
+    while (*link) {
+        FdWaiter* w = *link;
+        if (ready & (w->events | PROMISE_FD_ERROR | PROMISE_FD_HANGUP)) {
+            *link = w->next;
+            w->next = NULL;
+            *fired_tail = w;
+            fired_tail = &w->next;
+            count++;
+        } else {
+            link = &w->next;
+        }
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    if (fd_watch.waiters[fd]) {
+        // Re-arm the one-shot registration for those still waiting.
+        event.events = fd_watch_events_locked(fd) | EPOLLONESHOT;
+        event.data.u64 = (uint64_t)fd;
+        epoll_ctl(event_loop_wait.epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    } else {
+        epoll_ctl(event_loop_wait.epoll_fd, EPOLL_CTL_DEL, fd, &event);
+    }
+    __atomic_store_n(&fd_watch.count, fd_watch.count - count, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&fd_watch.lock);
+
+    while (fired) {
+        FdWaiter* next = fired->next;
+        unsigned reported = ready & (fired->events | PROMISE_FD_ERROR | PROMISE_FD_HANGUP);
+        promise_resolve(fired->promise, (PromiseValue)(uintptr_t)reported);
+        promise_free(fired->promise);
+        free(fired);
+        fired = next;
+    }
+}
+
+#ifdef QPROMISE_HAVE_IO_URING
+#define IO_RING_ENTRIES 4096
+// The kernel moves at most this much per read/write (MAX_RW_COUNT); larger
+// requests would also overflow the 32-bit sqe->len.
+#define IO_RING_MAX_TRANSFER 0x7ffff000u
+
+static struct {
+    int fd;             // -1 until set up, -2 if io_uring is unavailable
+    int event_fd;       // Signalled by the kernel per completion; in the epoll set
+    unsigned entries;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map;       // Same as sq_map with IORING_FEAT_SINGLE_MMAP
+    size_t cq_map_size;
+    size_t in_flight;   // Submitted, not yet reaped
+    pthread_mutex_t lock; // Submitters and set-up
+} io_ring = {
+    .fd = -1,
+    .event_fd = -1,
+    .in_flight = 0,
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+// Sets the ring up on first use. Called with io_ring.lock held.
+static bool io_ring_init_locked(void) {
+    if (io_ring.fd != -1) {
+        return io_ring.fd >= 0;
+    }
+    io_ring.fd = -2;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, IO_RING_ENTRIES, &params);
+    if (fd < 0) {
+        return false; // Old kernel or disabled: callers fall back to plain syscalls
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && cq_size > sq_size) sq_size = cq_size;
+
+    void* sq_map = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    void* cq_map = single ? sq_map : mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = EVENT_LOOP_TAG_RING;
+    if (sq_map == MAP_FAILED || cq_map == MAP_FAILED || sqes == MAP_FAILED || event_fd < 0 ||
+        syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD, &event_fd, 1) != 0 ||
+        epoll_ctl(event_loop_wait.epoll_fd, EPOLL_CTL_ADD, event_fd, &event) != 0) {
+        perror("Failed to set up io_uring");
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+        if (cq_map != MAP_FAILED && !single) munmap(cq_map, cq_size);
+        if (sq_map != MAP_FAILED) munmap(sq_map, sq_size);
+        if (event_fd >= 0) close(event_fd);
+        close(fd);
+        return false;
+    }
+
+    unsigned char* sq = (unsigned char*)sq_map;
+    unsigned char* cq = (unsigned char*)cq_map;
+    io_ring.entries = params.sq_entries;
+    io_ring.sq_head = (unsigned*)(sq + params.sq_off.head);
+    io_ring.sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    io_ring.sq_array = (unsigned*)(sq + params.sq_off.array);
+    io_ring.sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    io_ring.cq_head = (unsigned*)(cq + params.cq_off.head);
+    io_ring.cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    io_ring.cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    io_ring.sqes = (struct io_uring_sqe*)sqes;
+    io_ring.cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    io_ring.sq_map = sq_map;
+    io_ring.sq_map_size = sq_size;
+    io_ring.cq_map = cq_map;
+    io_ring.cq_map_size = single ? 0 : cq_size;
+    io_ring.event_fd = event_fd;
+    io_ring.fd = fd;
+    return true;
+}
+
+// Hands every queued SQE to the kernel, including any an earlier failed enter
+// left behind. Called with io_ring.lock held.
+static void io_ring_enter_locked(void) {
+    unsigned pending = *io_ring.sq_tail - __atomic_load_n(io_ring.sq_head, __ATOMIC_ACQUIRE);
+    if (pending > 0 && syscall(__NR_io_uring_enter, io_ring.fd, pending, 0, 0, NULL, 0) < 0 &&
+        errno != EAGAIN && errno != EBUSY) {
+        perror("Failed to submit to io_uring");
+    }
+}
+
+// Queues one read/write for `p` (taking a reference). Returns false if
+// io_uring is unavailable or its submission queue is full.
+static bool io_ring_submit(Promise* p, uint8_t opcode, int fd, const void* buffer, size_t length, long long offset) {
+    if (!event_loop_wait_init()) return false;
+
+    pthread_mutex_lock(&io_ring.lock);
+    if (!io_ring_init_locked()) {
+        pthread_mutex_unlock(&io_ring.lock);
+        return false;
+    }
+    unsigned tail = *io_ring.sq_tail;
+    unsigned head = __atomic_load_n(io_ring.sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= io_ring.entries) {
+        pthread_mutex_unlock(&io_ring.lock);
+        return false;
+    }
+
+    unsigned index = tail & io_ring.sq_mask;
+    struct io_uring_sqe* sqe = &io_ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    // Clamped, so an oversize request completes short like read(2) would.
+    sqe->len = length > IO_RING_MAX_TRANSFER ? IO_RING_MAX_TRANSFER : (uint32_t)length;
+    sqe->off = (uint64_t)offset;
+    sqe->user_data = (uint64_t)(uintptr_t)promise_retain(p);
+    io_ring.sq_array[index] = index;
+    __atomic_store_n(io_ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&io_ring.in_flight, 1, __ATOMIC_RELAXED);
+
+    // The loop thread submits its whole batch in one enter from event_loop_poll_io().
+    if (!event_loop_thread) {
+        io_ring_enter_locked();
+    }
+    pthread_mutex_unlock(&io_ring.lock);
+    return true;
+}
+
+// Settles every completed operation; loop thread only.
+static void io_ring_reap(void) {
+    unsigned head = *io_ring.cq_head;
+    unsigned tail = __atomic_load_n(io_ring.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe* cqe = &io_ring.cqes[head & io_ring.cq_mask];
+        Promise* p = (Promise*)(uintptr_t)cqe->user_data;
+        int result = cqe->res;
+        __atomic_store_n(io_ring.cq_head, ++head, __ATOMIC_RELEASE);
+        __atomic_sub_fetch(&io_ring.in_flight, 1, __ATOMIC_RELAXED);
+
+        if (result >= 0) {
+            promise_resolve(p, (PromiseValue)(intptr_t)result);
+        } else {
+            promise_reject(p, (PromiseValue)strerror(-result));
+        }
+        promise_free(p);
+
+        if (head == tail) {
+            tail = __atomic_load_n(io_ring.cq_tail, __ATOMIC_ACQUIRE);
+        }
+    }
+}
+#endif // QPROMISE_HAVE_IO_URING
+
+// Without io_uring the operation runs here and now; the promise still
+// settles through the event loop like any other.
+static void io_run_sync(Promise* p, bool write_op, int fd, void* buffer, size_t length, long long offset) {
+    ssize_t result;
+    if (write_op) {
+        result = offset < 0 ? write(fd, buffer, length) : pwrite(fd, buffer, length, (off_t)offset);
+    } else {
+        result = offset < 0 ? read(fd, buffer, length) : pread(fd, buffer, length, (off_t)offset);
+    }
+    if (result >= 0) {
+        promise_resolve(p, (PromiseValue)(intptr_t)result);
+    } else {
+        promise_reject(p, (PromiseValue)strerror(errno));
+    }
+}
+
+Promise* promise_read(int fd, void* buffer, size_t length, long long offset) {
+    Promise* p = promise_create();
+    if (!p) return NULL;
+#ifdef QPROMISE_HAVE_IO_URING
+    if (io_ring_submit(p, IORING_OP_READ, fd, buffer, length, offset)) {
+        return p;
+    }
+#endif
+    io_run_sync(p, false, fd, buffer, length, offset);
+    return p;
+}
+
+Promise* promise_write(int fd, const void* buffer, size_t length, long long offset) {
+    Promise* p = promise_create();
+    if (!p) return NULL;
+#ifdef QPROMISE_HAVE_IO_URING
+    if (io_ring_submit(p, IORING_OP_WRITE, fd, buffer, length, offset)) {
+        return p;
+    }
+#endif
+    io_run_sync(p, true, fd, (void*)buffer, length, offset);
+    return p;
+}
+
+static void event_loop_dispatch_io(const struct epoll_event* events, int count) {
+    for (int i = 0; i < count; ++i) {
+        uint64_t tag = events[i].data.u64;
+        uint64_t drained;
+        if (tag == EVENT_LOOP_TAG_WAKE) {
+            while (read(event_loop_wait.wake_fd, &drained, sizeof(drained)) > 0) {
+            }
+#ifdef QPROMISE_HAVE_IO_URING
+        } else if (tag == EVENT_LOOP_TAG_RING) {
+            while (read(io_ring.event_fd, &drained, sizeof(drained)) > 0) {
+            }
+            io_ring_reap();
+#endif
+        } else {
+            fd_watch_fire((int)tag, events[i].events);
+        }
+    }
+}
+
+// Reaps I/O without blocking: completions straight from the CQ ring, and
+// readiness with a zero-timeout epoll_wait (only while something is watched).
+static void event_loop_poll_io(void) {
+#ifdef QPROMISE_HAVE_IO_URING
+    if (__atomic_load_n(&io_ring.in_flight, __ATOMIC_RELAXED) > 0) {
+        pthread_mutex_lock(&io_ring.lock);
+        if (io_ring.fd >= 0) {
+            io_ring_enter_locked();
+        }
+        pthread_mutex_unlock(&io_ring.lock);
+        io_ring_reap();
+    }
+#endif
+    if (__atomic_load_n(&fd_watch.count, __ATOMIC_RELAXED) > 0) {
+        struct epoll_event events[EVENT_LOOP_IO_BATCH];
+        int ready = epoll_wait(event_loop_wait.epoll_fd, events, EVENT_LOOP_IO_BATCH, 0);
+        if (ready > 0) {
+            event_loop_dispatch_io(events, ready);
+        }
+    }
+}
+
+// free_event_loop(): drop watches and the ring. Their promises never settle.
+static void event_loop_io_teardown(void) {
+    pthread_mutex_lock(&fd_watch.lock);
+    for (size_t fd = 0; fd < fd_watch.capacity; ++fd) {
+        FdWaiter* w = fd_watch.waiters[fd];
+        while (w) {
+            FdWaiter* next = w->next;
+            promise_free(w->promise);
+            free(w);
+            w = next;
+        }
+    }
+    free(fd_watch.waiters);
+    fd_watch.waiters = NULL;
+    fd_watch.capacity = 0;
+    fd_watch.count = 0;
+    pthread_mutex_unlock(&fd_watch.lock);
+
+#ifdef QPROMISE_HAVE_IO_URING
+    pthread_mutex_lock(&io_ring.lock);
+    if (io_ring.fd >= 0) {
+        munmap(io_ring.sqes, io_ring.entries * sizeof(struct io_uring_sqe));
+        if (io_ring.cq_map_size) munmap(io_ring.cq_map, io_ring.cq_map_size);
+        munmap(io_ring.sq_map, io_ring.sq_map_size);
+        close(io_ring.event_fd);
+        close(io_ring.fd);
+    }
+    io_ring.fd = -1;
+    io_ring.event_fd = -1;
+    io_ring.in_flight = 0;
+    pthread_mutex_unlock(&io_ring.lock);
+#endif
+}
+
+// --- Q.defer() API Implementation ---
+PromiseDeferred* promise_defer_create_internal(bool is_persistent, void* pmem_ctx, pthread_mutex_t* lock) {
+    PromiseDeferred* deferred = (PromiseDeferred*)malloc(sizeof(PromiseDeferred));
+    if (!deferred) {
+        perror("Failed to allocate deferred object");
+        return NULL;
+    }
+
+    // The promise associated with the deferred object.
+    // Its persistence should match the deferred request.
+    if (is_persistent) {
+        deferred->promise = promise_create_persistent(pmem_ctx, lock);
+    } else {
+        deferred->promise = promise_create();
+    }
+
+    if (!deferred->promise) {
+        free(deferred);
+        return NULL;
+    }
+    // If 'deferred' itself needs to be persistent, its allocation would also use pmem.
+    return deferred;
+}
+
+
+PromiseDeferred* promise_defer_create(void) {
+    return promise_defer_create_internal(false, NULL, NULL);
+}
+
+PromiseDeferred* promise_defer_create_persistent(void* pmem_ctx, pthread_mutex_t* lock) {
+     if (!pmem_ctx) return NULL;
+    return promise_defer_create_internal(true, pmem_ctx, lock);
+}
+
+void promise_defer_resolve(PromiseDeferred* deferred, PromiseValue value) {
+    if (!deferred || !deferred->promise) return;
+    promise_resolve(deferred->promise, value);
+}
+
+void promise_defer_reject(PromiseDeferred* deferred, PromiseValue reason) {
+    if (!deferred || !deferred->promise) return;
+    promise_reject(deferred->promise, reason);
+}
+
+void promise_defer_free(PromiseDeferred* deferred) {
+    if (!deferred) return;
+    // The crucial question: does freeing the deferred object also free its promise?
+    // Typically, yes, unless the promise has been "detached" or returned elsewhere
+    // and its lifetime is now managed independently.
+    // For a simple defer, the promise is intrinsically linked.
+    // If promise_free handles ref counting or checks if it's part of a deferred,
+    // it might be okay. Otherwise, explicit free here.
+    if (deferred->promise) {
+        promise_free(deferred->promise); // This assumes deferred owns the promise.
+        deferred->promise = NULL;
+    }
+    free(deferred);
+}
+
+
+// --- Q.all() API Implementation ---
+// The aggregate is settled without a lock: every input owns one slot of the
+// results array and writes only that slot, then decrements `remaining`; the
+// input that takes it to zero settles the aggregate. Until its input
+// fulfills, a slot holds the PromiseAllContext pointer, so each input's
+// user_data is just its slot and needs no allocation of its own.
+
+typedef struct {
+    Promise* all_promise;   // The aggregate; this context holds a reference
+    PromiseValue* results;  // One slot per input, in input order
+    size_t remaining;       // Inputs not yet settled (atomic)
+    bool rejected;          // Set (atomically) by the first rejection
+} PromiseAllContext;
+
+// Runs once every input has settled; the context is no longer shared.
+static void promise_all_finish(PromiseAllContext* context) {
+    if (!__atomic_load_n(&context->rejected, __ATOMIC_ACQUIRE)) {
+        promise_resolve(context->all_promise, context->results); // The array now belongs to the consumer
+    } else {
+        free(context->results);
+    }
+    promise_free(context->all_promise);
+    free(context);
+}
+
+static PromiseValue promise_all_on_fulfilled(PromiseValue value, void* user_data) {
+    PromiseValue* slot = (PromiseValue*)user_data;
+    PromiseAllContext* context = (PromiseAllContext*)*slot;
+    *slot = value;
+    // Release publishes the slot; the finisher's acquire sees every slot.
+    if (__atomic_sub_fetch(&context->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+        promise_all_finish(context);
+    }
+    return NULL;
+}
+
+static PromiseValue promise_all_on_rejected(PromiseValue reason, void* user_data) {
+    PromiseValue* slot = (PromiseValue*)user_data;
+    PromiseAllContext* context = (PromiseAllContext*)*slot;
+    *slot = NULL;
+    if (!__atomic_exchange_n(&context->rejected, true, __ATOMIC_ACQ_REL)) {
+        promise_reject(context->all_promise, reason); // First rejection wins
+    }
+    if (__atomic_sub_fetch(&context->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+        promise_all_finish(context);
+    }
+    return NULL;
+}
+
+Promise* promise_all(Promise* promises[], size_t count) {
+    Promise* all_promise = promise_create();
+    if (!all_promise) return NULL;
+
+    if (count == 0) {
+        // Q resolves an empty input with an empty array; it is still freeable.
+        promise_resolve(all_promise, malloc(sizeof(PromiseValue)));
+        return all_promise;
+    }
+    if (!promises) {
+        promise_reject(all_promise, (PromiseValue)"promise_all: no input array");
+        return all_promise;
+    }
+
+    PromiseAllContext* context = (PromiseAllContext*)malloc(sizeof(PromiseAllContext));
+    PromiseValue* results = (PromiseValue*)malloc(count * sizeof(PromiseValue));
+    if (!context || !results) {
+        free(context);
+        free(results);
+        promise_reject(all_promise, (PromiseValue)"promise_all: out of memory");
+        return all_promise;
+    }
+    context->all_promise = promise_retain(all_promise);
+    context->results = results;
+    context->remaining = count;
+    context->rejected = false;
+    for (size_t i = 0; i < count; ++i) {
+        results[i] = context;
+    }
+
+    // Handlers may already be running on other threads (parallel event loop)
+    // while later inputs are registered; `remaining` cannot reach zero before
+    // the last registration, which is the last use of `context` here.
+    for (size_t i = 0; i < count; ++i) {
+        PromiseValue* slot = &results[i];
+        if (!promises[i]) {
+            promise_all_on_fulfilled(NULL, slot); // A missing input counts as fulfilled with NULL
+        } else if (!promise_observe(promises[i], promise_all_on_fulfilled, promise_all_on_rejected, slot)) {
+            promise_all_on_rejected((PromiseValue)"Failed to attach callback", slot);
+        }
+    }
+    return all_promise;
+}
+
+
+// --- Q.delay() / Q.timeout() ---
+
+typedef struct {
+    Promise* promise;
+    PromiseValue value;
+} PromiseDelayContext;
+
+static void promise_delay_fire(void* data) {
+    PromiseDelayContext* context = (PromiseDelayContext*)data;
+    promise_resolve(context->promise, context->value);
+    promise_free(context->promise); // The timer's reference
+    free(context);
+}
+
+Promise* promise_delay(unsigned long delay_ms, PromiseValue value) {
+    Promise* p = promise_create();
+    if (!p) return NULL;
+
+    PromiseDelayContext* context = (PromiseDelayContext*)malloc(sizeof(PromiseDelayContext));
+    if (!context) {
+        promise_reject(p, (void*)"Failed to allocate delay context");
+        return p;
+    }
+    context->promise = promise_retain(p);
+    context->value = value;
+    if (!event_loop_add_timer(delay_ms, promise_delay_fire, context)) {
+        promise_free(p);
+        free(context);
+        promise_reject(p, (void*)"Failed to schedule delay timer");
+    }
+    return p;
+}
+
+// Shared by the timer and the source promise's callbacks; whichever runs
+// last frees it.
+typedef struct {
+    Promise* promise;       // Returned promise (chained to the source); referenced
+    EventLoopTimer* timer;  // NULL once fired or cancelled
+    PromiseValue reason;
+    int refs;
+    pthread_mutex_t lock;
+} PromiseTimeoutContext;
+
+static void promise_timeout_release(PromiseTimeoutContext* context) {
+    if (__atomic_sub_fetch(&context->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        promise_free(context->promise);
+        pthread_mutex_destroy(&context->lock);
+        free(context);
+    }
+}
+
+static void promise_timeout_fire(void* data) {
+    PromiseTimeoutContext* context = (PromiseTimeoutContext*)data;
+    pthread_mutex_lock(&context->lock);
+    context->timer = NULL;
+    Promise* promise = context->promise;
+    pthread_mutex_unlock(&context->lock);
+
+    // A later resolve from the source's callback is a no-op on a settled promise.
+    promise_reject(promise, context->reason);
+    promise_timeout_release(context);
+}
+
+// The source settled first (or at all): disarm the timer if it is still armed.
+static void promise_timeout_disarm(PromiseTimeoutContext* context) {
+    pthread_mutex_lock(&context->lock);
+    EventLoopTimer* timer = context->timer;
+    context->timer = NULL;
+    bool cancelled = timer && event_loop_cancel_timer(timer);
+    pthread_mutex_unlock(&context->lock);
+
+    if (cancelled) {
+        promise_timeout_release(context); // The timer's reference
+    }
+}
+
+static PromiseValue promise_timeout_on_fulfilled(PromiseValue value, void* user_data) {
+    PromiseTimeoutContext* context = (PromiseTimeoutContext*)user_data;
+    promise_timeout_disarm(context);
+    promise_timeout_release(context);
+    return value; // Fulfils the returned promise, unless the timer won
+}
+
+static PromiseValue promise_timeout_on_rejected(PromiseValue reason, void* user_data) {
+    PromiseTimeoutContext* context = (PromiseTimeoutContext*)user_data;
+    promise_timeout_disarm(context);
+    // Returning would fulfil (recover); settle the rejection directly instead.
+    promise_reject(context->promise, reason);
+    promise_timeout_release(context);
+    return reason;
+}
+
+Promise* promise_timeout(Promise* p, unsigned long timeout_ms, PromiseValue reason) {
+    if (!p) return NULL;
+
+    PromiseTimeoutContext* context = (PromiseTimeoutContext*)malloc(sizeof(PromiseTimeoutContext));
+    if (!context) return NULL;
+    context->promise = NULL;
+    context->timer = NULL;
+    context->reason = reason;
+    context->refs = 2; // Source callback + timer
+    pthread_mutex_init(&context->lock, NULL);
+
+    // Hold the lock so callbacks running on another thread see `promise` and `timer`.
+    pthread_mutex_lock(&context->lock);
+    Promise* result = promise_then(p, promise_timeout_on_fulfilled, promise_timeout_on_rejected, context);
+    if (!result) {
+        pthread_mutex_unlock(&context->lock);
+        pthread_mutex_destroy(&context->lock);
+        free(context);
+        return NULL;
+    }
+    context->promise = promise_retain(result);
+    context->timer = event_loop_add_timer(timeout_ms, promise_timeout_fire, context);
+    if (!context->timer) {
+        context->refs--; // No timer will run; the source still decides
+    }
+    pthread_mutex_unlock(&context->lock);
+    return result;
+}
+
+
+// --- Blocking work ---
+// The job record is embedded in the task, so a submission is one pooled
+// allocation; the task is returned to the pool before the promise settles.
+
+typedef struct {
+    QRuntimeJob job;
+    promise_work_function work;
+    void* arg;
+    Promise* promise; // Reference held until the work has settled it
+} PromiseWorkTask;
+
+static QRuntimePool promise_work_pool = Q_RUNTIME_POOL("qpromise_work", PromiseWorkTask, NULL, NULL);
+
+static void promise_work_run(void* data) {
+    PromiseWorkTask* task = (PromiseWorkTask*)data;
+    promise_work_function work = task->work;
+    void* arg = task->arg;
+    Promise* p = task->promise;
+    q_runtime_free(&promise_work_pool, task);
+
+    PromiseValue result = NULL;
+    uint64_t start = q_trace_span_start();
+    bool fulfilled = work(arg, &result);
+    if (start) q_trace_complete("qpromise", "work", start, p);
+
+    if (fulfilled) {
+        promise_resolve(p, result);
+    } else {
+        promise_reject(p, result);
+    }
+    promise_free(p);
+}
+
+Promise* promise_run_async(promise_work_function work, void* arg) {
+    if (!work) return NULL;
+
+    Promise* p = promise_create();
+    if (!p) return NULL;
+
+    PromiseWorkTask* task = (PromiseWorkTask*)q_runtime_alloc(&promise_work_pool);
+    if (!task) {
+        promise_reject(p, (PromiseValue)"Failed to allocate work task");
+        return p;
+    }
+    task->job.function = promise_work_run;
+    task->job.arg = task;
+    task->work = work;
+    task->arg = arg;
+    task->promise = promise_retain(p);
+
+    if (!q_runtime_submit(&task->job)) {
+        q_runtime_free(&promise_work_pool, task);
+        promise_reject(p, (PromiseValue)"No worker thread available");
+        promise_free(p); // The task's reference
+    }
+    return p;
+}
+
+
+// promise_nfapply(): the arguments are copied just past the task record, which
+// lives until the wrapped function reports (possibly after it has returned,
+// from another thread), so the callback frees it.
+typedef struct {
+    QRuntimeJob job;
+    NodeFunction fn;
+    Promise* promise; // Reference held until the callback has settled it
+    uint64_t trace_start;
+    size_t argc;
+    PromiseValue* args; // Points just past this header
+} PromiseNodeTask;
+
+static void promise_node_settle(void* err, PromiseValue result, void* user_data) {
+    PromiseNodeTask* task = (PromiseNodeTask*)user_data;
+    Promise* p = task->promise;
+    if (task->trace_start) q_trace_complete("qpromise", "nfcall", task->trace_start, p);
+    free(task);
+
+    if (err) {
+        promise_reject(p, (PromiseValue)err);
+    } else {
+        promise_resolve(p, result);
+    }
+    promise_free(p);
+}
+
+static void promise_node_run(void* data) {
+    PromiseNodeTask* task = (PromiseNodeTask*)data;
+    task->trace_start = q_trace_span_start();
+    // The task may be gone once fn returns
+    task->fn(task->args, task->argc, promise_node_settle, task);
+}
+
+Promise* promise_nfapply(NodeFunction fn, PromiseValue args[], size_t argc) {
+    if (!fn || (argc > 0 && !args)) return NULL;
+
+    Promise* p = promise_create();
+    if (!p) return NULL;
+
+    PromiseNodeTask* task = (PromiseNodeTask*)malloc(sizeof(PromiseNodeTask) + argc * sizeof(PromiseValue));
+    if (!task) {
+        promise_reject(p, (PromiseValue)"Failed to allocate nfcall task");
+        return p;
+    }
+    task->job.function = promise_node_run;
+    task->job.arg = task;
+    task->fn = fn;
+    task->promise = promise_retain(p);
+    task->trace_start = 0;
+    task->argc = argc;
+    task->args = (PromiseValue*)(task + 1);
+    if (argc > 0) {
+        memcpy(task->args, args, argc * sizeof(PromiseValue));
+    }
+
+    if (!q_runtime_submit(&task->job)) {
+        free(task);
+        promise_reject(p, (PromiseValue)"No worker thread available");
+        promise_free(p); // The task's reference
+    }
+    return p;
+}
+
+// Arguments up to this many are gathered on the stack
+#define PROMISE_NFCALL_STACK_ARGS 16
+
+Promise* promise_nfcall_args(NodeFunction fn, size_t argc, ...) {
+    PromiseValue stack_args[PROMISE_NFCALL_STACK_ARGS];
+    PromiseValue* args = stack_args;
+    if (argc > PROMISE_NFCALL_STACK_ARGS) {
+        args = (PromiseValue*)malloc(argc * sizeof(PromiseValue));
+        if (!args) return NULL;
+    }
+
+    va_list ap;
+    va_start(ap, argc);
+    for (size_t i = 0; i < argc; ++i) {
+        args[i] = va_arg(ap, PromiseValue);
+    }
+    va_end(ap);
+
+    Promise* p = promise_nfapply(fn, args, argc);
+    if (args != stack_args) free(args);
+    return p;
+}
+
+
+// --- Q.nfcall() API Implementation (Sketch) ---
+typedef struct {
+    PromiseDeferred* deferred;
+    // Any other context needed by the NodeCallback wrapper
+} NFCALL_Context;
+
+// This is the actual callback that will be passed to the Node.js-style function
+static void nfcall_trampoline_callback(void* err, PromiseValue result, void* user_data) {
+    NFCALL_Context* context = (NFCALL_Context*)user_data;
+    if (!context || !context->deferred) return;
+
+    if (err) {
+        promise_defer_reject(context->deferred, err); // 'err' becomes the rejection reason
+    } else {
+        promise_defer_resolve(context->deferred, result); // 'result' becomes the fulfillment value
+    }
+    // The NFCALL_Context might need to be freed here if it was allocated per call.
     // free(context); // If context was dynamically allocated for this specific nfcall.
 }
 
@@ -1134,49 +3092,729 @@ Promise* promise_nfcall(NodeCallback node_fn_to_wrap, void* user_data_for_node_f
 }
 
 
-// --- PMLL Hardened Queue API (Sketch) ---
+// --- PMLL Hardened Queue ---
+// Write-ahead log layout: a 64-byte file header, then records appended back to
+// back, each a PMLLWalRecord followed by its payload padded to 8 bytes. An
+// OPERATION record carries a durable operation's payload; a DONE record (no
+// payload) marks the operation with the same sequence number finished. Each
+// record has a CRC-32 over its header and payload, so a torn append at the
+// end of the log is detected on replay and discarded.
+//
+// The file is mapped once with a fixed reservation and grows into it, so the
+// mapping never moves while producers copy records in. Producers append under
+// the queue lock and hand the operation to the committer thread, which msyncs
+// everything appended since its previous sync in one call and then releases
+// the whole batch to the workers (group commit). DONE records need no sync of
+// their own; they ride along with the next batch or the final sync. When no
+// logged operation is outstanding and the log has grown past a threshold, it
+// is truncated back to its header (checkpoint).
+
+#define PMLL_WAL_MAGIC "PMLLWAL1"
+#define PMLL_WAL_VERSION 1u
+#define PMLL_WAL_HEADER_SIZE 64
+#define PMLL_WAL_RECORD_MAGIC 0x524c4d50u // "PMLR"
+#define PMLL_WAL_RESERVE ((size_t)1 << 30) // Largest the log may grow to
+#define PMLL_WAL_GROWTH ((size_t)16 << 20)
+#define PMLL_WAL_CHECKPOINT ((size_t)64 << 20)
+#define PMLL_DEFAULT_WORKERS 4
+
+enum {
+    PMLL_RECORD_OPERATION = 1,
+    PMLL_RECORD_DONE = 2
+};
+
+typedef struct {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t reserved;
+    uint32_t length;   // Payload bytes
+    uint32_t checksum; // CRC-32 of this header (checksum field zero) and the payload
+    uint64_t sequence;
+} PMLLWalRecord;
+
+#define PMLL_WAL_RECORD_SIZE(length) ((sizeof(PMLLWalRecord) + (length) + 7) & ~(size_t)7)
+#define PMLL_WAL_DONE_SIZE PMLL_WAL_RECORD_SIZE(0)
+
+typedef struct PMLLOperation {
+    uint64_t sequence;         // Log sequence; 0 for operations that are not logged
+    size_t log_end;            // Must be durable up to here before it may run
+    void* payload;
+    size_t length;
+    on_fulfilled_callback operation_fn; // Unlogged operations only
+    on_rejected_callback error_fn;
+    void* user_data;
+    Promise* promise;          // Referenced; NULL for replayed operations
+    struct PMLLOperation* next;
+} PMLLOperation;
+
+typedef struct {
+    PMLLOperation* head;
+    PMLLOperation* tail;
+} PMLLOperationList;
+
 struct PMLL_HardenedResourceQueue {
-    const char* resource_id;
+    char* resource_id;
     bool persistent_queue_flag;
-    void* pmem_pool; // If persistent
-    // Internal queue for operations, logs, etc.
-    // pthread_mutex_t lock;
-    // ... other queue-specific data ...
+
+    // Write-ahead log (persistent queues only)
+    int wal_fd;
+    unsigned char* wal;        // PMLL_WAL_RESERVE bytes mapped; the file covers wal_file_size
+    size_t wal_file_size;
+    size_t wal_tail;           // Next append offset
+    size_t wal_synced;         // Everything before this offset is durable
+    size_t wal_reserved;       // Log space held back for DONE records of outstanding operations
+    uint64_t next_sequence;
+    size_t outstanding;        // Logged operations not yet marked done
+
+    PMLLOperationList committing; // Appended, waiting for the group commit
+    PMLLOperationList ready;      // Durable (or unlogged), waiting for a worker
+    PMLLOperationList replay;     // Found in the log at open, queued by pmll_queue_start()
+    size_t running;               // Operations on workers right now
+
+    pmll_operation_handler handler;
+    void* context;
+    pthread_t committer;
+    bool committer_started;
+    pthread_t* workers;
+    size_t worker_count;
+    bool closing;                 // pmll_queue_free() called: no new operations
+    bool stopping;                // Threads exit once their lists are empty
+
+    pthread_mutex_t lock;
+    pthread_cond_t commit_cond;   // Committer: operations to commit, or stopping
+    pthread_cond_t ready_cond;    // Workers: operations to run, or stopping
+    pthread_cond_t state_cond;    // Producers waiting for log space; pmll_queue_free() draining
+    PMLL_QueueStats stats;
 };
 
-PMLL_HardenedResourceQueue* pmll_queue_create(const char* resource_id, bool persistent_queue) {
-    // PMLL_HardenedResourceQueue* hq = (PMLL_HardenedResourceQueue*)malloc(sizeof(PMLL_HardenedResourceQueue));
-    // ... initialize ...
-    // If persistent, allocate hq in pmem, initialize pmem_pool, persistent locks, etc.
-    fprintf(stderr, "pmll_queue_create is not fully implemented in this sketch.\n");
+static uint32_t pmll_crc_table[256];
+static pthread_once_t pmll_crc_once = PTHREAD_ONCE_INIT;
+
+static void pmll_crc_init(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+        pmll_crc_table[i] = crc;
+    }
+}
+
+static uint32_t pmll_crc32(uint32_t crc, const void* data, size_t length) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i) {
+        crc = pmll_crc_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t pmll_record_checksum(const PMLLWalRecord* record, const void* payload) {
+    PMLLWalRecord header = *record;
+    header.checksum = 0;
+    uint32_t crc = pmll_crc32(0, &header, sizeof(header));
+    return pmll_crc32(crc, payload, record->length);
+}
+
+static void pmll_list_push(PMLLOperationList* list, PMLLOperation* op) {
+    op->next = NULL;
+    if (list->tail) {
+        list->tail->next = op;
+    } else {
+        list->head = op;
+    }
+    list->tail = op;
+}
+
+static PMLLOperation* pmll_list_pop(PMLLOperationList* list) {
+    PMLLOperation* op = list->head;
+    if (op) {
+        list->head = op->next;
+        if (!list->head) list->tail = NULL;
+    }
+    return op;
+}
+
+static void pmll_operation_free(PMLLOperation* op) {
+    promise_free(op->promise);
+    free(op->payload);
+    free(op);
+}
+
+// Makes the file cover at least `end` bytes. Size changes are metadata, which
+// msync() does not persist, so they are synced here (once per PMLL_WAL_GROWTH).
+// Must be called with hq->lock held.
+static bool pmll_wal_ensure(PMLL_HardenedResourceQueue* hq, size_t end) {
+    if (end <= hq->wal_file_size) {
+        return true;
+    }
+    size_t new_size = (end + PMLL_WAL_GROWTH - 1) / PMLL_WAL_GROWTH * PMLL_WAL_GROWTH;
+    if (new_size > PMLL_WAL_RESERVE) {
+        return false;
+    }
+    if (posix_fallocate(hq->wal_fd, (off_t)hq->wal_file_size, (off_t)(new_size - hq->wal_file_size)) != 0 ||
+        fdatasync(hq->wal_fd) != 0) {
+        perror("Failed to grow PMLL write-ahead log");
+        return false;
+    }
+    hq->wal_file_size = new_size;
+    return true;
+}
+
+// Appends one record and returns the log offset just past it, or 0 on failure.
+// Must be called with hq->lock held.
+static size_t pmll_wal_append(PMLL_HardenedResourceQueue* hq, uint16_t type, uint64_t sequence,
+                              const void* payload, size_t length) {
+    size_t size = PMLL_WAL_RECORD_SIZE(length);
+    if (!pmll_wal_ensure(hq, hq->wal_tail + size)) {
+        return 0;
+    }
+
+    PMLLWalRecord record;
+    record.magic = PMLL_WAL_RECORD_MAGIC;
+    record.type = type;
+    record.reserved = 0;
+    record.length = (uint32_t)length;
+    record.sequence = sequence;
+    record.checksum = pmll_record_checksum(&record, payload);
+
+    unsigned char* at = hq->wal + hq->wal_tail;
+    memcpy(at, &record, sizeof(record));
+    if (length > 0) {
+        memcpy(at + sizeof(record), payload, length);
+    }
+    memset(at + sizeof(record) + length, 0, size - sizeof(record) - length);
+    hq->wal_tail += size;
+    return hq->wal_tail;
+}
+
+// Truncates the log back to its header once nothing in it is needed any more.
+// Must be called with hq->lock held.
+static void pmll_wal_checkpoint(PMLL_HardenedResourceQueue* hq) {
+    if (hq->outstanding > 0 || hq->committing.head || hq->wal_tail == PMLL_WAL_HEADER_SIZE) {
+        return;
+    }
+    if (ftruncate(hq->wal_fd, PMLL_WAL_HEADER_SIZE) != 0) {
+        perror("Failed to checkpoint PMLL write-ahead log");
+        return;
+    }
+    hq->wal_file_size = PMLL_WAL_HEADER_SIZE;
+    hq->wal_tail = PMLL_WAL_HEADER_SIZE;
+    hq->wal_synced = PMLL_WAL_HEADER_SIZE;
+    // Regrow now so the next append does not pay for it; failure is retried then.
+    pmll_wal_ensure(hq, PMLL_WAL_GROWTH);
+}
+
+static bool pmll_wal_sync(PMLL_HardenedResourceQueue* hq, size_t start, size_t end) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t aligned = start & ~(page - 1);
+    if (end <= aligned) {
+        return true;
+    }
+    if (msync(hq->wal + aligned, end - aligned, MS_SYNC) != 0) {
+        perror("Failed to sync PMLL write-ahead log");
+        return false;
+    }
+    return true;
+}
+
+// Group commit: one msync covers every record appended since the last one.
+static void* pmll_committer_main(void* arg) {
+    PMLL_HardenedResourceQueue* hq = (PMLL_HardenedResourceQueue*)arg;
+
+    pthread_mutex_lock(&hq->lock);
+    while (true) {
+        while (!hq->committing.head && !hq->stopping) {
+            pthread_cond_wait(&hq->commit_cond, &hq->lock);
+        }
+        if (!hq->committing.head) {
+            break;
+        }
+
+        size_t start = hq->wal_synced;
+        size_t end = hq->wal_tail;
+        pthread_mutex_unlock(&hq->lock);
+        bool synced = pmll_wal_sync(hq, start, end);
+        pthread_mutex_lock(&hq->lock);
+
+        if (synced && end > hq->wal_synced) {
+            hq->wal_synced = end;
+        }
+        hq->stats.commit_batches++;
+        while (hq->committing.head && hq->committing.head->log_end <= end) {
+            PMLLOperation* op = pmll_list_pop(&hq->committing);
+            if (synced) {
+                hq->stats.committed++;
+                pmll_list_push(&hq->ready, op);
+            } else {
+                // Not known to be durable: fail it rather than run it.
+                hq->outstanding--;
+                hq->wal_reserved -= PMLL_WAL_DONE_SIZE;
+                pthread_mutex_unlock(&hq->lock);
+                promise_reject(op->promise, (void*)"Failed to make operation durable");
+                pmll_operation_free(op);
+                pthread_mutex_lock(&hq->lock);
+            }
+        }
+        pthread_cond_broadcast(&hq->ready_cond);
+        pthread_cond_broadcast(&hq->state_cond);
+    }
+    pthread_mutex_unlock(&hq->lock);
+    return NULL;
+}
+
+static void pmll_run_operation(PMLL_HardenedResourceQueue* hq, PMLLOperation* op) {
+    if (op->operation_fn) {
+        // Unlogged operation: settles like a then() callback, including adoption.
+        callback_adopted = NULL;
+        PromiseValue result = op->operation_fn(NULL, op->user_data);
+        Promise* adopted = callback_adopted == (Promise*)result ? callback_adopted : NULL;
+        callback_adopted = NULL;
+        if (adopted) {
+            promise_adopt_state(op->promise, adopted);
+        } else {
+            promise_resolve(op->promise, result);
+        }
+
+        pthread_mutex_lock(&hq->lock);
+        hq->stats.completed++;
+        return; // Caller unlocks
+    }
+
+    int status = -1;
+    for (int attempt = 0; attempt < PMLL_MAX_ATTEMPTS && status != 0; ++attempt) {
+        status = hq->handler(op->payload, op->length, hq->context);
+    }
+
+    pthread_mutex_lock(&hq->lock);
+    if (hq->persistent_queue_flag && op->sequence) {
+        if (pmll_wal_append(hq, PMLL_RECORD_DONE, op->sequence, NULL, 0) == 0) {
+            perror("Failed to mark PMLL operation done; it will be replayed");
+        }
+        hq->outstanding--;
+        hq->wal_reserved -= PMLL_WAL_DONE_SIZE;
+        if (hq->wal_tail >= PMLL_WAL_CHECKPOINT) {
+            pmll_wal_checkpoint(hq);
+        }
+    }
+    hq->stats.completed++;
+    if (status != 0) {
+        hq->stats.failed++;
+    }
+    pthread_mutex_unlock(&hq->lock);
+
+    if (status == 0) {
+        promise_resolve(op->promise, NULL);
+    } else {
+        promise_reject(op->promise, (void*)"Hardened operation failed");
+    }
+    pthread_mutex_lock(&hq->lock);
+}
+
+static void* pmll_worker_main(void* arg) {
+    PMLL_HardenedResourceQueue* hq = (PMLL_HardenedResourceQueue*)arg;
+
+    pthread_mutex_lock(&hq->lock);
+    while (true) {
+        while (!hq->ready.head && !hq->stopping) {
+            pthread_cond_wait(&hq->ready_cond, &hq->lock);
+        }
+        PMLLOperation* op = pmll_list_pop(&hq->ready);
+        if (!op) {
+            break; // Stopping and drained
+        }
+        hq->running++;
+        pthread_mutex_unlock(&hq->lock);
+
+        pmll_run_operation(hq, op); // Returns with the lock held
+        hq->running--;
+        pthread_cond_broadcast(&hq->state_cond);
+        pthread_mutex_unlock(&hq->lock);
+        pmll_operation_free(op);
+        pthread_mutex_lock(&hq->lock);
+    }
+    pthread_mutex_unlock(&hq->lock);
     return NULL;
 }
 
+static int pmll_sequence_compare(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Scans an existing log: unfinished operations go to hq->replay, the append
+// point is set just past the last intact record, and anything after it (a torn
+// append) is cut off so it can never be mistaken for a record later.
+//
+// Two passes over the mapping: the first validates records and collects the
+// DONE sequences, which are then sorted; the second copies out only the
+// operations a binary search finds no DONE for. Replay is O(records log
+// DONE records) however long the log grew between checkpoints.
+static bool pmll_wal_replay(PMLL_HardenedResourceQueue* hq, size_t file_size) {
+    if (file_size < PMLL_WAL_HEADER_SIZE || memcmp(hq->wal, PMLL_WAL_MAGIC, 8) != 0) {
+        fprintf(stderr, "%s is not a PMLL write-ahead log\n", hq->resource_id);
+        return false;
+    }
+    uint32_t version;
+    memcpy(&version, hq->wal + 8, sizeof(version));
+    if (version != PMLL_WAL_VERSION) {
+        fprintf(stderr, "Unsupported PMLL write-ahead log version %u\n", version);
+        return false;
+    }
+
+    size_t done_count = 0, done_capacity = 0;
+    uint64_t* done = NULL;
+    uint64_t max_sequence = 0;
+
+    size_t offset = PMLL_WAL_HEADER_SIZE;
+    while (offset + sizeof(PMLLWalRecord) <= file_size) {
+        PMLLWalRecord record;
+        memcpy(&record, hq->wal + offset, sizeof(record));
+        if (record.magic != PMLL_WAL_RECORD_MAGIC ||
+            record.length > file_size - offset - sizeof(record) ||
+            record.checksum != pmll_record_checksum(&record, hq->wal + offset + sizeof(record))) {
+            break;
+        }
+
+        if (record.sequence > max_sequence) {
+            max_sequence = record.sequence;
+        }
+        if (record.type == PMLL_RECORD_DONE) {
+            if (done_count == done_capacity) {
+                done_capacity = done_capacity ? done_capacity * 2 : 256;
+                uint64_t* grown = (uint64_t*)realloc(done, done_capacity * sizeof(uint64_t));
+                if (!grown) {
+                    // Replaying a finished operation again would be worse than failing
+                    perror("Failed to allocate PMLL replay index");
+                    free(done);
+                    return false;
+                }
+                done = grown;
+            }
+            done[done_count++] = record.sequence;
+        }
+        offset += PMLL_WAL_RECORD_SIZE(record.length);
+    }
+    if (done_count > 1) {
+        qsort(done, done_count, sizeof(uint64_t), pmll_sequence_compare);
+    }
+
+    // Keep operations without a DONE record, in log order.
+    for (size_t at = PMLL_WAL_HEADER_SIZE; at < offset;) {
+        PMLLWalRecord record;
+        memcpy(&record, hq->wal + at, sizeof(record));
+        const unsigned char* payload = hq->wal + at + sizeof(record);
+        at += PMLL_WAL_RECORD_SIZE(record.length);
+        if (record.type != PMLL_RECORD_OPERATION ||
+            (done_count && bsearch(&record.sequence, done, done_count, sizeof(uint64_t), pmll_sequence_compare))) {
+            continue;
+        }
+
+        PMLLOperation* op = (PMLLOperation*)calloc(1, sizeof(PMLLOperation));
+        if (op) op->payload = malloc(record.length ? record.length : 1);
+        if (!op || !op->payload) {
+            perror("Failed to allocate replayed PMLL operation");
+            free(op);
+            break;
+        }
+        memcpy(op->payload, payload, record.length);
+        op->length = record.length;
+        op->sequence = record.sequence;
+        pmll_list_push(&hq->replay, op);
+        hq->outstanding++;
+        hq->wal_reserved += PMLL_WAL_DONE_SIZE;
+        hq->stats.replayed++;
+    }
+    free(done);
+
+    hq->next_sequence = max_sequence + 1;
+    hq->wal_tail = offset;
+    hq->wal_synced = offset;
+    if (ftruncate(hq->wal_fd, (off_t)offset) != 0) {
+        perror("Failed to trim PMLL write-ahead log");
+        return false;
+    }
+    hq->wal_file_size = offset;
+    return pmll_wal_ensure(hq, offset + 1);
+}
+
+static bool pmll_wal_open(PMLL_HardenedResourceQueue* hq) {
+    const char* dir = getenv("PMLL_QUEUE_DIR");
+    char path[4096];
+    if (snprintf(path, sizeof(path), "%s/%s.wal", dir && *dir ? dir : ".", hq->resource_id) >= (int)sizeof(path)) {
+        fprintf(stderr, "PMLL write-ahead log path too long\n");
+        return false;
+    }
+
+    hq->wal_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    if (hq->wal_fd < 0 || fstat(hq->wal_fd, &st) != 0) {
+        perror("Failed to open PMLL write-ahead log");
+        return false;
+    }
+    void* map = mmap(NULL, PMLL_WAL_RESERVE, PROT_READ | PROT_WRITE, MAP_SHARED, hq->wal_fd, 0);
+    if (map == MAP_FAILED) {
+        perror("Failed to map PMLL write-ahead log");
+        return false;
+    }
+    hq->wal = (unsigned char*)map;
+
+    if (st.st_size > 0) {
+        return pmll_wal_replay(hq, (size_t)st.st_size);
+    }
+
+    // New log: write and sync the header before anything can depend on it.
+    hq->next_sequence = 1;
+    if (!pmll_wal_ensure(hq, PMLL_WAL_GROWTH)) {
+        return false;
+    }
+    uint32_t version = PMLL_WAL_VERSION;
+    memcpy(hq->wal, PMLL_WAL_MAGIC, 8);
+    memcpy(hq->wal + 8, &version, sizeof(version));
+    hq->wal_tail = PMLL_WAL_HEADER_SIZE;
+    hq->wal_synced = PMLL_WAL_HEADER_SIZE;
+    return pmll_wal_sync(hq, 0, PMLL_WAL_HEADER_SIZE);
+}
+
+PMLL_HardenedResourceQueue* pmll_queue_create(const char* resource_id, bool persistent_queue) {
+    if (!resource_id || !*resource_id) return NULL;
+    pthread_once(&pmll_crc_once, pmll_crc_init);
+
+    PMLL_HardenedResourceQueue* hq = (PMLL_HardenedResourceQueue*)calloc(1, sizeof(PMLL_HardenedResourceQueue));
+    if (!hq) {
+        perror("Failed to allocate PMLL hardened queue");
+        return NULL;
+    }
+    hq->resource_id = strdup(resource_id);
+    hq->persistent_queue_flag = persistent_queue;
+    hq->wal_fd = -1;
+    pthread_mutex_init(&hq->lock, NULL);
+    pthread_cond_init(&hq->commit_cond, NULL);
+    pthread_cond_init(&hq->ready_cond, NULL);
+    pthread_cond_init(&hq->state_cond, NULL);
+
+    bool ok = hq->resource_id != NULL;
+    if (ok && persistent_queue) {
+        ok = pmll_wal_open(hq) &&
+             pthread_create(&hq->committer, NULL, pmll_committer_main, hq) == 0;
+        hq->committer_started = ok;
+    }
+    if (!ok) {
+        pmll_queue_free(hq);
+        return NULL;
+    }
+    return hq;
+}
+
+bool pmll_queue_start(PMLL_HardenedResourceQueue* hq, size_t workers,
+                      pmll_operation_handler handler, void* context) {
+    if (!hq || !handler) return false;
+
+    pthread_mutex_lock(&hq->lock);
+    if (hq->handler || hq->closing) {
+        pthread_mutex_unlock(&hq->lock);
+        return false;
+    }
+    hq->handler = handler;
+    hq->context = context;
+
+    // Replayed operations run before anything submitted from now on.
+    if (hq->replay.head) {
+        hq->replay.tail->next = hq->ready.head;
+        if (!hq->ready.head) hq->ready.tail = hq->replay.tail;
+        hq->ready.head = hq->replay.head;
+        hq->replay.head = hq->replay.tail = NULL;
+    }
+
+    bool ok = true;
+    if (hq->worker_count == 0) {
+        size_t count = workers ? workers : PMLL_DEFAULT_WORKERS;
+        hq->workers = (pthread_t*)malloc(count * sizeof(pthread_t));
+        while (hq->workers && hq->worker_count < count &&
+               pthread_create(&hq->workers[hq->worker_count], NULL, pmll_worker_main, hq) == 0) {
+            hq->worker_count++;
+        }
+        ok = hq->worker_count > 0;
+        if (!ok) hq->handler = NULL;
+    }
+    pthread_cond_broadcast(&hq->ready_cond);
+    pthread_mutex_unlock(&hq->lock);
+    return ok;
+}
+
+static Promise* pmll_rejected(const char* reason) {
+    Promise* p = promise_create();
+    promise_reject(p, (void*)reason);
+    return p;
+}
+
+Promise* pmll_submit_durable(PMLL_HardenedResourceQueue* hq, const void* payload, size_t length) {
+    if (!hq || (!payload && length > 0)) return NULL;
+
+    PMLLOperation* op = (PMLLOperation*)calloc(1, sizeof(PMLLOperation));
+    Promise* promise = promise_create();
+    if (op) op->payload = malloc(length ? length : 1);
+    if (!op || !promise || !op->payload) {
+        if (op) free(op->payload);
+        free(op);
+        promise_reject(promise, (void*)"Failed to allocate hardened operation");
+        return promise;
+    }
+    memcpy(op->payload, payload, length);
+    op->length = length;
+    op->promise = promise_retain(promise);
+
+    pthread_mutex_lock(&hq->lock);
+    const char* error = NULL;
+    if (hq->closing) {
+        error = "Hardened queue closed";
+    } else if (!hq->handler) {
+        error = "Hardened queue has no handler; call pmll_queue_start()";
+    } else if (!hq->persistent_queue_flag) {
+        pmll_list_push(&hq->ready, op);
+        pthread_cond_signal(&hq->ready_cond);
+    } else {
+        size_t need = PMLL_WAL_RECORD_SIZE(length) + PMLL_WAL_DONE_SIZE;
+        if (PMLL_WAL_HEADER_SIZE + need > PMLL_WAL_RESERVE) {
+            error = "Hardened operation too large for the log";
+        }
+        // Back-pressure: wait until a checkpoint frees the log.
+        while (!error && hq->wal_tail + need + hq->wal_reserved > PMLL_WAL_RESERVE) {
+            pmll_wal_checkpoint(hq);
+            if (hq->wal_tail + need + hq->wal_reserved <= PMLL_WAL_RESERVE) break;
+            pthread_cond_wait(&hq->state_cond, &hq->lock);
+            if (hq->closing) error = "Hardened queue closed";
+        }
+        if (!error) {
+            op->sequence = hq->next_sequence++;
+            op->log_end = pmll_wal_append(hq, PMLL_RECORD_OPERATION, op->sequence, payload, length);
+            if (op->log_end == 0) {
+                error = "Failed to append to the write-ahead log";
+            } else {
+                hq->outstanding++;
+                hq->wal_reserved += PMLL_WAL_DONE_SIZE;
+                pmll_list_push(&hq->committing, op);
+                pthread_cond_signal(&hq->commit_cond);
+            }
+        }
+    }
+    pthread_mutex_unlock(&hq->lock);
+
+    if (error) {
+        promise_reject(promise, (void*)error);
+        pmll_operation_free(op);
+    }
+    return promise;
+}
+
 Promise* pmll_execute_hardened_operation(
     PMLL_HardenedResourceQueue* hq,
     on_fulfilled_callback operation_fn,
     on_rejected_callback error_fn,
     void* op_user_data) {
-    // 1. Create a deferred object for the promise to be returned.
-    // 2. Package the operation (op_fn, error_fn, user_data) into a task.
-    // 3. Enqueue this task into the hq's internal queue (potentially persistent).
-    // 4. The hq's worker mechanism would pick up tasks, execute operation_fn.
-    //    - On success, resolve the deferred with result.
-    //    - On failure, call error_fn. If error_fn recovers, resolve. Else, reject.
-    //    - Handle retries, logging, transactions as per hq's design.
-    // This is a complex component.
-    fprintf(stderr, "pmll_execute_hardened_operation is not fully implemented.\n");
-    PromiseDeferred* deferred = promise_defer_create(); // Or persistent if hq is
-    if (!deferred) return NULL; // Or return pre-rejected
-    // For now, immediately reject as it's not implemented.
-    promise_defer_reject(deferred, (void*)"Hardened operation not implemented");
-    return deferred->promise;
+    if (!hq || !operation_fn) {
+        return pmll_rejected("Invalid hardened operation");
+    }
+
+    PMLLOperation* op = (PMLLOperation*)calloc(1, sizeof(PMLLOperation));
+    Promise* promise = promise_create();
+    if (!op || !promise) {
+        free(op);
+        promise_reject(promise, (void*)"Failed to allocate hardened operation");
+        return promise;
+    }
+    op->operation_fn = operation_fn;
+    op->error_fn = error_fn;
+    op->user_data = op_user_data;
+    op->promise = promise_retain(promise);
+
+    pthread_mutex_lock(&hq->lock);
+    bool accepted = !hq->closing;
+    if (accepted && hq->worker_count == 0) {
+        // Start a pool on first use; durable operations still need pmll_queue_start().
+        hq->workers = (pthread_t*)malloc(PMLL_DEFAULT_WORKERS * sizeof(pthread_t));
+        while (hq->workers && hq->worker_count < PMLL_DEFAULT_WORKERS &&
+               pthread_create(&hq->workers[hq->worker_count], NULL, pmll_worker_main, hq) == 0) {
+            hq->worker_count++;
+        }
+        accepted = hq->worker_count > 0;
+    }
+    if (accepted) {
+        pmll_list_push(&hq->ready, op);
+        pthread_cond_signal(&hq->ready_cond);
+    }
+    pthread_mutex_unlock(&hq->lock);
+
+    if (!accepted) {
+        promise_reject(promise, (void*)"Hardened queue closed");
+        pmll_operation_free(op);
+    }
+    return promise;
+}
+
+void pmll_queue_get_stats(PMLL_HardenedResourceQueue* hq, PMLL_QueueStats* stats) {
+    if (!hq || !stats) return;
+    pthread_mutex_lock(&hq->lock);
+    *stats = hq->stats;
+    pthread_mutex_unlock(&hq->lock);
+}
+
+// An operation that will never run: unlogged ones go to error_fn; logged ones
+// stay in the log and are replayed when the queue is next opened.
+static void pmll_abandon(PMLLOperation* op, const char* reason) {
+    if (op->operation_fn && op->error_fn) {
+        promise_resolve(op->promise, op->error_fn((void*)reason, op->user_data));
+    } else {
+        promise_reject(op->promise, (void*)reason);
+    }
+    pmll_operation_free(op);
 }
 
 void pmll_queue_free(PMLL_HardenedResourceQueue* hq) {
-    // Free resources, close pmem pool if open, etc.
-    // free(hq);
-    fprintf(stderr, "pmll_queue_free is not fully implemented.\n");
+    if (!hq) return;
+
+    pthread_mutex_lock(&hq->lock);
+    hq->closing = true;
+    pthread_cond_broadcast(&hq->state_cond); // Producers waiting for log space give up
+    // With workers, let them run everything already accepted.
+    while (hq->worker_count > 0 && (hq->committing.head || hq->ready.head || hq->running > 0)) {
+        pthread_cond_wait(&hq->state_cond, &hq->lock);
+    }
+    hq->stopping = true;
+    pthread_cond_broadcast(&hq->commit_cond);
+    pthread_cond_broadcast(&hq->ready_cond);
+    pthread_mutex_unlock(&hq->lock);
+
+    if (hq->committer_started) {
+        pthread_join(hq->committer, NULL);
+    }
+    for (size_t i = 0; i < hq->worker_count; ++i) {
+        pthread_join(hq->workers[i], NULL);
+    }
+    free(hq->workers);
+
+    PMLLOperation* op;
+    while ((op = pmll_list_pop(&hq->ready)) != NULL) {
+        pmll_abandon(op, "Hardened queue closed");
+    }
+    while ((op = pmll_list_pop(&hq->replay)) != NULL) {
+        pmll_operation_free(op);
+    }
+
+    if (hq->wal) {
+        // DONE records appended since the last group commit.
+        pmll_wal_sync(hq, hq->wal_synced, hq->wal_tail);
+        munmap(hq->wal, PMLL_WAL_RESERVE);
+    }
+    if (hq->wal_fd >= 0) {
+        close(hq->wal_fd);
+    }
+    pthread_cond_destroy(&hq->state_cond);
+    pthread_cond_destroy(&hq->ready_cond);
+    pthread_cond_destroy(&hq->commit_cond);
+    pthread_mutex_destroy(&hq->lock);
+    free(hq->resource_id);
+    free(hq);
 }
 
 /*
@@ -1217,17 +3855,13 @@ Further Elaboration Points for Real-World Implementation:
         to avoid infinite recursion if `x` is a thenable that resolves to itself.
 
 5.  Persistent Memory (PMLL) Integration:
-    * Allocator: Use PMDK's `pmemobj_alloc`, `pmemobj_tx_alloc` for all promise structures,
-        callback queues, and potentially values if they need to be persistent.
-    * Pointers: Convert between `PMEMoid` (PMDK's persistent pointer) and `void*` using
-        `pmemobj_direct()`. All persistent pointers within structs must be `PMEMoid`.
-    * Transactions: Wrap state modifications (e.g., in `promise_settle_locked`, `callback_queue_add`
-        for persistent queues) in PMDK transactions (`TX_BEGIN`, `TX_ADD`, `TX_COMMIT`, `TX_END`)
-        to ensure atomicity and consistency in case of crashes.
-    * Root Object: A persistent promise system needs a root object in the pmem pool to locate
-        existing promises after a restart.
-    * Mutexes: Use persistent mutexes (`pthread_mutex_t` stored in pmem, initialized with
-        `POBJ_MUTEX_INIT` or similar, if using PMDK's helpers) for persistent data.
+    * Persistent promises live in a PromiseStore: an mmap'd regular file whose records are
+        updated with ordered msync flushes (spare copy, then header word), with a root
+        directory of named promises that promise_store_resume() walks after a restart.
+    * On real persistent memory (DAX), the msync calls in promise_store_flush() could become
+        cache-line flushes plus a fence (clwb/sfence); the record format would not change.
+    * Callback lists are deliberately not persisted: function pointers do not survive a
+        restart, so a resumed process attaches its callbacks again.
 
 6.  Event Loop Integration:
     * The sketched event loop is basic. In a real application, integrate with an existing
@@ -1247,8 +3881,8 @@ Further Elaboration Points for Real-World Implementation:
         is settled (either fulfilled or rejected).
 
 8.  Memory Management:
-    * Reference counting for promises can simplify lifetime management, especially in complex graphs
-        of chained promises. `promise_free` would decrement, and free only when count reaches zero.
+    * Promises are reference counted: `promise_retain` adds a reference and `promise_free` drops one;
+        the engine holds its own while callbacks, chained promises or timers still need a promise.
     * Clear rules for `PromiseValue` ownership: if a promise is fulfilled with dynamically allocated
         data, who is responsible for freeing it? Does the promise take ownership?
     * Callback data (`user_data`): The promise library generally shouldn't manage the lifetime of
@@ -0,0 +1,50 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Helpers shared by the programs in bench/: the clock they time with, the
+// busy-wait that stands in for callback work, latency sorting and
+// positional arguments. Each program is a single translation unit, so
+// everything here is static inline. Define the feature-test macro the
+// program needs (_POSIX_C_SOURCE or _GNU_SOURCE) before including it.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+// CLOCK_MONOTONIC in nanoseconds
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// CLOCK_MONOTONIC in seconds
+static inline double now_seconds(void) {
+    return now_ns() / 1e9;
+}
+
+// Keeps the CPU busy for `seconds`, like a callback doing real work
+static inline void spin_seconds(double seconds) {
+    double until = now_seconds() + seconds;
+    while (now_seconds() < until) {
+    }
+}
+
+// qsort() comparators for latency samples
+static inline int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static inline int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// argv[index] as a count, or `fallback` if it was not given
+static inline size_t arg_size(int argc, char** argv, int index, size_t fallback) {
+    return argc > index ? (size_t)atol(argv[index]) : fallback;
+}
+
+#endif // BENCH_H
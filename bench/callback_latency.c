@@ -0,0 +1,152 @@
+/*
+ * callback_latency - callback dispatch under contention on one promise.
+ *
+ * Every round, 32 threads register a listener on the same promise and
+ * then hammer it with q_promise_is_cancelled() while the main thread
+ * resolves it. The promise also carries a slow then-callback. Reported:
+ *
+ *   resolve_us     time q_promise_resolve() blocks the settling thread
+ *   latency p50/99 resolve -> listener start
+ *   stall_max_us   longest a contending thread waited for the promise lock
+ *
+ * Run once with inline dispatch and once with executor dispatch.
+ *
+ * Usage: bench_callback_latency [rounds] [callback_us]
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "cpm.h"
+#include "bench.h"
+#include <sched.h>
+
+#define THREADS 32
+
+static long callback_us = 50;
+
+typedef struct {
+    QPromise* promise;
+    double resolved_at;
+    double latencies[THREADS];
+    double stall_max;
+    int listeners_run;
+    int registered;
+    bool done;
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+} Round;
+
+typedef struct {
+    Round* round;
+    int index;
+} Contender;
+
+static void slow_then(QPromiseResult* result) {
+    (void)result;
+    spin_seconds(callback_us / 1e6);
+}
+
+static void on_settled(QPromise* promise, void* context) {
+    (void)promise;
+    Contender* contender = context;
+    Round* round = contender->round;
+    double started = now_ns() / 1e3;
+    spin_seconds(callback_us / 1e6);
+    
+    pthread_mutex_lock(&round->mutex);
+    round->latencies[contender->index] = started - round->resolved_at;
+    if (++round->listeners_run == THREADS) {
+        round->done = true;
+        pthread_cond_broadcast(&round->condition);
+    }
+    pthread_mutex_unlock(&round->mutex);
+}
+
+static void* contend(void* arg) {
+    Contender* contender = arg;
+    Round* round = contender->round;
+    
+    q_promise_on_settled(round->promise, on_settled, contender);
+    pthread_mutex_lock(&round->mutex);
+    round->registered++;
+    pthread_cond_broadcast(&round->condition);
+    pthread_mutex_unlock(&round->mutex);
+    
+    double stall_max = 0;
+    for (;;) {
+        double start = now_ns() / 1e3;
+        q_promise_is_cancelled(round->promise);
+        double stall = now_ns() / 1e3 - start;
+        if (stall > stall_max) stall_max = stall;
+        
+        pthread_mutex_lock(&round->mutex);
+        bool done = round->done;
+        if (done && stall_max > round->stall_max) round->stall_max = stall_max;
+        pthread_mutex_unlock(&round->mutex);
+        if (done) break;
+        sched_yield();
+    }
+    
+    return NULL;
+}
+
+static void run(QDispatchMode mode, const char* name, size_t rounds) {
+    size_t samples = rounds * THREADS;
+    double* latencies = malloc(samples * sizeof(double));
+    double resolve_total = 0;
+    double stall_max = 0;
+    if (!latencies) return;
+    
+    for (size_t r = 0; r < rounds; r++) {
+        Round round;
+        memset(&round, 0, sizeof(round));
+        pthread_mutex_init(&round.mutex, NULL);
+        pthread_cond_init(&round.condition, NULL);
+        round.promise = q_promise_new();
+        q_promise_set_dispatch(round.promise, mode);
+        q_promise_then(round.promise, slow_then);
+        
+        pthread_t threads[THREADS];
+        Contender contenders[THREADS];
+        for (int i = 0; i < THREADS; i++) {
+            contenders[i].round = &round;
+            contenders[i].index = i;
+            pthread_create(&threads[i], NULL, contend, &contenders[i]);
+        }
+        
+        pthread_mutex_lock(&round.mutex);
+        while (round.registered < THREADS) {
+            pthread_cond_wait(&round.condition, &round.mutex);
+        }
+        round.resolved_at = now_ns() / 1e3;
+        pthread_mutex_unlock(&round.mutex);
+        
+        q_promise_resolve(round.promise, NULL);
+        resolve_total += now_ns() / 1e3 - round.resolved_at;
+        
+        for (int i = 0; i < THREADS; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        
+        memcpy(&latencies[r * THREADS], round.latencies, sizeof(round.latencies));
+        if (round.stall_max > stall_max) stall_max = round.stall_max;
+        q_promise_free(round.promise);
+        pthread_cond_destroy(&round.condition);
+        pthread_mutex_destroy(&round.mutex);
+    }
+    
+    qsort(latencies, samples, sizeof(double), compare_doubles);
+    printf("callback_latency: dispatch=%s threads=%d callback_us=%ld resolve_us=%.1f "
+           "latency_p50_us=%.1f latency_p99_us=%.1f stall_max_us=%.1f\n",
+           name, THREADS, callback_us, resolve_total / rounds,
+           latencies[samples / 2], latencies[samples * 99 / 100], stall_max);
+    free(latencies);
+}
+
+int main(int argc, char** argv) {
+    size_t rounds = arg_size(argc, argv, 1, 100);
+    if (argc > 2) callback_us = atol(argv[2]);
+    if (rounds == 0) rounds = 1;
+    
+    run(Q_DISPATCH_INLINE, "inline", rounds);
+    run(Q_DISPATCH_EXECUTOR, "executor", rounds);
+    return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * cancel_abort - time-to-abort for a large install after the first fatal
+ * download error.
+ *
+ * Starts a local stand-in registry that drip-feeds large tarballs and drops
+ * the connection for one "fatal" package, points CPM_REGISTRY at it, and
+ * fetches every package through q_run_async() with a shared cancellation
+ * token. The first failure cancels the token; the benchmark reports how
+ * long it takes from there until every fetch promise has settled.
+ *
+ * Usage: bench_cancel_abort [packages] [fatal_index]
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "cpm.h"
+#include "bench.h"
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define DRIP_CHUNK 1024
+#define DRIP_INTERVAL_US 10000
+
+static void sleep_us(long us) {
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+// --- Stand-in registry ---
+
+static void* registry_connection(void* arg) {
+    int fd = (int)(long)arg;
+    char request[1024];
+    ssize_t n = recv(fd, request, sizeof(request) - 1, 0);
+    if (n <= 0) {
+        close(fd);
+        return NULL;
+    }
+    request[n] = '\0';
+    
+    if (strstr(request, "fatal")) {
+        // Fail after a short delay, like a registry returning garbage
+        sleep_us(20000);
+        close(fd);
+        return NULL;
+    }
+    
+    const char* header = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                         "Content-Length: 104857600\r\n\r\n";
+    send(fd, header, strlen(header), MSG_NOSIGNAL);
+    
+    char chunk[DRIP_CHUNK];
+    memset(chunk, 'x', sizeof(chunk));
+    while (send(fd, chunk, sizeof(chunk), MSG_NOSIGNAL) > 0) {
+        sleep_us(DRIP_INTERVAL_US);
+    }
+    
+    close(fd);
+    return NULL;
+}
+
+static void* registry_accept_loop(void* arg) {
+    int listener = (int)(long)arg;
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) continue;
+        
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, registry_connection, (void*)(long)fd) == 0) {
+            pthread_detach(thread);
+        } else {
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+static int registry_start(void) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) return -1;
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    
+    socklen_t len = sizeof(addr);
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listener, 1024) != 0 ||
+        getsockname(listener, (struct sockaddr*)&addr, &len) != 0) {
+        close(listener);
+        return -1;
+    }
+    
+    pthread_t thread;
+    pthread_create(&thread, NULL, registry_accept_loop, (void*)(long)listener);
+    pthread_detach(thread);
+    return ntohs(addr.sin_port);
+}
+
+// --- Install simulation ---
+
+typedef struct {
+    QCancelToken* token;
+    double first_failure_ms;
+    pthread_mutex_t mutex;
+} InstallState;
+
+static int fetch_tarball(void* arg, QCancelToken* token, void** result) {
+    char* url = arg;
+    HTTPResponse* response = http_get_cancellable(url, token);
+    if (!response) {
+        return q_cancel_token_is_cancelled(token) ? CPM_ERROR_CANCELLED : CPM_ERROR_NETWORK;
+    }
+    *result = response;
+    return CPM_SUCCESS;
+}
+
+static void on_fetch_settled(QPromise* promise, void* context) {
+    InstallState* state = context;
+    
+    if (promise->state == Q_FULFILLED) {
+        http_response_free(promise->result->data);
+        return;
+    }
+    
+    if (!promise->cancelled && !q_cancel_token_is_cancelled(state->token)) {
+        pthread_mutex_lock(&state->mutex);
+        if (state->first_failure_ms == 0) {
+            state->first_failure_ms = now_ns() / 1e6;
+        }
+        pthread_mutex_unlock(&state->mutex);
+        q_cancel_token_cancel(state->token, "Sibling download failed");
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t packages = arg_size(argc, argv, 1, 200);
+    size_t fatal_index = arg_size(argc, argv, 2, 3);
+    if (packages == 0) packages = 1;
+    if (fatal_index >= packages) fatal_index = packages - 1;
+    
+    int port = registry_start();
+    if (port < 0) {
+        fprintf(stderr, "cancel_abort: could not start stand-in registry\n");
+        return 1;
+    }
+    
+    char registry[64];
+    snprintf(registry, sizeof(registry), "http://127.0.0.1:%d", port);
+    setenv("CPM_REGISTRY", registry, 1);
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    
+    InstallState state;
+    state.token = q_cancel_token_new();
+    state.first_failure_ms = 0;
+    pthread_mutex_init(&state.mutex, NULL);
+    
+    char (*urls)[MAX_URL_LENGTH] = malloc(packages * sizeof(*urls));
+    QPromise** fetches = malloc(packages * sizeof(QPromise*));
+    if (!urls || !fetches || !state.token) {
+        fprintf(stderr, "cancel_abort: out of memory\n");
+        return 1;
+    }
+    
+    for (size_t i = 0; i < packages; i++) {
+        snprintf(urls[i], MAX_URL_LENGTH, "%s/%s-%zu/-/pkg.tgz", cpm_registry_url(),
+                 i == fatal_index ? "fatal" : "pkg", i);
+        fetches[i] = q_run_async(fetch_tarball, urls[i], state.token);
+        q_promise_on_settled(fetches[i], on_fetch_settled, &state);
+    }
+    
+    QPromise* settled = q_all_settled(fetches, packages);
+    q_promise_wait(settled);
+    double done_ms = now_ns() / 1e6;
+    
+    size_t aborted = 0;
+    for (size_t i = 0; i < packages; i++) {
+        if (i != fatal_index && fetches[i]->state == Q_REJECTED) {
+            aborted++;
+        }
+    }
+    
+    printf("cancel_abort: packages=%zu aborted=%zu time_to_abort_ms=%.3f\n",
+           packages, aborted, state.first_failure_ms ? done_ms - state.first_failure_ms : -1.0);
+    
+    q_all_settled_free(settled->result->data, packages);
+    q_promise_free(settled);
+    for (size_t i = 0; i < packages; i++) {
+        q_promise_free(fetches[i]);
+    }
+    free(fetches);
+    free(urls);
+    q_cancel_token_free(state.token);
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * event_loop_blocking - idle cost, wake-up latency and timer-wheel cost of
+ * run_event_loop_blocking().
+ *
+ * The loop runs on its own thread. For the blocking loop and, for
+ * comparison, a busy-polling run_event_loop() caller, reported are the
+ * loop thread's CPU use while idle for one second and the latency from
+ * enqueue_microtask() on another thread to the task starting (the loop is
+ * given time to fall asleep before every sample). Then the timer wheel:
+ * ns per add + cancel pair, and how late promise_delay()-style timers fire.
+ *
+ * Usage: bench_event_loop_blocking [wake_samples] [timers]
+ */
+#define _GNU_SOURCE
+#include "qpromise.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static int busy_stop;
+static size_t wake_samples;
+static uint64_t* latencies;
+static uint64_t sent_at;
+static size_t received;
+
+static uint64_t thread_cpu_ns(pthread_t thread) {
+    clockid_t clock;
+    struct timespec ts;
+    if (pthread_getcpuclockid(thread, &clock) != 0 || clock_gettime(clock, &ts) != 0) return 0;
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void* run_blocking(void* arg) {
+    (void)arg;
+    run_event_loop_blocking();
+    return NULL;
+}
+
+static void* run_busy(void* arg) {
+    (void)arg;
+    while (!__atomic_load_n(&busy_stop, __ATOMIC_ACQUIRE)) {
+        run_event_loop();
+    }
+    return NULL;
+}
+
+static void record_wake(void* data) {
+    (void)data;
+    latencies[received] = now_ns() - __atomic_load_n(&sent_at, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&received, received + 1, __ATOMIC_RELEASE);
+}
+
+static void measure_loop(const char* mode, void* (*loop)(void*)) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop, NULL);
+    usleep(50000);
+    
+    uint64_t cpu_start = thread_cpu_ns(thread);
+    uint64_t wall_start = now_ns();
+    sleep(1);
+    double idle_cpu = 100.0 * (thread_cpu_ns(thread) - cpu_start) / (double)(now_ns() - wall_start);
+    
+    received = 0;
+    for (size_t i = 0; i < wake_samples; i++) {
+        usleep(200); // Let the loop go back to sleep
+        __atomic_store_n(&sent_at, now_ns(), __ATOMIC_RELEASE);
+        enqueue_microtask(record_wake, NULL);
+        while (__atomic_load_n(&received, __ATOMIC_ACQUIRE) == i) {
+            sched_yield();
+        }
+    }
+    qsort(latencies, wake_samples, sizeof(uint64_t), compare_u64);
+    
+    if (loop == run_blocking) {
+        stop_event_loop();
+    } else {
+        __atomic_store_n(&busy_stop, 1, __ATOMIC_RELEASE);
+    }
+    pthread_join(thread, NULL);
+    busy_stop = 0;
+    
+    printf("event_loop_blocking: mode=%s idle_cpu_percent=%.2f wake_p50_us=%.1f wake_p99_us=%.1f wake_max_us=%.1f\n",
+           mode, idle_cpu, latencies[wake_samples / 2] / 1e3, latencies[wake_samples * 99 / 100] / 1e3,
+           latencies[wake_samples - 1] / 1e3);
+}
+
+static void note_fired(void* data) {
+    uint64_t due = (uint64_t)(uintptr_t)data;
+    latencies[received++] = now_ns() - due;
+}
+
+static void stop_loop(void* data) {
+    (void)data;
+    stop_event_loop();
+}
+
+static void measure_timers(size_t timers) {
+    EventLoopTimer** handles = malloc(timers * sizeof(EventLoopTimer*));
+    if (!handles) return;
+    
+    // Add + cancel across the whole wheel (up to an hour out)
+    srand(1);
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < timers; i++) {
+        handles[i] = event_loop_add_timer((unsigned long)rand() % 3600000ul, note_fired, NULL);
+    }
+    for (size_t i = 0; i < timers; i++) {
+        event_loop_cancel_timer(handles[i]);
+    }
+    double add_cancel_ns = (double)(now_ns() - start) / timers;
+    free(handles);
+    
+    // Firing accuracy for delays of 1-500 ms
+    size_t fired = timers < 2000 ? timers : 2000;
+    received = 0;
+    for (size_t i = 0; i < fired; i++) {
+        unsigned long delay = 1 + (unsigned long)rand() % 500;
+        event_loop_add_timer(delay, note_fired, (void*)(uintptr_t)(now_ns() + delay * 1000000ull));
+    }
+    event_loop_add_timer(600, stop_loop, NULL);
+    run_event_loop_blocking();
+    qsort(latencies, received, sizeof(uint64_t), compare_u64);
+    
+    printf("event_loop_blocking: timers=%zu add_cancel_ns=%.1f fired=%zu late_p50_ms=%.2f late_p99_ms=%.2f late_max_ms=%.2f\n",
+           timers, add_cancel_ns, received, latencies[received / 2] / 1e6, latencies[received * 99 / 100] / 1e6,
+           latencies[received - 1] / 1e6);
+}
+
+int main(int argc, char** argv) {
+    wake_samples = arg_size(argc, argv, 1, 2000);
+    size_t timers = arg_size(argc, argv, 2, 1000000);
+    if (wake_samples == 0) wake_samples = 1;
+    if (timers == 0) timers = 1;
+    
+    latencies = malloc((wake_samples > 2000 ? wake_samples : 2000) * sizeof(uint64_t));
+    if (!latencies) return 1;
+    
+    init_event_loop();
+    measure_loop("blocking", run_blocking);
+    measure_loop("busy_poll", run_busy);
+    measure_timers(timers);
+    free_event_loop();
+    
+    free(latencies);
+    return 0;
+}
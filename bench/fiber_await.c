@@ -0,0 +1,67 @@
+/*
+ * fiber_await - many in-flight install tasks on a handful of threads.
+ *
+ * Each task awaits three q_delay() timers in sequence, standing in for
+ * resolve -> fetch -> extract. Run as fibers, every task is suspended in
+ * q_await() at the same time while the worker pool stays at CPM_WORKERS
+ * threads. The same tasks on q_run_async() each pin a worker for the
+ * whole wait; that run is limited to a small sample.
+ *
+ * Usage: bench_fiber_await [tasks] [delay_ms]
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "cpm.h"
+#include "bench.h"
+#include <sys/resource.h>
+
+#define STEPS 3
+
+static unsigned long delay_ms = 10;
+
+static int install_task(void* arg, QCancelToken* token, void** result) {
+    (void)token;
+    for (int step = 0; step < STEPS; step++) {
+        QPromise* io = q_delay(delay_ms, arg);
+        AwaitResult awaited = q_await(io);
+        q_promise_free(io);
+        if (awaited.error) return CPM_ERROR_NETWORK;
+    }
+    *result = arg;
+    return CPM_SUCCESS;
+}
+
+static double run(QPromise* (*spawn)(QTaskFunction, void*, QCancelToken*), size_t tasks) {
+    QPromise** promises = malloc(tasks * sizeof(QPromise*));
+    if (!promises) return -1;
+    
+    double start = now_seconds();
+    for (size_t i = 0; i < tasks; i++) {
+        promises[i] = spawn(install_task, (void*)(i + 1), NULL);
+    }
+    for (size_t i = 0; i < tasks; i++) {
+        q_promise_wait(promises[i]);
+        q_promise_free(promises[i]);
+    }
+    double elapsed = now_seconds() - start;
+    
+    free(promises);
+    return elapsed;
+}
+
+int main(int argc, char** argv) {
+    size_t tasks = arg_size(argc, argv, 1, 20000);
+    if (argc > 2) delay_ms = (unsigned long)atol(argv[2]);
+    if (tasks == 0) tasks = 1;
+    
+    double fibers = run(q_fiber_spawn, tasks);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("fiber_await: mode=fiber tasks=%zu steps=%d delay_ms=%lu seconds=%.3f tasks_per_sec=%.0f max_rss_kb=%ld\n",
+           tasks, STEPS, delay_ms, fibers, tasks / fibers, usage.ru_maxrss);
+    
+    size_t sample = tasks < 200 ? tasks : 200;
+    double threads = run(q_run_async, sample);
+    printf("fiber_await: mode=thread tasks=%zu steps=%d delay_ms=%lu seconds=%.3f tasks_per_sec=%.0f\n",
+           sample, STEPS, delay_ms, threads, sample / threads);
+    return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * io_promises - one event-loop thread driving many concurrent I/O promises.
+ *
+ * Readiness: `sockets` socket pairs each get a promise_from_fd() wait, then
+ * a byte is written to every peer and run_event_loop_blocking() settles all
+ * the waits; reported as waits per second over several rounds.
+ *
+ * Completions: 4 KiB promise_read()s at random offsets of a scratch file,
+ * with `depth` kept in flight (each completion submits the next), against
+ * the same reads done one at a time with pread(); then promise_write()s the
+ * same way. Reported as operations per second.
+ *
+ * Usage: bench_io_promises [sockets] [depth] [operations]
+ */
+#define _GNU_SOURCE
+#include "qpromise.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define BLOCK 4096
+#define FILE_BLOCKS 4096 // 16 MiB scratch file
+#define ROUNDS 20
+
+static size_t remaining;   // Operations still to submit
+static size_t outstanding; // Operations submitted, not yet settled
+static size_t failures;
+static int scratch_fd;
+static char* buffers;
+static uint32_t seed = 2463534242u;
+
+static uint32_t next_random(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static void* run_loop(void* arg) {
+    (void)arg;
+    run_event_loop_blocking();
+    return NULL;
+}
+
+static PromiseValue consume_byte(PromiseValue value, void* user_data) {
+    char byte;
+    if (!((uintptr_t)value & PROMISE_FD_READABLE) || read((int)(intptr_t)user_data, &byte, 1) != 1) {
+        failures++;
+    }
+    if (--outstanding == 0) stop_event_loop();
+    return value;
+}
+
+static PromiseValue count_failure(PromiseValue reason, void* user_data) {
+    (void)user_data;
+    failures++;
+    if (--outstanding == 0) stop_event_loop();
+    return reason;
+}
+
+static void measure_readiness(size_t sockets) {
+    int (*pairs)[2] = malloc(sockets * sizeof(*pairs));
+    for (size_t i = 0; i < sockets; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pairs[i]) != 0) {
+            perror("io_promises: socketpair");
+            exit(1);
+        }
+    }
+    
+    double elapsed = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now_seconds();
+        outstanding = sockets;
+        for (size_t i = 0; i < sockets; i++) {
+            Promise* ready = promise_from_fd(pairs[i][0], PROMISE_FD_READABLE);
+            promise_free(promise_then(ready, consume_byte, count_failure, (void*)(intptr_t)pairs[i][0]));
+            promise_free(ready);
+        }
+        for (size_t i = 0; i < sockets; i++) {
+            if (write(pairs[i][1], "x", 1) != 1) failures++;
+        }
+        run_loop(NULL);
+        elapsed += now_seconds() - start;
+    }
+    
+    for (size_t i = 0; i < sockets; i++) {
+        close(pairs[i][0]);
+        close(pairs[i][1]);
+    }
+    free(pairs);
+    printf("io_promises: mode=fd_ready sockets=%zu rounds=%d waits_per_sec=%.0f failures=%zu\n",
+           sockets, ROUNDS, sockets * ROUNDS / elapsed, failures);
+}
+
+static void submit_next(size_t slot);
+
+static PromiseValue completed(PromiseValue value, void* user_data) {
+    if ((intptr_t)value != BLOCK) failures++;
+    outstanding--;
+    submit_next((size_t)(uintptr_t)user_data);
+    return value;
+}
+
+static PromiseValue failed(PromiseValue reason, void* user_data) {
+    failures++;
+    outstanding--;
+    submit_next((size_t)(uintptr_t)user_data);
+    return reason;
+}
+
+static bool writing;
+
+// Keeps `slot` busy with the next operation, or stops once all are done.
+static void submit_next(size_t slot) {
+    if (remaining == 0) {
+        if (outstanding == 0) stop_event_loop();
+        return;
+    }
+    remaining--;
+    outstanding++;
+    long long offset = (long long)(next_random() % FILE_BLOCKS) * BLOCK;
+    char* buffer = buffers + slot * BLOCK;
+    Promise* io = writing ? promise_write(scratch_fd, buffer, BLOCK, offset)
+                          : promise_read(scratch_fd, buffer, BLOCK, offset);
+    promise_free(promise_then(io, completed, failed, (void*)(uintptr_t)slot));
+    promise_free(io);
+}
+
+static double run_uring(size_t depth, size_t operations, bool write_mode) {
+    writing = write_mode;
+    remaining = operations;
+    outstanding = 0;
+    double start = now_seconds();
+    for (size_t slot = 0; slot < depth && remaining > 0; slot++) {
+        submit_next(slot);
+    }
+    run_loop(NULL);
+    return operations / (now_seconds() - start);
+}
+
+static double run_sync(size_t operations, bool write_mode) {
+    double start = now_seconds();
+    for (size_t i = 0; i < operations; i++) {
+        off_t offset = (off_t)(next_random() % FILE_BLOCKS) * BLOCK;
+        ssize_t done = write_mode ? pwrite(scratch_fd, buffers, BLOCK, offset)
+                                  : pread(scratch_fd, buffers, BLOCK, offset);
+        if (done != BLOCK) failures++;
+    }
+    return operations / (now_seconds() - start);
+}
+
+int main(int argc, char** argv) {
+    size_t sockets = arg_size(argc, argv, 1, 1000);
+    size_t depth = arg_size(argc, argv, 2, 1024);
+    size_t operations = arg_size(argc, argv, 3, 200000);
+    if (sockets == 0) sockets = 1;
+    if (depth == 0) depth = 1;
+    
+    init_event_loop();
+    measure_readiness(sockets);
+    
+    char path[] = "/tmp/io_promises_XXXXXX";
+    scratch_fd = mkstemp(path);
+    buffers = calloc(depth, BLOCK);
+    if (scratch_fd < 0 || !buffers) {
+        perror("io_promises: scratch file");
+        return 1;
+    }
+    unlink(path);
+    for (size_t i = 0; i < FILE_BLOCKS; i++) {
+        if (write(scratch_fd, buffers, BLOCK) != BLOCK) {
+            perror("io_promises: write");
+            return 1;
+        }
+    }
+    
+    const char* modes[] = { "read", "write" };
+    for (int m = 0; m < 2; m++) {
+        double uring = run_uring(depth, operations, m == 1);
+        double sync = run_sync(operations, m == 1);
+        printf("io_promises: mode=%s depth=%zu operations=%zu uring_ops_per_sec=%.0f sync_ops_per_sec=%.0f failures=%zu\n",
+               modes[m], depth, operations, uring, sync, failures);
+    }
+    
+    close(scratch_fd);
+    free(buffers);
+    free_event_loop();
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,53 @@
+/*
+ * map_limit - q_map_limit() throughput across concurrency limits.
+ *
+ * Each item stands in for a registry fetch with a fixed latency (a
+ * q_delay() timer). Throughput should grow with the limit until the
+ * per-item overhead of the promise machinery dominates.
+ *
+ * Usage: bench_map_limit [items] [latency_ms]
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "cpm.h"
+#include "bench.h"
+
+static unsigned long item_latency_ms = 1;
+
+static QPromise* fetch_item(void* item, size_t index) {
+    (void)index;
+    return q_delay(item_latency_ms, item);
+}
+
+int main(int argc, char** argv) {
+    size_t count = arg_size(argc, argv, 1, 2000);
+    if (argc > 2) item_latency_ms = (unsigned long)atol(argv[2]);
+    
+    void** items = malloc(count * sizeof(void*));
+    if (!items) return 1;
+    for (size_t i = 0; i < count; i++) {
+        items[i] = (void*)(i + 1);
+    }
+    
+    static const size_t limits[] = { 1, 4, 16, 64, 256, 1024 };
+    for (size_t l = 0; l < sizeof(limits) / sizeof(limits[0]); l++) {
+        double start = now_seconds();
+        QPromise* all = q_map_limit(items, count, fetch_item, limits[l]);
+        q_promise_wait(all);
+        double elapsed = now_seconds() - start;
+        
+        void** results = all->result->data;
+        bool ordered = all->state == Q_FULFILLED;
+        for (size_t i = 0; ordered && i < count; i++) {
+            ordered = results[i] == items[i];
+        }
+        
+        printf("map_limit: items=%zu latency_ms=%lu limit=%zu seconds=%.3f items_per_sec=%.0f ordered=%s\n",
+               count, item_latency_ms, limits[l], elapsed, count / elapsed, ordered ? "yes" : "no");
+        
+        free(results);
+        q_promise_free(all);
+    }
+    
+    free(items);
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * microtask_queue - enqueue_microtask() / run_event_loop() throughput with
+ * many producer threads and the single event-loop consumer.
+ *
+ * Producers each queue tasks as fast as they can while the consumer keeps
+ * draining. Reported per producer count: tasks per second end to end and
+ * the producers' enqueue rate.
+ *
+ * Usage: bench_microtask_queue [tasks]
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "qpromise.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static size_t executed;
+static size_t tasks_per_producer;
+static int producers_done;
+
+// Runs on the consumer only, so a plain counter is enough
+static void count_task(void* data) {
+    (void)data;
+    executed++;
+}
+
+static void* produce(void* arg) {
+    (void)arg;
+    for (size_t i = 0; i < tasks_per_producer; i++) {
+        enqueue_microtask(count_task, NULL);
+    }
+    __atomic_add_fetch(&producers_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    size_t total = arg_size(argc, argv, 1, 4000000);
+    static const int counts[] = { 1, 2, 4, 8, 16, 32 };
+
+    init_event_loop();
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        int producers = counts[c];
+        tasks_per_producer = total / producers;
+        size_t expected = tasks_per_producer * producers;
+        executed = 0;
+        producers_done = 0;
+
+        pthread_t threads[32];
+        double start = now_seconds();
+        for (int i = 0; i < producers; i++) {
+            pthread_create(&threads[i], NULL, produce, NULL);
+        }
+
+        double produced_at = 0;
+        while (executed < expected) {
+            run_event_loop();
+            if (produced_at == 0 && __atomic_load_n(&producers_done, __ATOMIC_ACQUIRE) == producers) {
+                produced_at = now_seconds();
+            }
+        }
+        double elapsed = now_seconds() - start;
+        if (produced_at == 0) produced_at = start + elapsed;
+
+        for (int i = 0; i < producers; i++) {
+            pthread_join(threads[i], NULL);
+        }
+
+        printf("microtask_queue: producers=%d tasks=%zu seconds=%.3f tasks_per_sec=%.0f enqueue_per_sec=%.0f\n",
+               producers, expected, elapsed, expected / elapsed, expected / (produced_at - start));
+    }
+    free_event_loop();
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * nfcall - blocking calls wrapped with promise_nfcall_args() vs. run inline
+ * in event-loop callbacks.
+ *
+ * A 1 ms timer on the event loop measures how late it fires (loop lag) while
+ * `jobs` FNV-1a hashes of a `kib` KiB buffer are done, each delivered as a
+ * Node.js-style (err, result) function. "inline" calls the function from a
+ * then() callback on the loop; "nfcall" hands it to promise_nfcall_args(), so
+ * the hashing runs on the shared worker pool. Reported per mode:
+ *
+ *   jobs/s          hashes completed per second
+ *   lag p50/max     milliseconds the 1 ms ticks fired late
+ *
+ * Usage: bench_nfcall [jobs] [kib]
+ */
+#define _GNU_SOURCE
+#include "qpromise.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_TICKS 100000
+
+static unsigned char* buffer;
+static size_t buffer_size;
+static size_t jobs_left;
+static size_t failures;
+static bool loop_done;
+static double tick_due;
+static double lags[MAX_TICKS];
+static size_t tick_count;
+
+// The wrapped blocking call: hash(args[0] = data, args[1] = size)
+static void hash_buffer(PromiseValue args[], size_t argc, NodeCallback callback, void* callback_data) {
+    const unsigned char* data = (const unsigned char*)args[0];
+    size_t size = argc > 1 ? (size_t)(uintptr_t)args[1] : 0;
+    uint64_t hash = 1469598103934665603ull;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    callback(NULL, (PromiseValue)(uintptr_t)(hash | 1), callback_data);
+}
+
+static PromiseValue hash_done(PromiseValue value, void* user_data) {
+    (void)user_data;
+    if (!value) failures++;
+    if (--jobs_left == 0) {
+        loop_done = true;
+        stop_event_loop();
+    }
+    return value;
+}
+
+static PromiseValue hash_failed(PromiseValue reason, void* user_data) {
+    failures++;
+    return hash_done(reason, user_data);
+}
+
+static void store_result(void* err, PromiseValue result, void* user_data) {
+    *(PromiseValue*)user_data = err ? NULL : result;
+}
+
+// Runs hash_buffer() right here, on the loop thread
+static PromiseValue hash_inline(PromiseValue value, void* user_data) {
+    (void)value;
+    (void)user_data;
+    PromiseValue args[2] = { buffer, (PromiseValue)(uintptr_t)buffer_size };
+    PromiseValue result = NULL;
+    hash_buffer(args, 2, store_result, &result);
+    return hash_done(result, NULL);
+}
+
+static void tick(void* data) {
+    double now = now_seconds();
+    if (tick_count < MAX_TICKS) {
+        lags[tick_count++] = (now - tick_due) * 1e3;
+    }
+    if (!loop_done) {
+        tick_due = now + 1e-3;
+        event_loop_add_timer(1, tick, data);
+    }
+}
+
+static void measure(const char* mode, bool offload, size_t jobs) {
+    jobs_left = jobs;
+    loop_done = false;
+    tick_count = 0;
+    
+    double start = now_seconds();
+    tick_due = start + 1e-3;
+    event_loop_add_timer(1, tick, NULL);
+    for (size_t i = 0; i < jobs; i++) {
+        Promise* job;
+        if (offload) {
+            job = promise_nfcall_args(hash_buffer, 2, (PromiseValue)buffer, (PromiseValue)(uintptr_t)buffer_size);
+            promise_free(promise_then(job, hash_done, hash_failed, NULL));
+        } else {
+            job = promise_create();
+            promise_free(promise_then(job, hash_inline, NULL, NULL));
+            promise_resolve(job, NULL);
+        }
+        promise_free(job);
+    }
+    run_event_loop_blocking();
+    double elapsed = now_seconds() - start;
+    
+    // The last tick may still be pending; let it fire and stop rescheduling
+    run_event_loop();
+    qsort(lags, tick_count, sizeof(double), compare_doubles);
+    printf("nfcall: mode=%s jobs=%zu kib=%zu jobs_per_sec=%.0f ticks=%zu lag_p50_ms=%.2f lag_max_ms=%.2f failures=%zu\n",
+           mode, jobs, buffer_size / 1024, jobs / elapsed, tick_count,
+           tick_count ? lags[tick_count / 2] : 0.0, tick_count ? lags[tick_count - 1] : 0.0, failures);
+}
+
+int main(int argc, char** argv) {
+    size_t jobs = arg_size(argc, argv, 1, 200);
+    size_t kib = arg_size(argc, argv, 2, 1024);
+    if (jobs == 0) jobs = 1;
+    if (kib == 0) kib = 1;
+    
+    buffer_size = kib * 1024;
+    buffer = malloc(buffer_size);
+    if (!buffer) return 1;
+    for (size_t i = 0; i < buffer_size; i++) {
+        buffer[i] = (unsigned char)(i * 31);
+    }
+    
+    init_event_loop();
+    measure("inline", false, jobs);
+    measure("nfcall", true, jobs);
+    free_event_loop();
+    free(buffer);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,215 @@
+/*
+ * pmll_queue - durable submit throughput and crash replay of the PMLL
+ * hardened queue.
+ *
+ * Producers submit operations with pmll_submit_durable() and wait for each
+ * one to settle (the promise's then() runs on a run_event_loop_blocking()
+ * thread) before sending the next, so throughput depends on how many
+ * submissions share one group commit. Reported per producer count:
+ * operations per second, msync batches and operations per batch.
+ *
+ * Before that, a forked child commits operations whose handler never returns and
+ * dies with them outstanding; the parent reopens the log and reports how
+ * many were replayed, the time to scan the log and the time to run them.
+ * This runs twice: on a log of only those operations, and on one where
+ * `done_operations` finished operations (an operation and a DONE record
+ * each) come first, as in a log that grew under steady load without
+ * reaching a checkpoint. One operation that never finishes is submitted
+ * ahead of them to keep the log from being checkpointed.
+ *
+ * The log goes to $PMLL_QUEUE_DIR, or a fresh directory under /tmp.
+ *
+ * Usage: bench_pmll_queue [operations] [crash_operations] [done_operations]
+ */
+#define _GNU_SOURCE
+#include "qpromise.h"
+#include "bench.h"
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PAYLOAD_SIZE 128
+
+static PMLL_HardenedResourceQueue* queue;
+static size_t operations_per_producer;
+static size_t handled;
+
+static int count_operation(const void* payload, size_t length, void* context) {
+    (void)payload;
+    (void)length;
+    (void)context;
+    __atomic_add_fetch(&handled, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// Operations whose payload starts with 'H' never return
+static int hang_marked_operation(const void* payload, size_t length, void* context) {
+    (void)length;
+    (void)context;
+    if (((const char*)payload)[0] == 'H') {
+        for (;;) pause();
+    }
+    return 0;
+}
+
+static PromiseValue post_settled(PromiseValue value, void* user_data) {
+    sem_post((sem_t*)user_data);
+    return value;
+}
+
+static void* run_loop(void* arg) {
+    (void)arg;
+    run_event_loop_blocking();
+    return NULL;
+}
+
+static void* produce(void* arg) {
+    size_t id = (size_t)arg;
+    char payload[PAYLOAD_SIZE];
+    sem_t settled;
+    sem_init(&settled, 0, 0);
+    
+    for (size_t i = 0; i < operations_per_producer; i++) {
+        snprintf(payload, sizeof(payload), "producer %zu operation %zu", id, i);
+        Promise* p = pmll_submit_durable(queue, payload, sizeof(payload));
+        Promise* done = promise_then(p, post_settled, post_settled, &settled);
+        sem_wait(&settled);
+        promise_free(done);
+        promise_free(p);
+    }
+    sem_destroy(&settled);
+    return NULL;
+}
+
+static void measure_producers(int producers, size_t total) {
+    static pthread_t threads[100];
+    operations_per_producer = total / producers;
+    size_t expected = operations_per_producer * producers;
+    
+    queue = pmll_queue_create("bench_pmll_queue", true);
+    if (!queue || !pmll_queue_start(queue, 4, count_operation, NULL)) {
+        fprintf(stderr, "pmll_queue: could not open the queue\n");
+        exit(1);
+    }
+    
+    double start = now_seconds();
+    for (int i = 0; i < producers; i++) {
+        pthread_create(&threads[i], NULL, produce, (void*)(size_t)i);
+    }
+    for (int i = 0; i < producers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = now_seconds() - start;
+    
+    PMLL_QueueStats stats;
+    pmll_queue_get_stats(queue, &stats);
+    pmll_queue_free(queue);
+    
+    printf("pmll_queue: producers=%d operations=%zu seconds=%.3f ops_per_sec=%.0f commit_batches=%zu ops_per_batch=%.1f\n",
+           producers, expected, elapsed, expected / elapsed, stats.commit_batches,
+           stats.commit_batches ? (double)stats.committed / stats.commit_batches : 0.0);
+}
+
+static void measure_replay(size_t count, size_t done_count) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/bench_pmll_crash.wal", getenv("PMLL_QUEUE_DIR"));
+    unlink(path);
+    
+    pid_t child = fork();
+    if (child == 0) {
+        // The first hanging operation pins one worker (and the log); the
+        // other worker finishes done_count operations, then hangs on the
+        // next. Once all of it is committed, die.
+        PMLL_HardenedResourceQueue* hq = pmll_queue_create("bench_pmll_crash", true);
+        if (!hq || !pmll_queue_start(hq, 2, hang_marked_operation, NULL)) _exit(1);
+        char hang[PAYLOAD_SIZE] = { 'H' };
+        char finish[PAYLOAD_SIZE] = { 0 };
+        PMLL_QueueStats stats;
+        
+        promise_free(pmll_submit_durable(hq, hang, sizeof(hang)));
+        for (size_t i = 0; i < done_count; i++) {
+            promise_free(pmll_submit_durable(hq, finish, sizeof(finish)));
+        }
+        do {
+            usleep(1000);
+            pmll_queue_get_stats(hq, &stats);
+        } while (stats.completed < done_count);
+        
+        for (size_t i = 1; i < count; i++) {
+            promise_free(pmll_submit_durable(hq, hang, sizeof(hang)));
+        }
+        do {
+            usleep(1000);
+            pmll_queue_get_stats(hq, &stats);
+        } while (stats.committed < count + done_count);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "pmll_queue: crash child failed\n");
+        exit(1);
+    }
+    
+    handled = 0;
+    double start = now_seconds();
+    PMLL_HardenedResourceQueue* hq = pmll_queue_create("bench_pmll_crash", true);
+    double scanned = now_seconds();
+    PMLL_QueueStats stats = { 0 };
+    pmll_queue_get_stats(hq, &stats);
+    pmll_queue_start(hq, 4, count_operation, NULL);
+    while (__atomic_load_n(&handled, __ATOMIC_RELAXED) < stats.replayed) {
+        usleep(100);
+    }
+    double finished = now_seconds();
+    pmll_queue_free(hq);
+    
+    printf("pmll_queue: crash_operations=%zu done_operations=%zu replayed=%zu scan_ms=%.2f replay_ms=%.2f\n",
+           count, done_count, stats.replayed, (scanned - start) * 1e3, (finished - scanned) * 1e3);
+}
+
+int main(int argc, char** argv) {
+    size_t total = arg_size(argc, argv, 1, 20000);
+    size_t crash_operations = arg_size(argc, argv, 2, 100000);
+    size_t done_operations = arg_size(argc, argv, 3, 1000000);
+    if (crash_operations == 0) crash_operations = 1;
+    static const int counts[] = { 1, 10, 100 };
+    
+    char dir[] = "/tmp/pmll_queue_XXXXXX";
+    bool own_dir = !getenv("PMLL_QUEUE_DIR");
+    if (own_dir) {
+        if (!mkdtemp(dir)) {
+            perror("pmll_queue: mkdtemp");
+            return 1;
+        }
+        setenv("PMLL_QUEUE_DIR", dir, 1);
+    }
+    const char* log_dir = getenv("PMLL_QUEUE_DIR");
+    
+    // Fork before any thread exists.
+    measure_replay(crash_operations, 0);
+    measure_replay(crash_operations, done_operations);
+    
+    init_event_loop();
+    pthread_t loop;
+    pthread_create(&loop, NULL, run_loop, NULL);
+    
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        measure_producers(counts[c], total);
+    }
+    
+    stop_event_loop();
+    pthread_join(loop, NULL);
+    free_event_loop();
+    
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/bench_pmll_queue.wal", log_dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/bench_pmll_crash.wal", log_dir);
+    unlink(path);
+    if (own_dir) rmdir(dir);
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * priority_lanes - keeping a fetch pipeline busy while CPU-bound callbacks
+ * share the event loop.
+ *
+ * `slots` simulated fetches (promise_delay() of `fetch_ms`) are kept in
+ * flight; each completion starts the next fetch and queues `work_us` of CPU
+ * work for the fetched item. In "fifo" mode that work shares the high lane
+ * with the completions, so a completion waits behind every work task queued
+ * before it; in "lanes" mode it is queued with PROMISE_PRIORITY_LOW and the
+ * completions overtake it. Reported per mode:
+ *
+ *   network_util    fetches * fetch_ms / (slots * time until the last fetch)
+ *   fetch_ms        time until the last fetch completed
+ *   total_ms        time until the last work task ran
+ *
+ * The starvation check floods the high lane with a self-requeueing task for
+ * 100 ms while low-lane tasks wait, and reports how many of them still ran.
+ *
+ * Usage: bench_priority_lanes [slots] [fetches] [fetch_ms] [work_us]
+ */
+#define _GNU_SOURCE
+#include "qpromise.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define FLOOD_MS 100
+#define FLOOD_LOW_TASKS 1000
+
+static size_t fetches_left;   // Fetches still to start
+static size_t work_left;      // Work tasks still to run
+static unsigned long fetch_delay;
+static double work_seconds;
+static bool use_lanes;
+static double last_fetch_at;
+
+static PromiseValue process_item(PromiseValue value, void* user_data) {
+    (void)user_data;
+    spin_seconds(work_seconds);
+    if (--work_left == 0) stop_event_loop();
+    return value;
+}
+
+static void start_fetch(void);
+
+static PromiseValue fetch_done(PromiseValue value, void* user_data) {
+    (void)user_data;
+    last_fetch_at = now_seconds();
+    start_fetch();
+    
+    Promise* work = promise_create();
+    if (use_lanes) {
+        promise_set_priority(work, PROMISE_PRIORITY_LOW);
+    }
+    promise_free(promise_then(work, process_item, NULL, NULL));
+    promise_resolve(work, value);
+    promise_free(work);
+    return value;
+}
+
+static void start_fetch(void) {
+    if (fetches_left == 0) return;
+    fetches_left--;
+    Promise* fetch = promise_delay(fetch_delay, NULL);
+    promise_free(promise_then(fetch, fetch_done, NULL, NULL));
+    promise_free(fetch);
+}
+
+static void measure(const char* mode, bool lanes, size_t slots, size_t fetches) {
+    use_lanes = lanes;
+    fetches_left = fetches;
+    work_left = fetches;
+    
+    double start = now_seconds();
+    for (size_t i = 0; i < slots; i++) {
+        start_fetch();
+    }
+    run_event_loop_blocking();
+    double total = now_seconds() - start;
+    double fetching = last_fetch_at - start;
+    
+    printf("priority_lanes: mode=%s slots=%zu fetches=%zu fetch_ms=%lu work_us=%.0f network_util=%.2f fetch_ms=%.1f total_ms=%.1f\n",
+           mode, slots, fetches, fetch_delay, work_seconds * 1e6,
+           fetches * (fetch_delay / 1e3) / (slots * fetching), fetching * 1e3, total * 1e3);
+}
+
+static size_t low_done;
+static size_t low_done_in_flood;
+static double flood_until;
+
+static void low_task(void* data) {
+    (void)data;
+    low_done++;
+}
+
+static void flood_task(void* data) {
+    if (now_seconds() < flood_until) {
+        enqueue_microtask_priority(flood_task, data, PROMISE_PRIORITY_HIGH);
+    } else {
+        low_done_in_flood = low_done;
+    }
+}
+
+static void measure_starvation(void) {
+    low_done = 0;
+    for (size_t i = 0; i < FLOOD_LOW_TASKS; i++) {
+        enqueue_microtask_priority(low_task, NULL, PROMISE_PRIORITY_LOW);
+    }
+    
+    flood_until = now_seconds() + FLOOD_MS / 1e3;
+    enqueue_microtask(flood_task, NULL);
+    
+    run_event_loop();
+    printf("priority_lanes: mode=starvation flood_ms=%d low_tasks=%d low_done_during_flood=%zu low_done=%zu\n",
+           FLOOD_MS, FLOOD_LOW_TASKS, low_done_in_flood, low_done);
+}
+
+int main(int argc, char** argv) {
+    size_t slots = arg_size(argc, argv, 1, 8);
+    size_t fetches = arg_size(argc, argv, 2, 400);
+    fetch_delay = argc > 3 ? (unsigned long)atol(argv[3]) : 2;
+    work_seconds = (argc > 4 ? atof(argv[4]) : 1000) / 1e6;
+    if (slots == 0) slots = 1;
+    if (fetches == 0) fetches = 1;
+    
+    init_event_loop();
+    measure("fifo", false, slots, fetches);
+    measure("lanes", true, slots, fetches);
+    measure_starvation();
+    free_event_loop();
+    return 0;
+}
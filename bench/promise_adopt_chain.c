@@ -0,0 +1,103 @@
+/*
+ * promise_adopt_chain - cost per link of long promise_then() chains whose
+ * callbacks return promises.
+ *
+ * Builds one chain of `links` promise_then() links, resolves its root and
+ * runs the event loop. Each callback produces value + 1 in one of three ways:
+ *   value     returns it directly (the floor: one hop per link)
+ *   settled   returns promise_adopt() of a promise already resolved with it,
+ *             which the chained promise adopts inline
+ *   pending   returns promise_adopt() of a pending promise that a separate
+ *             microtask resolves, standing in for real asynchronous work
+ * Reported: ns per link; the chain must end at `links`.
+ *
+ * Usage: bench_promise_adopt_chain [links]
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "qpromise.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef enum { RETURN_VALUE, RETURN_SETTLED, RETURN_PENDING } ReturnMode;
+
+static const char* mode_names[] = { "value", "settled", "pending" };
+
+typedef struct {
+    Promise* promise;
+    PromiseValue value;
+} DeferredResolve;
+
+static void resolve_later(void* data) {
+    DeferredResolve* deferred = data;
+    promise_resolve(deferred->promise, deferred->value);
+    promise_free(deferred->promise);
+    free(deferred);
+}
+
+static PromiseValue step(PromiseValue value, void* user_data) {
+    ReturnMode mode = (ReturnMode)(uintptr_t)user_data;
+    PromiseValue next = (PromiseValue)((uintptr_t)value + 1);
+    if (mode == RETURN_VALUE) return next;
+    
+    Promise* inner = promise_create();
+    DeferredResolve* deferred = mode == RETURN_PENDING ? malloc(sizeof(DeferredResolve)) : NULL;
+    if (deferred) {
+        deferred->promise = promise_retain(inner); // promise_adopt() takes ours
+        deferred->value = next;
+        enqueue_microtask(resolve_later, deferred);
+    } else {
+        promise_resolve(inner, next);
+    }
+    return promise_adopt(inner);
+}
+
+static PromiseValue record(PromiseValue value, void* user_data) {
+    *(uintptr_t*)user_data = (uintptr_t)value;
+    return value;
+}
+
+static double run(size_t links, ReturnMode mode, uintptr_t* result) {
+    Promise** chain = malloc((links + 2) * sizeof(Promise*));
+    if (!chain) return -1;
+    
+    chain[0] = promise_create();
+    for (size_t i = 1; i <= links; i++) {
+        chain[i] = promise_then(chain[i - 1], step, NULL, (void*)(uintptr_t)mode);
+    }
+    chain[links + 1] = promise_then(chain[links], record, NULL, result);
+    
+    uint64_t start = now_ns();
+    promise_resolve(chain[0], (PromiseValue)0);
+    run_event_loop();
+    double elapsed = (double)(now_ns() - start);
+    
+    for (size_t i = 0; i <= links + 1; i++) {
+        promise_free(chain[i]);
+    }
+    free(chain);
+    return elapsed / links;
+}
+
+int main(int argc, char** argv) {
+    size_t links = arg_size(argc, argv, 1, 1000000);
+    if (links == 0) links = 1;
+    
+    init_event_loop();
+    for (int mode = RETURN_VALUE; mode <= RETURN_PENDING; mode++) {
+        uintptr_t result = 0;
+        double ns = run(links, (ReturnMode)mode, &result);
+        if (ns < 0) {
+            fprintf(stderr, "promise_adopt_chain: out of memory\n");
+            return 1;
+        }
+        printf("promise_adopt_chain: mode=%s links=%zu ns_per_link=%.1f\n", mode_names[mode], links, ns);
+        if (result != links) {
+            fprintf(stderr, "promise_adopt_chain: chain ended at %zu, expected %zu\n", (size_t)result, links);
+            return 1;
+        }
+    }
+    free_event_loop();
+    return 0;
+}
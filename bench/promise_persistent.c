@@ -0,0 +1,132 @@
+/*
+ * promise_persistent - cost of file-backed persistent promises, and resuming
+ * them after a crash.
+ *
+ * First, create + resolve + free per promise for in-memory promises and for
+ * persistent ones, whose creation and settlement each flush their record.
+ * Then a forked child starts `installs` named persistent promises, attaching
+ * each one's progress as data, finishes every other one and dies without
+ * closing the store. The parent reopens the store, resumes the pending ones
+ * from their data and settles them, and reopens once more to confirm none
+ * is left. Reported: open and resume times and the counts found.
+ *
+ * Usage: bench_promise_persistent [promises] [installs]
+ */
+#define _GNU_SOURCE
+#include "qpromise.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static double settle_ns(PromiseStore* store, size_t count) {
+    double start = now_seconds();
+    for (size_t i = 0; i < count; i++) {
+        Promise* p = store ? promise_create_persistent(store, NULL) : promise_create();
+        promise_resolve(p, (PromiseValue)(i + 1));
+        promise_free(p);
+    }
+    return (now_seconds() - start) * 1e9 / count;
+}
+
+static void crash_mid_install(const char* path, size_t installs) {
+    PromiseStore* store = promise_store_open(path, installs);
+    if (!store) _exit(1);
+    for (size_t i = 0; i < installs; i++) {
+        char name[PROMISE_STORE_NAME_MAX];
+        char step[32];
+        snprintf(name, sizeof(name), "install:package-%zu", i);
+        snprintf(step, sizeof(step), "extracted %zu", i);
+        
+        Promise* p = promise_create_persistent(store, NULL);
+        if (!p || !promise_store_set_root(store, name, p) ||
+            !promise_persistent_set_data(p, step, strlen(step) + 1)) {
+            _exit(1);
+        }
+        if (i % 2 == 0) {
+            promise_resolve(p, (PromiseValue)0);
+        }
+        // Never freed: the process dies with the installs in flight.
+    }
+    _exit(0);
+}
+
+// Finishes an interrupted install from the progress it recorded.
+static void finish_install(const char* name, Promise* p, void* context) {
+    size_t* bad = (size_t*)context;
+    char step[PROMISE_STORE_DATA_MAX];
+    size_t length = promise_persistent_get_data(p, step, sizeof(step));
+    if (length == 0 || strncmp(step, "extracted ", 10) != 0 || strncmp(name, "install:", 8) != 0) {
+        (*bad)++;
+    }
+    promise_resolve(p, (PromiseValue)0);
+}
+
+static void count_pending(const char* name, Promise* p, void* context) {
+    (void)name;
+    (void)p;
+    (*(size_t*)context)++;
+}
+
+int main(int argc, char** argv) {
+    size_t count = arg_size(argc, argv, 1, 2000);
+    size_t installs = arg_size(argc, argv, 2, 1000);
+    if (count == 0) count = 1;
+    if (installs == 0) installs = 1;
+    
+    char path[] = "/tmp/promise_persistent_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("promise_persistent: mkstemp");
+        return 1;
+    }
+    close(fd);
+    unlink(path); // promise_store_open() creates it
+    
+    init_event_loop();
+    
+    PromiseStore* store = promise_store_open(path, 64);
+    if (!store) return 1;
+    settle_ns(NULL, count / 10 + 1);
+    double memory = settle_ns(NULL, count);
+    double persistent = settle_ns(store, count);
+    promise_store_close(store);
+    unlink(path);
+    printf("promise_persistent: promises=%zu in_memory_ns=%.1f persistent_ns=%.1f\n",
+           count, memory, persistent);
+    
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        crash_mid_install(path, installs);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "promise_persistent: crash child failed\n");
+        return 1;
+    }
+    
+    double start = now_seconds();
+    store = promise_store_open(path, installs);
+    double opened = now_seconds();
+    size_t bad = 0;
+    size_t resumed = store ? promise_store_resume(store, finish_install, &bad) : 0;
+    double finished = now_seconds();
+    promise_store_close(store);
+    
+    store = promise_store_open(path, installs);
+    size_t left = 0;
+    promise_store_resume(store, count_pending, &left);
+    promise_store_close(store);
+    unlink(path);
+    
+    run_event_loop();
+    free_event_loop();
+    
+    printf("promise_persistent: installs=%zu resumed=%zu bad_data=%zu pending_after=%zu open_ms=%.2f resume_ms=%.2f\n",
+           installs, resumed, bad, left, (opened - start) * 1e3, (finished - opened) * 1e3);
+    return resumed == installs / 2 && bad == 0 && left == 0 ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+/*
+ * promise_resolve_batch - settling bursts of I/O completions one promise at a
+ * time vs. with promise_resolve_batch().
+ *
+ * A completion thread stands in for a curl multi cycle: each round it
+ * finishes `burst` transfers at once, settles their promises (each with one
+ * then() callback) and waits until the run_event_loop_blocking() thread has
+ * run every callback, so the loop goes idle and must be woken for each
+ * burst. Reported per mode:
+ *
+ *   settle_ns       completion thread time per promise settled
+ *   callbacks/s     callbacks run per second of burst (settle -> last callback)
+ *   burst p50/p99   microseconds from the start of settling to the last callback
+ *
+ * Usage: bench_promise_resolve_batch [burst] [rounds]
+ */
+#define _GNU_SOURCE
+#include "qpromise.h"
+#include "bench.h"
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static size_t callbacks_run;
+static size_t callbacks_target;
+static double last_callback_at;
+
+static void* run_loop(void* arg) {
+    (void)arg;
+    run_event_loop_blocking();
+    return NULL;
+}
+
+// Runs on the loop thread only; the completion thread polls the counter
+static PromiseValue transfer_done(PromiseValue value, void* user_data) {
+    (void)user_data;
+    size_t run = callbacks_run + 1;
+    if (run == callbacks_target) {
+        last_callback_at = now_seconds();
+    }
+    __atomic_store_n(&callbacks_run, run, __ATOMIC_RELEASE);
+    return value;
+}
+
+static void measure(const char* mode, bool batched, size_t burst, size_t rounds) {
+    Promise** promises = malloc(burst * sizeof(Promise*));
+    PromiseValue* values = malloc(burst * sizeof(PromiseValue));
+    double* latencies = malloc(rounds * sizeof(double));
+    if (!promises || !values || !latencies) exit(1);
+    
+    double settling = 0, bursting = 0;
+    callbacks_run = 0;
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < burst; i++) {
+            promises[i] = promise_create();
+            values[i] = (PromiseValue)(uintptr_t)(i + 1);
+            promise_free(promise_then(promises[i], transfer_done, NULL, NULL));
+        }
+        callbacks_target = (r + 1) * burst;
+        
+        double start = now_seconds();
+        if (batched) {
+            promise_resolve_batch(promises, values, burst);
+        } else {
+            for (size_t i = 0; i < burst; i++) {
+                promise_resolve(promises[i], values[i]);
+            }
+        }
+        settling += now_seconds() - start;
+        
+        while (__atomic_load_n(&callbacks_run, __ATOMIC_ACQUIRE) < callbacks_target) {
+            sched_yield();
+        }
+        latencies[r] = (last_callback_at - start) * 1e6;
+        bursting += last_callback_at - start;
+        
+        for (size_t i = 0; i < burst; i++) {
+            promise_free(promises[i]);
+        }
+    }
+    
+    qsort(latencies, rounds, sizeof(double), compare_doubles);
+    if (mode) {
+        printf("promise_resolve_batch: mode=%s burst=%zu rounds=%zu settle_ns=%.1f callbacks_per_sec=%.0f burst_p50_us=%.1f burst_p99_us=%.1f\n",
+               mode, burst, rounds, settling * 1e9 / (burst * rounds), burst * rounds / bursting,
+               latencies[rounds / 2], latencies[rounds * 99 / 100]);
+    }
+    
+    free(promises);
+    free(values);
+    free(latencies);
+}
+
+int main(int argc, char** argv) {
+    size_t burst = arg_size(argc, argv, 1, 200);
+    size_t rounds = arg_size(argc, argv, 2, 2000);
+    if (burst == 0) burst = 1;
+    if (rounds == 0) rounds = 1;
+    
+    init_event_loop();
+    pthread_t loop;
+    pthread_create(&loop, NULL, run_loop, NULL);
+    
+    measure(NULL, false, burst, rounds / 10 + 1); // Warm-up, not reported
+    measure("single", false, burst, rounds);
+    measure("batch", true, burst, rounds);
+    
+    stop_event_loop();
+    pthread_join(loop, NULL);
+    free_event_loop();
+    return 0;
+}
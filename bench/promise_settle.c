@@ -0,0 +1,54 @@
+/*
+ * promise_settle - cost of one promise's life in the Q Promises engine:
+ * create, attach `thens` callbacks with promise_then(), resolve, run the
+ * callbacks on the event loop, free. Reported: ns per promise for 1, 2
+ * and 4 callbacks (the chained promises are freed too).
+ *
+ * Usage: bench_promise_settle [promises]
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "qpromise.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_THENS 4
+
+static PromiseValue pass(PromiseValue value, void* user_data) {
+    (void)user_data;
+    return value;
+}
+
+static double run(size_t count, size_t thens) {
+    Promise* chained[MAX_THENS];
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        Promise* p = promise_create();
+        for (size_t t = 0; t < thens; t++) {
+            chained[t] = promise_then(p, pass, NULL, NULL);
+        }
+        promise_resolve(p, (PromiseValue)(uintptr_t)i);
+        run_event_loop();
+        for (size_t t = 0; t < thens; t++) {
+            promise_free(chained[t]);
+        }
+        promise_free(p);
+    }
+    return (double)(now_ns() - start) / count;
+}
+
+int main(int argc, char** argv) {
+    size_t count = arg_size(argc, argv, 1, 1000000);
+    static const size_t thens[] = { 1, 2, 4 };
+    if (count == 0) count = 1;
+    
+    init_event_loop();
+    run(count / 10, 1); // Warm up the allocator
+    for (size_t i = 0; i < sizeof(thens) / sizeof(thens[0]); i++) {
+        printf("promise_settle: promises=%zu thens=%zu ns_per_promise=%.1f\n",
+               count, thens[i], run(count, thens[i]));
+    }
+    free_event_loop();
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * promise_soak - memory stability of the Q Promises engine under sustained
+ * load.
+ *
+ * Repeatedly builds a small promise graph, dropping every handle as soon as
+ * it is created: a root with two then() callbacks, one of which returns an
+ * adopted inner promise, plus a then() on a chained promise. The engine's
+ * own references are all that keep the graph alive until it settles. Every
+ * `interval` seconds it prints the promise count and resident set size; at
+ * the end, RSS after warm-up vs. at the end. For the 24-hour soak run it
+ * with 86400 seconds.
+ *
+ * Usage: bench_promise_soak [seconds] [interval]
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "qpromise.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define BATCH 1024
+
+static long rss_kb(void) {
+    long pages = 0, resident = 0;
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (!file) return -1;
+    if (fscanf(file, "%ld %ld", &pages, &resident) != 2) resident = -1;
+    fclose(file);
+    return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static PromiseValue increment(PromiseValue value, void* user_data) {
+    (void)user_data;
+    return (PromiseValue)((uintptr_t)value + 1);
+}
+
+static PromiseValue adopt_settled(PromiseValue value, void* user_data) {
+    (void)user_data;
+    Promise* inner = promise_create();
+    promise_resolve(inner, value);
+    return promise_adopt(inner);
+}
+
+// Builds and drops one graph; returns the number of promises it created.
+static size_t churn(uintptr_t i) {
+    Promise* root = promise_create();
+    Promise* a = promise_then(root, increment, NULL, NULL);
+    Promise* b = promise_then(root, adopt_settled, NULL, NULL);
+    Promise* c = promise_then(a, increment, NULL, NULL);
+    promise_free(a);
+    promise_free(b);
+    promise_free(c);
+    promise_resolve(root, (PromiseValue)i);
+    promise_free(root);
+    return 5;
+}
+
+int main(int argc, char** argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 10;
+    double interval = argc > 2 ? atof(argv[2]) : 1;
+    if (interval <= 0) interval = 1;
+    
+    init_event_loop();
+    double start = now_seconds();
+    double next_report = start + interval;
+    long rss_warm = -1, rss_max = 0;
+    uint64_t promises = 0;
+    
+    for (uintptr_t i = 0; now_seconds() - start < seconds; i++) {
+        for (size_t b = 0; b < BATCH; b++) {
+            promises += churn(i * BATCH + b);
+        }
+        run_event_loop();
+        
+        double now = now_seconds();
+        if (now >= next_report) {
+            long rss = rss_kb();
+            if (rss_warm < 0) rss_warm = rss;
+            if (rss > rss_max) rss_max = rss;
+            printf("promise_soak: elapsed=%.0f promises=%llu rss_kb=%ld\n",
+                   now - start, (unsigned long long)promises, rss);
+            fflush(stdout);
+            next_report += interval;
+        }
+    }
+    
+    double elapsed = now_seconds() - start;
+    long rss_end = rss_kb();
+    if (rss_warm < 0) rss_warm = rss_end;
+    if (rss_end > rss_max) rss_max = rss_end;
+    printf("promise_soak: seconds=%.1f promises=%llu promises_per_sec=%.0f rss_warm_kb=%ld rss_end_kb=%ld rss_max_kb=%ld\n",
+           elapsed, (unsigned long long)promises, promises / elapsed, rss_warm, rss_end, rss_max);
+    free_event_loop();
+    return 0;
+}
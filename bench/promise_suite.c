@@ -0,0 +1,375 @@
+/*
+ * promise_suite - microbenchmarks of both promise engines, as JSON.
+ *
+ * One record per measurement, so two builds can be compared by diffing
+ * their output (`make bench-promises` writes it to a file):
+ *
+ *   create_resolve_free  create + resolve + free, ns per promise
+ *   then_chain           a chain of `depth` then()s off a pending promise,
+ *                        settled link by link by the event loop; links/s
+ *   fan_out_in           `width` promises joined back into one, from 10 to
+ *                        1M wide: q_all() over settled inputs, and
+ *                        promise_all() over pending
+ *                        inputs resolved afterwards; ns per input
+ *   cross_thread         resolve on one thread -> observed on another
+ *                        (q_promise_wait() / the blocking event loop), p50
+ *                        and p99 microseconds
+ *   enqueue              enqueue_microtask() from 1 and 4 producers while
+ *                        the loop drains, and q_executor_submit() jobs;
+ *                        operations per second
+ *
+ * Usage: bench_promise_suite [output.json] [scale]
+ *   scale multiplies the iteration counts (default 1); widths are fixed.
+ */
+#define _GNU_SOURCE
+#include "cpm.h"
+#include "qpromise.h"
+#include "bench.h"
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define LATENCY_SAMPLES 1000
+
+static FILE* out;
+static bool first_record = true;
+static double scale = 1;
+
+static size_t scaled(size_t count) {
+    size_t n = (size_t)(count * scale);
+    return n ? n : 1;
+}
+
+// Starts a record; the caller adds `"key": value` fields and ends it with "}"
+static void record_begin(const char* name, const char* engine) {
+    fprintf(out, "%s\n    {\"name\": \"%s\", \"engine\": \"%s\"", first_record ? "" : ",", name, engine);
+    first_record = false;
+}
+
+// --- create_resolve_free ---
+
+static void bench_create_resolve_free(void) {
+    size_t count = scaled(1000000);
+    
+    double start = now_seconds();
+    for (size_t i = 0; i < count; i++) {
+        QPromise* p = q_promise_new();
+        q_promise_resolve(p, (void*)(i + 1));
+        q_promise_free(p);
+    }
+    double cpm = now_seconds() - start;
+    
+    start = now_seconds();
+    for (size_t i = 0; i < count; i++) {
+        Promise* p = promise_create();
+        promise_resolve(p, (PromiseValue)(i + 1));
+        promise_free(p);
+    }
+    run_event_loop();
+    double qp = now_seconds() - start;
+    
+    record_begin("create_resolve_free", "cpm");
+    fprintf(out, ", \"promises\": %zu, \"ns_per_op\": %.1f}", count, cpm * 1e9 / count);
+    record_begin("create_resolve_free", "qpromise");
+    fprintf(out, ", \"promises\": %zu, \"ns_per_op\": %.1f}", count, qp * 1e9 / count);
+}
+
+// --- then_chain ---
+
+static size_t chains_done;
+
+static PromiseValue pass_value(PromiseValue value, void* user_data) {
+    (void)user_data;
+    return value;
+}
+
+static PromiseValue count_chain(PromiseValue value, void* user_data) {
+    (void)user_data;
+    chains_done++;
+    return value;
+}
+
+static void bench_then_chain(void) {
+    static const size_t depths[] = { 1, 10, 100, 1000, 10000 };
+    size_t links = scaled(1000000);
+    
+    for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+        size_t depth = depths[d];
+        size_t chains = links / depth ? links / depth : 1;
+        chains_done = 0;
+        
+        double start = now_seconds();
+        for (size_t c = 0; c < chains; c++) {
+            Promise* root = promise_create();
+            Promise* tail = promise_retain(root);
+            for (size_t i = 1; i < depth; i++) {
+                Promise* next = promise_then(tail, pass_value, NULL, NULL);
+                promise_free(tail); // The callback entry keeps its own reference
+                tail = next;
+            }
+            promise_free(promise_then(tail, count_chain, NULL, NULL));
+            promise_free(tail);
+            promise_resolve(root, (PromiseValue)c);
+            promise_free(root);
+            run_event_loop();
+        }
+        double elapsed = now_seconds() - start;
+        
+        record_begin("then_chain", "qpromise");
+        fprintf(out, ", \"depth\": %zu, \"chains\": %zu, \"completed\": %zu, \"links_per_sec\": %.0f}",
+                depth, chains, chains_done, chains * depth / elapsed);
+    }
+}
+
+// --- fan_out_in ---
+
+static size_t fan_completions;
+
+// Counts an aggregate whose results came back in input order
+static PromiseValue fan_in(PromiseValue value, void* user_data) {
+    PromiseValue* results = (PromiseValue*)value;
+    size_t width = (size_t)(uintptr_t)user_data;
+    if (results[0] == (PromiseValue)1 && results[width - 1] == (PromiseValue)width) {
+        fan_completions++;
+    }
+    free(results);
+    return NULL;
+}
+
+static void bench_fan_out_in(void) {
+    static const size_t widths[] = { 10, 100, 1000, 10000, 100000, 1000000 };
+    size_t budget = scaled(2000000); // Inputs per width, split over rounds
+    
+    for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+        size_t width = widths[w];
+        size_t rounds = budget / width ? budget / width : 1;
+        QPromise** inputs = malloc(width * sizeof(QPromise*));
+        if (!inputs) return;
+        
+        size_t joined = 0;
+        double start = now_seconds();
+        for (size_t r = 0; r < rounds; r++) {
+            for (size_t i = 0; i < width; i++) {
+                inputs[i] = q_promise_new();
+                q_promise_resolve(inputs[i], (void*)(i + 1));
+            }
+            QPromise* all = q_all(inputs, width);
+            if (all && all->state == Q_FULFILLED) {
+                joined++;
+                free(all->result->data);
+            }
+            q_promise_free(all);
+            for (size_t i = 0; i < width; i++) {
+                q_promise_free(inputs[i]);
+            }
+        }
+        double cpm = now_seconds() - start;
+        free(inputs);
+        
+        Promise** pending = malloc(width * sizeof(Promise*));
+        if (!pending) return;
+        fan_completions = 0;
+        start = now_seconds();
+        for (size_t r = 0; r < rounds; r++) {
+            for (size_t i = 0; i < width; i++) {
+                pending[i] = promise_create();
+            }
+            Promise* all = promise_all(pending, width);
+            promise_free(promise_then(all, fan_in, NULL, (void*)(uintptr_t)width));
+            promise_free(all);
+            for (size_t i = 0; i < width; i++) {
+                promise_resolve(pending[i], (PromiseValue)(i + 1));
+                promise_free(pending[i]);
+            }
+            run_event_loop();
+        }
+        double qp = now_seconds() - start;
+        free(pending);
+        
+        record_begin("fan_out_in", "cpm");
+        fprintf(out, ", \"width\": %zu, \"rounds\": %zu, \"completed\": %zu, \"ns_per_input\": %.1f}",
+                width, rounds, joined, cpm * 1e9 / (rounds * width));
+        record_begin("fan_out_in", "qpromise");
+        fprintf(out, ", \"width\": %zu, \"rounds\": %zu, \"completed\": %zu, \"ns_per_input\": %.1f}",
+                width, rounds, fan_completions, qp * 1e9 / (rounds * width));
+    }
+}
+
+// --- cross_thread ---
+
+static QPromise* cpm_targets[LATENCY_SAMPLES];
+static double observed_at[LATENCY_SAMPLES];
+static size_t observed;
+
+static void* cpm_waiter(void* arg) {
+    (void)arg;
+    for (size_t i = 0; i < LATENCY_SAMPLES; i++) {
+        q_promise_wait(cpm_targets[i]);
+        observed_at[i] = now_seconds();
+        __atomic_store_n(&observed, i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static PromiseValue mark_observed(PromiseValue value, void* user_data) {
+    size_t i = (size_t)(uintptr_t)user_data;
+    observed_at[i] = now_seconds();
+    __atomic_store_n(&observed, i + 1, __ATOMIC_RELEASE);
+    return value;
+}
+
+static void* run_loop(void* arg) {
+    (void)arg;
+    run_event_loop_blocking();
+    return NULL;
+}
+
+static void report_latency(const char* engine, double* resolved_at) {
+    double latencies[LATENCY_SAMPLES];
+    for (size_t i = 0; i < LATENCY_SAMPLES; i++) {
+        latencies[i] = (observed_at[i] - resolved_at[i]) * 1e6;
+    }
+    qsort(latencies, LATENCY_SAMPLES, sizeof(double), compare_doubles);
+    record_begin("cross_thread", engine);
+    fprintf(out, ", \"samples\": %d, \"p50_us\": %.1f, \"p99_us\": %.1f}",
+            LATENCY_SAMPLES, latencies[LATENCY_SAMPLES / 2], latencies[LATENCY_SAMPLES * 99 / 100]);
+}
+
+// Sample i is resolved once the observer has seen i - 1 and had time to block
+static void bench_cross_thread(void) {
+    static double resolved_at[LATENCY_SAMPLES];
+    
+    for (size_t i = 0; i < LATENCY_SAMPLES; i++) {
+        cpm_targets[i] = q_promise_new();
+    }
+    observed = 0;
+    pthread_t waiter;
+    pthread_create(&waiter, NULL, cpm_waiter, NULL);
+    for (size_t i = 0; i < LATENCY_SAMPLES; i++) {
+        while (__atomic_load_n(&observed, __ATOMIC_ACQUIRE) < i) {
+            sched_yield();
+        }
+        usleep(20);
+        resolved_at[i] = now_seconds();
+        q_promise_resolve(cpm_targets[i], NULL);
+    }
+    pthread_join(waiter, NULL);
+    for (size_t i = 0; i < LATENCY_SAMPLES; i++) {
+        q_promise_free(cpm_targets[i]);
+    }
+    report_latency("cpm", resolved_at);
+    
+    observed = 0;
+    pthread_t loop;
+    pthread_create(&loop, NULL, run_loop, NULL);
+    for (size_t i = 0; i < LATENCY_SAMPLES; i++) {
+        while (__atomic_load_n(&observed, __ATOMIC_ACQUIRE) < i) {
+            sched_yield();
+        }
+        Promise* p = promise_create();
+        promise_free(promise_then(p, mark_observed, NULL, (void*)(uintptr_t)i));
+        usleep(20);
+        resolved_at[i] = now_seconds();
+        promise_resolve(p, NULL);
+        promise_free(p);
+    }
+    while (__atomic_load_n(&observed, __ATOMIC_ACQUIRE) < LATENCY_SAMPLES) {
+        sched_yield();
+    }
+    stop_event_loop();
+    pthread_join(loop, NULL);
+    report_latency("qpromise", resolved_at);
+}
+
+// --- enqueue ---
+
+static size_t executed;
+static size_t tasks_per_producer;
+
+static void count_task(void* data) {
+    (void)data;
+    __atomic_add_fetch(&executed, 1, __ATOMIC_RELAXED);
+}
+
+static void* produce(void* arg) {
+    (void)arg;
+    for (size_t i = 0; i < tasks_per_producer; i++) {
+        enqueue_microtask(count_task, NULL);
+    }
+    return NULL;
+}
+
+static void bench_enqueue(void) {
+    static const int counts[] = { 1, 4 };
+    size_t total = scaled(1000000);
+    
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        int producers = counts[c];
+        tasks_per_producer = total / producers;
+        size_t expected = tasks_per_producer * producers;
+        executed = 0;
+        
+        pthread_t threads[4];
+        double start = now_seconds();
+        for (int i = 0; i < producers; i++) {
+            pthread_create(&threads[i], NULL, produce, NULL);
+        }
+        while (__atomic_load_n(&executed, __ATOMIC_RELAXED) < expected) {
+            run_event_loop();
+        }
+        double elapsed = now_seconds() - start;
+        for (int i = 0; i < producers; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        
+        record_begin("enqueue", "qpromise");
+        fprintf(out, ", \"producers\": %d, \"tasks\": %zu, \"ops_per_sec\": %.0f}",
+                producers, expected, expected / elapsed);
+    }
+    
+    size_t jobs = scaled(200000);
+    executed = 0;
+    double start = now_seconds();
+    for (size_t i = 0; i < jobs; i++) {
+        if (q_executor_submit(count_task, NULL) != CPM_SUCCESS) {
+            __atomic_add_fetch(&executed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    while (__atomic_load_n(&executed, __ATOMIC_RELAXED) < jobs) {
+        sched_yield();
+    }
+    double elapsed = now_seconds() - start;
+    record_begin("enqueue", "cpm");
+    fprintf(out, ", \"producers\": 1, \"tasks\": %zu, \"ops_per_sec\": %.0f}", jobs, jobs / elapsed);
+}
+
+int main(int argc, char** argv) {
+    const char* path = argc > 1 ? argv[1] : NULL;
+    if (argc > 2 && atof(argv[2]) > 0) scale = atof(argv[2]);
+    
+    out = path ? fopen(path, "w") : stdout;
+    if (!out) {
+        perror("promise_suite: output");
+        return 1;
+    }
+    
+    fprintf(out, "{\n  \"suite\": \"promises\",\n  \"compiler\": \"%s\",\n  \"cpus\": %ld,\n  \"scale\": %g,\n  \"results\": [",
+            __VERSION__, sysconf(_SC_NPROCESSORS_ONLN), scale);
+    
+    init_event_loop();
+    bench_create_resolve_free();
+    bench_then_chain();
+    bench_fan_out_in();
+    bench_cross_thread();
+    bench_enqueue();
+    free_event_loop();
+    
+    fprintf(out, "\n  ]\n}\n");
+    if (path) {
+        fclose(out);
+        printf("promise_suite: results written to %s\n", path);
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * trace_overhead - cost of the tracing probes on the promise hot path.
+ *
+ * Runs the same create / then / resolve / wait / free loop with tracing
+ * off and on and reports ns per promise. With a path argument the traced
+ * run is written there as Chrome trace JSON (open it in Perfetto).
+ *
+ * Usage: bench_trace_overhead [promises] [trace.json]
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "cpm.h"
+#include "bench.h"
+
+static void on_fulfilled(QPromiseResult* result) {
+    (void)result;
+}
+
+static double run(size_t count) {
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        QPromise* promise = q_promise_new();
+        q_promise_then(promise, on_fulfilled);
+        q_promise_resolve(promise, (void*)i);
+        q_promise_wait(promise);
+        q_promise_free(promise);
+    }
+    return (double)(now_ns() - start) / count;
+}
+
+int main(int argc, char** argv) {
+    size_t count = arg_size(argc, argv, 1, 1000000);
+    const char* path = argc > 2 ? argv[2] : NULL;
+    if (count == 0) count = 1;
+
+    run(count / 10); // warm up the allocator
+    double off = run(count);
+
+    q_trace_start();
+    double on = run(count);
+    if (q_trace_stop(path) != 0) {
+        fprintf(stderr, "trace_overhead: could not write %s\n", path);
+        return 1;
+    }
+
+    double off_again = run(count);
+
+    printf("trace_overhead: promises=%zu disabled_ns=%.1f enabled_ns=%.1f disabled_after_ns=%.1f\n",
+           count, off, on, off_again);
+    return 0;
+}
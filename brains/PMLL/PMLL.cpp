@@ -5,9 +5,507 @@
 #include <unistd.h> // For sleep() in the main loop simulation
 #include <time.h>   // For seeding rand()
 #include <math.h>   // For sqrt, expf in conceptual functions
+#include <sys/resource.h> // For getrusage() in the attention benchmark
+#include <sys/wait.h>     // For waitpid() in the attention benchmark
+
+// Progress output of the pipeline stages; off while benchmarking
+static bool pmll_verbose = true;
+
+// --- Tensor Storage ---
+// A dense row-major matrix of floats in a single 64-byte-aligned allocation.
+// Row i starts at data + i * stride. The stride is cols rounded up to a whole
+// cache line (16 floats), so every row is aligned too and SIMD loads of one
+// row never touch the next. The padding floats are zeroed.
+
+#define TENSOR_ALIGNMENT 64
+#define TENSOR_ROW_ALIGN_FLOATS (TENSOR_ALIGNMENT / (int)sizeof(float))
+
+typedef struct {
+    float* data;
+    int rows;
+    int cols;
+    int stride; // Floats from one row start to the next (>= cols)
+} Tensor;
+
+// Buffers handed out by tensor_alloc() so far; printed per topic.
+static long tensor_allocations = 0;
+
+static inline float* tensor_row(const Tensor* t, int row) {
+    return t->data + (size_t)row * t->stride;
+}
+
+// Allocates a zeroed rows x cols tensor. Returns false (leaving `t` empty)
+// if the buffer cannot be allocated.
+bool tensor_alloc(Tensor* t, int rows, int cols) {
+    t->data = NULL;
+    t->rows = 0;
+    t->cols = 0;
+    t->stride = 0;
+    if (rows < 0 || cols < 0) return false;
+
+    int stride = (cols + TENSOR_ROW_ALIGN_FLOATS - 1) / TENSOR_ROW_ALIGN_FLOATS * TENSOR_ROW_ALIGN_FLOATS;
+    size_t bytes = (size_t)rows * stride * sizeof(float); // A multiple of TENSOR_ALIGNMENT
+    float* data = NULL;
+    if (bytes > 0) {
+        data = (float*)aligned_alloc(TENSOR_ALIGNMENT, bytes);
+        if (!data) return false;
+        memset(data, 0, bytes);
+        tensor_allocations++;
+    }
+    t->data = data;
+    t->rows = rows;
+    t->cols = cols;
+    t->stride = stride;
+    return true;
+}
+
+void tensor_free(Tensor* t) {
+    if (!t) return;
+    free(t->data);
+    t->data = NULL;
+    t->rows = 0;
+    t->cols = 0;
+    t->stride = 0;
+}
+
+// Copies src into dst; both must have the same shape (and so the same stride).
+void tensor_copy(Tensor* dst, const Tensor* src) {
+    if (dst->data == src->data) return;
+    memcpy(dst->data, src->data, (size_t)src->rows * src->stride * sizeof(float));
+}
+
+// --- Blocked GEMM ---
+// C = alpha * A * B + beta * C on row-major matrices, after Goto/BLIS: B is
+// packed KC x NC at a time into NR-column panels and A MC x KC at a time
+// into MR-row panels (alpha folded in), so a micro-kernel streams both from
+// cache while it keeps an MR x NR block of C in registers. The micro-kernel
+// (AVX-512, AVX2+FMA or portable C) is picked once at runtime from what the
+// CPU supports; PMLL_GEMM=avx512|avx2|scalar forces one.
+
+#define GEMM_MC 144  // Rows of A per packed block (a multiple of every MR)
+#define GEMM_KC 256  // Shared dimension per packed block
+#define GEMM_NC 2048 // Columns of B per packed block (a multiple of every NR)
+#define GEMM_MAX_MR 12
+#define GEMM_MAX_NR 32
+
+typedef struct {
+    const char* name;
+    int mr;
+    int nr;
+    // c[mr x nr] (row stride ldc) += packed A panel (kc x mr) * packed B panel (kc x nr)
+    void (*micro_kernel)(int kc, const float* a, const float* b, float* c, int ldc);
+    // Largest of row[0..n) (-INFINITY if n == 0)
+    float (*row_max)(const float* row, int n);
+    // row[j] = exp(row[j] - shift) for j < n, shift >= every row[j]; returns their sum
+    float (*exp_row)(float* row, int n, float shift);
+    // Sum of a[j] * b[j] for j < n
+    float (*dot)(const float* a, const float* b, int n);
+    // y[j] += alpha * x[j] for j < n
+    void (*axpy)(float* y, const float* x, float alpha, int n);
+} GemmKernels;
+
+static void gemm_kernel_scalar(int kc, const float* a, const float* b, float* c, int ldc) {
+    float acc[4][8] = {{0}};
+    for (int p = 0; p < kc; ++p, a += 4, b += 8) {
+        for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 8; ++j) acc[i][j] += a[i] * b[j];
+        }
+    }
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 8; ++j) c[i * ldc + j] += acc[i][j];
+    }
+}
+
+static float row_max_scalar(const float* row, int n) {
+    float max = -INFINITY;
+    for (int j = 0; j < n; ++j) max = row[j] > max ? row[j] : max;
+    return max;
+}
+
+static float exp_row_scalar(float* row, int n, float shift) {
+    float sum = 0.0f;
+    for (int j = 0; j < n; ++j) {
+        row[j] = expf(row[j] - shift);
+        sum += row[j];
+    }
+    return sum;
+}
+
+static float dot_scalar(const float* a, const float* b, int n) {
+    float sum = 0.0f;
+    for (int j = 0; j < n; ++j) sum += a[j] * b[j];
+    return sum;
+}
+
+static void axpy_scalar(float* y, const float* x, float alpha, int n) {
+    for (int j = 0; j < n; ++j) y[j] += alpha * x[j];
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GEMM_HAVE_X86 1
+// GCC 12 flags the _mm512_undefined_ps() placeholders inside its own
+// AVX-512 headers as uninitialised; the warning is attributed to the header.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+
+// exp(x) for x <= 0 (softmax inputs once the row max is subtracted):
+// x = n*ln2 + r, exp(r) from the Cephes expf polynomial, 2^n put into the
+// exponent bits.
+__attribute__((target("avx2,fma")))
+static inline __m256 gemm_exp_avx2(__m256 x) {
+    x = _mm256_max_ps(x, _mm256_set1_ps(-87.3f));
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)),
+                               _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+    __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+    __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+__attribute__((target("avx2,fma")))
+static void gemm_kernel_avx2(int kc, const float* a, const float* b, float* c, int ldc) {
+    __m256 acc[6][2];
+#pragma GCC unroll 6
+    for (int i = 0; i < 6; ++i) {
+        acc[i][0] = _mm256_setzero_ps();
+        acc[i][1] = _mm256_setzero_ps();
+    }
+    for (int p = 0; p < kc; ++p, a += 6, b += 16) {
+        __m256 b0 = _mm256_load_ps(b);
+        __m256 b1 = _mm256_load_ps(b + 8);
+#pragma GCC unroll 6
+        for (int i = 0; i < 6; ++i) {
+            __m256 ai = _mm256_broadcast_ss(a + i);
+            acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+        }
+    }
+#pragma GCC unroll 6
+    for (int i = 0; i < 6; ++i) {
+        float* row = c + i * ldc;
+        _mm256_storeu_ps(row, _mm256_add_ps(_mm256_loadu_ps(row), acc[i][0]));
+        _mm256_storeu_ps(row + 8, _mm256_add_ps(_mm256_loadu_ps(row + 8), acc[i][1]));
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static float row_max_avx2(const float* row, int n) {
+    int j = 0;
+    __m256 vmax = _mm256_set1_ps(-INFINITY);
+    for (; j + 8 <= n; j += 8) vmax = _mm256_max_ps(vmax, _mm256_loadu_ps(row + j));
+    float lanes[8];
+    _mm256_storeu_ps(lanes, vmax);
+    float max = lanes[0];
+    for (int l = 1; l < 8; ++l) max = lanes[l] > max ? lanes[l] : max;
+    for (; j < n; ++j) max = row[j] > max ? row[j] : max;
+    return max;
+}
+
+__attribute__((target("avx2,fma")))
+static float exp_row_avx2(float* row, int n, float shift) {
+    int j = 0;
+    __m256 vsum = _mm256_setzero_ps();
+    __m256 vshift = _mm256_set1_ps(shift);
+    for (; j + 8 <= n; j += 8) {
+        __m256 e = gemm_exp_avx2(_mm256_sub_ps(_mm256_loadu_ps(row + j), vshift));
+        _mm256_storeu_ps(row + j, e);
+        vsum = _mm256_add_ps(vsum, e);
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, vsum);
+    float sum = 0.0f;
+    for (int l = 0; l < 8; ++l) sum += lanes[l];
+    for (; j < n; ++j) {
+        row[j] = expf(row[j] - shift);
+        sum += row[j];
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float* a, const float* b, int n) {
+    int j = 0;
+    __m256 acc = _mm256_setzero_ps();
+    for (; j + 8 <= n; j += 8) acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + j), _mm256_loadu_ps(b + j), acc);
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+    float sum = 0.0f;
+    for (int l = 0; l < 8; ++l) sum += lanes[l];
+    for (; j < n; ++j) sum += a[j] * b[j];
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static void axpy_avx2(float* y, const float* x, float alpha, int n) {
+    int j = 0;
+    __m256 scale = _mm256_set1_ps(alpha);
+    for (; j + 8 <= n; j += 8) {
+        _mm256_storeu_ps(y + j, _mm256_fmadd_ps(scale, _mm256_loadu_ps(x + j), _mm256_loadu_ps(y + j)));
+    }
+    for (; j < n; ++j) y[j] += alpha * x[j];
+}
+
+// As gemm_exp_avx2(), with vscalefps applying 2^n
+__attribute__((target("avx512f")))
+static inline __m512 gemm_exp_avx512(__m512 x) {
+    x = _mm512_max_ps(x, _mm512_set1_ps(-87.3f));
+    __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(1.44269504f)),
+                                    _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(0.693359375f), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(-2.12194440e-4f), r);
+    __m512 p = _mm512_set1_ps(1.9875691500e-4f);
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.3981999507e-3f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(8.3334519073e-3f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(4.1665795894e-2f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.6666665459e-1f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(5.0000001201e-1f));
+    p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+    return _mm512_scalef_ps(p, n);
+}
+
+__attribute__((target("avx512f")))
+static void gemm_kernel_avx512(int kc, const float* a, const float* b, float* c, int ldc) {
+    __m512 acc[12][2];
+#pragma GCC unroll 12
+    for (int i = 0; i < 12; ++i) {
+        acc[i][0] = _mm512_setzero_ps();
+        acc[i][1] = _mm512_setzero_ps();
+    }
+    for (int p = 0; p < kc; ++p, a += 12, b += 32) {
+        __m512 b0 = _mm512_load_ps(b);
+        __m512 b1 = _mm512_load_ps(b + 16);
+#pragma GCC unroll 12
+        for (int i = 0; i < 12; ++i) {
+            __m512 ai = _mm512_set1_ps(a[i]);
+            acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+        }
+    }
+#pragma GCC unroll 12
+    for (int i = 0; i < 12; ++i) {
+        float* row = c + i * ldc;
+        _mm512_storeu_ps(row, _mm512_add_ps(_mm512_loadu_ps(row), acc[i][0]));
+        _mm512_storeu_ps(row + 16, _mm512_add_ps(_mm512_loadu_ps(row + 16), acc[i][1]));
+    }
+}
+
+__attribute__((target("avx512f")))
+static float row_max_avx512(const float* row, int n) {
+    int j = 0;
+    __m512 vmax = _mm512_set1_ps(-INFINITY);
+    for (; j + 16 <= n; j += 16) vmax = _mm512_max_ps(vmax, _mm512_loadu_ps(row + j));
+    float max = _mm512_reduce_max_ps(vmax);
+    for (; j < n; ++j) max = row[j] > max ? row[j] : max;
+    return max;
+}
+
+__attribute__((target("avx512f")))
+static float exp_row_avx512(float* row, int n, float shift) {
+    int j = 0;
+    __m512 vsum = _mm512_setzero_ps();
+    __m512 vshift = _mm512_set1_ps(shift);
+    for (; j + 16 <= n; j += 16) {
+        __m512 e = gemm_exp_avx512(_mm512_sub_ps(_mm512_loadu_ps(row + j), vshift));
+        _mm512_storeu_ps(row + j, e);
+        vsum = _mm512_add_ps(vsum, e);
+    }
+    float sum = _mm512_reduce_add_ps(vsum);
+    for (; j < n; ++j) {
+        row[j] = expf(row[j] - shift);
+        sum += row[j];
+    }
+    return sum;
+}
+
+__attribute__((target("avx512f")))
+static float dot_avx512(const float* a, const float* b, int n) {
+    int j = 0;
+    __m512 acc = _mm512_setzero_ps();
+    for (; j + 16 <= n; j += 16) acc = _mm512_fmadd_ps(_mm512_loadu_ps(a + j), _mm512_loadu_ps(b + j), acc);
+    float sum = _mm512_reduce_add_ps(acc);
+    for (; j < n; ++j) sum += a[j] * b[j];
+    return sum;
+}
+
+__attribute__((target("avx512f")))
+static void axpy_avx512(float* y, const float* x, float alpha, int n) {
+    int j = 0;
+    __m512 scale = _mm512_set1_ps(alpha);
+    for (; j + 16 <= n; j += 16) {
+        _mm512_storeu_ps(y + j, _mm512_fmadd_ps(scale, _mm512_loadu_ps(x + j), _mm512_loadu_ps(y + j)));
+    }
+    for (; j < n; ++j) y[j] += alpha * x[j];
+}
+#endif // x86
+
+static const GemmKernels gemm_scalar_kernels = {
+    "scalar", 4, 8, gemm_kernel_scalar, row_max_scalar, exp_row_scalar, dot_scalar, axpy_scalar
+};
+#ifdef GEMM_HAVE_X86
+static const GemmKernels gemm_avx2_kernels = {
+    "avx2", 6, 16, gemm_kernel_avx2, row_max_avx2, exp_row_avx2, dot_avx2, axpy_avx2
+};
+static const GemmKernels gemm_avx512_kernels = {
+    "avx512", 12, 32, gemm_kernel_avx512, row_max_avx512, exp_row_avx512, dot_avx512, axpy_avx512
+};
+#endif
+
+static const GemmKernels* gemm_active = NULL;
+
+// Returns the kernels for `name` ("avx512", "avx2" or "scalar") if this CPU
+// runs them, else NULL; NULL `name` picks the widest supported.
+const GemmKernels* gemm_kernels_for(const char* name) {
+#ifdef GEMM_HAVE_X86
+    __builtin_cpu_init();
+    bool avx512 = __builtin_cpu_supports("avx512f");
+    bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (!name) return avx512 ? &gemm_avx512_kernels : avx2 ? &gemm_avx2_kernels : &gemm_scalar_kernels;
+    if (strcmp(name, "avx512") == 0) return avx512 ? &gemm_avx512_kernels : NULL;
+    if (strcmp(name, "avx2") == 0) return avx2 ? &gemm_avx2_kernels : NULL;
+#else
+    if (!name) return &gemm_scalar_kernels;
+#endif
+    return strcmp(name, "scalar") == 0 ? &gemm_scalar_kernels : NULL;
+}
+
+const GemmKernels* gemm_kernels(void) {
+    if (!gemm_active) {
+        const char* forced = getenv("PMLL_GEMM");
+        gemm_active = forced ? gemm_kernels_for(forced) : NULL;
+        if (!gemm_active) gemm_active = gemm_kernels_for(NULL);
+    }
+    return gemm_active;
+}
+
+// Packing buffers, grown on demand and kept for the next call
+static float* gemm_pack = NULL;
+static size_t gemm_pack_capacity = 0;
+
+static float* gemm_pack_buffer(size_t floats) {
+    if (floats > gemm_pack_capacity) {
+        size_t bytes = (floats * sizeof(float) + TENSOR_ALIGNMENT - 1) / TENSOR_ALIGNMENT * TENSOR_ALIGNMENT;
+        float* buffer = (float*)aligned_alloc(TENSOR_ALIGNMENT, bytes);
+        if (!buffer) return NULL;
+        free(gemm_pack);
+        gemm_pack = buffer;
+        gemm_pack_capacity = bytes / sizeof(float);
+    }
+    return gemm_pack;
+}
+
+// B[kc x nc] -> nc/nr panels, each kc rows of nr floats (zero-padded)
+static void gemm_pack_b(const float* b, int ldb, int kc, int nc, int nr, float* out) {
+    for (int j = 0; j < nc; j += nr) {
+        int cols = nc - j < nr ? nc - j : nr;
+        for (int p = 0; p < kc; ++p) {
+            const float* src = b + (size_t)p * ldb + j;
+            int jj = 0;
+            for (; jj < cols; ++jj) out[jj] = src[jj];
+            for (; jj < nr; ++jj) out[jj] = 0.0f;
+            out += nr;
+        }
+    }
+}
+
+// alpha * A[mc x kc] -> mc/mr panels, each kc columns of mr floats (zero-padded)
+static void gemm_pack_a(const float* a, int lda, int mc, int kc, int mr, float alpha, float* out) {
+    for (int i = 0; i < mc; i += mr) {
+        int rows = mc - i < mr ? mc - i : mr;
+        for (int p = 0; p < kc; ++p) {
+            int ii = 0;
+            for (; ii < rows; ++ii) out[ii] = alpha * a[(size_t)(i + ii) * lda + p];
+            for (; ii < mr; ++ii) out[ii] = 0.0f;
+            out += mr;
+        }
+    }
+}
+
+// C[m x n] = alpha * A[m x k] * B[k x n] + beta * C. All row-major; lda, ldb
+// and ldc are the row strides in floats. Returns false if the packing
+// buffers cannot be allocated (C is then unchanged).
+bool gemm(int m, int n, int k, float alpha, const float* a, int lda,
+          const float* b, int ldb, float beta, float* c, int ldc) {
+    const GemmKernels* kernels = gemm_kernels();
+    int mr = kernels->mr, nr = kernels->nr;
+    float* packed_b = gemm_pack_buffer((size_t)GEMM_KC * (GEMM_NC + GEMM_MC));
+    if (!packed_b) return false;
+    float* packed_a = packed_b + (size_t)GEMM_KC * GEMM_NC;
+
+    for (int i = 0; i < m; ++i) {
+        float* row = c + (size_t)i * ldc;
+        if (beta == 0.0f) {
+            memset(row, 0, n * sizeof(float));
+        } else if (beta != 1.0f) {
+            for (int j = 0; j < n; ++j) row[j] *= beta;
+        }
+    }
+
+    for (int jc = 0; jc < n; jc += GEMM_NC) {
+        int nc = n - jc < GEMM_NC ? n - jc : GEMM_NC;
+        for (int pc = 0; pc < k; pc += GEMM_KC) {
+            int kc = k - pc < GEMM_KC ? k - pc : GEMM_KC;
+            gemm_pack_b(b + (size_t)pc * ldb + jc, ldb, kc, nc, nr, packed_b);
+
+            for (int ic = 0; ic < m; ic += GEMM_MC) {
+                int mc = m - ic < GEMM_MC ? m - ic : GEMM_MC;
+                gemm_pack_a(a + (size_t)ic * lda + pc, lda, mc, kc, mr, alpha, packed_a);
+
+                for (int jr = 0; jr < nc; jr += nr) {
+                    int cols = nc - jr < nr ? nc - jr : nr;
+                    for (int ir = 0; ir < mc; ir += mr) {
+                        int rows = mc - ir < mr ? mc - ir : mr;
+                        float* tile = c + (size_t)(ic + ir) * ldc + jc + jr;
+                        const float* a_panel = packed_a + (size_t)ir * kc;
+                        const float* b_panel = packed_b + (size_t)jr * kc;
+                        if (rows == mr && cols == nr) {
+                            kernels->micro_kernel(kc, a_panel, b_panel, tile, ldc);
+                            continue;
+                        }
+                        // Edge tile: run the full kernel on a scratch block, keep the valid part
+                        float edge[GEMM_MAX_MR * GEMM_MAX_NR] __attribute__((aligned(TENSOR_ALIGNMENT)));
+                        memset(edge, 0, sizeof(edge));
+                        kernels->micro_kernel(kc, a_panel, b_panel, edge, nr);
+                        for (int i = 0; i < rows; ++i) {
+                            for (int j = 0; j < cols; ++j) tile[(size_t)i * ldc + j] += edge[i * nr + j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
 
 // --- Elaborated Conceptual Data Structures ---
 
+// Projection weights of one attention block, each [d_model x d_model]
+typedef struct {
+    Tensor wq;
+    Tensor wk;
+    Tensor wv;
+    Tensor wo;
+} AttentionWeights;
+
+// Graph edges in compressed sparse row form: the neighbours of node i are
+// col_indices[row_offsets[i] .. row_offsets[i + 1]).
+typedef struct {
+    int num_nodes;
+    long long num_edges;  // Including the self-loop every node gets
+    int max_degree;
+    long long* row_offsets; // num_nodes + 1 entries
+    int* col_indices;       // num_edges entries
+} GraphAdjacency;
+
 typedef struct {
     char graph_id[128];
     long long node_count;
@@ -22,11 +520,17 @@ typedef struct {
     int model_dimension; // d_model
     int num_attention_heads;
     int feed_forward_dim; // Dimension of the inner layer of FFN
+    // Attention weights per layer, randomly initialised in DRAM until they
+    // can be mapped from transformer_model_parameters_pmem_ptr.
+    AttentionWeights* attention_weights;
+    // The node_count x edge_count edges as CSR, for graph-sparse attention.
+    // Random until the edges can be read from the PMLL.
+    GraphAdjacency adjacency;
 } PMLL_Graph;
 
 typedef struct {
     const PMLL_Graph* source_graph;
-    float** node_vectors; // Input embeddings [num_vectors x vector_dim]
+    Tensor node_vectors; // Input embeddings [num_vectors x vector_dim]
     int num_vectors;
     int vector_dim; // Should match source_graph->model_dimension
 } Vectorized_Graph;
@@ -34,7 +538,7 @@ typedef struct {
 // This struct will now represent the output after ALL Transformer layers
 typedef struct {
     const Vectorized_Graph* original_vectors;
-    float** final_contextual_embeddings; // Output embeddings [num_embeddings x embedding_dim]
+    Tensor final_contextual_embeddings; // Output embeddings [num_embeddings x embedding_dim]
     int num_embeddings;
     int embedding_dim; // Should match source_graph->model_dimension
 } Processed_Graph; // Renamed from Transformer_Output to reflect its role
@@ -43,7 +547,7 @@ typedef struct {
     const Processed_Graph* source_processed_graph;
     int* selected_node_indices;
     int num_selected;
-    float** selected_data_vectors; // Pointers to vectors within final_contextual_embeddings
+    const float** selected_data_vectors; // Pointers to rows of final_contextual_embeddings
 } Selection;
 
 typedef struct {
@@ -78,36 +582,124 @@ typedef struct {
     int d_k;     // dimension of key/query vectors (d_model / num_heads)
     int d_v;     // dimension of value vectors (d_model / num_heads)
     int d_ff;    // inner feed-forward dimension
+    int w_stride; // Floats between rows of Wq, Wk, Wv and Wo
 } TransformerLayerComponentParams;
 
 
 // --- Forward Declarations for Conceptual Transformer Sub-Components ---
+// Every tensor is [seq_len x d_model]; seq_len is taken from input->rows.
 void multi_head_self_attention(
-    float** input_embeddings,          // [seq_len x d_model]
-    float** output_embeddings,         // [seq_len x d_model] (to be filled)
+    const Tensor* input_embeddings,
+    Tensor* output_embeddings,         // To be filled
     const PMLL_Graph* graph_config,    // For model_dimension, num_heads
-    const TransformerLayerComponentParams* params, // Specific weights for this attention block
-    int seq_len
+    const TransformerLayerComponentParams* params // Specific weights for this attention block
 );
 
 void add_and_norm(
-    float** input_embeddings1,         // [seq_len x d_model] (e.g., original input to layer)
-    float** input_embeddings2,         // [seq_len x d_model] (e.g., output of attention/FFN)
-    float** output_embeddings,         // [seq_len x d_model] (to be filled)
-    const float* gamma, const float* beta, // LayerNorm params
-    int seq_len, int d_model
+    const Tensor* input_embeddings1,   // e.g., original input to layer
+    const Tensor* input_embeddings2,   // e.g., output of attention/FFN
+    Tensor* output_embeddings,         // To be filled; may be input_embeddings1
+    const float* gamma, const float* beta // LayerNorm params
 );
 
 void positionwise_feed_forward(
-    float** input_embeddings,          // [seq_len x d_model]
-    float** output_embeddings,         // [seq_len x d_model] (to be filled)
-    const TransformerLayerComponentParams* params, // Specific weights/biases for FFN
-    int seq_len
+    const Tensor* input_embeddings,
+    Tensor* output_embeddings,         // To be filled
+    const TransformerLayerComponentParams* params // Specific weights/biases for FFN
 );
 
 
 // --- Elaborated Placeholder Function Declarations (Stubs) ---
 
+// Fills `w` with uniform values in +-1/sqrt(d_model), which keeps the
+// projections of unit-scale embeddings at unit scale.
+bool attention_weights_init(AttentionWeights* w, int d_model) {
+    Tensor* parts[4] = { &w->wq, &w->wk, &w->wv, &w->wo };
+    float limit = 1.0f / sqrtf((float)d_model);
+    bool ok = true;
+    for (int t = 0; t < 4; ++t) {
+        ok = tensor_alloc(parts[t], d_model, d_model) && ok;
+        for (int i = 0; ok && i < d_model; ++i) {
+            float* row = tensor_row(parts[t], i);
+            for (int j = 0; j < d_model; ++j) row[j] = ((float)rand() / RAND_MAX * 2.0f - 1.0f) * limit;
+        }
+    }
+    return ok;
+}
+
+void attention_weights_free(AttentionWeights* w) {
+    tensor_free(&w->wq);
+    tensor_free(&w->wk);
+    tensor_free(&w->wv);
+    tensor_free(&w->wo);
+}
+
+void graph_adjacency_free(GraphAdjacency* adj) {
+    free(adj->row_offsets);
+    free(adj->col_indices);
+    memset(adj, 0, sizeof(*adj));
+}
+
+// Builds `edges` random directed edges (duplicates allowed) over `nodes`
+// nodes plus a self-loop per node, so that every node has something to
+// attend to. Counting sort by source: two passes over the edge list.
+bool graph_adjacency_build_random(GraphAdjacency* adj, int nodes, long long edges, unsigned int seed) {
+    memset(adj, 0, sizeof(*adj));
+    if (nodes <= 0 || edges < 0) return false;
+
+    long long total = edges + nodes;
+    int* sources = (int*)malloc(edges * sizeof(int) + 1);
+    int* targets = (int*)malloc(edges * sizeof(int) + 1);
+    adj->row_offsets = (long long*)calloc(nodes + 1, sizeof(long long));
+    adj->col_indices = (int*)malloc(total * sizeof(int));
+    if (!sources || !targets || !adj->row_offsets || !adj->col_indices) {
+        free(sources);
+        free(targets);
+        graph_adjacency_free(adj);
+        return false;
+    }
+
+    unsigned long long state = seed * 0x9E3779B97F4A7C15ull + 1; // xorshift64*
+    for (long long e = 0; e < edges; ++e) {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        unsigned long long r = state * 0x2545F4914F6CDD1Dull;
+        sources[e] = (int)((r >> 32) % (unsigned long long)nodes);
+        targets[e] = (int)((r & 0xffffffffull) % (unsigned long long)nodes);
+    }
+
+    for (long long e = 0; e < edges; ++e) adj->row_offsets[sources[e] + 1]++;
+    int max_degree = 0;
+    for (int i = 0; i < nodes; ++i) {
+        long long degree = adj->row_offsets[i + 1] + 1; // + self-loop
+        if (degree > max_degree) max_degree = (int)degree;
+        adj->row_offsets[i + 1] = adj->row_offsets[i] + degree;
+    }
+
+    // Self-loop first, then the edges in input order
+    long long* next = (long long*)malloc(nodes * sizeof(long long));
+    if (!next) {
+        free(sources);
+        free(targets);
+        graph_adjacency_free(adj);
+        return false;
+    }
+    for (int i = 0; i < nodes; ++i) {
+        adj->col_indices[adj->row_offsets[i]] = i;
+        next[i] = adj->row_offsets[i] + 1;
+    }
+    for (long long e = 0; e < edges; ++e) adj->col_indices[next[sources[e]]++] = targets[e];
+
+    free(next);
+    free(sources);
+    free(targets);
+    adj->num_nodes = nodes;
+    adj->num_edges = total;
+    adj->max_degree = max_degree;
+    return true;
+}
+
 PMLL_Graph* pmll_load_or_initialize_graph_elaborated(const char* graph_name) {
     printf("[PMLL] Loading or initializing persistent graph: %s...\n", graph_name);
     PMLL_Graph* graph = (PMLL_Graph*)malloc(sizeof(PMLL_Graph));
@@ -128,6 +720,25 @@ PMLL_Graph* pmll_load_or_initialize_graph_elaborated(const char* graph_name) {
     graph->num_attention_heads = 4;     // num_heads
     graph->feed_forward_dim = graph->model_dimension * 4; // Common practice: d_ff = 4 * d_model
 
+    graph->attention_weights = (AttentionWeights*)calloc(graph->num_transformer_layers, sizeof(AttentionWeights));
+    bool weights_ok = graph->attention_weights != NULL;
+    for (int l = 0; weights_ok && l < graph->num_transformer_layers; ++l) {
+        weights_ok = attention_weights_init(&graph->attention_weights[l], graph->model_dimension);
+    }
+    if (weights_ok &&
+        !graph_adjacency_build_random(&graph->adjacency, (int)graph->node_count, graph->edge_count, 1u)) {
+        weights_ok = false;
+    }
+    if (!weights_ok) {
+        perror("Failed to allocate attention weights or adjacency");
+        if (graph->attention_weights) {
+            for (int l = 0; l < graph->num_transformer_layers; ++l) attention_weights_free(&graph->attention_weights[l]);
+            free(graph->attention_weights);
+        }
+        free(graph);
+        return NULL;
+    }
+
     printf("[PMLL] Graph '%s' initialized. Nodes: %lld, Edges: %lld\n",
            graph->graph_id, graph->node_count, graph->edge_count);
     printf("[PMLL] Conceptual Transformer Config: Layers: %d, Dim: %d, Heads: %d, FF_Dim: %d\n",
@@ -148,27 +759,17 @@ Vectorized_Graph* vectorize_from_pmll_elaborated(const PMLL_Graph* p_graph) {
     v_graph->num_vectors = p_graph->node_count; 
     v_graph->vector_dim = p_graph->model_dimension; // Embeddings match model dimension
 
-    v_graph->node_vectors = (float**)malloc(v_graph->num_vectors * sizeof(float*));
-    if (!v_graph->node_vectors) {
-        perror("Failed to allocate node_vectors array of pointers");
+    if (!tensor_alloc(&v_graph->node_vectors, v_graph->num_vectors, v_graph->vector_dim)) {
+        perror("Failed to allocate node_vectors tensor");
         free(v_graph);
         return NULL;
     }
-    // Simulate allocating and initializing dummy embedding vectors
+    // Simulate initializing dummy embedding vectors
     // In a real system, these would be loaded from PMLL or computed based on graph content
     for (int i = 0; i < v_graph->num_vectors; ++i) {
-        v_graph->node_vectors[i] = (float*)malloc(v_graph->vector_dim * sizeof(float));
-        if (!v_graph->node_vectors[i]) {
-            perror("Failed to allocate individual node vector");
-            // Cleanup previously allocated vectors
-            for (int k = 0; k < i; ++k) free(v_graph->node_vectors[k]);
-            free(v_graph->node_vectors);
-            free(v_graph);
-            return NULL;
-        }
-        // Initialize with some dummy values
+        float* vector = tensor_row(&v_graph->node_vectors, i);
         for (int j = 0; j < v_graph->vector_dim; ++j) {
-            v_graph->node_vectors[i][j] = (float)rand() / RAND_MAX * 0.1f; // Small random values
+            vector[j] = (float)rand() / RAND_MAX * 0.1f; // Small random values
         }
     }
     printf("[VECTORIZE] Conceptual vectorization complete. Num vectors: %d, Dim: %d\n",
@@ -198,35 +799,24 @@ Processed_Graph* process_with_transformer_layers_elaborated(const Vectorized_Gra
     proc_graph->num_embeddings = v_graph->num_vectors;
     proc_graph->embedding_dim = v_graph->vector_dim;
 
-    // Allocate memory for the final output embeddings
-    proc_graph->final_contextual_embeddings = (float**)malloc(proc_graph->num_embeddings * sizeof(float*));
-    if (!proc_graph->final_contextual_embeddings) {
-        perror("Failed to allocate final_contextual_embeddings array of pointers");
+    // The final output embeddings, plus two scratch tensors of the same shape,
+    // all allocated once for every layer:
+    //  - temp_embeddings: sublayer outputs (after attention or FFN, before add&norm)
+    //  - ffn_input_for_residual: the FFN's input, kept for its residual connection
+    Tensor temp_embeddings, ffn_input_for_residual;
+    bool allocated = tensor_alloc(&proc_graph->final_contextual_embeddings, proc_graph->num_embeddings, proc_graph->embedding_dim);
+    allocated = tensor_alloc(&temp_embeddings, proc_graph->num_embeddings, proc_graph->embedding_dim) && allocated;
+    allocated = tensor_alloc(&ffn_input_for_residual, proc_graph->num_embeddings, proc_graph->embedding_dim) && allocated;
+    if (!allocated) {
+        perror("Failed to allocate transformer embedding tensors");
+        tensor_free(&proc_graph->final_contextual_embeddings);
+        tensor_free(&temp_embeddings);
+        tensor_free(&ffn_input_for_residual);
         free(proc_graph);
         return NULL;
     }
-    // Allocate memory for each embedding vector
-    for (int i = 0; i < proc_graph->num_embeddings; ++i) {
-        proc_graph->final_contextual_embeddings[i] = (float*)malloc(proc_graph->embedding_dim * sizeof(float));
-        if (!proc_graph->final_contextual_embeddings[i]) {
-            perror("Failed to allocate individual final embedding vector");
-            for (int k = 0; k < i; ++k) free(proc_graph->final_contextual_embeddings[k]);
-            free(proc_graph->final_contextual_embeddings);
-            free(proc_graph);
-            return NULL;
-        }
-        // Initialize/copy from input: current_x starts as input embeddings
-        memcpy(proc_graph->final_contextual_embeddings[i], v_graph->node_vectors[i], proc_graph->embedding_dim * sizeof(float));
-    }
-
-    // Temporary buffer for intermediate layer outputs (e.g., after attention, before add&norm)
-    // In a highly optimized version, this might be managed more carefully (in-place ops, etc.)
-    float** temp_embeddings = (float**)malloc(proc_graph->num_embeddings * sizeof(float*));
-    if (!temp_embeddings) { /* ... error handling ... */ return NULL; }
-    for (int i = 0; i < proc_graph->num_embeddings; ++i) {
-        temp_embeddings[i] = (float*)malloc(proc_graph->embedding_dim * sizeof(float));
-        if (!temp_embeddings[i]) { /* ... error handling ... */ return NULL; }
-    }
+    // current_x starts as the input embeddings
+    tensor_copy(&proc_graph->final_contextual_embeddings, &v_graph->node_vectors);
 
     // --- Loop through each Transformer Layer ---
     for (int layer_idx = 0; layer_idx < graph_config->num_transformer_layers; ++layer_idx) {
@@ -236,13 +826,21 @@ Processed_Graph* process_with_transformer_layers_elaborated(const Vectorized_Gra
         // This is highly simplified. A real system would map specific memory regions
         // from graph_config->transformer_model_parameters_pmem_ptr based on layer_idx.
         TransformerLayerComponentParams current_layer_params;
+        memset(&current_layer_params, 0, sizeof(current_layer_params)); // Weights not set below stay NULL
         current_layer_params.d_model = graph_config->model_dimension;
         current_layer_params.d_k = graph_config->model_dimension / graph_config->num_attention_heads;
         current_layer_params.d_v = graph_config->model_dimension / graph_config->num_attention_heads;
         current_layer_params.d_ff = graph_config->feed_forward_dim;
         // Wq, Wk, Wv etc. would be pointers to actual float arrays from PMLL for this layer.
         // For this stub, we'll leave them as NULL or point to dummy static data if needed for deeper stubs.
-        current_layer_params.Wq = NULL; /* ... and so on for other weights/biases */
+        if (graph_config->attention_weights) {
+            const AttentionWeights* weights = &graph_config->attention_weights[layer_idx];
+            current_layer_params.Wq = weights->wq.data;
+            current_layer_params.Wk = weights->wk.data;
+            current_layer_params.Wv = weights->wv.data;
+            current_layer_params.Wo = weights->wo.data;
+            current_layer_params.w_stride = weights->wq.stride;
+        }
         current_layer_params.norm1_gamma = NULL; /* ... etc ... */
 
 
@@ -250,93 +848,342 @@ Processed_Graph* process_with_transformer_layers_elaborated(const Vectorized_Gra
         // Input: proc_graph->final_contextual_embeddings (output of previous layer, or initial embeddings)
         // Output: temp_embeddings (output of attention mechanism for this layer)
         printf("    - Multi-Head Self-Attention...\n");
-        multi_head_self_attention(proc_graph->final_contextual_embeddings, temp_embeddings,
-                                  graph_config, &current_layer_params, proc_graph->num_embeddings);
+        multi_head_self_attention(&proc_graph->final_contextual_embeddings, &temp_embeddings,
+                                  graph_config, &current_layer_params);
 
         // 2. Add & Norm (Residual connection + Layer Normalization)
         // Input1: proc_graph->final_contextual_embeddings (input to the attention sublayer, i.e., x)
         // Input2: temp_embeddings (output of attention sublayer, i.e., Attention(x))
         // Output: proc_graph->final_contextual_embeddings (overwriting with SublayerOutput(x + Attention(x)))
         printf("    - Add & Norm 1...\n");
-        add_and_norm(proc_graph->final_contextual_embeddings, temp_embeddings,
-                     proc_graph->final_contextual_embeddings, // Output overwrites previous state
-                     current_layer_params.norm1_gamma, current_layer_params.norm1_beta,
-                     proc_graph->num_embeddings, proc_graph->embedding_dim);
+        add_and_norm(&proc_graph->final_contextual_embeddings, &temp_embeddings,
+                     &proc_graph->final_contextual_embeddings, // Output overwrites previous state
+                     current_layer_params.norm1_gamma, current_layer_params.norm1_beta);
 
-        // Store the output of Add & Norm 1 to be the input for the FFN's Add & Norm
-        // This requires another buffer or careful handling if we want to keep the pre-FFN state for the residual.
-        // For simplicity, let's assume temp_embeddings can be reused or we operate on copies.
-        // Or, more accurately, the input to FFN is the output of the first Add & Norm.
-        // Let's make a copy for the residual connection around FFN.
-        float** ffn_input_for_residual = (float**)malloc(proc_graph->num_embeddings * sizeof(float*));
-        // ... (allocate and copy proc_graph->final_contextual_embeddings to ffn_input_for_residual) ...
-        for(int i=0; i<proc_graph->num_embeddings; ++i) {
-            ffn_input_for_residual[i] = (float*)malloc(proc_graph->embedding_dim * sizeof(float));
-            memcpy(ffn_input_for_residual[i], proc_graph->final_contextual_embeddings[i], proc_graph->embedding_dim * sizeof(float));
-        }
+        // The output of Add & Norm 1 is the FFN's input, and also the residual
+        // around it; keep a copy, since Add & Norm 2 overwrites it in place.
+        tensor_copy(&ffn_input_for_residual, &proc_graph->final_contextual_embeddings);
 
 
         // 3. Position-wise Feed-Forward Network
         // Input: proc_graph->final_contextual_embeddings (output of first Add & Norm)
         // Output: temp_embeddings (output of FFN for this layer)
         printf("    - Position-wise Feed-Forward Network...\n");
-        positionwise_feed_forward(proc_graph->final_contextual_embeddings, temp_embeddings,
-                                  &current_layer_params, proc_graph->num_embeddings);
+        positionwise_feed_forward(&proc_graph->final_contextual_embeddings, &temp_embeddings,
+                                  &current_layer_params);
         
         // 4. Add & Norm (Residual connection + Layer Normalization)
         // Input1: ffn_input_for_residual (output of first Add & Norm, i.e. input to FFN sublayer)
         // Input2: temp_embeddings (output of FFN sublayer)
         // Output: proc_graph->final_contextual_embeddings (final output for this Transformer layer)
         printf("    - Add & Norm 2...\n");
-        add_and_norm(ffn_input_for_residual, temp_embeddings,
-                     proc_graph->final_contextual_embeddings, // Output overwrites
-                     current_layer_params.norm2_gamma, current_layer_params.norm2_beta,
-                     proc_graph->num_embeddings, proc_graph->embedding_dim);
-
-        // Free the temporary copy for FFN residual
-        for(int i=0; i<proc_graph->num_embeddings; ++i) free(ffn_input_for_residual[i]);
-        free(ffn_input_for_residual);
+        add_and_norm(&ffn_input_for_residual, &temp_embeddings,
+                     &proc_graph->final_contextual_embeddings, // Output overwrites
+                     current_layer_params.norm2_gamma, current_layer_params.norm2_beta);
     }
 
-    // Free temporary buffer
-    for (int i = 0; i < proc_graph->num_embeddings; ++i) free(temp_embeddings[i]);
-    free(temp_embeddings);
+    // Free scratch tensors
+    tensor_free(&temp_embeddings);
+    tensor_free(&ffn_input_for_residual);
 
     printf("[TRANSFORMER_CORE] All %d layers processed. Final contextual embeddings generated.\n", graph_config->num_transformer_layers);
     return proc_graph;
 }
 
 
-// --- Stubs for Transformer Sub-Components ---
+// --- Transformer Sub-Components ---
+
+// Attention is computed per head in one of three ways:
+//  - ATTENTION_TILED (default): flash-attention style. Query blocks of
+//    ATTENTION_QUERY_BLOCK rows meet key blocks of ATTENTION_KEY_BLOCK
+//    columns; each score tile is folded into the block's output with an
+//    online softmax (running row max and sum, earlier partial output
+//    rescaled whenever the max grows), so scores never exceed one tile and
+//    everything but Q/K/V/output stays cache resident: O(seq_len * d) memory.
+//  - ATTENTION_MATERIALIZED: the full seq_len x seq_len score matrix of a
+//    head, softmaxed row by row, then times V. O(seq_len^2) memory; kept as
+//    the reference the benchmark compares against.
+//  - ATTENTION_GRAPH_SPARSE: token i is graph node i and attends only to its
+//    neighbours in graph->adjacency. Each CSR row is one SpMM row: a dot
+//    product per (edge, head), a softmax over the row, then the neighbours'
+//    values accumulated with axpy. O(edges * d) work, O(max_degree * heads)
+//    scratch. Falls back to tiled when seq_len != the graph's node count.
+// PMLL_ATTENTION=tiled|materialized|graph picks one.
+typedef enum {
+    ATTENTION_TILED,
+    ATTENTION_MATERIALIZED,
+    ATTENTION_GRAPH_SPARSE
+} AttentionKernel;
+
+// One GEMM row block, so score products have no partial micro-tiles
+#define ATTENTION_QUERY_BLOCK GEMM_MC
+#define ATTENTION_KEY_BLOCK 256
+
+static AttentionKernel attention_kernel = ATTENTION_TILED;
+static bool attention_kernel_chosen = false;
+
+AttentionKernel attention_kernel_get(void) {
+    if (!attention_kernel_chosen) {
+        const char* forced = getenv("PMLL_ATTENTION");
+        attention_kernel = ATTENTION_TILED;
+        if (forced && strcmp(forced, "materialized") == 0) attention_kernel = ATTENTION_MATERIALIZED;
+        if (forced && strcmp(forced, "graph") == 0) attention_kernel = ATTENTION_GRAPH_SPARSE;
+        attention_kernel_chosen = true;
+    }
+    return attention_kernel;
+}
+
+void attention_kernel_set(AttentionKernel kernel) {
+    attention_kernel = kernel;
+    attention_kernel_chosen = true;
+}
+
+const char* attention_kernel_name(AttentionKernel kernel) {
+    switch (kernel) {
+        case ATTENTION_MATERIALIZED: return "materialized";
+        case ATTENTION_GRAPH_SPARSE: return "graph";
+        default: return "tiled";
+    }
+}
+
+// Scratch tensors for multi_head_self_attention(), kept between calls and
+// reallocated only when the shape changes.
+static struct {
+    Tensor q, k, v;  // Projections [seq_len x d_model]; head h is columns h*d_k..
+    Tensor context;  // Concatenated head outputs [seq_len x d_model]
+    Tensor keys_t;   // One head's keys, transposed [d_k x seq_len]
+    Tensor scores;   // Tiled: one score tile; materialized: [seq_len x seq_len];
+                     // graph: one node's edge scores [heads x max_degree]
+    Tensor partial;  // Tiled: a query block's unnormalised output [block x d_k]
+    Tensor stats;    // Tiled: running row max (row 0) and sum (row 1) [2 x block]
+} attention_workspace;
+
+static bool tensor_reshape(Tensor* t, int rows, int cols) {
+    if (t->data && t->rows == rows && t->cols == cols) return true;
+    tensor_free(t);
+    return tensor_alloc(t, rows, cols);
+}
+
+void attention_workspace_free(void) {
+    tensor_free(&attention_workspace.q);
+    tensor_free(&attention_workspace.k);
+    tensor_free(&attention_workspace.v);
+    tensor_free(&attention_workspace.context);
+    tensor_free(&attention_workspace.keys_t);
+    tensor_free(&attention_workspace.scores);
+    tensor_free(&attention_workspace.partial);
+    tensor_free(&attention_workspace.stats);
+    free(gemm_pack);
+    gemm_pack = NULL;
+    gemm_pack_capacity = 0;
+}
+
+// Writes head h's output into the context columns h*d_k.., materialising
+// all its scores at once.
+static bool attention_head_materialized(int h, int seq_len, int d_k, float scale) {
+    Tensor* q = &attention_workspace.q;
+    Tensor* v = &attention_workspace.v;
+    Tensor* context = &attention_workspace.context;
+    Tensor* keys_t = &attention_workspace.keys_t;
+    Tensor* scores = &attention_workspace.scores;
+    const GemmKernels* kernels = gemm_kernels();
+
+    if (!tensor_reshape(scores, seq_len, seq_len)) return false;
+    if (!gemm(seq_len, seq_len, d_k, scale, q->data + h * d_k, q->stride,
+              keys_t->data, keys_t->stride, 0.0f, scores->data, scores->stride)) {
+        return false;
+    }
+    for (int r = 0; r < seq_len; ++r) {
+        float* row = tensor_row(scores, r);
+        float inv = 1.0f / kernels->exp_row(row, seq_len, kernels->row_max(row, seq_len));
+        for (int j = 0; j < seq_len; ++j) row[j] *= inv;
+    }
+    return gemm(seq_len, d_k, seq_len, 1.0f, scores->data, scores->stride,
+                v->data + h * d_k, v->stride, 0.0f, context->data + h * d_k, context->stride);
+}
+
+// As attention_head_materialized(), one (query block, key block) tile at a time.
+static bool attention_head_tiled(int h, int seq_len, int d_k, float scale) {
+    Tensor* q = &attention_workspace.q;
+    Tensor* v = &attention_workspace.v;
+    Tensor* context = &attention_workspace.context;
+    Tensor* keys_t = &attention_workspace.keys_t;
+    Tensor* scores = &attention_workspace.scores;
+    Tensor* partial = &attention_workspace.partial;
+    Tensor* stats = &attention_workspace.stats;
+    const GemmKernels* kernels = gemm_kernels();
+
+    int query_block = seq_len < ATTENTION_QUERY_BLOCK ? seq_len : ATTENTION_QUERY_BLOCK;
+    int key_block = seq_len < ATTENTION_KEY_BLOCK ? seq_len : ATTENTION_KEY_BLOCK;
+    if (!tensor_reshape(scores, query_block, key_block) || !tensor_reshape(partial, query_block, d_k) ||
+        !tensor_reshape(stats, 2, query_block)) {
+        return false;
+    }
+    float* row_max = tensor_row(stats, 0);
+    float* row_sum = tensor_row(stats, 1);
+
+    for (int q0 = 0; q0 < seq_len; q0 += query_block) {
+        int rows = seq_len - q0 < query_block ? seq_len - q0 : query_block;
+        for (int r = 0; r < rows; ++r) {
+            row_max[r] = -INFINITY;
+            row_sum[r] = 0.0f;
+            memset(tensor_row(partial, r), 0, d_k * sizeof(float));
+        }
+
+        for (int k0 = 0; k0 < seq_len; k0 += key_block) {
+            int cols = seq_len - k0 < key_block ? seq_len - k0 : key_block;
+            if (!gemm(rows, cols, d_k, scale, tensor_row(q, q0) + h * d_k, q->stride,
+                      keys_t->data + k0, keys_t->stride, 0.0f, scores->data, scores->stride)) {
+                return false;
+            }
+            for (int r = 0; r < rows; ++r) {
+                float* tile = tensor_row(scores, r);
+                float tile_max = kernels->row_max(tile, cols);
+                if (tile_max > row_max[r]) {
+                    // The max grew: rescale what has been accumulated so far
+                    float correction = expf(row_max[r] - tile_max);
+                    float* out = tensor_row(partial, r);
+                    for (int c = 0; c < d_k; ++c) out[c] *= correction;
+                    row_sum[r] *= correction;
+                    row_max[r] = tile_max;
+                }
+                row_sum[r] += kernels->exp_row(tile, cols, row_max[r]);
+            }
+            if (!gemm(rows, d_k, cols, 1.0f, scores->data, scores->stride,
+                      tensor_row(v, k0) + h * d_k, v->stride, 1.0f, partial->data, partial->stride)) {
+                return false;
+            }
+        }
+
+        for (int r = 0; r < rows; ++r) {
+            const float* out = tensor_row(partial, r);
+            float* dst = tensor_row(context, q0 + r) + h * d_k;
+            float inv = 1.0f / row_sum[r];
+            for (int c = 0; c < d_k; ++c) dst[c] = out[c] * inv;
+        }
+    }
+    return true;
+}
+
+// Neighbours this many edges ahead are prefetched while the current one is scored
+#define ATTENTION_GRAPH_PREFETCH 4
+
+// Writes every head's output into the context, node i attending to the
+// nodes adjacent to it. All heads of a node are done together, so each
+// neighbour's K and V rows are fetched once per edge rather than once per
+// edge and head.
+static bool attention_graph_sparse(const GraphAdjacency* adj, int num_heads, int d_k, float scale) {
+    Tensor* q = &attention_workspace.q;
+    Tensor* k = &attention_workspace.k;
+    Tensor* v = &attention_workspace.v;
+    Tensor* context = &attention_workspace.context;
+    Tensor* scores = &attention_workspace.scores;
+    const GemmKernels* kernels = gemm_kernels();
+
+    if (!tensor_reshape(scores, num_heads, adj->max_degree)) return false;
+
+    for (int i = 0; i < adj->num_nodes; ++i) {
+        const int* neighbours = adj->col_indices + adj->row_offsets[i];
+        int degree = (int)(adj->row_offsets[i + 1] - adj->row_offsets[i]);
+        const float* query = tensor_row(q, i);
+
+        for (int e = 0; e < degree; ++e) {
+            if (e + ATTENTION_GRAPH_PREFETCH < degree) {
+                __builtin_prefetch(tensor_row(k, neighbours[e + ATTENTION_GRAPH_PREFETCH]));
+            }
+            const float* key = tensor_row(k, neighbours[e]);
+            for (int h = 0; h < num_heads; ++h) {
+                tensor_row(scores, h)[e] = scale * kernels->dot(query + h * d_k, key + h * d_k, d_k);
+            }
+        }
+        for (int h = 0; h < num_heads; ++h) {
+            float* row = tensor_row(scores, h);
+            float inv = 1.0f / kernels->exp_row(row, degree, kernels->row_max(row, degree));
+            for (int e = 0; e < degree; ++e) row[e] *= inv;
+        }
+
+        float* out = tensor_row(context, i);
+        memset(out, 0, context->cols * sizeof(float));
+        for (int e = 0; e < degree; ++e) {
+            if (e + ATTENTION_GRAPH_PREFETCH < degree) {
+                __builtin_prefetch(tensor_row(v, neighbours[e + ATTENTION_GRAPH_PREFETCH]));
+            }
+            const float* value = tensor_row(v, neighbours[e]);
+            for (int h = 0; h < num_heads; ++h) {
+                kernels->axpy(out + h * d_k, value + h * d_k, tensor_row(scores, h)[e], d_k);
+            }
+        }
+    }
+    return true;
+}
+
 void multi_head_self_attention(
-    float** input_embeddings, float** output_embeddings,
-    const PMLL_Graph* graph_config, const TransformerLayerComponentParams* params,
-    int seq_len) {
-    // This is a major simplification. Real MHA involves:
-    // For each head:
-    // 1. Linear projections of input_embeddings to Q, K, V matrices using params->Wq, Wk, Wv.
-    //    (seq_len x d_model) -> (seq_len x d_k or d_v)
-    // 2. Scaled Dot-Product Attention:
-    //    AttentionScores = softmax((Q * K^T) / sqrt(d_k))
-    //    AttendedValues = AttentionScores * V
-    //    This involves multiple matrix multiplications.
-    // Concatenate outputs of all heads: (seq_len x (num_heads * d_v)) -> (seq_len x d_model if num_heads*d_v = d_model)
-    // Final linear projection using params->Wo.
-
-    printf("      (Stub) Performing Multi-Head Self-Attention for %d tokens. Heads: %d, Dim: %d...\n",
-           seq_len, graph_config->num_attention_heads, graph_config->model_dimension);
-    // For stub: just copy input to output (no actual attention)
-    for (int i = 0; i < seq_len; ++i) {
-        memcpy(output_embeddings[i], input_embeddings[i], graph_config->model_dimension * sizeof(float));
-        // Simulate some processing by slightly altering values
-        if (graph_config->model_dimension > 0) output_embeddings[i][0] += 0.01f; 
+    const Tensor* input_embeddings, Tensor* output_embeddings,
+    const PMLL_Graph* graph_config, const TransformerLayerComponentParams* params) {
+    // Q = X Wq, K = X Wk, V = X Wv; for each head h (columns h*d_k.. of each):
+    //    head_h = softmax(Q_h K_h^T / sqrt(d_k)) V_h
+    // and the output is concat(head_1..head_H) Wo.
+    int seq_len = input_embeddings->rows;
+    int d_model = params->d_model;
+    int d_k = params->d_k;
+    int num_heads = graph_config->num_attention_heads;
+    AttentionKernel kernel = attention_kernel_get();
+    const GraphAdjacency* adj = &graph_config->adjacency;
+    if (kernel == ATTENTION_GRAPH_SPARSE && (!adj->row_offsets || adj->num_nodes != seq_len)) {
+        kernel = ATTENTION_TILED; // Tokens are not the graph's nodes
+    }
+
+    if (pmll_verbose) {
+        printf("      Performing Multi-Head Self-Attention for %d tokens. Heads: %d, Dim: %d (%s, %s GEMM)...\n",
+               seq_len, num_heads, d_model, attention_kernel_name(kernel), gemm_kernels()->name);
+    }
+    if (!params->Wq || !params->Wk || !params->Wv || !params->Wo) {
+        // No weights for this layer: pass the input through
+        tensor_copy(output_embeddings, input_embeddings);
+        return;
+    }
+
+    Tensor* q = &attention_workspace.q;
+    Tensor* k = &attention_workspace.k;
+    Tensor* v = &attention_workspace.v;
+    Tensor* context = &attention_workspace.context;
+    Tensor* keys_t = &attention_workspace.keys_t;
+    bool ok = tensor_reshape(q, seq_len, d_model) && tensor_reshape(k, seq_len, d_model) &&
+              tensor_reshape(v, seq_len, d_model) && tensor_reshape(context, seq_len, d_model) &&
+              (kernel == ATTENTION_GRAPH_SPARSE || tensor_reshape(keys_t, d_k, seq_len));
+
+    const float* x = input_embeddings->data;
+    int ldx = input_embeddings->stride;
+    ok = ok && gemm(seq_len, d_model, d_model, 1.0f, x, ldx, params->Wq, params->w_stride, 0.0f, q->data, q->stride);
+    ok = ok && gemm(seq_len, d_model, d_model, 1.0f, x, ldx, params->Wk, params->w_stride, 0.0f, k->data, k->stride);
+    ok = ok && gemm(seq_len, d_model, d_model, 1.0f, x, ldx, params->Wv, params->w_stride, 0.0f, v->data, v->stride);
+
+    float scale = 1.0f / sqrtf((float)d_k);
+    if (ok && kernel == ATTENTION_GRAPH_SPARSE) {
+        ok = attention_graph_sparse(adj, num_heads, d_k, scale);
+        num_heads = 0; // Every head is done
+    }
+    for (int h = 0; ok && h < num_heads; ++h) {
+        // K_h^T, so that every product is a plain A * B
+        for (int i = 0; i < seq_len; ++i) {
+            const float* key = tensor_row(k, i) + h * d_k;
+            for (int c = 0; c < d_k; ++c) tensor_row(keys_t, c)[i] = key[c];
+        }
+        ok = kernel == ATTENTION_TILED ? attention_head_tiled(h, seq_len, d_k, scale)
+                                       : attention_head_materialized(h, seq_len, d_k, scale);
+    }
+
+    ok = ok && gemm(seq_len, d_model, d_model, 1.0f, context->data, context->stride,
+                    params->Wo, params->w_stride, 0.0f, output_embeddings->data, output_embeddings->stride);
+    if (!ok) {
+        perror("Failed to allocate attention workspace");
+        tensor_copy(output_embeddings, input_embeddings);
     }
 }
 
 void add_and_norm(
-    float** input_embeddings1, float** input_embeddings2, float** output_embeddings,
-    const float* gamma, const float* beta, // LayerNorm params
-    int seq_len, int d_model) {
+    const Tensor* input_embeddings1, const Tensor* input_embeddings2, Tensor* output_embeddings,
+    const float* gamma, const float* beta) { // LayerNorm params
     // 1. Add: output_temp[i][j] = input_embeddings1[i][j] + input_embeddings2[i][j]
     // 2. Layer Normalization on output_temp:
     //    For each embedding vector in output_temp:
@@ -346,38 +1193,44 @@ void add_and_norm(
     //    Store result in output_embeddings.
     //    (gamma and beta are learnable parameters, d_model dimensional)
 
+    int seq_len = input_embeddings1->rows;
+    int d_model = input_embeddings1->cols;
     printf("      (Stub) Performing Add & Layer Normalization for %d tokens, dim %d...\n", seq_len, d_model);
     float epsilon = 1e-5f; // Small value to prevent division by zero
 
     for (int i = 0; i < seq_len; ++i) {
+        const float* x = tensor_row(input_embeddings1, i);
+        const float* sublayer = tensor_row(input_embeddings2, i);
+        float* out = tensor_row(output_embeddings, i);
+
         // Add
         for (int j = 0; j < d_model; ++j) {
-            output_embeddings[i][j] = input_embeddings1[i][j] + input_embeddings2[i][j];
+            out[j] = x[j] + sublayer[j];
         }
 
         // LayerNorm (conceptual, on the sum)
         float mean = 0.0f;
-        for (int j = 0; j < d_model; ++j) mean += output_embeddings[i][j];
+        for (int j = 0; j < d_model; ++j) mean += out[j];
         mean /= d_model;
 
         float variance = 0.0f;
-        for (int j = 0; j < d_model; ++j) variance += powf(output_embeddings[i][j] - mean, 2);
+        for (int j = 0; j < d_model; ++j) variance += powf(out[j] - mean, 2);
         variance /= d_model;
 
         for (int j = 0; j < d_model; ++j) {
-            float normalized_x = (output_embeddings[i][j] - mean) / sqrtf(variance + epsilon);
+            float normalized_x = (out[j] - mean) / sqrtf(variance + epsilon);
             // Apply scale (gamma) and shift (beta) - if params were provided
             // For stub, if gamma/beta are NULL, assume gamma=1, beta=0
             float current_gamma = (gamma && gamma[j]) ? gamma[j] : 1.0f;
             float current_beta  = (beta && beta[j]) ? beta[j] : 0.0f;
-            output_embeddings[i][j] = normalized_x * current_gamma + current_beta;
+            out[j] = normalized_x * current_gamma + current_beta;
         }
     }
 }
 
 void positionwise_feed_forward(
-    float** input_embeddings, float** output_embeddings,
-    const TransformerLayerComponentParams* params, int seq_len) {
+    const Tensor* input_embeddings, Tensor* output_embeddings,
+    const TransformerLayerComponentParams* params) {
     // For each position (independently):
     // 1. Linear transformation: hidden = activation(input_embeddings * W_ff1 + b_ff1)
     //    (d_model -> d_ff)
@@ -385,13 +1238,14 @@ void positionwise_feed_forward(
     // 2. Linear transformation: output_embeddings = hidden * W_ff2 + b_ff2
     //    (d_ff -> d_model)
 
+    int seq_len = input_embeddings->rows;
     printf("      (Stub) Performing Position-wise Feed-Forward Network for %d tokens (d_model: %d, d_ff: %d)...\n",
            seq_len, params->d_model, params->d_ff);
     // For stub: just copy input to output (no actual FFN)
+    tensor_copy(output_embeddings, input_embeddings);
     for (int i = 0; i < seq_len; ++i) {
-        memcpy(output_embeddings[i], input_embeddings[i], params->d_model * sizeof(float));
         // Simulate some processing
-        if (params->d_model > 0) output_embeddings[i][0] -= 0.005f;
+        if (params->d_model > 0) tensor_row(output_embeddings, i)[0] -= 0.005f;
     }
 }
 
@@ -412,7 +1266,7 @@ Selection* select_relevant_from_graph_elaborated(const Processed_Graph* p_graph,
 
     if (selection->num_selected > 0) {
         selection->selected_node_indices = (int*)malloc(selection->num_selected * sizeof(int));
-        selection->selected_data_vectors = (float**)malloc(selection->num_selected * sizeof(float*)); // Array of pointers
+        selection->selected_data_vectors = (const float**)malloc(selection->num_selected * sizeof(float*)); // Array of pointers
 
         if (!selection->selected_node_indices || !selection->selected_data_vectors) {
             perror("Failed to allocate selection arrays");
@@ -425,7 +1279,7 @@ Selection* select_relevant_from_graph_elaborated(const Processed_Graph* p_graph,
         for (int i = 0; i < selection->num_selected; ++i) {
             selection->selected_node_indices[i] = rand() % p_graph->num_embeddings;
             // Point to the actual (conceptually final) embedding data
-            selection->selected_data_vectors[i] = p_graph->final_contextual_embeddings[selection->selected_node_indices[i]];
+            selection->selected_data_vectors[i] = tensor_row(&p_graph->final_contextual_embeddings, selection->selected_node_indices[i]);
         }
     } else {
         selection->selected_node_indices = NULL;
@@ -487,30 +1341,25 @@ void print_generated_write_up(const WriteUp* write_up) {
 void free_pmll_graph_elaborated(PMLL_Graph* graph) {
     if (!graph) return;
     printf("[PMLL] Freeing conceptual PMLL_Graph structure for '%s'.\n", graph->graph_id);
+    if (graph->attention_weights) {
+        for (int l = 0; l < graph->num_transformer_layers; ++l) attention_weights_free(&graph->attention_weights[l]);
+        free(graph->attention_weights);
+    }
+    graph_adjacency_free(&graph->adjacency);
     free(graph);
 }
 
 void free_vectorized_graph_elaborated(Vectorized_Graph* v_graph) {
     if (!v_graph) return;
     printf("[VECTORIZE] Freeing Vectorized_Graph structure and its dummy vectors.\n");
-    if (v_graph->node_vectors) {
-        for (int i = 0; i < v_graph->num_vectors; ++i) {
-            if (v_graph->node_vectors[i]) free(v_graph->node_vectors[i]);
-        }
-        free(v_graph->node_vectors);
-    }
+    tensor_free(&v_graph->node_vectors);
     free(v_graph);
 }
 
 void free_processed_graph_elaborated(Processed_Graph* p_graph) {
     if (!p_graph) return;
     printf("[TRANSFORMER_CORE] Freeing Processed_Graph structure and its final embeddings.\n");
-    if (p_graph->final_contextual_embeddings) {
-        for (int i = 0; i < p_graph->num_embeddings; ++i) {
-            if (p_graph->final_contextual_embeddings[i]) free(p_graph->final_contextual_embeddings[i]);
-        }
-        free(p_graph->final_contextual_embeddings);
-    }
+    tensor_free(&p_graph->final_contextual_embeddings);
     free(p_graph);
 }
 
@@ -533,8 +1382,306 @@ void free_write_up(WriteUp* write_up) {
 }
 
 
+// --- Attention Benchmark ---
+
+static double bench_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Checks gemm() with every kernel set this CPU runs against a naive product,
+// on a shape that exercises edge tiles and several KC blocks.
+static bool bench_check_gemm(void) {
+    const int m = 37, n = 53, k = 300, lda = k + 3, ldb = n + 5, ldc = n + 1;
+    float* a = (float*)malloc(sizeof(float) * m * lda);
+    float* b = (float*)malloc(sizeof(float) * k * ldb);
+    float* c = (float*)malloc(sizeof(float) * m * ldc);
+    float* c0 = (float*)malloc(sizeof(float) * m * ldc);
+    if (!a || !b || !c || !c0) return false;
+    for (int i = 0; i < m * lda; ++i) a[i] = (float)rand() / RAND_MAX - 0.5f;
+    for (int i = 0; i < k * ldb; ++i) b[i] = (float)rand() / RAND_MAX - 0.5f;
+    for (int i = 0; i < m * ldc; ++i) c0[i] = (float)rand() / RAND_MAX - 0.5f;
+
+    bool passed = true;
+    const char* names[] = { "avx512", "avx2", "scalar" };
+    const GemmKernels* selected = gemm_kernels();
+    for (int t = 0; t < 3; ++t) {
+        gemm_active = gemm_kernels_for(names[t]);
+        if (!gemm_active) continue;
+        memcpy(c, c0, sizeof(float) * m * ldc);
+        gemm(m, n, k, 0.5f, a, lda, b, ldb, 0.25f, c, ldc);
+        double max_error = 0.0;
+        for (int i = 0; i < m; ++i) {
+            for (int j = 0; j < n; ++j) {
+                double expected = 0.25 * c0[i * ldc + j];
+                for (int p = 0; p < k; ++p) expected += 0.5 * a[i * lda + p] * b[p * ldb + j];
+                double error = fabs(expected - c[i * ldc + j]);
+                max_error = error > max_error ? error : max_error;
+            }
+        }
+        printf("gemm_check: kernels=%s max_abs_error=%.2e\n", names[t], max_error);
+        passed = passed && max_error < 1e-3;
+    }
+    gemm_active = selected;
+    free(a);
+    free(b);
+    free(c);
+    free(c0);
+    return passed;
+}
+
+// Weights, input and output of one benchmark case (d_k = 64)
+typedef struct {
+    PMLL_Graph config;
+    AttentionWeights weights;
+    TransformerLayerComponentParams params;
+    Tensor input;
+    Tensor output;
+} BenchAttentionCase;
+
+static bool bench_case_init(BenchAttentionCase* c, int d_model, int seq_len) {
+    memset(c, 0, sizeof(*c));
+    c->config.model_dimension = d_model;
+    c->config.num_attention_heads = d_model / 64;
+    c->params.d_model = d_model;
+    c->params.d_k = c->params.d_v = 64;
+    if (!attention_weights_init(&c->weights, d_model) || !tensor_alloc(&c->input, seq_len, d_model) ||
+        !tensor_alloc(&c->output, seq_len, d_model)) {
+        return false;
+    }
+    c->params.Wq = c->weights.wq.data;
+    c->params.Wk = c->weights.wk.data;
+    c->params.Wv = c->weights.wv.data;
+    c->params.Wo = c->weights.wo.data;
+    c->params.w_stride = c->weights.wq.stride;
+    for (int i = 0; i < seq_len; ++i) {
+        float* row = tensor_row(&c->input, i);
+        for (int j = 0; j < d_model; ++j) row[j] = (float)rand() / RAND_MAX - 0.5f;
+    }
+    return true;
+}
+
+static void bench_case_free(BenchAttentionCase* c) {
+    attention_weights_free(&c->weights);
+    graph_adjacency_free(&c->config.adjacency);
+    tensor_free(&c->input);
+    tensor_free(&c->output);
+}
+
+// Checks the tiled kernel against the materialized one on a shape with
+// partial query and key blocks.
+static bool bench_check_attention(void) {
+    BenchAttentionCase c;
+    if (!bench_case_init(&c, 128, 700)) return false;
+    Tensor reference;
+    if (!tensor_alloc(&reference, 700, 128)) return false;
+
+    attention_kernel_set(ATTENTION_MATERIALIZED);
+    multi_head_self_attention(&c.input, &reference, &c.config, &c.params);
+    attention_kernel_set(ATTENTION_TILED);
+    multi_head_self_attention(&c.input, &c.output, &c.config, &c.params);
+
+    double max_error = 0.0;
+    for (int i = 0; i < 700; ++i) {
+        for (int j = 0; j < 128; ++j) {
+            double error = fabs(tensor_row(&reference, i)[j] - tensor_row(&c.output, i)[j]);
+            max_error = error > max_error ? error : max_error;
+        }
+    }
+    printf("attention_check: tiled_vs_materialized max_abs_error=%.2e\n", max_error);
+    tensor_free(&reference);
+    bench_case_free(&c);
+    attention_workspace_free();
+    return max_error < 1e-4;
+}
+
+// Runs in a child process of its own, so ru_maxrss is this case's peak.
+static int bench_attention_case(int d_model, int seq_len, AttentionKernel kernel) {
+    BenchAttentionCase c;
+    if (!bench_case_init(&c, d_model, seq_len)) {
+        perror("bench_attention: allocation");
+        return 1;
+    }
+    attention_kernel_set(kernel);
+
+    double start = bench_seconds();
+    multi_head_self_attention(&c.input, &c.output, &c.config, &c.params);
+    double elapsed = bench_seconds() - start;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    // Four d_model x d_model projections, then Q K^T and P V over all heads
+    double flops = 8.0 * seq_len * d_model * d_model + 4.0 * seq_len * (double)seq_len * d_model;
+    printf("attention: kernel=%s gemm=%s d_model=%d heads=%d seq_len=%d seconds=%.3f gflops=%.1f peak_rss_mb=%.1f\n",
+           attention_kernel_name(kernel), gemm_kernels()->name, d_model,
+           c.config.num_attention_heads, seq_len, elapsed, flops / elapsed / 1e9, usage.ru_maxrss / 1024.0);
+    fflush(stdout); // The child leaves with _exit()
+    bench_case_free(&c);
+    attention_workspace_free();
+    return 0;
+}
+
+// Times one multi_head_self_attention() call, tiled and materialized, for
+// every model_dimension in 128..1024 and seq_len in 1000..max_seq_len.
+static int bench_attention(int max_seq_len) {
+    pmll_verbose = false;
+    if (!bench_check_gemm()) {
+        fprintf(stderr, "gemm_check: FAILED\n");
+        return 1;
+    }
+    if (!bench_check_attention()) {
+        fprintf(stderr, "attention_check: FAILED\n");
+        return 1;
+    }
+
+    const int dims[] = { 128, 256, 512, 1024 };
+    const int seq_lens[] = { 1000, 4000, 16000 };
+    const AttentionKernel kernels[] = { ATTENTION_TILED, ATTENTION_MATERIALIZED };
+    int failures = 0;
+    for (int di = 0; di < 4; ++di) {
+        for (int si = 0; si < 3 && seq_lens[si] <= max_seq_len; ++si) {
+            for (int ki = 0; ki < 2; ++ki) {
+                fflush(stdout);
+                pid_t child = fork();
+                if (child == 0) {
+                    _exit(bench_attention_case(dims[di], seq_lens[si], kernels[ki]));
+                }
+                int status = 0;
+                if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) ||
+                    WEXITSTATUS(status) != 0) {
+                    fprintf(stderr, "bench_attention: d_model=%d seq_len=%d failed\n", dims[di], seq_lens[si]);
+                    failures++;
+                }
+            }
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// Checks graph-sparse attention on a complete graph (every node adjacent to
+// every node, itself included) against the dense tiled kernel.
+static bool bench_check_graph_attention(void) {
+    const int n = 300;
+    BenchAttentionCase c;
+    if (!bench_case_init(&c, 128, n)) return false;
+    Tensor reference;
+    if (!tensor_alloc(&reference, n, 128)) return false;
+
+    GraphAdjacency* adj = &c.config.adjacency;
+    adj->row_offsets = (long long*)malloc((n + 1) * sizeof(long long));
+    adj->col_indices = (int*)malloc((size_t)n * n * sizeof(int));
+    if (!adj->row_offsets || !adj->col_indices) return false;
+    for (int i = 0; i <= n; ++i) adj->row_offsets[i] = (long long)i * n;
+    for (int i = 0; i < n * n; ++i) adj->col_indices[i] = i % n;
+    adj->num_nodes = n;
+    adj->num_edges = (long long)n * n;
+    adj->max_degree = n;
+
+    attention_kernel_set(ATTENTION_TILED);
+    multi_head_self_attention(&c.input, &reference, &c.config, &c.params);
+    attention_kernel_set(ATTENTION_GRAPH_SPARSE);
+    multi_head_self_attention(&c.input, &c.output, &c.config, &c.params);
+
+    double max_error = 0.0;
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < 128; ++j) {
+            double error = fabs(tensor_row(&reference, i)[j] - tensor_row(&c.output, i)[j]);
+            max_error = error > max_error ? error : max_error;
+        }
+    }
+    printf("attention_check: graph_complete_vs_tiled max_abs_error=%.2e\n", max_error);
+    tensor_free(&reference);
+    bench_case_free(&c);
+    attention_workspace_free();
+    return max_error < 1e-4;
+}
+
+// Runs in a child process of its own, like bench_attention_case(). Reports
+// the whole attention call and, separately, the sparse kernel alone (rerun
+// on the projections the call left in the workspace).
+static int bench_graph_attention_case(int d_model, int nodes, long long edges, AttentionKernel kernel) {
+    BenchAttentionCase c;
+    if (!bench_case_init(&c, d_model, nodes) ||
+        !graph_adjacency_build_random(&c.config.adjacency, nodes, edges, 1u)) {
+        perror("bench_graph_attention: allocation");
+        return 1;
+    }
+    attention_kernel_set(kernel);
+
+    double start = bench_seconds();
+    multi_head_self_attention(&c.input, &c.output, &c.config, &c.params);
+    double elapsed = bench_seconds() - start;
+    double kernel_elapsed = 0.0;
+    if (kernel == ATTENTION_GRAPH_SPARSE) {
+        start = bench_seconds();
+        attention_graph_sparse(&c.config.adjacency, c.config.num_attention_heads, c.params.d_k,
+                               1.0f / sqrtf((float)c.params.d_k));
+        kernel_elapsed = bench_seconds() - start;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    long long scored = kernel == ATTENTION_GRAPH_SPARSE ? c.config.adjacency.num_edges : (long long)nodes * nodes;
+    printf("graph_attention: kernel=%s gemm=%s d_model=%d nodes=%d edges=%lld scored_pairs=%lld seconds=%.3f "
+           "kernel_seconds=%.3f edges_per_sec=%.3g peak_rss_mb=%.1f\n",
+           attention_kernel_name(kernel), gemm_kernels()->name, d_model, nodes, c.config.adjacency.num_edges,
+           scored, elapsed, kernel_elapsed, kernel_elapsed > 0.0 ? c.config.adjacency.num_edges / kernel_elapsed : 0.0,
+           usage.ru_maxrss / 1024.0);
+    fflush(stdout); // The child leaves with _exit()
+    bench_case_free(&c);
+    attention_workspace_free();
+    return 0;
+}
+
+static bool bench_fork(int (*run)(int, int, long long, AttentionKernel), int d_model, int nodes, long long edges,
+                       AttentionKernel kernel) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        _exit(run(d_model, nodes, edges, kernel));
+    }
+    int status = 0;
+    return child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Graph-sparse attention at d_model 128 on `nodes` nodes with an average
+// out-degree of edges / nodes, after a sparse vs dense tiled comparison on a
+// graph small enough for the dense kernel.
+static int bench_graph_attention(int nodes, long long edges) {
+    pmll_verbose = false;
+    if (!bench_check_graph_attention()) {
+        fprintf(stderr, "attention_check: FAILED\n");
+        return 1;
+    }
+
+    const int small_nodes = 16000;
+    long long small_edges = (long long)((double)edges / nodes * small_nodes);
+    int failures = 0;
+    failures += !bench_fork(bench_graph_attention_case, 128, small_nodes, small_edges, ATTENTION_TILED);
+    failures += !bench_fork(bench_graph_attention_case, 128, small_nodes, small_edges, ATTENTION_GRAPH_SPARSE);
+    failures += !bench_fork(bench_graph_attention_case, 128, nodes, edges, ATTENTION_GRAPH_SPARSE);
+    if (failures) fprintf(stderr, "bench_graph_attention: %d case(s) failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
+
 // --- Main Program Loop ---
-int main() {
+// With --bench-attention [max_seq_len] or --bench-graph-attention [nodes]
+// [edges], runs that benchmark instead of the demo loop.
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "--bench-attention") == 0) {
+        return bench_attention(argc > 2 ? atoi(argv[2]) : 16000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-graph-attention") == 0) {
+        int nodes = argc > 2 ? atoi(argv[2]) : 1000000;
+        long long edges = argc > 3 ? atoll(argv[3]) : 10000000;
+        if (nodes <= 0 || edges < 0) {
+            fprintf(stderr, "Usage: %s --bench-graph-attention [nodes] [edges]\n", argv[0]);
+            return 1;
+        }
+        return bench_graph_attention(nodes, edges);
+    }
+
     srand(time(NULL));
 
     printf("Initializing ELABORATED & TRANSFORMER-DETAILED Conceptual PMLL Processing System...\n");
@@ -556,6 +1703,7 @@ int main() {
             sleep(1);
             continue;
         }
+        long allocations_before = tensor_allocations;
 
         Vectorized_Graph* vectorized_data = vectorize_from_pmll_elaborated(main_pmll_graph);
         if (!vectorized_data) {
@@ -568,28 +1716,30 @@ int main() {
         Processed_Graph* processed_data = process_with_transformer_layers_elaborated(vectorized_data, main_pmll_graph);
         // Vectorized_data's content (node_vectors) is conceptually used as the initial input
         // to the transformer layers. The Processed_Graph will contain the final output.
-        // We free vectorized_data wrapper and its allocated dummy vectors after it's used.
-        free_vectorized_graph_elaborated(vectorized_data); 
-        
         if (!processed_data) {
             fprintf(stderr, "[ERROR] Failed to process graph with transformer layers for topic %s.\n", current_topic->id);
+            free_vectorized_graph_elaborated(vectorized_data);
             free_novel_topic(current_topic);
             continue;
         }
+        printf("[TENSOR] %ld tensor buffers allocated for topic %s.\n",
+               tensor_allocations - allocations_before, current_topic->id);
 
         Selection* selection = select_relevant_from_graph_elaborated(processed_data, current_topic);
-        // Processed_data's content (final_contextual_embeddings) is used by selection.
-        // We free processed_data wrapper and its allocated dummy embeddings after.
-        free_processed_graph_elaborated(processed_data); 
-        
         if (!selection) {
             fprintf(stderr, "[ERROR] Failed to select relevant data for topic %s.\n", current_topic->id);
+            free_processed_graph_elaborated(processed_data);
+            free_vectorized_graph_elaborated(vectorized_data);
             free_novel_topic(current_topic);
             continue;
         }
 
         WriteUp* final_write_up = rewrite_or_generate_write_up_elaborated(selection, current_topic);
+        // The selection points into processed_data's embeddings, and processed_data
+        // back at vectorized_data, so all three are freed only after the write-up.
         free_selection_elaborated(selection);
+        free_processed_graph_elaborated(processed_data);
+        free_vectorized_graph_elaborated(vectorized_data);
 
         if (final_write_up) {
             print_generated_write_up(final_write_up);
@@ -607,6 +1757,7 @@ int main() {
     printf("\n[SYSTEM] Demo loop finished.\n");
     printf("[PMLL] System shutting down. Persisting final graph state (conceptual)...\n");
     free_pmll_graph_elaborated(main_pmll_graph);
+    attention_workspace_free();
 
     return 0;
 }
@@ -10,6 +10,7 @@
 #include <curl/curl.h>
 #include <json-c/json.h>
 #include <pthread.h>
+#include "q_trace.h"
 
 // Version information
 #define CPM_VERSION "1.0.0"
@@ -22,11 +23,17 @@
 #define MAX_VERSION_LENGTH 32
 #define MAX_PATH_LENGTH 1024
 
+// Q Promise error messages
+#define Q_ERROR_CANCELLED "Promise cancelled"
+#define Q_ERROR_TIMEOUT "Promise timed out"
+#define Q_ERROR_NO_PROMISE "Mapper returned no promise"
+
 // Forward declarations
 typedef struct Package Package;
 typedef struct PMLL PMLL;
 typedef struct QPromise QPromise;
 typedef struct QPromiseResult QPromiseResult;
+typedef struct QCancelToken QCancelToken;
 
 // Q Promise system for asynchronous operations
 typedef enum {
@@ -38,6 +45,16 @@ typedef enum {
 typedef void (*QPromiseResolver)(void* data);
 typedef void (*QPromiseRejecter)(const char* error);
 typedef void (*QPromiseThen)(QPromiseResult* result);
+typedef void (*QPromiseListener)(QPromise* promise, void* context);
+
+// Where then/catch callbacks and listeners run once a promise settles.
+// They are all dispatched by the promise core (CPM/qpromises), after the
+// promise mutex has been released, in registration order.
+typedef enum {
+    Q_DISPATCH_INLINE,     // on the thread that settles the promise
+    Q_DISPATCH_EXECUTOR,   // on the q_run_async() worker pool
+    Q_DISPATCH_EVENT_LOOP  // on the qpromises microtask loop (run_event_loop())
+} QDispatchMode;
 
 struct QPromiseResult {
     void* data;
@@ -45,11 +62,18 @@ struct QPromiseResult {
     QPromiseState state;
 };
 
+// A QPromise is a qpromises Promise (its `core`) plus the result record,
+// cancellation and blocking wait the CPM engine needs. The core holds the
+// callbacks and dispatches them, and settles with the QPromise as its value.
 struct QPromise {
     QPromiseState state;
     QPromiseResult* result;
-    QPromiseThen then_callback;
-    QPromiseThen catch_callback;
+    struct Promise* core;
+    unsigned int refs;
+    QDispatchMode dispatch;
+    bool cancelled;
+    QCancelToken* cancel_token;
+    unsigned long cancel_registration;
     pthread_mutex_t mutex;
     pthread_cond_t condition;
 };
@@ -103,6 +127,71 @@ QPromise* q_promise_then(QPromise* promise, QPromiseThen callback);
 QPromise* q_promise_catch(QPromise* promise, QPromiseThen callback);
 void q_promise_wait(QPromise* promise);
 void q_promise_free(QPromise* promise);
+QPromise* q_promise_retain(QPromise* promise);
+void q_promise_cancel(QPromise* promise);
+int q_promise_on_settled(QPromise* promise, QPromiseListener listener, void* context);
+bool q_promise_is_cancelled(QPromise* promise);
+int q_promise_attach_token(QPromise* promise, QCancelToken* token);
+int q_promise_set_dispatch(QPromise* promise, QDispatchMode mode);
+
+// Cancellation tokens: cancelling rejects every attached promise, drops
+// queued executor tasks and aborts in-flight cancellable transfers
+typedef void (*QCancelCallback)(void* context);
+
+QCancelToken* q_cancel_token_new(void);
+void q_cancel_token_cancel(QCancelToken* token, const char* reason);
+bool q_cancel_token_is_cancelled(QCancelToken* token);
+const char* q_cancel_token_reason(QCancelToken* token);
+unsigned long q_cancel_token_register(QCancelToken* token, QCancelCallback callback, void* context);
+bool q_cancel_token_unregister(QCancelToken* token, unsigned long id);
+void q_cancel_token_free(QCancelToken* token);
+
+// Executor: runs blocking work on the worker pool of q_runtime.h, shared
+// with CPM/qpromises' promise_run_async(). A task returns a CPMError code;
+// non-success rejects the promise with cpm_error_string().
+typedef int (*QTaskFunction)(void* arg, QCancelToken* token, void** result);
+
+typedef void (*QExecutorJob)(void* arg);
+
+QPromise* q_run_async(QTaskFunction task, void* arg, QCancelToken* token);
+int q_executor_submit(QExecutorJob job, void* arg);
+
+// Fibers: user-space tasks multiplexed over the executor's workers. Inside
+// a fiber, q_await() suspends the fiber instead of blocking its thread.
+QPromise* q_fiber_spawn(QTaskFunction task, void* arg, QCancelToken* token);
+bool q_fiber_active(void);
+bool q_fiber_await(QPromise* promise);
+
+// Async/await style wrapper: suspends the calling fiber, or blocks the
+// calling thread outside a fiber
+typedef struct {
+    QPromise* promise;
+    void* result;
+    char* error;
+} AwaitResult;
+
+AwaitResult q_await(QPromise* promise);
+
+// Q Promise combinators (non-blocking). q_all resolves with a malloc'd
+// array of the values in input order (the caller frees it), or rejects on
+// the first rejection.
+QPromise* q_all(QPromise** promises, size_t count);
+QPromise* q_race(QPromise** promises, size_t count);
+QPromise* q_any(QPromise** promises, size_t count);
+QPromise* q_all_settled(QPromise** promises, size_t count);
+void q_all_settled_free(QPromiseResult* results, size_t count);
+QPromise* q_timeout(QPromise* promise, unsigned long timeout_ms);
+QPromise* q_delay(unsigned long delay_ms, void* data);
+
+// Bounded-concurrency map: calls fn(items[i], i) with at most limit of the
+// returned promises pending at once. Resolves with a malloc'd array of the
+// results in input order; rejects (and cancels the rest) on first failure.
+// fn must return an owned reference (q_map_limit frees it once the promise
+// has settled); a mapper that keeps the promise must q_promise_retain() it
+// first. A NULL return fails that item with Q_ERROR_NO_PROMISE.
+typedef QPromise* (*QPromiseMapper)(void* item, size_t index);
+
+QPromise* q_map_limit(void** items, size_t count, QPromiseMapper fn, size_t limit);
 
 // PMLL functions
 PMLL* pmll_new(void);
@@ -120,7 +209,11 @@ int pmll_sort(PMLL* list);
 int load_package_json(CPMContext* ctx);
 int save_package_json(CPMContext* ctx);
 int download_package(const char* package_name, const char* version, const char* target_dir);
+int download_package_cancellable(const char* package_name, const char* version, const char* target_dir,
+                                 QCancelToken* token);
 int extract_package(const char* tarball_path, const char* target_dir);
+int extract_package_cancellable(const char* tarball_path, const char* target_dir, QCancelToken* token);
+const char* cpm_registry_url(void);
 char* fetch_package_info(const char* package_name);
 int validate_package_name(const char* name);
 int create_directory(const char* path);
@@ -128,6 +221,7 @@ int create_directory(const char* path);
 // HTTP helper functions
 size_t WriteMemoryCallback(void* contents, size_t size, size_t nmemb, HTTPResponse* response);
 HTTPResponse* http_get(const char* url);
+HTTPResponse* http_get_cancellable(const char* url, QCancelToken* token);
 void http_response_free(HTTPResponse* response);
 
 // Error handling
@@ -140,7 +234,8 @@ typedef enum {
     CPM_ERROR_FILE_IO = 5,
     CPM_ERROR_DEPENDENCY = 6,
     CPM_ERROR_PERMISSION = 7,
-    CPM_ERROR_MEMORY = 8
+    CPM_ERROR_MEMORY = 8,
+    CPM_ERROR_CANCELLED = 9
 } CPMError;
 
 const char* cpm_error_string(CPMError error);
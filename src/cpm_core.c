@@ -30,14 +30,150 @@ int cpm_init(CPMContext* ctx) {
     return CPM_SUCCESS;
 }
 
+// One package of a package.json install. The downloads share a token, so
+// the first one to fail cancels the rest.
+typedef struct InstallFanOut InstallFanOut;
+
+typedef struct {
+    InstallFanOut* fan_out;
+    const Package* package;
+    char target_dir[MAX_PATH_LENGTH];
+    int result;
+} InstallJob;
+
+struct InstallFanOut {
+    QCancelToken* token;
+    int first_error;
+    pthread_mutex_t mutex;
+};
+
+static int install_job_run(void* arg, QCancelToken* token, void** result) {
+    InstallJob* job = arg;
+    (void)result;
+    job->result = download_package_cancellable(job->package->name, job->package->version, job->target_dir, token);
+    return job->result;
+}
+
+static void install_job_on_settled(QPromise* promise, void* context) {
+    InstallJob* job = context;
+    InstallFanOut* fan_out = job->fan_out;
+    
+    // Jobs cancelled while still queued never ran and keep CPM_ERROR_CANCELLED
+    if (promise->state == Q_FULFILLED || job->result == CPM_ERROR_CANCELLED) return;
+    
+    pthread_mutex_lock(&fan_out->mutex);
+    bool first = fan_out->first_error == CPM_SUCCESS;
+    if (first) fan_out->first_error = job->result;
+    pthread_mutex_unlock(&fan_out->mutex);
+    
+    if (first) {
+        fprintf(stderr, "✗ %s@%s: %s\n", job->package->name, job->package->version,
+                cpm_error_string(job->result));
+        q_cancel_token_cancel(fan_out->token, "Sibling download failed");
+    }
+}
+
+// Scoped packages ("@scope/name") need their scope directory first. A
+// path that does not fit is an error, never a truncated directory.
+static int install_create_target(const char* modules_dir, const char* name, char* target_dir) {
+    const char* slash = strchr(name, '/');
+    int length;
+    if (slash) {
+        length = snprintf(target_dir, MAX_PATH_LENGTH, "%s/%.*s", modules_dir, (int)(slash - name), name);
+        if (length < 0 || length >= MAX_PATH_LENGTH) return CPM_ERROR_INVALID_ARGS;
+        if (create_directory(target_dir) != CPM_SUCCESS) return CPM_ERROR_PERMISSION;
+    }
+    length = snprintf(target_dir, MAX_PATH_LENGTH, "%s/%s", modules_dir, name);
+    if (length < 0 || length >= MAX_PATH_LENGTH) return CPM_ERROR_INVALID_ARGS;
+    return CPM_SUCCESS;
+}
+
+// Downloads every package in ctx->package_list into node_modules in
+// parallel on the q_run_async() workers.
+static int cpm_install_all(CPMContext* ctx) {
+    size_t count = 0;
+    for (Package* p = ctx->package_list->head; p; p = p->next) {
+        if (ctx->dry_run) printf("Would install: %s@%s\n", p->name, p->version);
+        count++;
+    }
+    if (count == 0 || ctx->dry_run) return CPM_SUCCESS;
+    
+    char modules_dir[MAX_PATH_LENGTH];
+    int length = snprintf(modules_dir, MAX_PATH_LENGTH, "%s/node_modules", ctx->current_directory);
+    if (length < 0 || length >= MAX_PATH_LENGTH) return CPM_ERROR_INVALID_ARGS;
+    if (create_directory(modules_dir) != CPM_SUCCESS) return CPM_ERROR_PERMISSION;
+    
+    InstallFanOut fan_out;
+    fan_out.token = q_cancel_token_new();
+    fan_out.first_error = CPM_SUCCESS;
+    InstallJob* jobs = calloc(count, sizeof(InstallJob));
+    QPromise** downloads = calloc(count, sizeof(QPromise*));
+    if (!fan_out.token || !jobs || !downloads) {
+        q_cancel_token_free(fan_out.token);
+        free(jobs);
+        free(downloads);
+        return CPM_ERROR_MEMORY;
+    }
+    pthread_mutex_init(&fan_out.mutex, NULL);
+    
+    size_t started = 0;
+    for (Package* p = ctx->package_list->head; p; p = p->next) {
+        InstallJob* job = &jobs[started];
+        job->fan_out = &fan_out;
+        job->package = p;
+        job->result = CPM_ERROR_CANCELLED;
+        int created = install_create_target(modules_dir, p->name, job->target_dir);
+        if (created != CPM_SUCCESS) {
+            job->result = created;
+            fan_out.first_error = created;
+            fprintf(stderr, "✗ %s@%s: %s\n", p->name, p->version, cpm_error_string(created));
+            q_cancel_token_cancel(fan_out.token, "Could not create package directory");
+            break;
+        }
+        if (ctx->verbose) printf("Installing package: %s@%s\n", p->name, p->version);
+        
+        downloads[started] = q_run_async(install_job_run, job, fan_out.token);
+        if (!downloads[started]) {
+            fan_out.first_error = CPM_ERROR_MEMORY;
+            q_cancel_token_cancel(fan_out.token, "Out of memory");
+            break;
+        }
+        q_promise_on_settled(downloads[started], install_job_on_settled, job);
+        started++;
+    }
+    
+    if (started > 0) {
+        QPromise* settled = q_all_settled(downloads, started);
+        if (settled) {
+            q_promise_wait(settled);
+            q_all_settled_free(settled->result->data, started);
+            q_promise_free(settled);
+        } else {
+            for (size_t i = 0; i < started; i++) q_promise_wait(downloads[i]);
+        }
+    }
+    
+    for (size_t i = 0; i < started; i++) {
+        if (jobs[i].result == CPM_SUCCESS) {
+            printf("✓ Installed %s@%s\n", jobs[i].package->name, jobs[i].package->version);
+        }
+        q_promise_free(downloads[i]);
+    }
+    
+    int result = fan_out.first_error;
+    pthread_mutex_destroy(&fan_out.mutex);
+    q_cancel_token_free(fan_out.token);
+    free(jobs);
+    free(downloads);
+    return result;
+}
+
 int cpm_install(CPMContext* ctx, const char* package_name, const char* version) {
     if (!ctx) return CPM_ERROR_INVALID_ARGS;
     
     if (package_name == NULL) {
-        // Install from package.json
         printf("Installing dependencies from package.json...\n");
-        // Implementation would parse package.json and install all dependencies
-        return CPM_SUCCESS;
+        return cpm_install_all(ctx);
     }
     
     if (ctx->verbose) {
@@ -192,6 +328,7 @@ const char* cpm_error_string(CPMError error) {
         case CPM_ERROR_DEPENDENCY: return "Dependency error";
         case CPM_ERROR_PERMISSION: return "Permission denied";
         case CPM_ERROR_MEMORY: return "Memory allocation error";
+        case CPM_ERROR_CANCELLED: return "Operation cancelled";
         default: return "Unknown error";
     }
 }
\ No newline at end of file
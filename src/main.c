@@ -48,6 +48,9 @@ int main(int argc, char* argv[]) {
         return CPM_ERROR_MEMORY;
     }
 
+    // CPM_TRACE=<file> records promise activity as Chrome trace JSON
+    q_trace_start_from_env();
+
     // Parse command
     const char* command = argv[1];
 
@@ -0,0 +1,163 @@
+#define _POSIX_C_SOURCE 200809L
+#include "cpm.h"
+#include "q_runtime.h"
+
+typedef enum {
+    Q_TASK_NEW,
+    Q_TASK_QUEUED,
+    Q_TASK_CANCELLED
+} QTaskState;
+
+typedef struct QTask {
+    QRuntimeJob runtime_job;
+    QTaskFunction function;
+    QExecutorJob job;
+    void* arg;
+    QCancelToken* token;
+    unsigned long cancel_registration;
+    QPromise* promise;
+    QTaskState state;
+} QTask;
+
+static QRuntimePool q_task_pool = Q_RUNTIME_POOL("q_task", QTask, NULL, NULL);
+
+// Guards the NEW -> QUEUED/CANCELLED transition of tasks with a token; the
+// queue itself belongs to the shared runtime executor.
+static pthread_mutex_t q_executor_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static QTask* q_task_new(void) {
+    QTask* task = q_runtime_alloc(&q_task_pool);
+    if (!task) return NULL;
+    
+    task->runtime_job.prev = NULL;
+    task->runtime_job.next = NULL;
+    task->runtime_job.queued = false;
+    task->runtime_job.arg = task;
+    task->function = NULL;
+    task->job = NULL;
+    task->arg = NULL;
+    task->token = NULL;
+    task->cancel_registration = 0;
+    task->promise = NULL;
+    task->state = Q_TASK_NEW;
+    return task;
+}
+
+// Plain jobs have no promise or token of their own
+static void q_executor_run_job(void* arg) {
+    QTask* task = arg;
+    QExecutorJob job = task->job;
+    void* job_arg = task->arg;
+    q_runtime_free(&q_task_pool, task);
+    
+    uint64_t start = q_trace_span_start();
+    job(job_arg);
+    if (start) q_trace_complete("executor", "job", start, NULL);
+}
+
+static void q_executor_run_task(void* arg) {
+    QTask* task = arg;
+    void* result = NULL;
+    int status = CPM_ERROR_CANCELLED;
+    if (!q_cancel_token_is_cancelled(task->token)) {
+        uint64_t start = q_trace_span_start();
+        status = task->function(task->arg, task->token, &result);
+        if (start) q_trace_complete("executor", "task", start, task->promise);
+    }
+    
+    // Waits out a cancel callback that may still be looking at this task
+    if (task->cancel_registration) {
+        q_cancel_token_unregister(task->token, task->cancel_registration);
+    }
+    
+    if (status == CPM_SUCCESS) {
+        q_promise_resolve(task->promise, result);
+    } else if (q_cancel_token_is_cancelled(task->token)) {
+        q_promise_reject(task->promise, q_cancel_token_reason(task->token));
+    } else {
+        q_promise_reject(task->promise, cpm_error_string(status));
+    }
+    
+    q_promise_free(task->promise);
+    q_runtime_free(&q_task_pool, task);
+}
+
+// Token callback: a task still waiting in the queue is removed and its
+// promise rejected right away. Running tasks observe the token themselves.
+static void q_executor_on_cancel(void* context) {
+    QTask* task = context;
+    
+    pthread_mutex_lock(&q_executor_mutex);
+    if (task->state == Q_TASK_NEW) {
+        // q_run_async has not queued it yet and will drop it instead
+        task->state = Q_TASK_CANCELLED;
+        pthread_mutex_unlock(&q_executor_mutex);
+        return;
+    }
+    pthread_mutex_unlock(&q_executor_mutex);
+    
+    if (q_runtime_cancel(&task->runtime_job)) {
+        q_promise_reject(task->promise, q_cancel_token_reason(task->token));
+        q_promise_free(task->promise);
+        q_runtime_free(&q_task_pool, task);
+    }
+}
+
+QPromise* q_run_async(QTaskFunction function, void* arg, QCancelToken* token) {
+    if (!function) return NULL;
+    if (q_runtime_worker_count() == 0) return NULL;
+    
+    QPromise* promise = q_promise_new();
+    if (!promise) return NULL;
+    
+    QTask* task = q_task_new();
+    if (!task) {
+        q_promise_free(promise);
+        return NULL;
+    }
+    
+    task->runtime_job.function = q_executor_run_task;
+    task->function = function;
+    task->arg = arg;
+    task->token = token;
+    // The task keeps its own reference so callers may free the promise early
+    task->promise = q_promise_retain(promise);
+    
+    if (token) {
+        task->cancel_registration = q_cancel_token_register(token, q_executor_on_cancel, task);
+    }
+    
+    pthread_mutex_lock(&q_executor_mutex);
+    bool cancelled = task->state == Q_TASK_CANCELLED;
+    if (!cancelled) {
+        task->state = Q_TASK_QUEUED;
+        q_runtime_submit(&task->runtime_job);
+    }
+    pthread_mutex_unlock(&q_executor_mutex);
+    
+    if (cancelled) {
+        q_promise_reject(promise, q_cancel_token_reason(token));
+        q_promise_free(promise);
+        q_runtime_free(&q_task_pool, task);
+    }
+    
+    return promise;
+}
+
+// Runs `job(arg)` on the worker pool; used for deferred promise callbacks
+int q_executor_submit(QExecutorJob job, void* arg) {
+    if (!job) return CPM_ERROR_INVALID_ARGS;
+    
+    QTask* task = q_task_new();
+    if (!task) return CPM_ERROR_MEMORY;
+    
+    task->runtime_job.function = q_executor_run_job;
+    task->job = job;
+    task->arg = arg;
+    if (!q_runtime_submit(&task->runtime_job)) {
+        q_runtime_free(&q_task_pool, task);
+        return CPM_ERROR_MEMORY;
+    }
+    
+    return CPM_SUCCESS;
+}
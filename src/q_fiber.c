@@ -0,0 +1,205 @@
+#define _GNU_SOURCE
+#include "cpm.h"
+#include <sys/mman.h>
+#include <ucontext.h>
+
+// Fiber stacks are reserved lazily by mmap, so only touched pages cost
+// memory; the lowest page is a guard. Released stacks are pooled.
+#define Q_FIBER_STACK_SIZE (256 * 1024)
+#define Q_FIBER_STACK_POOL 256
+
+typedef struct QFiber {
+    ucontext_t context;
+    ucontext_t* caller;     // where the fiber returns when it suspends
+    void* stack;
+    QTaskFunction function;
+    void* arg;
+    QCancelToken* token;
+    QPromise* promise;      // settled with the task's outcome
+    QPromise* awaiting;     // set while suspended in q_await()
+    bool finished;
+} QFiber;
+
+static struct {
+    void* stacks[Q_FIBER_STACK_POOL];
+    size_t stack_count;
+    size_t page_size;
+    pthread_mutex_t mutex;
+} q_fiber_pool = {
+    .stack_count = 0,
+    .page_size = 0,
+    .mutex = PTHREAD_MUTEX_INITIALIZER
+};
+
+static __thread QFiber* q_fiber_current = NULL;
+
+// Fibers migrate between worker threads, so never let the compiler keep a
+// thread-local address across a context switch
+static __attribute__((noinline)) QFiber* q_fiber_self(void) {
+    return q_fiber_current;
+}
+
+static __attribute__((noinline)) void q_fiber_set_self(QFiber* fiber) {
+    q_fiber_current = fiber;
+}
+
+static void* q_fiber_stack_acquire(void) {
+    pthread_mutex_lock(&q_fiber_pool.mutex);
+    if (q_fiber_pool.page_size == 0) {
+        q_fiber_pool.page_size = (size_t)sysconf(_SC_PAGESIZE);
+    }
+    void* stack = q_fiber_pool.stack_count > 0 ? q_fiber_pool.stacks[--q_fiber_pool.stack_count] : NULL;
+    size_t page_size = q_fiber_pool.page_size;
+    pthread_mutex_unlock(&q_fiber_pool.mutex);
+    
+    if (stack) return stack;
+    
+    stack = mmap(NULL, Q_FIBER_STACK_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) return NULL;
+    
+    mprotect(stack, page_size, PROT_NONE);
+    return stack;
+}
+
+static void q_fiber_stack_release(void* stack) {
+    pthread_mutex_lock(&q_fiber_pool.mutex);
+    if (q_fiber_pool.stack_count < Q_FIBER_STACK_POOL) {
+        q_fiber_pool.stacks[q_fiber_pool.stack_count++] = stack;
+        stack = NULL;
+    }
+    pthread_mutex_unlock(&q_fiber_pool.mutex);
+    
+    if (stack) {
+        munmap(stack, Q_FIBER_STACK_SIZE);
+    }
+}
+
+static void q_fiber_destroy(QFiber* fiber) {
+    q_fiber_stack_release(fiber->stack);
+    q_promise_free(fiber->promise);
+    free(fiber);
+}
+
+static void q_fiber_entry(void) {
+    QFiber* fiber = q_fiber_self();
+    
+    void* result = NULL;
+    int status = CPM_ERROR_CANCELLED;
+    if (!q_cancel_token_is_cancelled(fiber->token)) {
+        status = fiber->function(fiber->arg, fiber->token, &result);
+    }
+    
+    if (status == CPM_SUCCESS) {
+        q_promise_resolve(fiber->promise, result);
+    } else if (q_cancel_token_is_cancelled(fiber->token)) {
+        q_promise_reject(fiber->promise, q_cancel_token_reason(fiber->token));
+    } else {
+        q_promise_reject(fiber->promise, cpm_error_string(status));
+    }
+    
+    fiber->finished = true;
+    setcontext(fiber->caller);
+}
+
+static void q_fiber_run(void* arg);
+
+// Queue the fiber on the worker pool. Running it here instead is also
+// safe (the caller's context is saved per run), just not concurrent.
+static void q_fiber_schedule(QFiber* fiber) {
+    if (q_executor_submit(q_fiber_run, fiber) != CPM_SUCCESS) {
+        q_fiber_run(fiber);
+    }
+}
+
+static void q_fiber_on_settled(QPromise* promise, void* context) {
+    (void)promise;
+    q_fiber_schedule(context);
+}
+
+// Executor job: run the fiber until it finishes or suspends. A suspended
+// fiber is only handed to the awaited promise once its context has been
+// saved, so it can never be resumed twice.
+static void q_fiber_run(void* arg) {
+    QFiber* fiber = arg;
+    QFiber* outer = q_fiber_self();
+    ucontext_t caller;
+    
+    fiber->caller = &caller;
+    q_fiber_set_self(fiber);
+    uint64_t start = q_trace_span_start();
+    swapcontext(&caller, &fiber->context);
+    if (start) q_trace_complete("fiber", "run", start, fiber->promise);
+    q_fiber_set_self(outer);
+    
+    if (fiber->finished) {
+        q_fiber_destroy(fiber);
+        return;
+    }
+    
+    QPromise* awaited = fiber->awaiting;
+    fiber->awaiting = NULL;
+    if (q_promise_on_settled(awaited, q_fiber_on_settled, fiber) != CPM_SUCCESS) {
+        // q_fiber_await() re-checks the state and suspends again if needed
+        q_fiber_schedule(fiber);
+    }
+}
+
+bool q_fiber_active(void) {
+    return q_fiber_self() != NULL;
+}
+
+bool q_fiber_await(QPromise* promise) {
+    QFiber* fiber = q_fiber_self();
+    if (!fiber || !promise) return false;
+    
+    for (;;) {
+        pthread_mutex_lock(&promise->mutex);
+        bool pending = promise->state == Q_PENDING;
+        pthread_mutex_unlock(&promise->mutex);
+        if (!pending) break;
+        
+        fiber->awaiting = promise;
+        swapcontext(&fiber->context, fiber->caller);
+    }
+    
+    return true;
+}
+
+QPromise* q_fiber_spawn(QTaskFunction function, void* arg, QCancelToken* token) {
+    if (!function) return NULL;
+    
+    QFiber* fiber = malloc(sizeof(QFiber));
+    if (!fiber) return NULL;
+    
+    fiber->stack = q_fiber_stack_acquire();
+    fiber->promise = q_promise_new();
+    if (!fiber->stack || !fiber->promise || getcontext(&fiber->context) != 0) {
+        if (fiber->stack) q_fiber_stack_release(fiber->stack);
+        q_promise_free(fiber->promise);
+        free(fiber);
+        return NULL;
+    }
+    
+    size_t guard = q_fiber_pool.page_size;
+    fiber->context.uc_stack.ss_sp = (char*)fiber->stack + guard;
+    fiber->context.uc_stack.ss_size = Q_FIBER_STACK_SIZE - guard;
+    fiber->context.uc_link = NULL;
+    makecontext(&fiber->context, q_fiber_entry, 0);
+    
+    fiber->caller = NULL;
+    fiber->function = function;
+    fiber->arg = arg;
+    fiber->token = token;
+    fiber->awaiting = NULL;
+    fiber->finished = false;
+    
+    // The caller gets its own reference; the fiber keeps one until it ends
+    QPromise* promise = q_promise_retain(fiber->promise);
+    if (token) {
+        q_promise_attach_token(promise, token);
+    }
+    
+    q_fiber_schedule(fiber);
+    return promise;
+}
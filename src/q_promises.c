@@ -1,63 +1,192 @@
+#define _POSIX_C_SOURCE 200809L
 #include "cpm.h"
+#include "q_runtime.h"
+#include "../CPM/qpromises/qpromise.h"
+#include <stdint.h>
+
+static bool q_promise_fulfil(QPromise* promise, void* data);
+static void q_promise_settle_rejected(QPromise* promise, const char* error, bool cancelled);
+static void q_promise_detach_token(QPromise* promise);
+
+// QPromise is a layer over the qpromises core: the core Promise holds the
+// callbacks (then, catch and listeners alike) and dispatches them through
+// its scheduler, so a QPromise and a Promise settled side by side run their
+// callbacks the same way and, with Q_DISPATCH_EVENT_LOOP, on the same loop.
+// The core settles with the QPromise itself as its value.
+
+// A then/catch callback or listener, registered as one core callback entry
+typedef struct {
+    QPromiseListener listener;
+    QPromiseThen callback;
+    void* context;
+    QPromiseState on;      // Q_FULFILLED (then), Q_REJECTED (catch), Q_PENDING (either)
+    bool holds_reference;  // see q_promise_add_reaction()
+    bool pooled;           // false for the block's own first reaction
+} QPromiseReaction;
+
+// Promises come from the shared runtime pools with their result record
+// alongside and their mutex and condition variable already initialised.
+// Most promises get a single reaction, so the first one lives here too.
+typedef struct {
+    QPromise promise;
+    QPromiseResult result;
+    QPromiseReaction first_reaction;
+    bool first_reaction_used;
+} QPromiseBlock;
+
+static bool q_promise_construct(void* object) {
+    QPromiseBlock* block = object;
+    if (pthread_mutex_init(&block->promise.mutex, NULL) != 0) {
+        return false;
+    }
+    if (pthread_cond_init(&block->promise.condition, NULL) != 0) {
+        pthread_mutex_destroy(&block->promise.mutex);
+        return false;
+    }
+    return true;
+}
+
+static void q_promise_destroy(void* object) {
+    QPromiseBlock* block = object;
+    pthread_mutex_destroy(&block->promise.mutex);
+    pthread_cond_destroy(&block->promise.condition);
+}
+
+static QRuntimePool q_promise_pool = Q_RUNTIME_POOL("q_promise", QPromiseBlock, q_promise_construct, q_promise_destroy);
+static QRuntimePool q_reaction_pool = Q_RUNTIME_POOL("q_reaction", QPromiseReaction, NULL, NULL);
 
 QPromise* q_promise_new(void) {
-    QPromise* promise = malloc(sizeof(QPromise));
-    if (!promise) return NULL;
+    QPromiseBlock* block = q_runtime_alloc(&q_promise_pool);
+    if (!block) return NULL;
     
-    promise->state = Q_PENDING;
-    promise->result = malloc(sizeof(QPromiseResult));
-    if (!promise->result) {
-        free(promise);
+    QPromise* promise = &block->promise;
+    promise->core = promise_create();
+    if (!promise->core) {
+        q_runtime_free(&q_promise_pool, block);
         return NULL;
     }
+    promise_set_dispatch(promise->core, PROMISE_DISPATCH_INLINE);
     
+    promise->state = Q_PENDING;
+    promise->result = &block->result;
     promise->result->data = NULL;
     promise->result->error = NULL;
     promise->result->state = Q_PENDING;
-    promise->then_callback = NULL;
-    promise->catch_callback = NULL;
+    block->first_reaction_used = false;
+    promise->refs = 1;
+    promise->dispatch = Q_DISPATCH_INLINE;
+    promise->cancelled = false;
+    promise->cancel_token = NULL;
+    promise->cancel_registration = 0;
     
-    // Initialize thread synchronization
-    if (pthread_mutex_init(&promise->mutex, NULL) != 0) {
-        free(promise->result);
-        free(promise);
-        return NULL;
+    if (Q_TRACE_ON()) {
+        q_trace_async_begin("promise", "pending", promise);
     }
     
-    if (pthread_cond_init(&promise->condition, NULL) != 0) {
-        pthread_mutex_destroy(&promise->mutex);
-        free(promise->result);
-        free(promise);
-        return NULL;
+    return promise;
+}
+
+// Core callback for every reaction. A NULL value means the promise was
+// freed before it settled: the reaction is dropped without running.
+static PromiseValue q_promise_react(PromiseValue value, void* context) {
+    QPromiseReaction* reaction = context;
+    QPromise* promise = value;
+    
+    if (promise && (reaction->on == Q_PENDING || reaction->on == promise->state)) {
+        uint64_t start = q_trace_span_start();
+        if (reaction->callback) {
+            reaction->callback(promise->result);
+            if (start) q_trace_complete("promise", promise->state == Q_FULFILLED ? "then" : "catch", start, promise);
+        } else {
+            reaction->listener(promise, reaction->context);
+            if (start) q_trace_complete("promise", "listener", start, promise);
+        }
     }
     
-    return promise;
+    bool release = promise && reaction->holds_reference;
+    if (reaction->pooled) {
+        q_runtime_free(&q_reaction_pool, reaction);
+    }
+    if (release) {
+        q_promise_free(promise);
+    }
+    return NULL;
+}
+
+// Drops the settling path's reference once the reactions registered
+// before it have run (they run in registration order).
+static PromiseValue q_promise_release(PromiseValue value, void* context) {
+    (void)context;
+    q_promise_free(value);
+    return NULL;
+}
+
+// Hands the settled promise to the core, which runs (or queues) its
+// reactions. Inline, they have all run by the time the core has settled,
+// under the caller's reference. Otherwise they run later, so the settling
+// path takes a reference that a last entry drops once they have.
+static void q_promise_settle_core(QPromise* promise, QDispatchMode mode) {
+    bool deferred = mode != Q_DISPATCH_INLINE;
+    bool released = deferred && promise_observe(promise->core, q_promise_release, q_promise_release, NULL);
+    if (promise->state == Q_FULFILLED) {
+        promise_resolve(promise->core, promise);
+    } else {
+        promise_reject(promise->core, promise);
+    }
+    if (deferred && !released) {
+        q_promise_free(promise);
+    }
 }
 
 void q_promise_resolve(QPromise* promise, void* data) {
-    if (!promise || promise->state != Q_PENDING) return;
+    q_promise_fulfil(promise, data);
+}
+
+// Returns false if the promise had already settled (e.g. it was cancelled),
+// in which case `data` stays the caller's.
+static bool q_promise_fulfil(QPromise* promise, void* data) {
+    if (!promise) return false;
     
     pthread_mutex_lock(&promise->mutex);
+    if (promise->state != Q_PENDING) {
+        pthread_mutex_unlock(&promise->mutex);
+        return false;
+    }
     
     promise->state = Q_FULFILLED;
     promise->result->state = Q_FULFILLED;
     promise->result->data = data;
-    
-    // Execute then callback if registered
-    if (promise->then_callback) {
-        promise->then_callback(promise->result);
+    QDispatchMode mode = promise->dispatch;
+    if (mode != Q_DISPATCH_INLINE) {
+        promise->refs++; // held until the reactions have run
     }
-    
     pthread_cond_broadcast(&promise->condition);
     pthread_mutex_unlock(&promise->mutex);
+    
+    if (Q_TRACE_ON()) {
+        q_trace_async_end("promise", "pending", promise, "fulfilled");
+    }
+    
+    q_promise_detach_token(promise);
+    q_promise_settle_core(promise, mode);
+    return true;
 }
 
 void q_promise_reject(QPromise* promise, const char* error) {
-    if (!promise || promise->state != Q_PENDING) return;
+    q_promise_settle_rejected(promise, error, false);
+}
+
+static void q_promise_settle_rejected(QPromise* promise, const char* error, bool cancelled) {
+    if (!promise) return;
     
     pthread_mutex_lock(&promise->mutex);
+    if (promise->state != Q_PENDING) {
+        pthread_mutex_unlock(&promise->mutex);
+        return;
+    }
     
     promise->state = Q_REJECTED;
+    promise->cancelled = cancelled;
     promise->result->state = Q_REJECTED;
     
     // Copy error message
@@ -69,48 +198,139 @@ void q_promise_reject(QPromise* promise, const char* error) {
         }
     }
     
-    // Execute catch callback if registered
-    if (promise->catch_callback) {
-        promise->catch_callback(promise->result);
+    QDispatchMode mode = promise->dispatch;
+    if (mode != Q_DISPATCH_INLINE) {
+        promise->refs++; // held until the reactions have run
     }
-    
     pthread_cond_broadcast(&promise->condition);
     pthread_mutex_unlock(&promise->mutex);
+    
+    if (Q_TRACE_ON()) {
+        q_trace_async_end("promise", "pending", promise, cancelled ? "cancelled" : "rejected");
+    }
+    
+    q_promise_detach_token(promise);
+    q_promise_settle_core(promise, mode);
 }
 
-QPromise* q_promise_then(QPromise* promise, QPromiseThen callback) {
-    if (!promise || !callback) return promise;
+int q_promise_set_dispatch(QPromise* promise, QDispatchMode mode) {
+    if (!promise) return CPM_ERROR_INVALID_ARGS;
     
+    PromiseDispatch dispatch = PROMISE_DISPATCH_INLINE;
+    if (mode == Q_DISPATCH_EXECUTOR) {
+        dispatch = PROMISE_DISPATCH_RUNTIME;
+    } else if (mode == Q_DISPATCH_EVENT_LOOP) {
+        dispatch = PROMISE_DISPATCH_LOOP;
+    }
     pthread_mutex_lock(&promise->mutex);
-    promise->then_callback = callback;
+    promise->dispatch = mode;
+    promise_set_dispatch(promise->core, dispatch);
+    pthread_mutex_unlock(&promise->mutex);
     
-    // If already resolved, execute immediately
-    if (promise->state == Q_FULFILLED) {
-        callback(promise->result);
-    }
+    return CPM_SUCCESS;
+}
+
+// Internal producers (timers, executor tasks, combinators) retain the
+// promises they will touch later; q_promise_free() drops one reference.
+QPromise* q_promise_retain(QPromise* promise) {
+    if (!promise) return NULL;
     
+    pthread_mutex_lock(&promise->mutex);
+    promise->refs++;
     pthread_mutex_unlock(&promise->mutex);
     return promise;
 }
 
-QPromise* q_promise_catch(QPromise* promise, QPromiseThen callback) {
-    if (!promise || !callback) return promise;
+void q_promise_cancel(QPromise* promise) {
+    q_promise_settle_rejected(promise, Q_ERROR_CANCELLED, true);
+}
+
+bool q_promise_is_cancelled(QPromise* promise) {
+    if (!promise) return false;
     
     pthread_mutex_lock(&promise->mutex);
-    promise->catch_callback = callback;
+    bool cancelled = promise->cancelled;
+    pthread_mutex_unlock(&promise->mutex);
+    
+    return cancelled;
+}
+
+// Registers a reaction with the core. One attached while the promise is
+// pending is covered by the settling path; one attached later to a promise
+// that does not dispatch inline takes a reference of its own, since it may
+// run after the caller lets go.
+static int q_promise_add_reaction(QPromise* promise, QPromiseListener listener,
+                                  QPromiseThen callback, void* context, QPromiseState on) {
+    QPromiseBlock* block = (QPromiseBlock*)promise;
     
-    // If already rejected, execute immediately
-    if (promise->state == Q_REJECTED) {
-        callback(promise->result);
+    // The mutex orders a pending registration before the settling path's
+    // release entry; a settled one may run inline, so it is added unlocked.
+    pthread_mutex_lock(&promise->mutex);
+    QPromiseReaction* reaction = &block->first_reaction;
+    if (!block->first_reaction_used) {
+        block->first_reaction_used = true;
+        reaction->pooled = false;
+    } else if ((reaction = q_runtime_alloc(&q_reaction_pool)) != NULL) {
+        reaction->pooled = true;
+    } else {
+        pthread_mutex_unlock(&promise->mutex);
+        return CPM_ERROR_MEMORY;
     }
     
-    pthread_mutex_unlock(&promise->mutex);
+    reaction->listener = listener;
+    reaction->callback = callback;
+    reaction->context = context;
+    reaction->on = on;
+    bool pending = promise->state == Q_PENDING;
+    reaction->holds_reference = !pending && promise->dispatch != Q_DISPATCH_INLINE;
+    if (pending) {
+        bool added = promise_observe(promise->core, q_promise_react, q_promise_react, reaction);
+        pthread_mutex_unlock(&promise->mutex);
+        if (added) return CPM_SUCCESS;
+    } else if (!reaction->holds_reference) {
+        pthread_mutex_unlock(&promise->mutex);
+        if (promise_observe(promise->core, q_promise_react, q_promise_react, reaction)) {
+            return CPM_SUCCESS;
+        }
+    } else {
+        promise->refs++;
+        pthread_mutex_unlock(&promise->mutex);
+        if (promise_observe(promise->core, q_promise_react, q_promise_react, reaction)) {
+            return CPM_SUCCESS;
+        }
+        q_promise_free(promise);
+    }
+    
+    if (reaction->pooled) {
+        q_runtime_free(&q_reaction_pool, reaction);
+    }
+    return CPM_ERROR_MEMORY;
+}
+
+int q_promise_on_settled(QPromise* promise, QPromiseListener listener, void* context) {
+    if (!promise || !listener) return CPM_ERROR_INVALID_ARGS;
+    
+    return q_promise_add_reaction(promise, listener, NULL, context, Q_PENDING);
+}
+
+QPromise* q_promise_then(QPromise* promise, QPromiseThen callback) {
+    if (!promise || !callback) return promise;
+    
+    q_promise_add_reaction(promise, NULL, callback, NULL, Q_FULFILLED);
+    return promise;
+}
+
+QPromise* q_promise_catch(QPromise* promise, QPromiseThen callback) {
+    if (!promise || !callback) return promise;
+    
+    q_promise_add_reaction(promise, NULL, callback, NULL, Q_REJECTED);
     return promise;
 }
 
 void q_promise_wait(QPromise* promise) {
     if (!promise) return;
     
+    uint64_t start = q_trace_span_start();
     pthread_mutex_lock(&promise->mutex);
     
     while (promise->state == Q_PENDING) {
@@ -118,100 +338,894 @@ void q_promise_wait(QPromise* promise) {
     }
     
     pthread_mutex_unlock(&promise->mutex);
+    if (start) q_trace_complete("promise", "wait", start, promise);
 }
 
 void q_promise_free(QPromise* promise) {
     if (!promise) return;
     
     pthread_mutex_lock(&promise->mutex);
+    bool last = --promise->refs == 0;
+    bool pending = promise->state == Q_PENDING;
+    pthread_mutex_unlock(&promise->mutex);
     
-    if (promise->result) {
-        if (promise->result->error) {
-            free(promise->result->error);
+    if (!last) return;
+    
+    if (pending) {
+        // Drop reactions that never fired: settle the core with no promise,
+        // running its entries here so they free their records
+        promise_set_dispatch(promise->core, PROMISE_DISPATCH_INLINE);
+        promise_reject(promise->core, NULL);
+    }
+    promise_free(promise->core);
+    
+    free(promise->result->error);
+    
+    // The mutex and condition variable stay initialised in the pool
+    q_runtime_free(&q_promise_pool, (QPromiseBlock*)promise);
+}
+
+// Cancellation tokens. Callbacks registered on a token run once, on the
+// thread that cancels it, outside the token mutex.
+typedef struct QCancelRegistration {
+    unsigned long id;
+    QCancelCallback callback;
+    void* context;
+    struct QCancelRegistration* next;
+} QCancelRegistration;
+
+struct QCancelToken {
+    bool cancelled;
+    char* reason;
+    QCancelRegistration* registrations;
+    unsigned long next_id;
+    bool firing;
+    pthread_t firing_thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+};
+
+QCancelToken* q_cancel_token_new(void) {
+    QCancelToken* token = malloc(sizeof(QCancelToken));
+    if (!token) return NULL;
+    
+    token->cancelled = false;
+    token->reason = NULL;
+    token->registrations = NULL;
+    token->next_id = 1;
+    token->firing = false;
+    
+    if (pthread_mutex_init(&token->mutex, NULL) != 0) {
+        free(token);
+        return NULL;
+    }
+    
+    if (pthread_cond_init(&token->condition, NULL) != 0) {
+        pthread_mutex_destroy(&token->mutex);
+        free(token);
+        return NULL;
+    }
+    
+    return token;
+}
+
+void q_cancel_token_cancel(QCancelToken* token, const char* reason) {
+    if (!token) return;
+    
+    pthread_mutex_lock(&token->mutex);
+    if (token->cancelled) {
+        pthread_mutex_unlock(&token->mutex);
+        return;
+    }
+    
+    token->cancelled = true;
+    if (!reason) reason = Q_ERROR_CANCELLED;
+    token->reason = malloc(strlen(reason) + 1);
+    if (token->reason) {
+        strcpy(token->reason, reason);
+    }
+    
+    QCancelRegistration* registrations = token->registrations;
+    token->registrations = NULL;
+    token->firing = true;
+    token->firing_thread = pthread_self();
+    pthread_mutex_unlock(&token->mutex);
+    
+    while (registrations) {
+        QCancelRegistration* next = registrations->next;
+        registrations->callback(registrations->context);
+        free(registrations);
+        registrations = next;
+    }
+    
+    pthread_mutex_lock(&token->mutex);
+    token->firing = false;
+    pthread_cond_broadcast(&token->condition);
+    pthread_mutex_unlock(&token->mutex);
+}
+
+bool q_cancel_token_is_cancelled(QCancelToken* token) {
+    if (!token) return false;
+    
+    pthread_mutex_lock(&token->mutex);
+    bool cancelled = token->cancelled;
+    pthread_mutex_unlock(&token->mutex);
+    
+    return cancelled;
+}
+
+const char* q_cancel_token_reason(QCancelToken* token) {
+    if (!token) return NULL;
+    
+    pthread_mutex_lock(&token->mutex);
+    const char* reason = token->reason ? token->reason : (token->cancelled ? Q_ERROR_CANCELLED : NULL);
+    pthread_mutex_unlock(&token->mutex);
+    
+    return reason;
+}
+
+unsigned long q_cancel_token_register(QCancelToken* token, QCancelCallback callback, void* context) {
+    if (!token || !callback) return 0;
+    
+    QCancelRegistration* registration = malloc(sizeof(QCancelRegistration));
+    if (!registration) return 0;
+    
+    pthread_mutex_lock(&token->mutex);
+    if (token->cancelled) {
+        pthread_mutex_unlock(&token->mutex);
+        free(registration);
+        // Already cancelled: run now so the caller never misses it
+        callback(context);
+        return 0;
+    }
+    
+    registration->id = token->next_id++;
+    registration->callback = callback;
+    registration->context = context;
+    registration->next = token->registrations;
+    token->registrations = registration;
+    
+    unsigned long id = registration->id;
+    pthread_mutex_unlock(&token->mutex);
+    return id;
+}
+
+bool q_cancel_token_unregister(QCancelToken* token, unsigned long id) {
+    if (!token) return false;
+    
+    pthread_mutex_lock(&token->mutex);
+    
+    bool found = false;
+    for (QCancelRegistration** link = &token->registrations; *link; link = &(*link)->next) {
+        if ((*link)->id == id) {
+            QCancelRegistration* registration = *link;
+            *link = registration->next;
+            free(registration);
+            found = true;
+            break;
         }
-        free(promise->result);
     }
     
+    // If the callback may be running on another thread, wait for it so the
+    // caller can release whatever the callback's context points at.
+    while (!found && token->firing && !pthread_equal(token->firing_thread, pthread_self())) {
+        pthread_cond_wait(&token->condition, &token->mutex);
+    }
+    
+    pthread_mutex_unlock(&token->mutex);
+    return found;
+}
+
+void q_cancel_token_free(QCancelToken* token) {
+    if (!token) return;
+    
+    pthread_mutex_lock(&token->mutex);
+    while (token->firing) {
+        pthread_cond_wait(&token->condition, &token->mutex);
+    }
+    while (token->registrations) {
+        QCancelRegistration* next = token->registrations->next;
+        free(token->registrations);
+        token->registrations = next;
+    }
+    pthread_mutex_unlock(&token->mutex);
+    
+    pthread_mutex_destroy(&token->mutex);
+    pthread_cond_destroy(&token->condition);
+    free(token->reason);
+    free(token);
+}
+
+// The token registration holds a reference to the promise. Whichever side
+// retires the registration (the firing token or the settle path) drops it.
+static void q_promise_on_token_cancelled(void* context) {
+    QPromise* promise = context;
+    q_promise_settle_rejected(promise, q_cancel_token_reason(promise->cancel_token), true);
+    q_promise_free(promise);
+}
+
+int q_promise_attach_token(QPromise* promise, QCancelToken* token) {
+    if (!promise || !token) return CPM_ERROR_INVALID_ARGS;
+    
+    pthread_mutex_lock(&promise->mutex);
+    bool pending = promise->state == Q_PENDING && !promise->cancel_token;
+    if (pending) {
+        promise->cancel_token = token;
+        promise->refs++;
+    }
+    pthread_mutex_unlock(&promise->mutex);
+    
+    if (!pending) return CPM_ERROR_INVALID_ARGS;
+    
+    unsigned long registration = q_cancel_token_register(token, q_promise_on_token_cancelled, promise);
+    if (registration == 0) {
+        // Either the callback already ran (and dropped the reference) or
+        // registration failed and the reference is still ours
+        if (!q_cancel_token_is_cancelled(token)) {
+            q_promise_free(promise);
+            return CPM_ERROR_MEMORY;
+        }
+        return CPM_SUCCESS;
+    }
+    
+    pthread_mutex_lock(&promise->mutex);
+    promise->cancel_registration = registration;
+    bool settled = promise->state != Q_PENDING;
     pthread_mutex_unlock(&promise->mutex);
-    pthread_mutex_destroy(&promise->mutex);
-    pthread_cond_destroy(&promise->condition);
     
-    free(promise);
+    // Settled while we were registering; the settle path saw no id yet
+    if (settled) {
+        q_promise_detach_token(promise);
+    }
+    
+    return CPM_SUCCESS;
 }
 
-// Q Promise utility functions for chaining
-QPromise* q_all(QPromise** promises, size_t count) {
-    if (!promises || count == 0) return NULL;
+// Called once the promise has settled so the token no longer refers to it
+static void q_promise_detach_token(QPromise* promise) {
+    pthread_mutex_lock(&promise->mutex);
+    QCancelToken* token = promise->cancel_token;
+    unsigned long registration = promise->cancel_registration;
+    promise->cancel_registration = 0;
+    pthread_mutex_unlock(&promise->mutex);
+    
+    if (token && registration && q_cancel_token_unregister(token, registration)) {
+        q_promise_free(promise);
+    }
+}
+
+// Shared state for q_all, q_race, q_any and q_all_settled. Each input gets
+// a slot so its listener knows its index; the context is freed once every
+// input has reported back.
+typedef enum {
+    Q_COMBINE_ALL,
+    Q_COMBINE_RACE,
+    Q_COMBINE_ANY,
+    Q_COMBINE_ALL_SETTLED
+} QCombineMode;
+
+typedef struct QCombineContext QCombineContext;
+
+typedef struct {
+    QCombineContext* ctx;
+    size_t index;
+} QCombineSlot;
+
+struct QCombineContext {
+    QCombineMode mode;
+    QPromise* main_promise;
+    QPromise** inputs;
+    QCombineSlot* slots;
+    QPromiseResult* outcomes;  // q_all_settled: handed to the caller on success
+    void** values;  // q_all: fulfilled values, handed to the caller on success
+    size_t total;
+    size_t settled;
+    size_t rejected;
+    size_t pending_listeners;
+    bool done;
+    pthread_mutex_t mutex;
+};
+
+static void q_combine_release(QCombineContext* ctx) {
+    pthread_mutex_lock(&ctx->mutex);
+    bool last = --ctx->pending_listeners == 0;
+    pthread_mutex_unlock(&ctx->mutex);
+    
+    if (!last) return;
+    
+    for (size_t i = 0; i < ctx->total; i++) {
+        q_promise_free(ctx->inputs[i]);
+    }
+    q_promise_free(ctx->main_promise);
+    pthread_mutex_destroy(&ctx->mutex);
+    // Still here if the combined promise settled (was cancelled) first
+    free(ctx->values);
+    q_all_settled_free(ctx->outcomes, ctx->total);
+    free(ctx->inputs);
+    free(ctx->slots);
+    free(ctx);
+}
+
+// Cancel every input except the winner; their listeners still fire and
+// release their hold on the context.
+static void q_combine_cancel_losers(QCombineContext* ctx, size_t winner) {
+    for (size_t i = 0; i < ctx->total; i++) {
+        if (i != winner) {
+            q_promise_cancel(ctx->inputs[i]);
+        }
+    }
+}
+
+// Cancelling the combined promise cancels every input still running
+static void q_combine_on_main_settled(QPromise* promise, void* context) {
+    QCombineContext* ctx = context;
+    
+    if (promise->cancelled) {
+        q_combine_cancel_losers(ctx, ctx->total);
+    }
+    q_combine_release(ctx);
+}
+
+static void q_combine_on_settled(QPromise* promise, void* context) {
+    QCombineSlot* slot = context;
+    QCombineContext* ctx = slot->ctx;
+    bool fulfilled = promise->state == Q_FULFILLED;
+    bool settle_main = false;
+    void** values = NULL;
+    QPromiseResult* outcomes = NULL;
+    
+    pthread_mutex_lock(&ctx->mutex);
+    ctx->settled++;
+    if (!fulfilled) ctx->rejected++;
+    
+    switch (ctx->mode) {
+        case Q_COMBINE_ALL:
+            if (fulfilled) ctx->values[slot->index] = promise->result->data;
+            settle_main = !ctx->done && (!fulfilled || ctx->settled == ctx->total);
+            if (settle_main && fulfilled) {
+                values = ctx->values; // Now the caller's
+                ctx->values = NULL;
+            }
+            break;
+        case Q_COMBINE_RACE:
+            settle_main = !ctx->done;
+            break;
+        case Q_COMBINE_ANY:
+            settle_main = !ctx->done && (fulfilled || ctx->rejected == ctx->total);
+            break;
+        case Q_COMBINE_ALL_SETTLED: {
+            QPromiseResult* outcome = &ctx->outcomes[slot->index];
+            outcome->state = promise->state;
+            outcome->data = promise->result->data;
+            outcome->error = NULL;
+            if (promise->result->error) {
+                outcome->error = malloc(strlen(promise->result->error) + 1);
+                if (outcome->error) {
+                    strcpy(outcome->error, promise->result->error);
+                }
+            }
+            settle_main = ctx->settled == ctx->total;
+            if (settle_main) {
+                outcomes = ctx->outcomes; // Now the caller's
+                ctx->outcomes = NULL;
+            }
+            break;
+        }
+    }
+    if (settle_main) ctx->done = true;
+    pthread_mutex_unlock(&ctx->mutex);
     
-    QPromise* all_promise = q_promise_new();
-    if (!all_promise) return NULL;
+    if (settle_main) {
+        switch (ctx->mode) {
+            case Q_COMBINE_ALL:
+                if (fulfilled && !q_promise_fulfil(ctx->main_promise, values)) {
+                    free(values);
+                } else if (!fulfilled) {
+                    q_promise_reject(ctx->main_promise, "One or more promises failed");
+                }
+                break;
+            case Q_COMBINE_RACE:
+                if (fulfilled) {
+                    q_promise_resolve(ctx->main_promise, promise->result->data);
+                } else {
+                    q_promise_reject(ctx->main_promise, promise->result->error);
+                }
+                q_combine_cancel_losers(ctx, slot->index);
+                break;
+            case Q_COMBINE_ANY:
+                if (fulfilled) {
+                    q_promise_resolve(ctx->main_promise, promise->result->data);
+                    q_combine_cancel_losers(ctx, slot->index);
+                } else {
+                    q_promise_reject(ctx->main_promise, "All promises were rejected");
+                }
+                break;
+            case Q_COMBINE_ALL_SETTLED:
+                if (!q_promise_fulfil(ctx->main_promise, outcomes)) {
+                    q_all_settled_free(outcomes, ctx->total);
+                }
+                break;
+        }
+    }
     
-    // Create a structure to track completion
-    typedef struct {
-        size_t completed;
-        size_t total;
-        void** results;
-        bool has_error;
-        QPromise* main_promise;
-        pthread_mutex_t mutex;
-    } AllContext;
+    q_combine_release(ctx);
+}
+
+static QPromise* q_combine(QCombineMode mode, QPromise** promises, size_t count) {
+    if (!promises || count == 0) return NULL;
     
-    AllContext* ctx = malloc(sizeof(AllContext));
+    QPromise* main_promise = q_promise_new();
+    if (!main_promise) return NULL;
+    
+    QCombineContext* ctx = malloc(sizeof(QCombineContext));
     if (!ctx) {
-        q_promise_free(all_promise);
+        q_promise_free(main_promise);
         return NULL;
     }
     
-    ctx->completed = 0;
+    ctx->mode = mode;
+    ctx->main_promise = main_promise;
+    ctx->inputs = malloc(count * sizeof(QPromise*));
+    ctx->slots = malloc(count * sizeof(QCombineSlot));
+    ctx->outcomes = (mode == Q_COMBINE_ALL_SETTLED) ? calloc(count, sizeof(QPromiseResult)) : NULL;
+    ctx->values = (mode == Q_COMBINE_ALL) ? calloc(count, sizeof(void*)) : NULL;
     ctx->total = count;
-    ctx->results = calloc(count, sizeof(void*));
-    ctx->has_error = false;
-    ctx->main_promise = all_promise;
+    ctx->settled = 0;
+    ctx->rejected = 0;
+    ctx->pending_listeners = count + 1;
+    ctx->done = false;
+    
+    if (!ctx->inputs || !ctx->slots || (mode == Q_COMBINE_ALL_SETTLED && !ctx->outcomes) ||
+        (mode == Q_COMBINE_ALL && !ctx->values)) {
+        free(ctx->inputs);
+        free(ctx->slots);
+        free(ctx->outcomes);
+        free(ctx->values);
+        free(ctx);
+        q_promise_free(main_promise);
+        return NULL;
+    }
+    
+    // The context keeps every promise it may still settle or cancel alive
     pthread_mutex_init(&ctx->mutex, NULL);
+    q_promise_retain(main_promise);
+    for (size_t i = 0; i < count; i++) {
+        ctx->inputs[i] = q_promise_retain(promises[i]);
+        ctx->slots[i].ctx = ctx;
+        ctx->slots[i].index = i;
+    }
     
-    // Set up completion callbacks for each promise
+    if (q_promise_on_settled(main_promise, q_combine_on_main_settled, ctx) != CPM_SUCCESS) {
+        ctx->pending_listeners--;
+    }
+    
+    // Only the caller's array is read after registration starts: the last
+    // listener to run frees the context, possibly inside this loop.
     for (size_t i = 0; i < count; i++) {
-        // This would require more complex callback handling
-        // For now, we'll implement a simplified version
-        q_promise_wait(promises[i]);
-        
-        pthread_mutex_lock(&ctx->mutex);
-        if (promises[i]->state == Q_REJECTED) {
-            if (!ctx->has_error) {
-                ctx->has_error = true;
-                q_promise_reject(all_promise, "One or more promises failed");
-            }
-        } else {
-            ctx->results[i] = promises[i]->result->data;
-            ctx->completed++;
+        QCombineSlot* slot = &ctx->slots[i];
+        if (q_promise_on_settled(promises[i], q_combine_on_settled, slot) != CPM_SUCCESS) {
+            // Treat an input we cannot observe as rejected
+            q_promise_cancel(promises[i]);
+            q_combine_on_settled(promises[i], slot);
         }
-        pthread_mutex_unlock(&ctx->mutex);
     }
     
+    return main_promise;
+}
+
+QPromise* q_all(QPromise** promises, size_t count) {
+    return q_combine(Q_COMBINE_ALL, promises, count);
+}
+
+QPromise* q_race(QPromise** promises, size_t count) {
+    return q_combine(Q_COMBINE_RACE, promises, count);
+}
+
+QPromise* q_any(QPromise** promises, size_t count) {
+    return q_combine(Q_COMBINE_ANY, promises, count);
+}
+
+QPromise* q_all_settled(QPromise** promises, size_t count) {
+    return q_combine(Q_COMBINE_ALL_SETTLED, promises, count);
+}
+
+void q_all_settled_free(QPromiseResult* results, size_t count) {
+    if (!results) return;
+    
+    for (size_t i = 0; i < count; i++) {
+        free(results[i].error);
+    }
+    free(results);
+}
+
+// Timers for q_timeout and q_delay live on the qpromises timer wheel. The
+// CLI never runs the event loop, so the wheel's driver thread fires them.
+static EventLoopTimer* q_timer_start(unsigned long delay_ms, event_loop_timer_callback callback, void* context) {
+    if (!event_loop_drive_timers()) return NULL;
+    return event_loop_add_timer(delay_ms, callback, context);
+}
+
+// q_timeout: the result mirrors the source unless the deadline passes
+// first, in which case the result rejects and the source is cancelled.
+typedef struct {
+    QPromise* source;
+    QPromise* main_promise;
+    EventLoopTimer* timer; // NULL once fired or cancelled
+    int refs;
+    pthread_mutex_t mutex;
+} TimeoutContext;
+
+static void q_timeout_release(TimeoutContext* ctx) {
     pthread_mutex_lock(&ctx->mutex);
-    if (!ctx->has_error && ctx->completed == ctx->total) {
-        q_promise_resolve(all_promise, ctx->results);
+    bool last = --ctx->refs == 0;
+    pthread_mutex_unlock(&ctx->mutex);
+    
+    if (last) {
+        q_promise_free(ctx->source);
+        q_promise_free(ctx->main_promise);
+        pthread_mutex_destroy(&ctx->mutex);
+        free(ctx);
     }
+}
+
+static void q_timeout_on_expired(void* context) {
+    TimeoutContext* ctx = context;
+    
+    pthread_mutex_lock(&ctx->mutex);
+    ctx->timer = NULL;
     pthread_mutex_unlock(&ctx->mutex);
     
-    pthread_mutex_destroy(&ctx->mutex);
-    free(ctx);
+    q_promise_reject(ctx->main_promise, Q_ERROR_TIMEOUT);
+    q_promise_cancel(ctx->source);
+    q_timeout_release(ctx);
+}
+
+static void q_timeout_on_main_settled(QPromise* promise, void* context) {
+    TimeoutContext* ctx = context;
     
-    return all_promise;
+    if (promise->cancelled) {
+        q_promise_cancel(ctx->source);
+    }
+    q_timeout_release(ctx);
+}
+
+static void q_timeout_on_settled(QPromise* promise, void* context) {
+    TimeoutContext* ctx = context;
+    
+    if (promise->state == Q_FULFILLED) {
+        q_promise_resolve(ctx->main_promise, promise->result->data);
+    } else {
+        q_promise_reject(ctx->main_promise, promise->result->error);
+    }
+    
+    // If the timer had not fired yet it never will; drop its reference too.
+    // The lock keeps a firing timer's handle alive until it clears `timer`.
+    pthread_mutex_lock(&ctx->mutex);
+    EventLoopTimer* timer = ctx->timer;
+    ctx->timer = NULL;
+    bool cancelled = timer && event_loop_cancel_timer(timer);
+    pthread_mutex_unlock(&ctx->mutex);
+    
+    if (cancelled) {
+        q_timeout_release(ctx);
+    }
+    q_timeout_release(ctx);
+}
+
+QPromise* q_timeout(QPromise* promise, unsigned long timeout_ms) {
+    if (!promise) return NULL;
+    
+    QPromise* main_promise = q_promise_new();
+    if (!main_promise) return NULL;
+    
+    TimeoutContext* ctx = malloc(sizeof(TimeoutContext));
+    if (!ctx) {
+        q_promise_free(main_promise);
+        return NULL;
+    }
+    
+    ctx->source = q_promise_retain(promise);
+    ctx->main_promise = q_promise_retain(main_promise);
+    ctx->refs = 3;
+    pthread_mutex_init(&ctx->mutex, NULL);
+    
+    if (q_promise_on_settled(main_promise, q_timeout_on_main_settled, ctx) != CPM_SUCCESS) {
+        ctx->refs--;
+    }
+    
+    // Hold the lock so a timer firing at once sees `timer` set
+    pthread_mutex_lock(&ctx->mutex);
+    EventLoopTimer* timer = q_timer_start(timeout_ms, q_timeout_on_expired, ctx);
+    ctx->timer = timer;
+    pthread_mutex_unlock(&ctx->mutex);
+    if (!timer) {
+        // Freeing the main promise drops its listener without running it
+        q_promise_free(ctx->source);
+        q_promise_free(main_promise);
+        q_promise_free(main_promise);
+        pthread_mutex_destroy(&ctx->mutex);
+        free(ctx);
+        return NULL;
+    }
+    
+    if (q_promise_on_settled(promise, q_timeout_on_settled, ctx) != CPM_SUCCESS) {
+        // Without a listener only the timer can settle the result
+        q_timeout_release(ctx);
+    }
+    
+    return main_promise;
 }
 
-// Async/await style wrapper
 typedef struct {
     QPromise* promise;
-    void* result;
-    char* error;
-} AwaitResult;
+    void* data;
+} DelayContext;
+
+static void q_delay_on_expired(void* context) {
+    DelayContext* ctx = context;
+    
+    q_promise_resolve(ctx->promise, ctx->data);
+    q_promise_free(ctx->promise);
+    free(ctx);
+}
+
+QPromise* q_delay(unsigned long delay_ms, void* data) {
+    QPromise* promise = q_promise_new();
+    if (!promise) return NULL;
+    
+    DelayContext* ctx = malloc(sizeof(DelayContext));
+    if (!ctx) {
+        q_promise_free(promise);
+        return NULL;
+    }
+    ctx->promise = q_promise_retain(promise);
+    ctx->data = data;
+    
+    if (!q_timer_start(delay_ms, q_delay_on_expired, ctx)) {
+        free(ctx);
+        q_promise_free(promise);
+        q_promise_free(promise);
+        return NULL;
+    }
+    
+    return promise;
+}
 
+// q_map_limit: a pump launches mapped promises until `limit` are pending;
+// each settlement frees a slot and pumps again. Only one thread pumps at a
+// time, so promises that settle inline never recurse into the mapper.
+typedef struct MapLimitContext MapLimitContext;
+
+typedef struct {
+    MapLimitContext* ctx;
+    size_t index;
+} MapLimitSlot;
+
+struct MapLimitContext {
+    void** items;
+    size_t count;
+    QPromiseMapper mapper;
+    size_t limit;
+    QPromise* main_promise;
+    QPromise** promises;
+    MapLimitSlot* slots;
+    void** results;
+    size_t next;
+    size_t active;
+    size_t completed;
+    size_t refs;
+    bool failed;
+    bool pumping;
+    pthread_mutex_t mutex;
+};
+
+static void q_map_limit_release(MapLimitContext* ctx) {
+    pthread_mutex_lock(&ctx->mutex);
+    bool last = --ctx->refs == 0;
+    pthread_mutex_unlock(&ctx->mutex);
+    
+    if (!last) return;
+    
+    // Every listener has run; the mapped promises are ours to free
+    for (size_t i = 0; i < ctx->next; i++) {
+        q_promise_free(ctx->promises[i]);
+    }
+    if (ctx->failed) {
+        free(ctx->results);
+    }
+    q_promise_free(ctx->main_promise);
+    pthread_mutex_destroy(&ctx->mutex);
+    free(ctx->promises);
+    free(ctx->slots);
+    free(ctx);
+}
+
+static void q_map_limit_cancel_pending(MapLimitContext* ctx) {
+    pthread_mutex_lock(&ctx->mutex);
+    size_t launched = ctx->next;
+    pthread_mutex_unlock(&ctx->mutex);
+    
+    for (size_t i = 0; i < launched; i++) {
+        pthread_mutex_lock(&ctx->mutex);
+        QPromise* promise = ctx->promises[i];
+        pthread_mutex_unlock(&ctx->mutex);
+        
+        // Still NULL means the pump is inside the mapper (it checks `failed`)
+        // or the slot never got a promise
+        if (promise) {
+            q_promise_cancel(promise);
+        }
+    }
+}
+
+static void q_map_limit_pump(MapLimitContext* ctx);
+
+// Records a slot's outcome and keeps the pump going. `promise` is NULL when
+// the slot could not get one at all, which counts as a failure.
+static void q_map_limit_settle_slot(MapLimitSlot* slot, QPromise* promise) {
+    MapLimitContext* ctx = slot->ctx;
+    bool fulfilled = promise && promise->state == Q_FULFILLED;
+    bool first_failure = false;
+    bool finished = false;
+    
+    pthread_mutex_lock(&ctx->mutex);
+    ctx->active--;
+    ctx->completed++;
+    if (fulfilled) {
+        ctx->results[slot->index] = promise->result->data;
+    } else if (!ctx->failed) {
+        ctx->failed = true;
+        first_failure = true;
+    }
+    finished = !ctx->failed && ctx->completed == ctx->count;
+    pthread_mutex_unlock(&ctx->mutex);
+    
+    if (first_failure) {
+        q_promise_reject(ctx->main_promise, promise ? promise->result->error : Q_ERROR_NO_PROMISE);
+        q_map_limit_cancel_pending(ctx);
+    } else if (finished) {
+        q_promise_resolve(ctx->main_promise, ctx->results);
+    } else {
+        q_map_limit_pump(ctx);
+    }
+    
+    q_map_limit_release(ctx);
+}
+
+static void q_map_limit_on_settled(QPromise* promise, void* context) {
+    q_map_limit_settle_slot(context, promise);
+}
+
+static void q_map_limit_on_main_settled(QPromise* promise, void* context) {
+    MapLimitContext* ctx = context;
+    
+    if (promise->cancelled) {
+        pthread_mutex_lock(&ctx->mutex);
+        bool already_failed = ctx->failed;
+        ctx->failed = true;
+        pthread_mutex_unlock(&ctx->mutex);
+        
+        if (!already_failed) {
+            q_map_limit_cancel_pending(ctx);
+        }
+    }
+    q_map_limit_release(ctx);
+}
+
+static void q_map_limit_pump(MapLimitContext* ctx) {
+    pthread_mutex_lock(&ctx->mutex);
+    if (ctx->pumping) {
+        // The pumping thread re-checks capacity before it stops
+        pthread_mutex_unlock(&ctx->mutex);
+        return;
+    }
+    ctx->pumping = true;
+    
+    while (!ctx->failed && ctx->active < ctx->limit && ctx->next < ctx->count) {
+        size_t index = ctx->next++;
+        ctx->active++;
+        ctx->refs++;
+        pthread_mutex_unlock(&ctx->mutex);
+        
+        QPromise* promise = ctx->mapper(ctx->items[index], index);
+        if (!promise) {
+            // Stand in a rejected promise so the slot settles like any other
+            promise = q_promise_new();
+            q_promise_reject(promise, Q_ERROR_NO_PROMISE);
+        }
+        
+        pthread_mutex_lock(&ctx->mutex);
+        ctx->promises[index] = promise;
+        bool failed = ctx->failed;
+        pthread_mutex_unlock(&ctx->mutex);
+        
+        if (!promise) {
+            // Out of memory even for the stand-in: fail the slot directly
+            q_map_limit_settle_slot(&ctx->slots[index], NULL);
+            pthread_mutex_lock(&ctx->mutex);
+            continue;
+        }
+        if (failed) {
+            q_promise_cancel(promise);
+        }
+        if (q_promise_on_settled(promise, q_map_limit_on_settled, &ctx->slots[index]) != CPM_SUCCESS) {
+            q_promise_cancel(promise);
+            q_map_limit_on_settled(promise, &ctx->slots[index]);
+        }
+        
+        pthread_mutex_lock(&ctx->mutex);
+    }
+    
+    ctx->pumping = false;
+    pthread_mutex_unlock(&ctx->mutex);
+}
+
+QPromise* q_map_limit(void** items, size_t count, QPromiseMapper fn, size_t limit) {
+    if ((!items && count > 0) || !fn) return NULL;
+    
+    QPromise* main_promise = q_promise_new();
+    if (!main_promise) return NULL;
+    
+    if (count == 0) {
+        q_promise_resolve(main_promise, NULL);
+        return main_promise;
+    }
+    
+    MapLimitContext* ctx = malloc(sizeof(MapLimitContext));
+    if (!ctx) {
+        q_promise_free(main_promise);
+        return NULL;
+    }
+    
+    ctx->items = items;
+    ctx->count = count;
+    ctx->mapper = fn;
+    ctx->limit = (limit == 0 || limit > count) ? count : limit;
+    ctx->main_promise = main_promise;
+    ctx->promises = calloc(count, sizeof(QPromise*));
+    ctx->slots = malloc(count * sizeof(MapLimitSlot));
+    ctx->results = calloc(count, sizeof(void*));
+    ctx->next = 0;
+    ctx->active = 0;
+    ctx->completed = 0;
+    ctx->refs = 2; // the pump below and the main promise listener
+    ctx->failed = false;
+    ctx->pumping = false;
+    
+    if (!ctx->promises || !ctx->slots || !ctx->results) {
+        free(ctx->promises);
+        free(ctx->slots);
+        free(ctx->results);
+        free(ctx);
+        q_promise_free(main_promise);
+        return NULL;
+    }
+    
+    pthread_mutex_init(&ctx->mutex, NULL);
+    q_promise_retain(main_promise);
+    for (size_t i = 0; i < count; i++) {
+        ctx->slots[i].ctx = ctx;
+        ctx->slots[i].index = i;
+    }
+    
+    if (q_promise_on_settled(main_promise, q_map_limit_on_main_settled, ctx) != CPM_SUCCESS) {
+        ctx->refs--;
+    }
+    
+    q_map_limit_pump(ctx);
+    q_map_limit_release(ctx);
+    
+    return main_promise;
+}
+
+// Async/await style wrapper
 AwaitResult q_await(QPromise* promise) {
     AwaitResult result = {0};
     if (!promise) return result;
     
-    q_promise_wait(promise);
+    if (!q_fiber_await(promise)) {
+        q_promise_wait(promise);
+    }
     
     result.promise = promise;
     if (promise->state == Q_FULFILLED) {
@@ -0,0 +1,241 @@
+#define _POSIX_C_SOURCE 200809L
+#include "q_runtime.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Worker pool limits; CPM_WORKERS overrides the default
+#define Q_RUNTIME_MIN_WORKERS 4
+#define Q_RUNTIME_MAX_WORKERS 64
+
+// Pools beyond this many fall back to plain malloc/free
+#define Q_RUNTIME_MAX_POOLS 32
+// Objects cached per pool per thread
+#define Q_RUNTIME_POOL_CACHE 256
+
+// --- Executor ---
+
+static struct {
+    QRuntimeJob* head;
+    QRuntimeJob* tail;
+    size_t worker_count;
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    pthread_once_t once;
+} q_runtime_executor = {
+    .head = NULL,
+    .tail = NULL,
+    .worker_count = 0,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .condition = PTHREAD_COND_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT
+};
+
+// Must be called with q_runtime_executor.mutex held
+static void q_runtime_unlink(QRuntimeJob* job) {
+    if (job->prev) job->prev->next = job->next;
+    else q_runtime_executor.head = job->next;
+    
+    if (job->next) job->next->prev = job->prev;
+    else q_runtime_executor.tail = job->prev;
+    
+    job->prev = NULL;
+    job->next = NULL;
+    job->queued = false;
+}
+
+static void* q_runtime_worker(void* arg) {
+    (void)arg;
+    
+    for (;;) {
+        pthread_mutex_lock(&q_runtime_executor.mutex);
+        while (!q_runtime_executor.head) {
+            pthread_cond_wait(&q_runtime_executor.condition, &q_runtime_executor.mutex);
+        }
+        QRuntimeJob* job = q_runtime_executor.head;
+        q_runtime_unlink(job);
+        pthread_mutex_unlock(&q_runtime_executor.mutex);
+        
+        // The job may be freed by its own function
+        QRuntimeFunction function = job->function;
+        function(job->arg);
+    }
+    
+    return NULL;
+}
+
+static void q_runtime_start_workers(void) {
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    const char* override = getenv("CPM_WORKERS");
+    if (override && atol(override) > 0) {
+        workers = atol(override);
+    } else if (workers < Q_RUNTIME_MIN_WORKERS) {
+        workers = Q_RUNTIME_MIN_WORKERS;
+    }
+    if (workers > Q_RUNTIME_MAX_WORKERS) {
+        workers = Q_RUNTIME_MAX_WORKERS;
+    }
+    
+    for (long i = 0; i < workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, q_runtime_worker, NULL) == 0) {
+            pthread_detach(thread);
+            q_runtime_executor.worker_count++;
+        }
+    }
+}
+
+size_t q_runtime_worker_count(void) {
+    pthread_once(&q_runtime_executor.once, q_runtime_start_workers);
+    return q_runtime_executor.worker_count;
+}
+
+bool q_runtime_submit(QRuntimeJob* job) {
+    if (!job || !job->function || q_runtime_worker_count() == 0) return false;
+    
+    pthread_mutex_lock(&q_runtime_executor.mutex);
+    job->queued = true;
+    job->next = NULL;
+    job->prev = q_runtime_executor.tail;
+    if (q_runtime_executor.tail) {
+        q_runtime_executor.tail->next = job;
+    } else {
+        q_runtime_executor.head = job;
+    }
+    q_runtime_executor.tail = job;
+    pthread_cond_signal(&q_runtime_executor.condition);
+    pthread_mutex_unlock(&q_runtime_executor.mutex);
+    
+    return true;
+}
+
+bool q_runtime_cancel(QRuntimeJob* job) {
+    if (!job) return false;
+    
+    pthread_mutex_lock(&q_runtime_executor.mutex);
+    bool removed = job->queued;
+    if (removed) {
+        q_runtime_unlink(job);
+    }
+    pthread_mutex_unlock(&q_runtime_executor.mutex);
+    
+    return removed;
+}
+
+// --- Object pools ---
+
+// Precedes every pooled object; keeps the object 16-byte aligned
+typedef struct QRuntimeBlock {
+    struct QRuntimeBlock* next;
+    void* reserved;
+} QRuntimeBlock;
+
+#define Q_RUNTIME_OBJECT(block) ((void*)((block) + 1))
+#define Q_RUNTIME_BLOCK(object) ((QRuntimeBlock*)(object) - 1)
+
+static struct {
+    QRuntimePool* pools[Q_RUNTIME_MAX_POOLS];
+    int count;
+    pthread_mutex_t mutex;
+    pthread_key_t drain_key;
+    pthread_once_t once;
+} q_runtime_registry = {
+    .count = 0,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT
+};
+
+static __thread struct {
+    QRuntimeBlock* head;
+    unsigned int count;
+} q_runtime_cache[Q_RUNTIME_MAX_POOLS];
+
+static __thread bool q_runtime_cache_armed;
+
+static void q_runtime_block_release(QRuntimePool* pool, QRuntimeBlock* block) {
+    if (pool->destroy) pool->destroy(Q_RUNTIME_OBJECT(block));
+    free(block);
+}
+
+// Thread-exit destructor: returns everything this thread cached to malloc
+static void q_runtime_drain(void* unused) {
+    (void)unused;
+    int count = __atomic_load_n(&q_runtime_registry.count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        while (q_runtime_cache[i].head) {
+            QRuntimeBlock* block = q_runtime_cache[i].head;
+            q_runtime_cache[i].head = block->next;
+            q_runtime_block_release(q_runtime_registry.pools[i], block);
+        }
+        q_runtime_cache[i].count = 0;
+    }
+    q_runtime_cache_armed = false;
+}
+
+static void q_runtime_init_registry(void) {
+    pthread_key_create(&q_runtime_registry.drain_key, q_runtime_drain);
+}
+
+// Returns the pool's cache slot, registering the pool on first use; -1 once
+// every slot is taken.
+static int q_runtime_pool_slot(QRuntimePool* pool) {
+    int id = __atomic_load_n(&pool->id, __ATOMIC_ACQUIRE);
+    if (id != 0) return id > 0 ? id - 1 : -1;
+    
+    pthread_mutex_lock(&q_runtime_registry.mutex);
+    id = pool->id;
+    if (id == 0) {
+        if (q_runtime_registry.count < Q_RUNTIME_MAX_POOLS) {
+            q_runtime_registry.pools[q_runtime_registry.count] = pool;
+            id = q_runtime_registry.count + 1;
+            __atomic_store_n(&q_runtime_registry.count, id, __ATOMIC_RELEASE);
+        } else {
+            id = -1; // Uncached
+        }
+        __atomic_store_n(&pool->id, id, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&q_runtime_registry.mutex);
+    return id > 0 ? id - 1 : -1;
+}
+
+void* q_runtime_alloc(QRuntimePool* pool) {
+    if (!pool) return NULL;
+    
+    int slot = q_runtime_pool_slot(pool);
+    if (slot >= 0 && q_runtime_cache[slot].head) {
+        QRuntimeBlock* block = q_runtime_cache[slot].head;
+        q_runtime_cache[slot].head = block->next;
+        q_runtime_cache[slot].count--;
+        return Q_RUNTIME_OBJECT(block);
+    }
+    
+    QRuntimeBlock* block = malloc(sizeof(QRuntimeBlock) + pool->size);
+    if (!block) return NULL;
+    if (pool->construct && !pool->construct(Q_RUNTIME_OBJECT(block))) {
+        free(block);
+        return NULL;
+    }
+    return Q_RUNTIME_OBJECT(block);
+}
+
+void q_runtime_free(QRuntimePool* pool, void* object) {
+    if (!pool || !object) return;
+    
+    QRuntimeBlock* block = Q_RUNTIME_BLOCK(object);
+    int slot = q_runtime_pool_slot(pool);
+    if (slot < 0 || q_runtime_cache[slot].count >= Q_RUNTIME_POOL_CACHE) {
+        q_runtime_block_release(pool, block);
+        return;
+    }
+    
+    if (!q_runtime_cache_armed) {
+        // Register this thread for the exit-time drain (a non-NULL value arms it)
+        pthread_once(&q_runtime_registry.once, q_runtime_init_registry);
+        pthread_setspecific(q_runtime_registry.drain_key, &q_runtime_cache_armed);
+        q_runtime_cache_armed = true;
+    }
+    block->next = q_runtime_cache[slot].head;
+    q_runtime_cache[slot].head = block;
+    q_runtime_cache[slot].count++;
+}
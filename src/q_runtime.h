@@ -0,0 +1,74 @@
+#ifndef Q_RUNTIME_H
+#define Q_RUNTIME_H
+
+// Runtime shared by the CPM promise engine and CPM/qpromises: one worker
+// pool that runs blocking work for both (q_run_async() and
+// promise_run_async()), and the per-thread object pools their promises,
+// tasks and callback records are allocated from. Like q_trace, it depends on
+// nothing but libc and pthreads.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// --- Executor ---
+// Workers are started on first submission: CPM_WORKERS of them if set,
+// otherwise one per online CPU (at least 4, at most 64). Jobs run in FIFO
+// order.
+
+typedef void (*QRuntimeFunction)(void* arg);
+
+// A unit of work. The caller owns the storage (usually embedded in its own
+// task record) and keeps it alive until `function` starts; by then the job
+// has been unlinked, so `function` may free it.
+typedef struct QRuntimeJob {
+    QRuntimeFunction function;
+    void* arg;
+    bool queued;
+    struct QRuntimeJob* prev;
+    struct QRuntimeJob* next;
+} QRuntimeJob;
+
+// Queues `job`. Returns false if no worker could be started.
+bool q_runtime_submit(QRuntimeJob* job);
+
+// Removes `job` if it is still waiting in the queue. Returns false once a
+// worker has taken it (or if it was never queued).
+bool q_runtime_cancel(QRuntimeJob* job);
+
+// Number of worker threads, starting them if needed
+size_t q_runtime_worker_count(void);
+
+// --- Object pools ---
+// Fixed-size objects are recycled through a per-thread cache, so steady-state
+// alloc/free pairs never reach malloc. `construct` runs once when an object
+// is first carved from malloc (e.g. to initialise a mutex that stays valid
+// while the object is cached) and `destroy` once before it goes back; either
+// may be NULL. An object freed on another thread than it was allocated on
+// joins that thread's cache. Caches are bounded and emptied at thread exit.
+
+typedef struct QRuntimePool {
+    const char* name;
+    size_t size;
+    bool (*construct)(void* object);
+    void (*destroy)(void* object);
+    int id; // Assigned on first use
+} QRuntimePool;
+
+#define Q_RUNTIME_POOL(name, type, construct, destroy) { name, sizeof(type), construct, destroy, 0 }
+
+// Returns an object of pool->size bytes (16-byte aligned, contents
+// unspecified apart from what `construct` set up), or NULL.
+void* q_runtime_alloc(QRuntimePool* pool);
+
+// Returns `object` (from q_runtime_alloc() on the same pool) to the cache.
+void q_runtime_free(QRuntimePool* pool, void* object);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // Q_RUNTIME_H
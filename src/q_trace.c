@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include "q_trace.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define Q_TRACE_CHUNK_EVENTS 1024
+
+int q_trace_active = 0;
+
+typedef struct {
+    const char* category;
+    const char* name;
+    const char* outcome;
+    const void* id;
+    uint64_t timestamp;
+    uint64_t duration;
+    char phase;
+} QTraceEvent;
+
+typedef struct QTraceChunk {
+    QTraceEvent events[Q_TRACE_CHUNK_EVENTS];
+    size_t count;
+    struct QTraceChunk* next;
+} QTraceChunk;
+
+// One buffer per recording thread: appends never take a lock. The writer
+// publishes each event with a release store of `count`.
+typedef struct QTraceBuffer {
+    long tid;
+    QTraceChunk* head;
+    QTraceChunk* tail;
+    struct QTraceBuffer* next;
+} QTraceBuffer;
+
+static struct {
+    QTraceBuffer* buffers;
+    uint64_t epoch;
+    pthread_mutex_t mutex;
+} q_trace = {
+    .buffers = NULL,
+    .epoch = 0,
+    .mutex = PTHREAD_MUTEX_INITIALIZER
+};
+
+static __thread QTraceBuffer* q_trace_local = NULL;
+static char q_trace_env_path[PATH_MAX];
+
+uint64_t q_trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static QTraceBuffer* q_trace_buffer(void) {
+    if (q_trace_local) return q_trace_local;
+    
+    QTraceBuffer* buffer = malloc(sizeof(QTraceBuffer));
+    QTraceChunk* chunk = malloc(sizeof(QTraceChunk));
+    if (!buffer || !chunk) {
+        free(buffer);
+        free(chunk);
+        return NULL;
+    }
+    
+    chunk->count = 0;
+    chunk->next = NULL;
+    buffer->tid = (long)syscall(SYS_gettid);
+    buffer->head = chunk;
+    buffer->tail = chunk;
+    
+    pthread_mutex_lock(&q_trace.mutex);
+    buffer->next = q_trace.buffers;
+    q_trace.buffers = buffer;
+    pthread_mutex_unlock(&q_trace.mutex);
+    
+    q_trace_local = buffer;
+    return buffer;
+}
+
+static void q_trace_record(char phase, const char* category, const char* name, const void* id,
+                           const char* outcome, uint64_t timestamp, uint64_t duration) {
+    QTraceBuffer* buffer = q_trace_buffer();
+    if (!buffer) return;
+    
+    QTraceChunk* chunk = buffer->tail;
+    if (chunk->count == Q_TRACE_CHUNK_EVENTS) {
+        QTraceChunk* next = malloc(sizeof(QTraceChunk));
+        if (!next) return; // Drop the event rather than stall the caller
+        next->count = 0;
+        next->next = NULL;
+        __atomic_store_n(&chunk->next, next, __ATOMIC_RELEASE);
+        buffer->tail = next;
+        chunk = next;
+    }
+    
+    QTraceEvent* event = &chunk->events[chunk->count];
+    event->phase = phase;
+    event->category = category;
+    event->name = name;
+    event->id = id;
+    event->outcome = outcome;
+    event->timestamp = timestamp;
+    event->duration = duration;
+    __atomic_store_n(&chunk->count, chunk->count + 1, __ATOMIC_RELEASE);
+}
+
+void q_trace_async_begin(const char* category, const char* name, const void* id) {
+    q_trace_record('b', category, name, id, NULL, q_trace_now(), 0);
+}
+
+void q_trace_async_end(const char* category, const char* name, const void* id, const char* outcome) {
+    q_trace_record('e', category, name, id, outcome, q_trace_now(), 0);
+}
+
+void q_trace_complete(const char* category, const char* name, uint64_t start_ns, const void* id) {
+    q_trace_record('X', category, name, id, NULL, start_ns, q_trace_now() - start_ns);
+}
+
+void q_trace_start(void) {
+    pthread_mutex_lock(&q_trace.mutex);
+    q_trace.epoch = q_trace_now();
+    pthread_mutex_unlock(&q_trace.mutex);
+    
+    __atomic_store_n(&q_trace_active, 1, __ATOMIC_RELEASE);
+}
+
+static void q_trace_write_event(FILE* file, const QTraceEvent* event, long pid, long tid, uint64_t epoch) {
+    // trace_event timestamps are microseconds; keep nanosecond precision
+    double ts = (double)(event->timestamp - epoch) / 1000.0;
+    
+    fprintf(file, ",\n{\"ph\":\"%c\",\"cat\":\"%s\",\"name\":\"%s\",\"pid\":%ld,\"tid\":%ld,\"ts\":%.3f",
+            event->phase, event->category, event->name, pid, tid, ts);
+    
+    switch (event->phase) {
+        case 'b':
+            fprintf(file, ",\"id\":\"%p\"}", event->id);
+            break;
+        case 'e':
+            fprintf(file, ",\"id\":\"%p\",\"args\":{\"outcome\":\"%s\"}}", event->id,
+                    event->outcome ? event->outcome : "");
+            break;
+        default:
+            fprintf(file, ",\"dur\":%.3f", (double)event->duration / 1000.0);
+            if (event->id) {
+                fprintf(file, ",\"args\":{\"promise\":\"%p\"}", event->id);
+            }
+            fputc('}', file);
+            break;
+    }
+}
+
+// Writes every published event to `path`. Only `reset` frees and rewinds
+// the buffers, which is safe only once no thread can be recording: a
+// writer that passed Q_TRACE_ON() before recording stopped may still be
+// appending. Without it, such late events are simply left out.
+static int q_trace_flush(const char* path, bool reset) {
+    FILE* file = path ? fopen(path, "w") : NULL;
+    long pid = (long)getpid();
+    
+    pthread_mutex_lock(&q_trace.mutex);
+    
+    if (file) {
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        fprintf(file, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%ld,\"args\":{\"name\":\"cpm\"}}", pid);
+    }
+    
+    for (QTraceBuffer* buffer = q_trace.buffers; buffer; buffer = buffer->next) {
+        QTraceChunk* chunk = buffer->head;
+        while (chunk) {
+            size_t count = __atomic_load_n(&chunk->count, __ATOMIC_ACQUIRE);
+            for (size_t i = 0; file && i < count; i++) {
+                q_trace_write_event(file, &chunk->events[i], pid, buffer->tid, q_trace.epoch);
+            }
+            
+            QTraceChunk* next = __atomic_load_n(&chunk->next, __ATOMIC_ACQUIRE);
+            if (!reset) {
+                // Leave the chunk to its writer
+            } else if (chunk == buffer->head) {
+                chunk->count = 0;
+                chunk->next = NULL;
+            } else {
+                free(chunk);
+            }
+            chunk = next;
+        }
+        if (reset) {
+            buffer->tail = buffer->head;
+        }
+    }
+    
+    pthread_mutex_unlock(&q_trace.mutex);
+    
+    if (!file) return path ? -1 : 0;
+    
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+int q_trace_stop(const char* path) {
+    __atomic_store_n(&q_trace_active, 0, __ATOMIC_RELEASE);
+    return q_trace_flush(path, true);
+}
+
+// Detached runtime workers, the timer driver and fibers may still be inside a
+// probe at exit, so this only writes what has been published.
+static void q_trace_write_at_exit(void) {
+    __atomic_store_n(&q_trace_active, 0, __ATOMIC_RELEASE);
+    if (q_trace_flush(q_trace_env_path, false) != 0) {
+        fprintf(stderr, "cpm: could not write trace to %s\n", q_trace_env_path);
+    }
+}
+
+void q_trace_start_from_env(void) {
+    const char* path = getenv("CPM_TRACE");
+    if (!path || !*path || q_trace_env_path[0]) return;
+    
+    snprintf(q_trace_env_path, sizeof(q_trace_env_path), "%s", path);
+    q_trace_start();
+    atexit(q_trace_write_at_exit);
+}
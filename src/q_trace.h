@@ -0,0 +1,56 @@
+#ifndef Q_TRACE_H
+#define Q_TRACE_H
+
+// Promise lifecycle tracing, written as Chrome trace_event JSON (open the
+// file in Perfetto or chrome://tracing). Shared by the CPM promise engine
+// and CPM/qpromises, so it depends on nothing but libc and pthreads.
+//
+// Recording is off until q_trace_start(); every probe is guarded by
+// Q_TRACE_ON(), a single relaxed load. Build with -DQ_TRACE_DISABLED to
+// compile the probes out entirely.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int q_trace_active;
+
+#ifdef Q_TRACE_DISABLED
+#define Q_TRACE_ON() 0
+#else
+#define Q_TRACE_ON() __builtin_expect(__atomic_load_n(&q_trace_active, __ATOMIC_RELAXED), 0)
+#endif
+
+// Recording control. Start and stop from a quiescent point; stop writes
+// every buffered event to `path` (NULL discards them) and clears buffers.
+void q_trace_start(void);
+int q_trace_stop(const char* path);
+
+// Starts recording when CPM_TRACE names an output file; the trace is
+// written when the process exits. Threads may still be running then, so
+// the exit hook only writes the events recorded so far and frees nothing.
+void q_trace_start_from_env(void);
+
+// Monotonic clock in nanoseconds
+uint64_t q_trace_now(void);
+
+// Probes. `category` and `name` must be string literals (they are stored
+// by pointer and emitted unescaped). `id` ties async begin/end pairs.
+void q_trace_async_begin(const char* category, const char* name, const void* id);
+void q_trace_async_end(const char* category, const char* name, const void* id, const char* outcome);
+void q_trace_complete(const char* category, const char* name, uint64_t start_ns, const void* id);
+
+// Span start for q_trace_complete(); 0 when tracing is off, so callers
+// record the span with `if (start) q_trace_complete(...)`.
+static inline uint64_t q_trace_span_start(void) {
+    return Q_TRACE_ON() ? q_trace_now() : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // Q_TRACE_H
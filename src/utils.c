@@ -1,4 +1,12 @@
+#define _POSIX_C_SOURCE 200809L
 #include "cpm.h"
+#include <ctype.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+
+// How often a running extraction checks its cancellation token
+#define EXTRACT_POLL_US 10000
 
 // HTTP response callback for libcurl
 size_t WriteMemoryCallback(void* contents, size_t size, size_t nmemb, HTTPResponse* response) {
@@ -19,8 +27,20 @@ size_t WriteMemoryCallback(void* contents, size_t size, size_t nmemb, HTTPRespon
 }
 
 HTTPResponse* http_get(const char* url) {
+    return http_get_cancellable(url, NULL);
+}
+
+// Cancel callback: kick the transfer loop out of curl_multi_poll()
+static void http_on_cancel(void* context) {
+    curl_multi_wakeup((CURLM*)context);
+}
+
+// Runs the transfer on a private multi handle so a cancelled token can
+// interrupt it immediately instead of waiting for the next progress tick.
+HTTPResponse* http_get_cancellable(const char* url, QCancelToken* token) {
     CURL* curl;
-    CURLcode res;
+    CURLM* multi;
+    CURLcode res = CURLE_OK;
     HTTPResponse* response = malloc(sizeof(HTTPResponse));
     
     if (!response) return NULL;
@@ -29,22 +49,63 @@ HTTPResponse* http_get(const char* url) {
     response->size = 0;
     
     curl = curl_easy_init();
-    if (curl) {
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)response);
-        curl_easy_setopt(curl, CURLOPT_USERAGENT, "CPM/1.0.0");
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+    multi = curl_multi_init();
+    if (!curl || !multi) {
+        if (curl) curl_easy_cleanup(curl);
+        if (multi) curl_multi_cleanup(multi);
+        http_response_free(response);
+        return NULL;
+    }
+    
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)response);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "CPM/1.0.0");
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+    curl_multi_add_handle(multi, curl);
+    
+    unsigned long registration = 0;
+    if (token) {
+        registration = q_cancel_token_register(token, http_on_cancel, multi);
+    }
+    
+    int running = 1;
+    while (running) {
+        if (q_cancel_token_is_cancelled(token)) {
+            res = CURLE_ABORTED_BY_CALLBACK;
+            break;
+        }
         
-        res = curl_easy_perform(curl);
-        curl_easy_cleanup(curl);
+        if (curl_multi_perform(multi, &running) != CURLM_OK) {
+            res = CURLE_FAILED_INIT;
+            break;
+        }
         
-        if (res != CURLE_OK) {
-            http_response_free(response);
-            return NULL;
+        if (running) {
+            curl_multi_poll(multi, NULL, 0, 1000, NULL);
         }
-    } else {
+    }
+    
+    if (res == CURLE_OK) {
+        int queued;
+        CURLMsg* msg;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg == CURLMSG_DONE) {
+                res = msg->data.result;
+            }
+        }
+    }
+    
+    if (registration) {
+        q_cancel_token_unregister(token, registration);
+    }
+    
+    curl_multi_remove_handle(multi, curl);
+    curl_easy_cleanup(curl);
+    curl_multi_cleanup(multi);
+    
+    if (res != CURLE_OK) {
         http_response_free(response);
         return NULL;
     }
@@ -61,11 +122,17 @@ void http_response_free(HTTPResponse* response) {
     }
 }
 
+// CPM_REGISTRY points fetches at a mirror or a local stand-in registry
+const char* cpm_registry_url(void) {
+    const char* registry = getenv("CPM_REGISTRY");
+    return (registry && registry[0]) ? registry : NPM_REGISTRY;
+}
+
 char* fetch_package_info(const char* package_name) {
     if (!package_name) return NULL;
     
     char url[MAX_URL_LENGTH];
-    snprintf(url, MAX_URL_LENGTH, "%s/%s", NPM_REGISTRY, package_name);
+    snprintf(url, MAX_URL_LENGTH, "%s/%s", cpm_registry_url(), package_name);
     
     HTTPResponse* response = http_get(url);
     if (!response) return NULL;
@@ -231,37 +298,183 @@ int save_package_json(CPMContext* ctx) {
 }
 
 int download_package(const char* package_name, const char* version, const char* target_dir) {
+    return download_package_cancellable(package_name, version, target_dir, NULL);
+}
+
+// A release version "major.minor.patch". Pre-releases never match a range.
+typedef struct {
+    long major;
+    long minor;
+    long patch;
+} SemVer;
+
+static bool semver_parse(const char* text, SemVer* version) {
+    long* parts[3] = { &version->major, &version->minor, &version->patch };
+    for (int i = 0; i < 3; i++) {
+        if (!isdigit((unsigned char)*text)) return false;
+        char* end;
+        *parts[i] = strtol(text, &end, 10);
+        if (*end != (i < 2 ? '.' : '\0')) return false;
+        text = end + 1;
+    }
+    return true;
+}
+
+static int semver_compare(const SemVer* a, const SemVer* b) {
+    if (a->major != b->major) return a->major < b->major ? -1 : 1;
+    if (a->minor != b->minor) return a->minor < b->minor ? -1 : 1;
+    if (a->patch != b->patch) return a->patch < b->patch ? -1 : 1;
+    return 0;
+}
+
+// npm semantics: ~1.2.3 is >=1.2.3 <1.3.0; ^1.2.3 is >=1.2.3 <2.0.0, and
+// below 1.0.0 the caret keeps the first non-zero part (^0.2.3 <0.3.0).
+static bool semver_satisfies(const SemVer* version, char range, const SemVer* base) {
+    if (semver_compare(version, base) < 0 || version->major != base->major) return false;
+    if (range == '~' || base->major == 0) {
+        if (version->minor != base->minor) return false;
+        if (range == '^' && base->minor == 0 && version->patch != base->patch) return false;
+    }
+    return true;
+}
+
+// Picks the tarball URL for `version` out of the registry metadata: an
+// exact version (optionally prefixed with =), a dist-tag ("latest", or
+// "*" / empty for it), or a ^/~ range, which takes the highest published
+// release inside it. Anything else, or a range nothing satisfies, is not
+// resolved, so a version the manifest excludes is never installed.
+static char* resolve_tarball_url(const char* metadata, const char* version) {
+    json_object* root = json_tokener_parse(metadata);
+    if (!root) return NULL;
+    
+    char range = 0;
+    if (*version == '^' || *version == '~') {
+        range = *version++;
+    } else if (*version == '=') {
+        version++;
+    }
+    if (*version == '\0' || strcmp(version, "*") == 0) {
+        version = "latest";
+    }
+    
+    json_object* versions;
+    json_object* entry = NULL;
+    if (json_object_object_get_ex(root, "versions", &versions)) {
+        SemVer base;
+        json_object* dist_tags;
+        json_object* tagged;
+        if (range && semver_parse(version, &base)) {
+            SemVer best = { 0, 0, 0 };
+            json_object_object_foreach(versions, key, val) {
+                SemVer candidate;
+                if (semver_parse(key, &candidate) && semver_satisfies(&candidate, range, &base) &&
+                    (!entry || semver_compare(&candidate, &best) > 0)) {
+                    best = candidate;
+                    entry = val;
+                }
+            }
+        } else if (!range && !json_object_object_get_ex(versions, version, &entry) &&
+                   json_object_object_get_ex(root, "dist-tags", &dist_tags) &&
+                   json_object_object_get_ex(dist_tags, version, &tagged)) {
+            json_object_object_get_ex(versions, json_object_get_string(tagged), &entry);
+        }
+    }
+    
+    char* url = NULL;
+    json_object* dist;
+    json_object* tarball;
+    if (entry && json_object_object_get_ex(entry, "dist", &dist) &&
+        json_object_object_get_ex(dist, "tarball", &tarball)) {
+        url = strdup(json_object_get_string(tarball));
+    }
+    
+    json_object_put(root);
+    return url;
+}
+
+// Fetches the package's metadata and tarball and unpacks it into
+// target_dir. Every step stops early once `token` is cancelled.
+int download_package_cancellable(const char* package_name, const char* version, const char* target_dir,
+                                 QCancelToken* token) {
     if (!package_name || !version || !target_dir) return CPM_ERROR_INVALID_ARGS;
     
-    // Create package directory
     if (create_directory(target_dir) != CPM_SUCCESS) {
         return CPM_ERROR_PERMISSION;
     }
     
-    // For now, create a basic package.json in the target directory
-    // In a full implementation, this would download and extract the actual package
-    char package_json_path[MAX_PATH_LENGTH];
-    snprintf(package_json_path, MAX_PATH_LENGTH, "%s/package.json", target_dir);
+    char url[MAX_URL_LENGTH];
+    snprintf(url, MAX_URL_LENGTH, "%s/%s", cpm_registry_url(), package_name);
+    HTTPResponse* response = http_get_cancellable(url, token);
+    if (!response) {
+        return q_cancel_token_is_cancelled(token) ? CPM_ERROR_CANCELLED : CPM_ERROR_NETWORK;
+    }
     
-    FILE* file = fopen(package_json_path, "w");
-    if (!file) return CPM_ERROR_FILE_IO;
+    char* tarball_url = resolve_tarball_url(response->memory, version);
+    http_response_free(response);
+    if (!tarball_url) return CPM_ERROR_PACKAGE_NOT_FOUND;
     
-    fprintf(file, "{\n");
-    fprintf(file, "  \"name\": \"%s\",\n", package_name);
-    fprintf(file, "  \"version\": \"%s\",\n", version);
-    fprintf(file, "  \"description\": \"Downloaded by CPM\"\n");
-    fprintf(file, "}\n");
+    response = http_get_cancellable(tarball_url, token);
+    free(tarball_url);
+    if (!response) {
+        return q_cancel_token_is_cancelled(token) ? CPM_ERROR_CANCELLED : CPM_ERROR_NETWORK;
+    }
     
-    fclose(file);
+    char tarball_path[MAX_PATH_LENGTH];
+    snprintf(tarball_path, MAX_PATH_LENGTH, "%s/package.tgz", target_dir);
+    FILE* file = fopen(tarball_path, "wb");
+    if (!file) {
+        http_response_free(response);
+        return CPM_ERROR_FILE_IO;
+    }
+    size_t written = fwrite(response->memory, 1, response->size, file);
+    bool write_ok = fclose(file) == 0 && written == response->size;
+    http_response_free(response);
     
-    printf("Downloaded %s@%s to %s\n", package_name, version, target_dir);
-    return CPM_SUCCESS;
+    int result = write_ok ? extract_package_cancellable(tarball_path, target_dir, token) : CPM_ERROR_FILE_IO;
+    unlink(tarball_path);
+    
+    if (result == CPM_SUCCESS) {
+        printf("Downloaded %s@%s to %s\n", package_name, version, target_dir);
+    }
+    return result;
 }
 
 int extract_package(const char* tarball_path, const char* target_dir) {
+    return extract_package_cancellable(tarball_path, target_dir, NULL);
+}
+
+// Unpacks with tar(1), dropping the archive's top-level "package/"
+// directory. The token is polled while tar runs; cancelling kills tar,
+// which stops it at whatever entry it has reached.
+int extract_package_cancellable(const char* tarball_path, const char* target_dir, QCancelToken* token) {
     if (!tarball_path || !target_dir) return CPM_ERROR_INVALID_ARGS;
     
-    // This would implement tarball extraction
-    // For now, return success as a placeholder
-    return CPM_SUCCESS;
-}
\ No newline at end of file
+    if (q_cancel_token_is_cancelled(token)) {
+        return CPM_ERROR_CANCELLED;
+    }
+    
+    pid_t child = fork();
+    if (child < 0) return CPM_ERROR_FILE_IO;
+    if (child == 0) {
+        execlp("tar", "tar", "-xzf", tarball_path, "-C", target_dir, "--strip-components=1", (char*)NULL);
+        _exit(127);
+    }
+    
+    // Only signal tar while it is unreaped, so its pid cannot have been reused
+    int status = 0;
+    struct timespec poll = { 0, EXTRACT_POLL_US * 1000L };
+    for (;;) {
+        pid_t done = waitpid(child, &status, token ? WNOHANG : 0);
+        if (done == child) break;
+        if (done < 0) return CPM_ERROR_FILE_IO;
+        
+        if (q_cancel_token_is_cancelled(token)) {
+            kill(child, SIGKILL);
+            waitpid(child, &status, 0);
+            return CPM_ERROR_CANCELLED;
+        }
+        nanosleep(&poll, NULL);
+    }
+    
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? CPM_SUCCESS : CPM_ERROR_FILE_IO;
+}